@@ -0,0 +1,482 @@
+#define _GNU_SOURCE // For memmem and clock_nanosleep
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "messagePool.h"
+
+// Headless benchmark: a sender and a receiver s-talk over loopback, stdin and stdout are
+// pipes owned by this driver. Every line carries its sequence number and send time, so
+// the receiver's screen output is enough to measure one-way latency.
+
+#define ERROR -1
+
+#define DEFAULT_COUNT 10000
+#define DEFAULT_SIZE 64
+#define DEFAULT_PORT 7000
+#define MIN_SIZE 40                 // Room for "<sequence> <timestamp> " and the newline
+#define MAX_SIZE 65536
+
+#define READ_BUFFER_SIZE (2 * MAX_SIZE)
+#define STARTUP_TIMEOUT_US 2000000u
+#define IDLE_TIMEOUT_US 1000000u     // Give up waiting once nothing arrived for this long
+#define EXIT_TIMEOUT_US 5000000u
+
+typedef struct Endpoint {
+    pid_t       pid;
+    int         input;              // Write end of its stdin
+    int         output;             // Read end of its stdout, -1 when discarded
+    uint64_t    cpu;                // User plus system microseconds, once reaped
+    uint64_t    exited;             // When it was reaped, in microseconds
+} Endpoint;
+
+// Chat-like padding for -t, something a compressor can work with but not trivially
+// What s-talk prints once its socket is bound
+static const char sListening[] = "Client listening on port";
+
+static const char* sWords[] = {
+    "hey", "there", "what", "do", "you", "think", "about", "the", "meeting", "tomorrow", "sounds",
+    "good", "to", "me", "I'll", "send", "it", "over", "later", "tonight", "thanks", "a", "lot",
+    "no", "problem", "see", "you", "soon", "did", "anyone", "check", "build", "yet", "lol", "ok"
+};
+#define WORD_COUNT (int)(sizeof(sWords) / sizeof(sWords[0]))
+
+typedef struct Results {
+    int             count;          // Messages sent
+    bool*           pSeen;          // Per sequence number
+    uint64_t*       pLatencies;     // Microseconds, in arrival order
+    atomic_int      received;
+    atomic_bool     ready;          // The receiver printed its first prompt
+    int             duplicates;
+    int             reordered;
+    int             highest;
+    atomic_uint_fast64_t lastArrival;
+} Results;
+
+typedef struct Reader {
+    int         descriptor;
+    Results*    pResults;
+} Reader;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static void printUsage(const char* program) {
+    printf("Usage: %s [-b s-talk] [-c count] [-s size] [-r rate] [-p port] [-l label] [-t] [-k] [-v] [-- s-talk flags]\n", program);
+    printf("  size counts the newline, at most %d unless the flags include -F, -r, -z or -c\n", MAX_CHAR_COUNT - 1);
+    printf("  -t pads lines with chat-like words instead of 'x'\n");
+    printf("  rate is messages per second, 0 sends as fast as the sender takes them\n");
+    printf("  -k ends the session with SIGTERM to the sender instead of typing '!'\n");
+    printf("  -v fails unless every message arrived exactly once and in order\n");
+}
+
+static void sleepUntil(uint64_t microseconds) {
+    struct timespec deadline;
+    deadline.tv_sec = (time_t)(microseconds / 1000000u);
+    deadline.tv_nsec = (long)(microseconds % 1000000u) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+static bool writeAll(int descriptor, const char* pData, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(descriptor, pData, length);
+        if (written == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pData += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+// Run binary with flags, then "<myPort> 127.0.0.1 <remotePort>"
+static Endpoint spawnEndpoint(const char* binary, char** ppFlags, int flagCount, int myPort, int remotePort, bool keepOutput) {
+    int input[2];
+    int output[2];
+    if (pipe2(input, O_CLOEXEC) == ERROR || pipe2(output, O_CLOEXEC) == ERROR) {
+        perror("pipe failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == ERROR) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0) {
+        char myPortText[16];
+        char remotePortText[16];
+        snprintf(myPortText, sizeof(myPortText), "%d", myPort);
+        snprintf(remotePortText, sizeof(remotePortText), "%d", remotePort);
+
+        char** ppArguments = calloc((size_t)flagCount + 5, sizeof(char*));
+        int argumentCount = 0;
+        ppArguments[argumentCount++] = (char*)binary;
+        for (int i = 0; i < flagCount; i++) {
+            ppArguments[argumentCount++] = ppFlags[i];
+        }
+        ppArguments[argumentCount++] = myPortText;
+        ppArguments[argumentCount++] = "127.0.0.1";
+        ppArguments[argumentCount++] = remotePortText;
+
+        dup2(input[0], STDIN_FILENO);
+        if (keepOutput) {
+            dup2(output[1], STDOUT_FILENO);
+        } else {
+            int devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDOUT_FILENO);
+        }
+        execv(binary, ppArguments);
+        perror("exec failed");
+        _exit(EXIT_FAILURE);
+    }
+
+    close(input[0]);
+    close(output[1]);
+    if (!keepOutput) {
+        close(output[0]);
+    }
+
+    Endpoint endpoint = {pid, input[1], keepOutput ? output[0] : ERROR, 0, 0};
+    return endpoint;
+}
+
+static uint64_t cpuMicroseconds(const struct rusage* pUsage) {
+    return (uint64_t)(pUsage->ru_utime.tv_sec + pUsage->ru_stime.tv_sec) * 1000000u
+           + (uint64_t)(pUsage->ru_utime.tv_usec + pUsage->ru_stime.tv_usec);
+}
+
+// Wait for both endpoints to exit, killing what is left once the timeout runs out. Looks
+// every millisecond, that is the resolution of the shutdown times.
+static void reapEndpoints(Endpoint* pEndpoints, int count, uint64_t deadline) {
+    int remaining = count;
+    while (remaining > 0) {
+        bool late = clockMicroseconds() > deadline;
+        for (int i = 0; i < count; i++) {
+            if (pEndpoints[i].exited != 0) {
+                continue;
+            }
+
+            struct rusage usage;
+            memset(&usage, 0, sizeof(usage));
+            if (late) {
+                fprintf(stderr, "Endpoint %d did not exit, killing it\n", (int)pEndpoints[i].pid);
+                kill(pEndpoints[i].pid, SIGKILL);
+                wait4(pEndpoints[i].pid, NULL, 0, &usage);
+            } else if (wait4(pEndpoints[i].pid, NULL, WNOHANG, &usage) == 0) {
+                continue;
+            }
+
+            pEndpoints[i].exited = clockMicroseconds();
+            pEndpoints[i].cpu = cpuMicroseconds(&usage);
+            remaining--;
+        }
+        if (remaining > 0) {
+            usleep(1000);
+        }
+    }
+}
+
+// Words from a varying starting point up to the newline
+static void fillWords(char* pLine, int from, int size, int seed) {
+    int word = seed % WORD_COUNT;
+    while (from < size - 1) {
+        for (const char* pWord = sWords[word]; *pWord != '\0' && from < size - 1; pWord++) {
+            pLine[from++] = *pWord;
+        }
+        if (from < size - 1) {
+            pLine[from++] = ' ';
+        }
+        word = (word * 7 + 3) % WORD_COUNT;
+    }
+}
+
+// One line of screen output, anything that isn't a benchmark message is ignored
+static void recordLine(Results* pResults, const char* pLine, size_t length, uint64_t now) {
+    const char* pRemote = memmem(pLine, length, "Remote: ", 8);
+    if (pRemote == NULL) {
+        return;
+    }
+
+    unsigned int sequence;
+    uint64_t sent;
+    if (sscanf(pRemote + 8, "%u %" SCNu64, &sequence, &sent) != 2 || sequence >= (unsigned int)pResults->count) {
+        return;
+    }
+
+    if (pResults->pSeen[sequence]) {
+        pResults->duplicates++;
+        return;
+    }
+    pResults->pSeen[sequence] = true;
+
+    if ((int)sequence < pResults->highest) {
+        pResults->reordered++;
+    } else {
+        pResults->highest = (int)sequence;
+    }
+
+    int received = atomic_load(&pResults->received);
+    pResults->pLatencies[received] = now - sent;
+    atomic_store(&pResults->lastArrival, now);
+    atomic_store(&pResults->received, received + 1);
+}
+
+static int compareLatency(const void* pLeft, const void* pRight) {
+    uint64_t left = *(const uint64_t*)pLeft;
+    uint64_t right = *(const uint64_t*)pRight;
+    return (left > right) - (left < right);
+}
+
+static uint64_t percentile(const uint64_t* pSorted, int count, double fraction) {
+    int index = (int)(fraction * count + 0.999999) - 1;
+    if (index < 0) {
+        index = 0;
+    }
+    return pSorted[index < count ? index : count - 1];
+}
+
+//===================================================================================
+// Routines
+//===================================================================================
+
+// Drain the receiver's stdout until it exits
+static void* readerRoutine(void* args) {
+    Reader* pReader = (Reader*)args;
+    char* pBuffer = malloc(READ_BUFFER_SIZE);
+    if (pBuffer == NULL) {
+        perror("Read buffer allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t pending = 0;
+
+    while (1) {
+        ssize_t result = read(pReader->descriptor, pBuffer + pending, READ_BUFFER_SIZE - pending);
+        if (result == ERROR && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        pending += (size_t)result;
+        uint64_t now = clockMicroseconds();
+
+        // Bound and listening, printed on piped stdin too where there is no prompt
+        if (!atomic_load(&pReader->pResults->ready) && memmem(pBuffer, pending, sListening, sizeof(sListening) - 1) != NULL) {
+            atomic_store(&pReader->pResults->ready, true);
+        }
+
+        size_t start = 0;
+        char* pNewline;
+        while ((pNewline = memchr(pBuffer + start, '\n', pending - start)) != NULL) {
+            size_t end = (size_t)(pNewline - pBuffer) + 1;
+            recordLine(pReader->pResults, pBuffer + start, end - start, now);
+            start = end;
+        }
+
+        // A line longer than the buffer can't be a benchmark message
+        if (start == 0 && pending == READ_BUFFER_SIZE) {
+            start = pending;
+        }
+        pending -= start;
+        memmove(pBuffer, pBuffer + start, pending);
+    }
+
+    free(pBuffer);
+    return NULL;
+}
+
+//===================================================================================
+// Main
+//===================================================================================
+
+int main(int argc, char* argv[]) {
+    const char* binary = "bin/s-talk";
+    const char* label = NULL;
+    int count = DEFAULT_COUNT;
+    int size = DEFAULT_SIZE;
+    int rate = 0;
+    int port = DEFAULT_PORT;
+    bool words = false;
+    bool terminate = false;
+    bool verify = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "b:c:s:r:p:l:tkvh")) != -1) {
+        if (option == 'b') {
+            binary = optarg;
+        } else if (option == 'c') {
+            count = atoi(optarg);
+        } else if (option == 's') {
+            size = atoi(optarg);
+        } else if (option == 'r') {
+            rate = atoi(optarg);
+        } else if (option == 'p') {
+            port = atoi(optarg);
+        } else if (option == 'l') {
+            label = optarg;
+        } else if (option == 't') {
+            words = true;
+        } else if (option == 'k') {
+            terminate = true;
+        } else if (option == 'v') {
+            verify = true;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (count <= 0 || size < MIN_SIZE || size > MAX_SIZE || rate < 0 || port <= 0 || port > 65534) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Everything after "--" goes to both endpoints
+    char** ppFlags = argv + optind;
+    int flagCount = argc - optind;
+
+    // A dead endpoint shows up as a failed write
+    signal(SIGPIPE, SIG_IGN);
+
+    Results results;
+    memset(&results, 0, sizeof(results));
+    results.count = count;
+    results.highest = -1;
+    results.pSeen = calloc((size_t)count, sizeof(bool));
+    results.pLatencies = calloc((size_t)count, sizeof(uint64_t));
+    char* pLine = malloc((size_t)size + 1);
+    if (results.pSeen == NULL || results.pLatencies == NULL || pLine == NULL) {
+        perror("Benchmark allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&results.received, 0);
+    atomic_init(&results.ready, false);
+    atomic_init(&results.lastArrival, 0);
+
+    // The receiver goes first so nothing is sent to a port that isn't bound yet
+    Endpoint receiver = spawnEndpoint(binary, ppFlags, flagCount, port + 1, port, true);
+    Reader reader = {receiver.output, &results};
+    pthread_t readerThread;
+    if (pthread_create(&readerThread, NULL, readerRoutine, &reader) != 0) {
+        fprintf(stderr, "Error creating thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t startupDeadline = clockMicroseconds() + STARTUP_TIMEOUT_US;
+    while (!atomic_load(&results.ready) && clockMicroseconds() < startupDeadline) {
+        usleep(1000);
+    }
+    if (!atomic_load(&results.ready)) {
+        fprintf(stderr, "Receiver did not start\n");
+    }
+
+    Endpoint sender = spawnEndpoint(binary, ppFlags, flagCount, port, port + 1, false);
+
+    // Padding after the sequence number and send time makes up the requested size
+    memset(pLine, 'x', (size_t)size);
+    pLine[size - 1] = '\n';
+
+    int sent = 0;
+    uint64_t start = clockMicroseconds();
+    for (; sent < count; sent++) {
+        if (rate > 0) {
+            sleepUntil(start + (uint64_t)sent * 1000000u / (uint64_t)rate);
+        }
+
+        uint64_t now = clockMicroseconds();
+        int stamp = snprintf(pLine, (size_t)size, "%d %" PRIu64 " ", sent, now);
+        if (words) {
+            fillWords(pLine, stamp, size, sent);
+        } else {
+            pLine[stamp] = 'x';
+        }
+        if (!writeAll(sender.input, pLine, (size_t)size)) {
+            perror("Sender stopped taking input");
+            break;
+        }
+    }
+    uint64_t sendEnd = clockMicroseconds();
+
+    // Wait for the stragglers, stop once the stream has gone quiet
+    uint64_t lastProgress = sendEnd;
+    int lastReceived = atomic_load(&results.received);
+    while (lastReceived < sent && clockMicroseconds() - lastProgress < IDLE_TIMEOUT_US) {
+        usleep(10000);
+        int received = atomic_load(&results.received);
+        if (received != lastReceived) {
+            lastReceived = received;
+            lastProgress = clockMicroseconds();
+        }
+    }
+
+    // '!' or SIGTERM ends both sessions, the receiver exiting closes the pipe the reader is on
+    uint64_t ending = clockMicroseconds();
+    if (terminate) {
+        kill(sender.pid, SIGTERM);
+    } else {
+        writeAll(sender.input, "!\n", 2);
+    }
+    uint64_t exitDeadline = ending + EXIT_TIMEOUT_US;
+    Endpoint endpoints[2] = {sender, receiver};
+    reapEndpoints(endpoints, 2, exitDeadline);
+    sender = endpoints[0];
+    receiver = endpoints[1];
+    pthread_join(readerThread, NULL);
+    close(sender.input);
+    close(receiver.input);
+    close(receiver.output);
+
+    int received = atomic_load(&results.received);
+    uint64_t lastArrival = atomic_load(&results.lastArrival);
+    double seconds = (double)((lastArrival > start ? lastArrival : sendEnd) - start) / 1e6;
+    if (seconds <= 0) {
+        seconds = 1e-6;
+    }
+
+    printf("%s\n", label != NULL ? label : binary);
+    printf("  sent %d, delivered %d (%.2f%% lost), %d reordered, %d duplicates\n",
+           sent, received, sent > 0 ? 100.0 * (sent - received) / sent : 0.0, results.reordered, results.duplicates);
+    printf("  %.0f msg/s, %.2f MB/s with %d byte messages\n",
+           received / seconds, (double)received * size / seconds / 1e6, size);
+    printf("  cpu ms: sender %.1f, receiver %.1f, %.1f ns per delivered byte\n",
+           (double)sender.cpu / 1e3, (double)receiver.cpu / 1e3,
+           received > 0 ? (double)(sender.cpu + receiver.cpu) * 1e3 / ((double)received * size) : 0.0);
+    printf("  shutdown ms after %s: sender %.1f, receiver %.1f\n", terminate ? "SIGTERM" : "'!'",
+           (double)(sender.exited - ending) / 1e3, (double)(receiver.exited - ending) / 1e3);
+
+    if (received > 0) {
+        qsort(results.pLatencies, (size_t)received, sizeof(uint64_t), compareLatency);
+        printf("  latency us: p50 %" PRIu64 ", p99 %" PRIu64 ", p999 %" PRIu64 ", max %" PRIu64 "\n",
+               percentile(results.pLatencies, received, 0.50),
+               percentile(results.pLatencies, received, 0.99),
+               percentile(results.pLatencies, received, 0.999),
+               results.pLatencies[received - 1]);
+    }
+
+    bool intact = received == sent && results.reordered == 0 && results.duplicates == 0;
+    if (verify) {
+        printf("  %s\n", intact ? "PASS" : "FAIL: messages were lost, reordered or duplicated");
+    }
+
+    free(pLine);
+    free(results.pSeen);
+    free(results.pLatencies);
+    return received > 0 && (!verify || intact) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
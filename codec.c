@@ -0,0 +1,237 @@
+#include "codec.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Token: literal count in the high nibble, match length - CODEC_MIN_MATCH in the low one,
+// 15 means more follows in bytes of up to 255. Literals, then a little-endian 16-bit
+// offset and the match. The last sequence is literals only, the input ends after them.
+#define CODEC_MIN_MATCH 4
+#define CODEC_HASH_BITS 10
+#define CODEC_HASH_SIZE (1 << CODEC_HASH_BITS)
+
+// Phrases that keep coming up in chat, most common last so they are the closest match.
+// Changing it breaks compatibility with peers that still have the old one.
+static const char sDictionary[] =
+    "http://https://www..com/.org/ :) :( :D ;) lol haha hahaha lmao omg btw idk tbh imo brb "
+    "thx thanks thank you thanks a lot no problem you're welcome sorry my bad "
+    "what do you think about that? what are you doing? where are you? how are you doing? "
+    "I don't know I'm not sure I think so I don't think so I guess so maybe later "
+    "sounds good sounds great that's great that's awesome that's cool that makes sense "
+    "see you later see you tomorrow talk to you later good morning good night good luck "
+    "let me know let me check let me see can you send me could you please would you like "
+    "tomorrow tonight today yesterday this weekend next week in a minute right now "
+    "meeting message please because something anything everything nothing really actually "
+    "should would could have been going to want to need to have to got it I see okay ok "
+    "yes yeah yep no nope sure of course exactly absolutely definitely probably "
+    "the and that this with for from have your you are what when where there their "
+    "hello hi hey everyone guys is it the one I'm on my way just a sec ";
+
+#define CODEC_DICTIONARY_SIZE (sizeof(sDictionary) - 1)
+#define CODEC_WINDOW_SIZE (CODEC_DICTIONARY_SIZE + CODEC_MAX_INPUT)
+
+// Positions + 1 into the window, 0 is empty. The dictionary part is hashed once.
+static uint16_t sDictionaryTable[CODEC_HASH_SIZE];
+static pthread_once_t sDictionaryOnce = PTHREAD_ONCE_INIT;
+
+// Dictionary followed by the message being compressed, so matches can span both
+static _Thread_local uint8_t sWindow[CODEC_WINDOW_SIZE];
+static _Thread_local bool sWindowReady = false;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static inline uint32_t readWord(const uint8_t* pBytes) {
+    uint32_t word;
+    memcpy(&word, pBytes, sizeof(word));
+    return word;
+}
+
+static inline uint32_t hashWord(uint32_t word) {
+    return (word * 2654435761u) >> (32 - CODEC_HASH_BITS);
+}
+
+static void hashDictionary(void) {
+    const uint8_t* pDictionary = (const uint8_t*)sDictionary;
+    for (size_t i = 0; i + CODEC_MIN_MATCH <= CODEC_DICTIONARY_SIZE; i++) {
+        sDictionaryTable[hashWord(readWord(pDictionary + i))] = (uint16_t)(i + 1);
+    }
+}
+
+// Lengths of 15 and up spill into extra bytes, returns false when out of room
+static bool putLength(uint8_t** ppOut, const uint8_t* pEnd, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (*ppOut >= pEnd) {
+            return false;
+        }
+        *(*ppOut)++ = 255;
+    }
+    if (*ppOut >= pEnd) {
+        return false;
+    }
+    *(*ppOut)++ = (uint8_t)length;
+    return true;
+}
+
+static bool getLength(const uint8_t** ppIn, const uint8_t* pEnd, size_t* pLength) {
+    uint8_t byte;
+    do {
+        if (*ppIn >= pEnd) {
+            return false;
+        }
+        byte = *(*ppIn)++;
+        *pLength += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// One sequence, a match length of 0 marks the final literals-only one
+static bool putSequence(uint8_t** ppOut, const uint8_t* pEnd, const uint8_t* pLiterals, size_t literals,
+                        size_t offset, size_t match) {
+    uint8_t* pToken = (*ppOut)++;
+    if (pToken >= pEnd) {
+        return false;
+    }
+
+    size_t extra = match > 0 ? match - CODEC_MIN_MATCH : 0;
+    *pToken = (uint8_t)((literals < 15 ? literals : 15) << 4 | (extra < 15 ? extra : 15));
+
+    if (literals >= 15 && !putLength(ppOut, pEnd, literals - 15)) {
+        return false;
+    }
+    if ((size_t)(pEnd - *ppOut) < literals) {
+        return false;
+    }
+    memcpy(*ppOut, pLiterals, literals);
+    *ppOut += literals;
+
+    if (match == 0) {
+        return true;
+    }
+    if (pEnd - *ppOut < 2) {
+        return false;
+    }
+    *(*ppOut)++ = (uint8_t)offset;
+    *(*ppOut)++ = (uint8_t)(offset >> 8);
+    return extra < 15 || putLength(ppOut, pEnd, extra - 15);
+}
+
+//===================================================================================
+// Dictionary LZ
+//===================================================================================
+
+static size_t lzCompress(const char* pSource, size_t length, uint8_t* pDestination, size_t capacity) {
+    if (length < CODEC_MIN_LENGTH || length > CODEC_MAX_INPUT) {
+        return 0;
+    }
+
+    pthread_once(&sDictionaryOnce, hashDictionary);
+    if (!sWindowReady) {
+        memcpy(sWindow, sDictionary, CODEC_DICTIONARY_SIZE);
+        sWindowReady = true;
+    }
+    memcpy(sWindow + CODEC_DICTIONARY_SIZE, pSource, length);
+
+    uint16_t table[CODEC_HASH_SIZE];
+    memcpy(table, sDictionaryTable, sizeof(table));
+
+    // Anything at least as long as the input is not worth the flag
+    uint8_t* pOut = pDestination;
+    const uint8_t* pEnd = pDestination + (capacity < length ? capacity : length - 1);
+
+    size_t anchor = CODEC_DICTIONARY_SIZE;
+    size_t position = CODEC_DICTIONARY_SIZE;
+    size_t end = CODEC_DICTIONARY_SIZE + length;
+
+    // Greedy, the first match of at least CODEC_MIN_MATCH bytes is taken
+    while (position + CODEC_MIN_MATCH <= end) {
+        uint32_t word = readWord(sWindow + position);
+        uint32_t hash = hashWord(word);
+        size_t candidate = table[hash];
+        table[hash] = (uint16_t)(position + 1);
+
+        if (candidate == 0 || readWord(sWindow + candidate - 1) != word) {
+            position++;
+            continue;
+        }
+        candidate--;
+
+        size_t match = CODEC_MIN_MATCH;
+        while (position + match < end && sWindow[candidate + match] == sWindow[position + match]) {
+            match++;
+        }
+
+        if (!putSequence(&pOut, pEnd, sWindow + anchor, position - anchor, position - candidate, match)) {
+            return 0;
+        }
+        position += match;
+        anchor = position;
+    }
+
+    if (!putSequence(&pOut, pEnd, sWindow + anchor, end - anchor, 0, 0)) {
+        return 0;
+    }
+    return (size_t)(pOut - pDestination);
+}
+
+static ssize_t lzDecompress(const uint8_t* pSource, size_t length, char* pDestination, size_t capacity) {
+    const uint8_t* pIn = pSource;
+    const uint8_t* pEnd = pSource + length;
+    size_t written = 0;
+
+    while (pIn < pEnd) {
+        uint8_t token = *pIn++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(&pIn, pEnd, &literals)) {
+            return -1;
+        }
+        if ((size_t)(pEnd - pIn) < literals || capacity - written < literals) {
+            return -1;
+        }
+        memcpy(pDestination + written, pIn, literals);
+        pIn += literals;
+        written += literals;
+
+        // The last sequence has no match
+        if (pIn == pEnd) {
+            break;
+        }
+
+        if (pEnd - pIn < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)pIn[0] | (size_t)pIn[1] << 8;
+        pIn += 2;
+
+        size_t match = (token & 15) + CODEC_MIN_MATCH;
+        if ((token & 15) == 15 && !getLength(&pIn, pEnd, &match)) {
+            return -1;
+        }
+        if (offset == 0 || offset > written + CODEC_DICTIONARY_SIZE || capacity - written < match) {
+            return -1;
+        }
+
+        // Byte by byte, a match may overlap what it is producing or start in the dictionary
+        for (size_t i = 0; i < match; i++, written++) {
+            pDestination[written] = offset > written ? sDictionary[CODEC_DICTIONARY_SIZE + written - offset]
+                                                     : pDestination[written - offset];
+        }
+    }
+
+    return (ssize_t)written;
+}
+
+const Codec codecDictionaryLz = { "dictionary-lz", CODEC_ID_DICTIONARY_LZ, lzCompress, lzDecompress };
+
+static const Codec* sCodecs[] = { &codecDictionaryLz };
+
+const Codec* codecFind(uint8_t id) {
+    for (size_t i = 0; i < sizeof(sCodecs) / sizeof(sCodecs[0]); i++) {
+        if (sCodecs[i]->id == id) {
+            return sCodecs[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Messages shorter than this go out as they are, the header flag says which ones didn't
+#define CODEC_MIN_LENGTH 24
+
+// Longest input compress takes, longer ones are left alone
+#define CODEC_MAX_INPUT 4096
+
+// Codec ids, a compressed payload starts with the one that produced it
+#define CODEC_ID_DICTIONARY_LZ 1
+
+// A payload transform applied per datagram, between the outbound queue and sendmmsg and
+// between recvmmsg and the inbound queue. Both ends must agree on the dictionary.
+typedef struct Codec {
+    const char* pName;
+    uint8_t     id;
+
+    // Returns the compressed size, or 0 when the output would not be smaller than the input
+    // or not fit capacity. The message then goes out uncompressed.
+    size_t (*compress)(const char* pSource, size_t length, uint8_t* pDestination, size_t capacity);
+
+    // Returns the original size, or -1 when the input is malformed or doesn't fit capacity
+    ssize_t (*decompress)(const uint8_t* pSource, size_t length, char* pDestination, size_t capacity);
+} Codec;
+
+// LZ77 in the LZ4 block layout, matches may reach back into a built-in dictionary of
+// common chat phrases so even a short line finds something to reference
+extern const Codec codecDictionaryLz;
+
+// The codec a received payload names, NULL when we don't have it
+const Codec* codecFind(uint8_t id);
+
+#endif
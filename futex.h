@@ -0,0 +1,39 @@
+#ifndef FUTEX_H_
+#define FUTEX_H_
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // For syscall
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// Thin wrappers over the futex syscall, the word must be 32 bits wide
+
+// Sleep while *pWord == expected, returns early on a wake, signal or timeout
+// A negative timeout waits forever
+static inline int futexWait(atomic_uint* pWord, unsigned int expected, int milliseconds) {
+    struct timespec timeout;
+    struct timespec* pTimeout = NULL;
+
+    if (milliseconds >= 0) {
+        timeout.tv_sec = milliseconds / 1000;
+        timeout.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+        pTimeout = &timeout;
+    }
+
+    return (int)syscall(SYS_futex, (uint32_t*)pWord, FUTEX_WAIT_PRIVATE, expected, pTimeout, NULL, 0);
+}
+
+// Wake up to count sleepers on pWord
+static inline int futexWake(atomic_uint* pWord, int count) {
+    return (int)syscall(SYS_futex, (uint32_t*)pWord, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#endif
@@ -0,0 +1,181 @@
+#include "lineReader.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Chunks come back from whichever thread sent their last slice
+static pthread_mutex_t sCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static LineChunk* sCache = NULL;
+static int sCached = 0;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static LineChunk* acquireChunk(void) {
+    pthread_mutex_lock(&sCacheMutex);
+    LineChunk* pChunk = sCache;
+    if (pChunk != NULL) {
+        sCache = pChunk->pNext;
+        sCached--;
+    }
+    pthread_mutex_unlock(&sCacheMutex);
+
+    if (pChunk == NULL) {
+        pChunk = malloc(sizeof(LineChunk));
+        if (pChunk == NULL) {
+            perror("Line chunk allocation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pChunk->pNext = NULL;
+    pChunk->length = 0;
+    atomic_store_explicit(&pChunk->references, 1, memory_order_relaxed);
+    return pChunk;
+}
+
+// Hand out length bytes from the reader's position
+static void slice(LineReader* pReader, Message* pMessage, size_t length, bool partial) {
+    LineChunk* pChunk = pReader->pChunk;
+    atomic_fetch_add_explicit(&pChunk->references, 1, memory_order_relaxed);
+
+    pMessage->pData = pChunk->data + pReader->start;
+    pMessage->pChunk = pChunk;
+    pMessage->length = length;
+    pMessage->partial = partial;
+    pMessage->fragment = pReader->fragment;
+
+    pReader->fragment = partial ? pReader->fragment + 1 : 0;
+    pReader->start += length;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void lineReaderInitialize(LineReader* pReader, bool framed) {
+    assert(pReader != NULL);
+
+    pReader->pChunk = NULL;
+    pReader->start = 0;
+    pReader->framed = framed;
+    pReader->discarding = false;
+    pReader->ended = false;
+    pReader->fragment = 0;
+}
+
+void lineReaderDestroy(LineReader* pReader) {
+    assert(pReader != NULL);
+
+    // Slices still in flight keep the chunk alive
+    if (pReader->pChunk != NULL) {
+        lineChunkRelease(pReader->pChunk);
+        pReader->pChunk = NULL;
+    }
+}
+
+ssize_t lineReaderFill(LineReader* pReader, int descriptor) {
+    LineChunk* pChunk = pReader->pChunk;
+
+    // Nothing points into it anymore, start over at the front
+    if (pChunk != NULL && pReader->start == pChunk->length
+        && atomic_load_explicit(&pChunk->references, memory_order_acquire) == 1) {
+        pChunk->length = 0;
+        pReader->start = 0;
+    }
+
+    // Nearly full, carry the unfinished line over to a fresh chunk. Complete lines are
+    // always handed out first, so this is at most one slot's worth of bytes.
+    if (pChunk == NULL || LINE_CHUNK_SIZE - pChunk->length < MAX_CHAR_COUNT) {
+        LineChunk* pFresh = acquireChunk();
+        if (pChunk != NULL) {
+            pFresh->length = pChunk->length - pReader->start;
+            assert(pFresh->length < LINE_CHUNK_SIZE);
+            memcpy(pFresh->data, pChunk->data + pReader->start, pFresh->length);
+            lineChunkRelease(pChunk);
+        }
+        pReader->pChunk = pChunk = pFresh;
+        pReader->start = 0;
+    }
+
+    ssize_t result = read(descriptor, pChunk->data + pChunk->length, LINE_CHUNK_SIZE - pChunk->length);
+    if (result > 0) {
+        pChunk->length += (size_t)result;
+    } else if (result == 0) {
+        pReader->ended = true;
+    }
+    return result;
+}
+
+bool lineReaderNext(LineReader* pReader, Message* pMessage) {
+    LineChunk* pChunk = pReader->pChunk;
+    size_t limit = pReader->framed ? MAX_CHAR_COUNT : MAX_CHAR_COUNT - 1;
+
+    while (pChunk != NULL && pReader->start < pChunk->length) {
+        char* pStart = pChunk->data + pReader->start;
+        size_t window = pChunk->length - pReader->start;
+
+        // Skip to the end of the truncated line
+        if (pReader->discarding) {
+            char* pNewline = memchr(pStart, '\n', window);
+            pReader->start = pNewline == NULL ? pChunk->length : (size_t)(pNewline - pChunk->data) + 1;
+            pReader->discarding = pNewline == NULL;
+            continue;
+        }
+
+        // memchr scans a vector at a time
+        char* pNewline = memchr(pStart, '\n', window < limit ? window : limit);
+        if (pNewline != NULL) {
+            slice(pReader, pMessage, (size_t)(pNewline - pStart) + 1, false);
+            return true;
+        }
+
+        // Too long for one slot, framed links send the rest as further fragments
+        if (window >= limit) {
+            slice(pReader, pMessage, limit, pReader->framed);
+            pReader->discarding = !pReader->framed;
+            return true;
+        }
+
+        // Input ended without a newline, what is left is the last line
+        if (pReader->ended) {
+            slice(pReader, pMessage, window, false);
+            return true;
+        }
+        break;
+    }
+
+    return false;
+}
+
+void lineChunkRelease(LineChunk* pChunk) {
+    if (atomic_fetch_sub_explicit(&pChunk->references, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    pthread_mutex_lock(&sCacheMutex);
+    if (sCached < LINE_CHUNK_CACHE) {
+        pChunk->pNext = sCache;
+        sCache = pChunk;
+        sCached++;
+        pChunk = NULL;
+    }
+    pthread_mutex_unlock(&sCacheMutex);
+
+    free(pChunk);
+}
+
+void lineChunkCacheDrain(void) {
+    pthread_mutex_lock(&sCacheMutex);
+    while (sCache != NULL) {
+        LineChunk* pChunk = sCache;
+        sCache = pChunk->pNext;
+        free(pChunk);
+    }
+    sCached = 0;
+    pthread_mutex_unlock(&sCacheMutex);
+}
@@ -0,0 +1,55 @@
+#ifndef LINE_READER_H_
+#define LINE_READER_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "messagePool.h"
+
+// Bytes pulled from stdin per read
+#define LINE_CHUNK_SIZE (64 * 1024)
+
+// Free chunks kept around instead of going back to malloc
+#define LINE_CHUNK_CACHE 8
+
+// One read() worth of stdin. Messages point into it rather than holding a copy,
+// each of them keeps it alive with a reference.
+typedef struct LineChunk {
+    atomic_int          references;     // The reader's own plus one per slice in flight
+    struct LineChunk*   pNext;          // Cache link
+    size_t              length;         // Bytes read into data so far
+    char                data[LINE_CHUNK_SIZE];
+} LineChunk;
+
+// Bulk stdin ingestion, lines are split in place and handed out as slices
+typedef struct LineReader {
+    LineChunk*   pChunk;         // Being filled, NULL before the first read
+    size_t       start;          // First byte not handed out yet
+    bool         framed;         // Long lines go out as fragments instead of being truncated
+    bool         discarding;     // Dropping the tail of an over-long line (unframed only)
+    bool         ended;          // read returned 0, the unterminated tail is the last line
+    uint16_t     fragment;       // Next fragment index of the line being split
+} LineReader;
+
+void lineReaderInitialize(LineReader* pReader, bool framed);
+void lineReaderDestroy(LineReader* pReader);
+
+// One read() into the current chunk, an unfinished line moves to a fresh chunk when it
+// is full. Returns bytes read, 0 at the end of input or -1 with errno set (EAGAIN included).
+ssize_t lineReaderFill(LineReader* pReader, int descriptor);
+
+// Point pMessage at the next line, or fragment of a long one, and take a chunk reference
+// for it. Unframed lines are truncated to what fgets would have kept. False when nothing
+// complete is buffered.
+bool lineReaderNext(LineReader* pReader, Message* pMessage);
+
+// Drop a slice's reference, the message pool calls this when the slot is freed
+void lineChunkRelease(LineChunk* pChunk);
+
+// Free the cached chunks, once nothing reads stdin anymore
+void lineChunkCacheDrain(void);
+
+#endif
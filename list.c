@@ -0,0 +1,429 @@
+#include "list.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Arena blocks, 64M nodes in all. The table is fixed so a lookup never races a resize,
+// and blocks never move, which keeps inline items at a stable address.
+#define LIST_MAX_BLOCKS 65536
+
+// Free nodes a thread moves to or from the shared free list at a time
+#define LIST_CACHE_BATCH 32
+
+// Only allocation touches shared state, a list itself belongs to whoever holds its lock
+static pthread_mutex_t sArenaMutex = PTHREAD_MUTEX_INITIALIZER;
+static Node* sBlocks[LIST_MAX_BLOCKS];
+static int sBlockCount = 0;
+static int sNodesUsed = 0;          // Indices handed out so far, free or not
+static int sFirstFreeNode = LIST_NO_NODE;
+static List* sFirstFreeHead = NULL;
+
+// Each thread keeps a few free nodes of its own, so the mutex is taken once per batch
+static _Thread_local int sCachedNode = LIST_NO_NODE;
+static _Thread_local int sCachedCount = 0;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static inline Node* nodeAt(int index) {
+    return &sBlocks[index / LIST_MAX_NUM_NODES][index % LIST_MAX_NUM_NODES];
+}
+
+// Called with sArenaMutex held
+static bool growArena(void) {
+    if (sBlockCount == LIST_MAX_BLOCKS) {
+        return false;
+    }
+
+    Node* pBlock = malloc(LIST_MAX_NUM_NODES * sizeof(Node));
+    if (pBlock == NULL) {
+        return false;
+    }
+    sBlocks[sBlockCount++] = pBlock;
+    return true;
+}
+
+// Take a batch from the shared free list, or carve fresh nodes out of the arena
+static void refillCache(void) {
+    pthread_mutex_lock(&sArenaMutex);
+    while (sCachedCount < LIST_CACHE_BATCH) {
+        int index = sFirstFreeNode;
+        if (index != LIST_NO_NODE) {
+            sFirstFreeNode = nodeAt(index)->next;
+        } else {
+            if (sNodesUsed == sBlockCount * LIST_MAX_NUM_NODES && !growArena()) {
+                break;
+            }
+            index = sNodesUsed++;
+        }
+        nodeAt(index)->next = sCachedNode;
+        sCachedNode = index;
+        sCachedCount++;
+    }
+    pthread_mutex_unlock(&sArenaMutex);
+}
+
+// Hand a batch back, the consumer of a queue frees what its producer allocates
+static void spillCache(void) {
+    int first = sCachedNode;
+    int last = first;
+    for (int i = 1; i < LIST_CACHE_BATCH; i++) {
+        last = nodeAt(last)->next;
+    }
+    sCachedNode = nodeAt(last)->next;
+    sCachedCount -= LIST_CACHE_BATCH;
+
+    pthread_mutex_lock(&sArenaMutex);
+    nodeAt(last)->next = sFirstFreeNode;
+    sFirstFreeNode = first;
+    pthread_mutex_unlock(&sArenaMutex);
+}
+
+// Recently freed nodes first, they are the ones still in cache
+static int allocateNode(void* pItem) {
+    if (sCachedCount == 0) {
+        refillCache();
+        if (sCachedCount == 0) {
+            return LIST_NO_NODE;
+        }
+    }
+
+    int index = sCachedNode;
+    Node* pNode = nodeAt(index);
+    sCachedNode = pNode->next;
+    sCachedCount--;
+
+    pNode->pItem = pItem;
+    pNode->next = LIST_NO_NODE;
+    pNode->prev = LIST_NO_NODE;
+    return index;
+}
+
+static void freeNode(int index) {
+    nodeAt(index)->next = sCachedNode;
+    sCachedNode = index;
+    if (++sCachedCount > 2 * LIST_CACHE_BATCH) {
+        spillCache();
+    }
+}
+
+static void releaseHead(List* pList) {
+    pthread_mutex_lock(&sArenaMutex);
+    pList->pNextFreeHead = sFirstFreeHead;
+    sFirstFreeHead = pList;
+    pthread_mutex_unlock(&sArenaMutex);
+}
+
+// Put a fresh node after prev (LIST_NO_NODE for the front) and make it current
+static void linkNode(List* pList, int index, int prev) {
+    Node* pNode = nodeAt(index);
+    int next = prev == LIST_NO_NODE ? pList->first : nodeAt(prev)->next;
+
+    pNode->prev = prev;
+    pNode->next = next;
+    if (prev == LIST_NO_NODE) {
+        pList->first = index;
+    } else {
+        nodeAt(prev)->next = index;
+    }
+    if (next == LIST_NO_NODE) {
+        pList->last = index;
+    } else {
+        nodeAt(next)->prev = index;
+    }
+
+    pList->current = index;
+    pList->count++;
+}
+
+static void unlinkNode(List* pList, int index) {
+    Node* pNode = nodeAt(index);
+
+    if (pNode->prev == LIST_NO_NODE) {
+        pList->first = pNode->next;
+    } else {
+        nodeAt(pNode->prev)->next = pNode->next;
+    }
+    if (pNode->next == LIST_NO_NODE) {
+        pList->last = pNode->prev;
+    } else {
+        nodeAt(pNode->next)->prev = pNode->prev;
+    }
+
+    pList->count--;
+    freeNode(index);
+}
+
+static int insertAt(List* pList, void* pItem, int prev) {
+    int index = allocateNode(pItem);
+    if (index == LIST_NO_NODE) {
+        return LIST_FAIL;
+    }
+    linkNode(pList, index, prev);
+    return LIST_SUCCESS;
+}
+
+static int insertInline(List* pList, const void* pData, int size, bool atEnd) {
+#if LIST_INLINE_SIZE > 0
+    if (size < 0 || size > LIST_INLINE_SIZE) {
+        return LIST_FAIL;
+    }
+
+    int index = allocateNode(NULL);
+    if (index == LIST_NO_NODE) {
+        return LIST_FAIL;
+    }
+
+    Node* pNode = nodeAt(index);
+    memcpy(pNode->inlineItem, pData, (size_t)size);
+    pNode->pItem = pNode->inlineItem;
+    linkNode(pList, index, atEnd ? pList->last : LIST_NO_NODE);
+    return LIST_SUCCESS;
+#else
+    (void)pList;
+    (void)pData;
+    (void)size;
+    (void)atEnd;
+    return LIST_FAIL;
+#endif
+}
+
+static void* itemAt(int index) {
+    return index == LIST_NO_NODE ? NULL : nodeAt(index)->pItem;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+List* List_create() {
+    pthread_mutex_lock(&sArenaMutex);
+    if (sFirstFreeHead == NULL) {
+        List* pHeads = malloc(LIST_MAX_NUM_HEADS * sizeof(List));
+        if (pHeads == NULL) {
+            pthread_mutex_unlock(&sArenaMutex);
+            return NULL;
+        }
+        for (int i = 0; i < LIST_MAX_NUM_HEADS; i++) {
+            pHeads[i].pNextFreeHead = i + 1 < LIST_MAX_NUM_HEADS ? &pHeads[i + 1] : NULL;
+        }
+        sFirstFreeHead = pHeads;
+    }
+
+    List* pList = sFirstFreeHead;
+    sFirstFreeHead = pList->pNextFreeHead;
+    pthread_mutex_unlock(&sArenaMutex);
+
+    pList->first = LIST_NO_NODE;
+    pList->last = LIST_NO_NODE;
+    pList->current = LIST_NO_NODE;
+    pList->count = 0;
+    pList->pNextFreeHead = NULL;
+    pList->lastOutOfBoundsReason = LIST_OOB_START;
+    return pList;
+}
+
+int List_count(List* pList) {
+    assert(pList != NULL);
+    return pList->count;
+}
+
+void* List_first(List* pList) {
+    assert(pList != NULL);
+
+    // On an empty list the cursor stays on whichever side it was, like in list.o
+    pList->current = pList->first;
+    if (pList->count > 0) {
+        pList->lastOutOfBoundsReason = LIST_OOB_START;
+    }
+    return itemAt(pList->current);
+}
+
+void* List_last(List* pList) {
+    assert(pList != NULL);
+
+    pList->current = pList->last;
+    if (pList->count > 0) {
+        pList->lastOutOfBoundsReason = LIST_OOB_END;
+    }
+    return itemAt(pList->current);
+}
+
+void* List_next(List* pList) {
+    assert(pList != NULL);
+
+    if (pList->current != LIST_NO_NODE) {
+        pList->current = nodeAt(pList->current)->next;
+    } else if (pList->lastOutOfBoundsReason == LIST_OOB_START) {
+        pList->current = pList->first;
+    }
+
+    if (pList->current == LIST_NO_NODE) {
+        pList->lastOutOfBoundsReason = LIST_OOB_END;
+    }
+    return itemAt(pList->current);
+}
+
+void* List_prev(List* pList) {
+    assert(pList != NULL);
+
+    if (pList->current != LIST_NO_NODE) {
+        pList->current = nodeAt(pList->current)->prev;
+    } else if (pList->lastOutOfBoundsReason == LIST_OOB_END) {
+        pList->current = pList->last;
+    }
+
+    if (pList->current == LIST_NO_NODE) {
+        pList->lastOutOfBoundsReason = LIST_OOB_START;
+    }
+    return itemAt(pList->current);
+}
+
+void* List_curr(List* pList) {
+    assert(pList != NULL);
+    return itemAt(pList->current);
+}
+
+int List_insert_after(List* pList, void* pItem) {
+    assert(pList != NULL);
+
+    int prev = pList->current;
+    if (prev == LIST_NO_NODE && pList->lastOutOfBoundsReason == LIST_OOB_END) {
+        prev = pList->last;
+    }
+    return insertAt(pList, pItem, prev);
+}
+
+int List_insert_before(List* pList, void* pItem) {
+    assert(pList != NULL);
+
+    int prev;
+    if (pList->current != LIST_NO_NODE) {
+        prev = nodeAt(pList->current)->prev;
+    } else {
+        prev = pList->lastOutOfBoundsReason == LIST_OOB_END ? pList->last : LIST_NO_NODE;
+    }
+    return insertAt(pList, pItem, prev);
+}
+
+int List_append(List* pList, void* pItem) {
+    assert(pList != NULL);
+    return insertAt(pList, pItem, pList->last);
+}
+
+int List_prepend(List* pList, void* pItem) {
+    assert(pList != NULL);
+    return insertAt(pList, pItem, LIST_NO_NODE);
+}
+
+int List_append_inline(List* pList, const void* pData, int size) {
+    assert(pList != NULL);
+    return insertInline(pList, pData, size, true);
+}
+
+int List_prepend_inline(List* pList, const void* pData, int size) {
+    assert(pList != NULL);
+    return insertInline(pList, pData, size, false);
+}
+
+void* List_remove(List* pList) {
+    assert(pList != NULL);
+
+    int index = pList->current;
+    if (index == LIST_NO_NODE) {
+        return NULL;
+    }
+
+    Node* pNode = nodeAt(index);
+    void* pItem = pNode->pItem;
+    pList->current = pNode->next;
+    if (pList->current == LIST_NO_NODE) {
+        pList->lastOutOfBoundsReason = LIST_OOB_END;
+    }
+
+    unlinkNode(pList, index);
+    return pItem;
+}
+
+void* List_trim(List* pList) {
+    assert(pList != NULL);
+
+    int index = pList->last;
+    if (index == LIST_NO_NODE) {
+        return NULL;
+    }
+
+    void* pItem = nodeAt(index)->pItem;
+    unlinkNode(pList, index);
+
+    pList->current = pList->last;
+    pList->lastOutOfBoundsReason = LIST_OOB_END;
+    return pItem;
+}
+
+void List_concat(List* pList1, List* pList2) {
+    assert(pList1 != NULL);
+    assert(pList2 != NULL);
+
+    // Splice the two chains, no node moves
+    if (pList2->first != LIST_NO_NODE) {
+        if (pList1->last == LIST_NO_NODE) {
+            pList1->first = pList2->first;
+        } else {
+            nodeAt(pList1->last)->next = pList2->first;
+            nodeAt(pList2->first)->prev = pList1->last;
+        }
+        pList1->last = pList2->last;
+        pList1->count += pList2->count;
+    }
+
+    releaseHead(pList2);
+}
+
+void List_free(List* pList, FREE_FN pItemFreeFn) {
+    assert(pList != NULL);
+
+    // Last to first, the order list.o freed items in
+    int index = pList->last;
+    while (index != LIST_NO_NODE) {
+        Node* pNode = nodeAt(index);
+        int prev = pNode->prev;
+        if (pItemFreeFn != NULL) {
+            (*pItemFreeFn)(pNode->pItem);
+        }
+        freeNode(index);
+        index = prev;
+    }
+
+    releaseHead(pList);
+}
+
+void* List_search(List* pList, COMPARATOR_FN pComparator, void* pComparisonArg) {
+    assert(pList != NULL);
+    assert(pComparator != NULL);
+
+    if (pList->count == 0) {
+        return NULL;
+    }
+
+    int index = pList->current;
+    if (index == LIST_NO_NODE && pList->lastOutOfBoundsReason == LIST_OOB_START) {
+        index = pList->first;
+    }
+
+    while (index != LIST_NO_NODE) {
+        Node* pNode = nodeAt(index);
+        if ((*pComparator)(pNode->pItem, pComparisonArg)) {
+            pList->current = index;
+            return pNode->pItem;
+        }
+        index = pNode->next;
+    }
+
+    pList->current = LIST_NO_NODE;
+    pList->lastOutOfBoundsReason = LIST_OOB_END;
+    return NULL;
+}
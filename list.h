@@ -9,11 +9,24 @@
 #define LIST_SUCCESS 0
 #define LIST_FAIL -1
 
+// Nodes live in a growable arena and link to each other by index, so a list walk touches
+// small, mostly adjacent nodes instead of chasing heap pointers
+#define LIST_NO_NODE -1
+
+// Bytes a node can hold itself, see List_append_inline. Off by default so a node
+// stays 16 bytes, build with -DLIST_INLINE_SIZE=48 for a 64 byte (one cache line) node.
+#ifndef LIST_INLINE_SIZE
+#define LIST_INLINE_SIZE 0
+#endif
+
 typedef struct Node_s Node;
 struct Node_s {
     void* pItem;
-    Node* pNext;
-    Node* pPrev;
+    int next;       // Arena index, LIST_NO_NODE at the end (and free list link)
+    int prev;
+#if LIST_INLINE_SIZE > 0
+    _Alignas(8) unsigned char inlineItem[LIST_INLINE_SIZE];
+#endif
 };
 
 enum ListOutOfBounds {
@@ -23,22 +36,25 @@ enum ListOutOfBounds {
 
 typedef struct List_s List;
 struct List_s{
-    Node* pFirstNode;
-    Node* pLastNode;
-    Node* pCurrentNode;
+    int first;
+    int last;
+    int current;    // LIST_NO_NODE when out of bounds
     int count;
     List* pNextFreeHead;
     enum ListOutOfBounds lastOutOfBoundsReason;
 };
 
-// Maximum number of unique lists the system can support
-// (You may modify for your needs)
+// Heads allocated at a time, there is no limit on the number of lists anymore
 #define LIST_MAX_NUM_HEADS 100
 
-// Maximum total number of nodes (statically allocated) to be shared across all lists
-// (You may modify for your needs)
-#define LIST_MAX_NUM_NODES 1000
+// Nodes per arena block (a power of two), the arena grows a block at a time until
+// malloc fails, so a burst no longer runs out of nodes. Threads keep up to 64 free
+// nodes each for themselves.
+#define LIST_MAX_NUM_NODES 1024
 
+// Thread safety: the arena is shared and locked internally, so different lists can be used
+// from different threads at once. Calls on one list still need the caller's own lock.
+//
 // General Error Handling:
 // Client code is assumed never to call these functions with a NULL List pointer, or 
 // bad List pointer. If it does, any behaviour is permitted (such as crashing).
@@ -130,4 +146,11 @@ void* List_trim(List* pList);
 typedef bool (*COMPARATOR_FN)(void* pItem, void* pComparisonArg);
 void* List_search(List* pList, COMPARATOR_FN pComparator, void* pComparisonArg);
 
+// Like List_append and List_prepend, but copy size bytes into the node itself and use the
+// copy as the item, saving the caller an allocation and the walk a pointer chase. The copy
+// lives as long as the node: an item removed with List_remove or List_trim stays readable
+// only until the next insert. Returns -1 when size exceeds LIST_INLINE_SIZE.
+int List_append_inline(List* pList, const void* pData, int size);
+int List_prepend_inline(List* pList, const void* pData, int size);
+
 #endif
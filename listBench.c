@@ -0,0 +1,239 @@
+#define _GNU_SOURCE // For clock_gettime
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "list.h"
+
+// List micro-benchmark, built once against the prebuilt obj/list.o and once against list.c
+// (see make listbench). Every workload stays within the old object's 100 heads and 1000
+// nodes so both can run it, the burst row shows where each one runs out.
+
+#define DEFAULT_ROUNDS 2000
+#define QUEUE_DEPTH 64              // Messages in flight between two routines
+#define WALK_LENGTH 900
+#define CONCAT_LISTS 50
+#define CONCAT_LENGTH 18
+#define BURST_LIMIT 1000000
+
+#define RECORD_SIZE 32
+
+// What a queued message looks like to a walk, the key is compared on every step
+typedef struct Record {
+    int     key;
+    char    payload[RECORD_SIZE - sizeof(int)];
+} Record;
+
+static volatile uintptr_t sSink;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static bool matchKey(void* pItem, void* pComparisonArg) {
+    return ((Record*)pItem)->key == *(int*)pComparisonArg;
+}
+
+static bool matchNothing(void* pItem, void* pComparisonArg) {
+    return pItem == pComparisonArg;
+}
+
+static void report(const char* label, const char* workload, uint64_t nanoseconds, long operations) {
+    printf("  %-10s %-24s %8.1f ns/op\n", label, workload, (double)nanoseconds / (double)operations);
+}
+
+// The messageQueue pattern: prepend on push, trim on pop, a steady depth in between
+static void benchQueue(const char* label, int rounds) {
+    List* pList = List_create();
+    long operations = (long)rounds * 1000;
+
+    for (int i = 0; i < QUEUE_DEPTH; i++) {
+        List_prepend(pList, (void*)(uintptr_t)(i + 1));
+    }
+
+    uint64_t start = clockNanoseconds();
+    for (long i = 0; i < operations; i++) {
+        List_prepend(pList, (void*)(uintptr_t)(i + 1));
+        sSink += (uintptr_t)List_trim(pList);
+    }
+    report(label, "queue prepend/trim", clockNanoseconds() - start, operations);
+
+    List_free(pList, NULL);
+}
+
+// Full traversals, items are records scattered over the heap the way strdup'd messages are
+static void benchWalk(const char* label, int rounds) {
+    List* pList = List_create();
+    Record* pRecords[WALK_LENGTH];
+    void* pSpacers[WALK_LENGTH];
+
+    for (int i = 0; i < WALK_LENGTH; i++) {
+        pRecords[i] = malloc(sizeof(Record));
+        pSpacers[i] = malloc(64 + (size_t)(i % 7) * 48);
+        pRecords[i]->key = i;
+        List_append(pList, pRecords[i]);
+    }
+
+    int missing = -1;
+    uint64_t start = clockNanoseconds();
+    for (int i = 0; i < rounds; i++) {
+        List_first(pList);
+        sSink += (uintptr_t)List_search(pList, matchKey, &missing);
+    }
+    report(label, "search, record items", clockNanoseconds() - start, (long)rounds * WALK_LENGTH);
+
+    start = clockNanoseconds();
+    for (int i = 0; i < rounds; i++) {
+        List_first(pList);
+        sSink += (uintptr_t)List_search(pList, matchNothing, NULL);
+    }
+    report(label, "search, pointers only", clockNanoseconds() - start, (long)rounds * WALK_LENGTH);
+
+    start = clockNanoseconds();
+    for (int i = 0; i < rounds; i++) {
+        for (void* pItem = List_last(pList); pItem != NULL; pItem = List_prev(pList)) {
+            sSink += (uintptr_t)pItem;
+        }
+    }
+    report(label, "walk backwards", clockNanoseconds() - start, (long)rounds * WALK_LENGTH);
+
+    List_free(pList, NULL);
+    for (int i = 0; i < WALK_LENGTH; i++) {
+        free(pRecords[i]);
+        free(pSpacers[i]);
+    }
+}
+
+#if LIST_INLINE_SIZE >= RECORD_SIZE
+// The same walk with the records copied into the nodes
+static void benchWalkInline(const char* label, int rounds) {
+    List* pList = List_create();
+    Record record;
+    memset(&record, 0, sizeof(record));
+
+    for (int i = 0; i < WALK_LENGTH; i++) {
+        record.key = i;
+        List_append_inline(pList, &record, sizeof(record));
+    }
+
+    int missing = -1;
+    uint64_t start = clockNanoseconds();
+    for (int i = 0; i < rounds; i++) {
+        List_first(pList);
+        sSink += (uintptr_t)List_search(pList, matchKey, &missing);
+    }
+    report(label, "search, inline records", clockNanoseconds() - start, (long)rounds * WALK_LENGTH);
+
+    List_free(pList, NULL);
+}
+#endif
+
+// Inserts and removes around a moving cursor, nodes get recycled out of order
+static void benchChurn(const char* label, int rounds) {
+    List* pList = List_create();
+    long operations = (long)rounds * 1000;
+    unsigned seed = 1;
+
+    for (int i = 0; i < WALK_LENGTH / 2; i++) {
+        List_append(pList, (void*)(uintptr_t)(i + 1));
+    }
+    List_first(pList);
+
+    uint64_t start = clockNanoseconds();
+    for (long i = 0; i < operations; i++) {
+        seed = seed * 1103515245u + 12345u;
+        if (List_curr(pList) == NULL) {
+            List_first(pList);
+        }
+
+        int choice = (int)(seed >> 16) % 4;
+        if (choice == 0 && List_count(pList) < WALK_LENGTH) {
+            List_insert_after(pList, (void*)(uintptr_t)(i + 1));
+        } else if (choice == 1 && List_count(pList) < WALK_LENGTH) {
+            List_insert_before(pList, (void*)(uintptr_t)(i + 1));
+        } else if (choice == 2 && List_count(pList) > 1) {
+            sSink += (uintptr_t)List_remove(pList);
+        } else {
+            sSink += (uintptr_t)List_next(pList);
+        }
+    }
+    report(label, "cursor insert/remove", clockNanoseconds() - start, operations);
+
+    List_free(pList, NULL);
+}
+
+static void benchConcat(const char* label, int rounds) {
+    List* pLists[CONCAT_LISTS];
+
+    uint64_t start = clockNanoseconds();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < CONCAT_LISTS; i++) {
+            pLists[i] = List_create();
+            for (int j = 0; j < CONCAT_LENGTH; j++) {
+                List_append(pLists[i], (void*)(uintptr_t)(j + 1));
+            }
+        }
+        for (int i = 1; i < CONCAT_LISTS; i++) {
+            List_concat(pLists[0], pLists[i]);
+        }
+        sSink += (uintptr_t)List_count(pLists[0]);
+        List_free(pLists[0], NULL);
+    }
+    report(label, "create/append/concat", clockNanoseconds() - start, (long)rounds * CONCAT_LISTS * CONCAT_LENGTH);
+}
+
+// How many messages a sudden backlog can hold before appends fail
+static void benchBurst(const char* label) {
+    List* pList = List_create();
+
+    int held = 0;
+    while (held < BURST_LIMIT && List_append(pList, (void*)(uintptr_t)(held + 1)) == LIST_SUCCESS) {
+        held++;
+    }
+    printf("  %-10s %-24s %8d%s\n", label, "burst capacity", held, held == BURST_LIMIT ? " (limit of the test)" : "");
+
+    List_free(pList, NULL);
+}
+
+static void printUsage(const char* program) {
+    fprintf(stderr, "Usage: %s [-n rounds] [-l label]\n", program);
+}
+
+//===================================================================================
+// Main
+//===================================================================================
+
+int main(int argc, char* argv[]) {
+    const char* label = "list";
+    int rounds = DEFAULT_ROUNDS;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:l:h")) != -1) {
+        if (option == 'n') {
+            rounds = atoi(optarg);
+        } else if (option == 'l') {
+            label = optarg;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (rounds <= 0) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    benchQueue(label, rounds);
+    benchWalk(label, rounds);
+#if LIST_INLINE_SIZE >= RECORD_SIZE
+    benchWalkInline(label, rounds);
+#endif
+    benchChurn(label, rounds);
+    benchConcat(label, rounds);
+    benchBurst(label);
+    return EXIT_SUCCESS;
+}
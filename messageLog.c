@@ -0,0 +1,723 @@
+#define _GNU_SOURCE // For pread and fdatasync
+#include "messageLog.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ERROR -1
+
+#define LOG_ALIGN(length) (((size_t)(length) + 7u) & ~(size_t)7u)
+
+_Static_assert(sizeof(LogRecord) % 8 == 0, "records must keep the payload 8-byte aligned");
+
+// A message as the tap saw it, copied so no pool slot waits on the writer
+typedef struct LogTap {
+    uint32_t  length;
+    int       peer;         // Message::peer, resolved to an address by the writer
+    uint16_t  fragment;
+    uint16_t  flags;
+    uint8_t   payload[];
+} LogTap;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static uint64_t wallMicroseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+static uint32_t checksumBytes(uint32_t hash, const void* pBytes, size_t length) {
+    const uint8_t* pByte = pBytes;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ pByte[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Everything after magic up to the checksum, then the payload
+static uint32_t recordChecksum(const LogRecord* pRecord, const void* pPayload) {
+    size_t start = offsetof(LogRecord, length);
+    uint32_t hash = checksumBytes(2166136261u, (const uint8_t*)pRecord + start, offsetof(LogRecord, checksum) - start);
+    return checksumBytes(hash, pPayload, pRecord->length);
+}
+
+// The record at offset if it is complete, intact and the one expected there
+static const LogRecord* recordAt(const uint8_t* pBase, size_t size, size_t offset, uint64_t expected) {
+    if (pBase == NULL || offset + sizeof(LogRecord) > size) {
+        return NULL;
+    }
+
+    const LogRecord* pRecord = (const LogRecord*)(pBase + offset);
+    if (pRecord->magic != LOG_MAGIC || pRecord->sequence != expected
+        || pRecord->length > size - offset - sizeof(LogRecord)
+        || pRecord->checksum != recordChecksum(pRecord, pRecord + 1)) {
+        return NULL;
+    }
+    return pRecord;
+}
+
+static void segmentPath(char* pPath, size_t size, const char* directory, uint64_t first, const char* suffix) {
+    snprintf(pPath, size, "%s/%020" PRIu64 "%s", directory, first, suffix);
+}
+
+static int compareSequences(const void* pLeft, const void* pRight) {
+    uint64_t left = *(const uint64_t*)pLeft;
+    uint64_t right = *(const uint64_t*)pRight;
+    return (left > right) - (left < right);
+}
+
+// First sequences of the directory's segments in ascending order, -1 when it can't be read
+static int listSegments(const char* directory, uint64_t** ppSegments) {
+    *ppSegments = NULL;
+    DIR* pDirectory = opendir(directory);
+    if (pDirectory == NULL) {
+        return ERROR;
+    }
+
+    int count = 0;
+    int capacity = 0;
+    struct dirent* pEntry;
+    while ((pEntry = readdir(pDirectory)) != NULL) {
+        uint64_t first;
+        char suffix[8];
+        if (strlen(pEntry->d_name) != 24 || sscanf(pEntry->d_name, "%20" SCNu64 "%7s", &first, suffix) != 2
+            || strcmp(suffix, ".log") != 0) {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            uint64_t* pGrown = realloc(*ppSegments, (size_t)capacity * sizeof(uint64_t));
+            if (pGrown == NULL) {
+                perror("Log segment list allocation failed");
+                exit(EXIT_FAILURE);
+            }
+            *ppSegments = pGrown;
+        }
+        (*ppSegments)[count++] = first;
+    }
+
+    closedir(pDirectory);
+    qsort(*ppSegments, (size_t)count, sizeof(uint64_t), compareSequences);
+    return count;
+}
+
+static void writeAll(int fd, const void* pBytes, size_t length) {
+    const uint8_t* pByte = pBytes;
+    while (length > 0) {
+        ssize_t written = write(fd, pByte, length);
+        if (written == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Log index write failed");
+            return;
+        }
+        pByte += written;
+        length -= (size_t)written;
+    }
+}
+
+//===================================================================================
+// Writer
+//===================================================================================
+
+static void openSegment(MessageLog* pLog) {
+    char path[PATH_MAX + 32];
+    pLog->firstSequence = pLog->nextSequence;
+
+    segmentPath(path, sizeof(path), pLog->directory, pLog->firstSequence, ".log");
+    pLog->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (pLog->fd == ERROR) {
+        perror("Could not create log segment");
+        exit(EXIT_FAILURE);
+    }
+
+    // Sparse until written, a zeroed header is where the segment ends
+    if (ftruncate(pLog->fd, LOG_SEGMENT_SIZE) == ERROR) {
+        perror("Could not size log segment");
+        exit(EXIT_FAILURE);
+    }
+
+    pLog->pBase = mmap(NULL, LOG_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, pLog->fd, 0);
+    if (pLog->pBase == MAP_FAILED) {
+        perror("Could not map log segment");
+        exit(EXIT_FAILURE);
+    }
+
+    segmentPath(path, sizeof(path), pLog->directory, pLog->firstSequence, ".idx");
+    pLog->indexFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (pLog->indexFd == ERROR) {
+        perror("Could not create log index");
+        exit(EXIT_FAILURE);
+    }
+
+    pLog->used = 0;
+    pLog->written = 0;
+    pLog->committed = 0;
+    pLog->pendingCount = 0;
+}
+
+// Everything in it reaches the disk and the file shrinks to its records, an empty one goes away
+static void sealSegment(MessageLog* pLog) {
+    if (pLog->used > 0 && msync(pLog->pBase, pLog->used, MS_SYNC) == ERROR) {
+        perror("msync failed");
+    }
+    munmap(pLog->pBase, LOG_SEGMENT_SIZE);
+    pLog->pBase = NULL;
+
+    if (ftruncate(pLog->fd, (off_t)pLog->used) == ERROR || fsync(pLog->fd) == ERROR) {
+        perror("Could not trim log segment");
+    }
+    fdatasync(pLog->indexFd);
+    close(pLog->fd);
+    close(pLog->indexFd);
+
+    if (pLog->used == 0) {
+        char path[PATH_MAX + 32];
+        segmentPath(path, sizeof(path), pLog->directory, pLog->firstSequence, ".log");
+        unlink(path);
+        segmentPath(path, sizeof(path), pLog->directory, pLog->firstSequence, ".idx");
+        unlink(path);
+    }
+}
+
+static void flushIndex(MessageLog* pLog) {
+    if (pLog->pendingCount > 0) {
+        writeAll(pLog->indexFd, pLog->pending, (size_t)pLog->pendingCount * sizeof(LogIndexEntry));
+        pLog->pendingCount = 0;
+    }
+}
+
+// Start over in a new segment once the committer is out of the old mapping
+static void rollSegment(MessageLog* pLog) {
+    flushIndex(pLog);
+
+    pthread_mutex_lock(&pLog->mutex);
+    while (pLog->syncing) {
+        pthread_cond_wait(&pLog->changed, &pLog->mutex);
+    }
+    sealSegment(pLog);
+    openSegment(pLog);
+    pthread_mutex_unlock(&pLog->mutex);
+}
+
+static void appendRecord(MessageLog* pLog, const LogTap* pTap, uint64_t timestamp) {
+    size_t length = pTap->length;
+    if (pLog->used + sizeof(LogRecord) + LOG_ALIGN(length) > LOG_SEGMENT_SIZE) {
+        rollSegment(pLog);
+    }
+
+    LogRecord* pRecord = (LogRecord*)(pLog->pBase + pLog->used);
+    uint8_t* pPayload = (uint8_t*)(pRecord + 1);
+    memcpy(pPayload, pTap->payload, length);
+
+    pRecord->length = (uint32_t)length;
+    pRecord->sequence = pLog->nextSequence;
+    pRecord->timestamp = timestamp;
+    pRecord->peerAddress = 0;
+    pRecord->peerPort = 0;
+    pRecord->fragment = pTap->fragment;
+    pRecord->flags = pTap->flags;
+    pRecord->reserved = 0;
+    if (!(pTap->flags & LOG_FLAG_SENT) && pTap->peer >= 0 && pTap->peer < pLog->peerCount) {
+        pRecord->peerAddress = pLog->pPeers[pTap->peer].sin_addr.s_addr;
+        pRecord->peerPort = ntohs(pLog->pPeers[pTap->peer].sin_port);
+    }
+    pRecord->checksum = recordChecksum(pRecord, pPayload);
+
+    // Last, recovery only trusts records that carry it
+    atomic_thread_fence(memory_order_release);
+    pRecord->magic = LOG_MAGIC;
+
+    if ((pLog->nextSequence - pLog->firstSequence) % LOG_INDEX_INTERVAL == 0) {
+        LogIndexEntry* pEntry = &pLog->pending[pLog->pendingCount++];
+        pEntry->sequence = pLog->nextSequence;
+        pEntry->timestamp = timestamp;
+        pEntry->offset = pLog->used;
+    }
+
+    pLog->used += sizeof(LogRecord) + LOG_ALIGN(length);
+    pLog->nextSequence++;
+}
+
+static void* writerRoutine(void* pArgs) {
+    MessageLog* pLog = pArgs;
+    LogTap* batch[LOG_WRITE_BATCH];
+
+    while (1) {
+        size_t count = mpmcQueuePopBatch(&pLog->tap, (void**)batch, LOG_WRITE_BATCH);
+        if (count == 0) {
+            // Closed, what the routines pushed before that still goes in
+            count = mpmcQueueTryPopBatch(&pLog->tap, (void**)batch, LOG_WRITE_BATCH);
+            if (count == 0) {
+                break;
+            }
+        }
+
+        // One clock read per batch, held back if the wall clock steps backwards
+        uint64_t timestamp = wallMicroseconds();
+        if (timestamp < pLog->lastTimestamp) {
+            timestamp = pLog->lastTimestamp;
+        }
+        pLog->lastTimestamp = timestamp;
+
+        for (size_t i = 0; i < count; i++) {
+            appendRecord(pLog, batch[i], timestamp);
+            free(batch[i]);
+        }
+        flushIndex(pLog);
+
+        pthread_mutex_lock(&pLog->mutex);
+        pLog->written = pLog->used;
+        pthread_cond_broadcast(&pLog->changed);
+        pthread_mutex_unlock(&pLog->mutex);
+    }
+    return NULL;
+}
+
+// Group commit, one msync covers everything written while the previous one ran
+static void* committerRoutine(void* pArgs) {
+    MessageLog* pLog = pArgs;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+    pthread_mutex_lock(&pLog->mutex);
+    while (1) {
+        while (pLog->written == pLog->committed && !pLog->stopping) {
+            pthread_cond_wait(&pLog->changed, &pLog->mutex);
+        }
+        if (pLog->written == pLog->committed) {
+            break;
+        }
+
+        uint8_t* pBase = pLog->pBase;
+        size_t from = pLog->committed & ~(size_t)(page - 1);
+        size_t to = pLog->written;
+        pLog->syncing = true;
+        pthread_mutex_unlock(&pLog->mutex);
+
+        if (msync(pBase + from, to - from, MS_SYNC) == ERROR) {
+            perror("msync failed");
+        }
+
+        pthread_mutex_lock(&pLog->mutex);
+        pLog->syncing = false;
+        pLog->committed = to;
+        pthread_cond_broadcast(&pLog->changed);
+    }
+    pthread_mutex_unlock(&pLog->mutex);
+    return NULL;
+}
+
+// Cut the last segment back to its intact records and rebuild its index, a crash can
+// leave both behind the records. Returns where the sequence continues.
+static uint64_t recoverSegment(MessageLog* pLog, uint64_t first) {
+    char path[PATH_MAX + 32];
+    segmentPath(path, sizeof(path), pLog->directory, first, ".log");
+    int fd = open(path, O_RDWR);
+    if (fd == ERROR) {
+        perror("Could not open log segment");
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) == ERROR) {
+        perror("Could not stat log segment");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t size = (size_t)status.st_size;
+    const uint8_t* pBase = NULL;
+    if (size > 0) {
+        pBase = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (pBase == MAP_FAILED) {
+            perror("Could not map log segment");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    segmentPath(path, sizeof(path), pLog->directory, first, ".idx");
+    int indexFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (indexFd == ERROR) {
+        perror("Could not create log index");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t offset = 0;
+    uint64_t sequence = first;
+    const LogRecord* pRecord;
+    while ((pRecord = recordAt(pBase, size, offset, sequence)) != NULL) {
+        if ((sequence - first) % LOG_INDEX_INTERVAL == 0) {
+            LogIndexEntry entry = { .sequence = sequence, .timestamp = pRecord->timestamp, .offset = offset };
+            writeAll(indexFd, &entry, sizeof(entry));
+        }
+        pLog->lastTimestamp = pRecord->timestamp;
+        offset += sizeof(LogRecord) + LOG_ALIGN(pRecord->length);
+        sequence++;
+    }
+
+    if (pBase != NULL) {
+        munmap((void*)pBase, size);
+    }
+    if (ftruncate(fd, (off_t)offset) == ERROR || fsync(fd) == ERROR || fsync(indexFd) == ERROR) {
+        perror("Could not trim log segment");
+    }
+    close(fd);
+    close(indexFd);
+
+    // Nothing survived, the next run's segment takes over its name
+    if (offset == 0) {
+        unlink(path);
+        segmentPath(path, sizeof(path), pLog->directory, first, ".log");
+        unlink(path);
+    }
+    return sequence;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void messageLogOpen(MessageLog* pLog, const char* directory) {
+    assert(pLog != NULL && directory != NULL);
+
+    if (strlen(directory) >= sizeof(pLog->directory)) {
+        fprintf(stderr, "Log directory path is too long\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(pLog->directory, directory);
+
+    if (mkdir(directory, 0755) == ERROR && errno != EEXIST) {
+        perror("Could not create log directory");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t* pSegments;
+    int count = listSegments(directory, &pSegments);
+    if (count == ERROR) {
+        perror("Could not read log directory");
+        exit(EXIT_FAILURE);
+    }
+
+    // Earlier segments were sealed before the next one started, only the last can be torn
+    pLog->lastTimestamp = 0;
+    pLog->nextSequence = count > 0 ? recoverSegment(pLog, pSegments[count - 1]) : 1;
+    free(pSegments);
+
+    pLog->pPeers = NULL;
+    pLog->peerCount = 0;
+    pLog->syncing = false;
+    pLog->stopping = false;
+    atomic_init(&pLog->dropped, 0);
+    mpmcQueueInitialize(&pLog->tap, LOG_TAP_CAPACITY);
+    pthread_mutex_init(&pLog->mutex, NULL);
+    pthread_cond_init(&pLog->changed, NULL);
+
+    openSegment(pLog);
+
+    if (pthread_create(&pLog->writer, NULL, writerRoutine, pLog) != 0
+        || pthread_create(&pLog->committer, NULL, committerRoutine, pLog) != 0) {
+        perror("Could not start the log threads");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void messageLogClose(MessageLog* pLog) {
+    assert(pLog != NULL);
+
+    mpmcQueueClose(&pLog->tap);
+    pthread_join(pLog->writer, NULL);
+
+    pthread_mutex_lock(&pLog->mutex);
+    pLog->stopping = true;
+    pthread_cond_broadcast(&pLog->changed);
+    pthread_mutex_unlock(&pLog->mutex);
+    pthread_join(pLog->committer, NULL);
+
+    sealSegment(pLog);
+
+    uint64_t dropped = atomic_load(&pLog->dropped);
+    if (dropped > 0) {
+        fprintf(stderr, "%" PRIu64 " messages were not logged, the writer fell behind\n", dropped);
+    }
+
+    mpmcQueueDestroy(&pLog->tap);
+    pthread_mutex_destroy(&pLog->mutex);
+    pthread_cond_destroy(&pLog->changed);
+    free(pLog->pPeers);
+    pLog->pPeers = NULL;
+}
+
+void messageLogSetPeers(MessageLog* pLog, const struct sockaddr_in* pAddresses, int count) {
+    assert(pLog != NULL && count >= 0);
+
+    free(pLog->pPeers);
+    pLog->pPeers = malloc((size_t)(count > 0 ? count : 1) * sizeof(struct sockaddr_in));
+    if (pLog->pPeers == NULL) {
+        perror("Log peer allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(pLog->pPeers, pAddresses, (size_t)count * sizeof(struct sockaddr_in));
+    pLog->peerCount = count;
+}
+
+// Reassembled messages are chains of slots, they become one record. NULL when out of memory.
+static LogTap* copyMessage(const Message* pMessage, bool sent) {
+    size_t length = 0;
+    const Message* pLast = pMessage;
+    for (const Message* pSlot = pMessage; pSlot != NULL; pSlot = pSlot->pContinuation) {
+        length += pSlot->length;
+        pLast = pSlot;
+    }
+
+    // Nothing the reassembly hands out comes close, but a record must fit a segment
+    size_t limit = LOG_SEGMENT_SIZE - sizeof(LogRecord);
+    if (length > limit) {
+        length = limit;
+    }
+
+    LogTap* pTap = malloc(sizeof(LogTap) + length);
+    if (pTap == NULL) {
+        return NULL;
+    }
+
+    size_t copied = 0;
+    for (const Message* pSlot = pMessage; pSlot != NULL && copied < length; pSlot = pSlot->pContinuation) {
+        size_t piece = pSlot->length < length - copied ? pSlot->length : length - copied;
+        memcpy(pTap->payload + copied, pSlot->pData, piece);
+        copied += piece;
+    }
+
+    pTap->length = (uint32_t)length;
+    pTap->peer = pMessage->peer;
+    pTap->fragment = pMessage->fragment;
+    pTap->flags = (uint16_t)((sent ? LOG_FLAG_SENT : 0) | (pLast->partial ? LOG_FLAG_PARTIAL : 0)
+                             | (pMessage->bundle ? LOG_FLAG_BUNDLE : 0));
+    return pTap;
+}
+
+void messageLogTap(MessageLog* pLog, Message** ppMessages, int count, bool sent) {
+    LogTap* taps[LOG_WRITE_BATCH];
+
+    for (int from = 0; from < count; from += LOG_WRITE_BATCH) {
+        int to = count - from < LOG_WRITE_BATCH ? count : from + LOG_WRITE_BATCH;
+        size_t copied = 0;
+        for (int i = from; i < to; i++) {
+            LogTap* pTap = copyMessage(ppMessages[i], sent);
+            if (pTap != NULL) {
+                taps[copied++] = pTap;
+            }
+        }
+
+        // A full tap means the writer is stuck, the conversation doesn't wait for it
+        size_t pushed = mpmcQueueTryPushBatch(&pLog->tap, (void**)taps, copied);
+        for (size_t i = pushed; i < copied; i++) {
+            free(taps[i]);
+        }
+        if (pushed < (size_t)(to - from)) {
+            atomic_fetch_add_explicit(&pLog->dropped, (size_t)(to - from) - pushed, memory_order_relaxed);
+        }
+    }
+}
+
+//===================================================================================
+// Reader
+//===================================================================================
+
+static bool mapSegment(LogReader* pReader, int segment) {
+    if (pReader->pBase != NULL) {
+        munmap((void*)pReader->pBase, pReader->size);
+        pReader->pBase = NULL;
+    }
+
+    pReader->current = segment;
+    pReader->size = 0;
+    pReader->offset = 0;
+    pReader->expected = pReader->pSegments[segment];
+
+    char path[PATH_MAX + 32];
+    segmentPath(path, sizeof(path), pReader->directory, pReader->pSegments[segment], ".log");
+    int fd = open(path, O_RDONLY);
+    if (fd == ERROR) {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        void* pBase = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (pBase != MAP_FAILED) {
+            pReader->pBase = pBase;
+            pReader->size = (size_t)status.st_size;
+        }
+    }
+    close(fd);
+    return pReader->pBase != NULL;
+}
+
+// The segment's index, NULL when it has none
+static LogIndexEntry* loadIndex(const LogReader* pReader, int segment, size_t* pCount) {
+    *pCount = 0;
+    char path[PATH_MAX + 32];
+    segmentPath(path, sizeof(path), pReader->directory, pReader->pSegments[segment], ".idx");
+    int fd = open(path, O_RDONLY);
+    if (fd == ERROR) {
+        return NULL;
+    }
+
+    struct stat status;
+    LogIndexEntry* pEntries = NULL;
+    if (fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(LogIndexEntry)) {
+        size_t count = (size_t)status.st_size / sizeof(LogIndexEntry);
+        pEntries = malloc(count * sizeof(LogIndexEntry));
+        if (pEntries != NULL && read(fd, pEntries, count * sizeof(LogIndexEntry)) == (ssize_t)(count * sizeof(LogIndexEntry))) {
+            *pCount = count;
+        } else {
+            free(pEntries);
+            pEntries = NULL;
+        }
+    }
+    close(fd);
+    return pEntries;
+}
+
+// Jump to the last index entry that passes test, or stay at the segment start
+static void seekIndex(LogReader* pReader, bool (*pBefore)(const LogIndexEntry*, uint64_t), uint64_t target) {
+    size_t count;
+    LogIndexEntry* pEntries = loadIndex(pReader, pReader->current, &count);
+
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (pBefore(&pEntries[middle], target)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    // A stale index only costs the jump
+    if (low > 0 && recordAt(pReader->pBase, pReader->size, pEntries[low - 1].offset, pEntries[low - 1].sequence) != NULL) {
+        pReader->offset = pEntries[low - 1].offset;
+        pReader->expected = pEntries[low - 1].sequence;
+    }
+    free(pEntries);
+}
+
+static bool sequenceBefore(const LogIndexEntry* pEntry, uint64_t sequence) {
+    return pEntry->sequence <= sequence;
+}
+
+static bool timeBefore(const LogIndexEntry* pEntry, uint64_t timestamp) {
+    return pEntry->timestamp < timestamp;
+}
+
+// The next record, moving on to the following segment where this one ends
+static const LogRecord* peekRecord(LogReader* pReader) {
+    while (1) {
+        const LogRecord* pRecord = recordAt(pReader->pBase, pReader->size, pReader->offset, pReader->expected);
+        if (pRecord != NULL) {
+            return pRecord;
+        }
+        if (pReader->current + 1 >= pReader->segmentCount) {
+            return NULL;
+        }
+        mapSegment(pReader, pReader->current + 1);
+    }
+}
+
+static uint64_t firstTimestamp(const LogReader* pReader, int segment) {
+    char path[PATH_MAX + 32];
+    segmentPath(path, sizeof(path), pReader->directory, pReader->pSegments[segment], ".log");
+    int fd = open(path, O_RDONLY);
+    if (fd == ERROR) {
+        return UINT64_MAX;
+    }
+
+    LogRecord record;
+    bool valid = pread(fd, &record, sizeof(record), 0) == (ssize_t)sizeof(record) && record.magic == LOG_MAGIC;
+    close(fd);
+    return valid ? record.timestamp : UINT64_MAX;
+}
+
+bool logReaderOpen(LogReader* pReader, const char* directory) {
+    assert(pReader != NULL && directory != NULL);
+
+    if (strlen(directory) >= sizeof(pReader->directory)) {
+        return false;
+    }
+    strcpy(pReader->directory, directory);
+    pReader->pBase = NULL;
+    pReader->segmentCount = listSegments(directory, &pReader->pSegments);
+    if (pReader->segmentCount <= 0) {
+        free(pReader->pSegments);
+        pReader->pSegments = NULL;
+        return false;
+    }
+
+    mapSegment(pReader, 0);
+    return true;
+}
+
+void logReaderClose(LogReader* pReader) {
+    if (pReader->pBase != NULL) {
+        munmap((void*)pReader->pBase, pReader->size);
+        pReader->pBase = NULL;
+    }
+    free(pReader->pSegments);
+    pReader->pSegments = NULL;
+}
+
+bool logReaderSeekSequence(LogReader* pReader, uint64_t sequence) {
+    int segment = 0;
+    while (segment + 1 < pReader->segmentCount && pReader->pSegments[segment + 1] <= sequence) {
+        segment++;
+    }
+
+    mapSegment(pReader, segment);
+    seekIndex(pReader, sequenceBefore, sequence);
+
+    const LogRecord* pRecord;
+    while ((pRecord = peekRecord(pReader)) != NULL && pRecord->sequence < sequence) {
+        logReaderNext(pReader);
+    }
+    return pRecord != NULL;
+}
+
+bool logReaderSeekTime(LogReader* pReader, uint64_t timestamp) {
+    // Timestamps never go backwards, so neither do the segments' first ones
+    int segment = 0;
+    while (segment + 1 < pReader->segmentCount && firstTimestamp(pReader, segment + 1) < timestamp) {
+        segment++;
+    }
+
+    mapSegment(pReader, segment);
+    seekIndex(pReader, timeBefore, timestamp);
+
+    const LogRecord* pRecord;
+    while ((pRecord = peekRecord(pReader)) != NULL && pRecord->timestamp < timestamp) {
+        logReaderNext(pReader);
+    }
+    return pRecord != NULL;
+}
+
+const LogRecord* logReaderNext(LogReader* pReader) {
+    const LogRecord* pRecord = peekRecord(pReader);
+    if (pRecord != NULL) {
+        pReader->offset += sizeof(LogRecord) + LOG_ALIGN(pRecord->length);
+        pReader->expected++;
+    }
+    return pRecord;
+}
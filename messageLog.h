@@ -0,0 +1,128 @@
+#ifndef MESSAGE_LOG_H_
+#define MESSAGE_LOG_H_
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "messagePool.h"
+#include "mpmcQueue.h"
+
+// Bytes per segment file, the next record that doesn't fit starts a new one
+#ifndef LOG_SEGMENT_SIZE
+#define LOG_SEGMENT_SIZE (16u * 1024 * 1024)
+#endif
+
+// Sparse index, one entry per this many records
+#define LOG_INDEX_INTERVAL 64
+
+// Copies waiting for the writer, a power of two well above both pools so taps never
+// find it full unless the writer is stuck
+#define LOG_TAP_CAPACITY 4096
+
+// Records the writer copies per pass, everything it copied goes into the next commit
+#define LOG_WRITE_BATCH 256
+
+#define LOG_MAGIC 0x4c4b5453u
+
+#define LOG_FLAG_SENT     0x01  // Typed here, otherwise received from peerAddress
+#define LOG_FLAG_PARTIAL  0x02  // More of the message follows in a later record
+#define LOG_FLAG_BUNDLE   0x04  // Payload holds bundle records
+
+// Segment header on disk, 8-byte aligned and followed by the payload padded to 8.
+// A zeroed header ends the segment.
+typedef struct LogRecord {
+    uint32_t  magic;        // Stored last, a record without it was cut off by a crash
+    uint32_t  length;       // Payload bytes
+    uint64_t  sequence;     // Consecutive across segments and runs
+    uint64_t  timestamp;    // Microseconds since the epoch when written, never goes backwards
+    uint32_t  peerAddress;  // Network order, 0 for what we sent to every peer
+    uint16_t  peerPort;
+    uint16_t  fragment;
+    uint16_t  flags;
+    uint16_t  reserved;
+    uint32_t  checksum;     // FNV-1a over the header fields after magic and the payload
+} LogRecord;
+
+// .idx next to each segment, where every LOG_INDEX_INTERVAL-th record starts
+typedef struct LogIndexEntry {
+    uint64_t  sequence;
+    uint64_t  timestamp;
+    uint64_t  offset;
+} LogIndexEntry;
+
+// Append-only log of everything sent and delivered, split into segments named after their
+// first sequence number. The send and receive paths copy each message onto the tap, so a
+// slow disk never holds pool slots (or the receive credit they back). A writer thread moves
+// the copies into the mapped segment, and a committer thread msyncs whatever the writer got done while the last msync ran.
+typedef struct MessageLog {
+    char                directory[PATH_MAX];
+    MpmcQueue           tap;
+    atomic_uint_fast64_t dropped;       // Tap was full, the message went unlogged
+    struct sockaddr_in* pPeers;         // Message::peer to address, set by udpInitialize
+    int                 peerCount;
+    pthread_t           writer;
+    pthread_t           committer;
+
+    // Writer only
+    int                 fd;
+    int                 indexFd;
+    uint8_t*            pBase;
+    size_t              used;
+    uint64_t            firstSequence;  // Of the mapped segment, names its files
+    uint64_t            nextSequence;
+    uint64_t            lastTimestamp;
+    LogIndexEntry       pending[LOG_WRITE_BATCH / LOG_INDEX_INTERVAL + 1];
+    int                 pendingCount;
+
+    // Writer and committer
+    pthread_mutex_t     mutex;
+    pthread_cond_t      changed;
+    size_t              written;        // Bytes of the mapped segment ready to commit
+    size_t              committed;
+    bool                syncing;        // The committer is in msync, the mapping must stay
+    bool                stopping;
+} MessageLog;
+
+// Recover the directory's last segment (a crash leaves a torn tail that is cut off here),
+// start a fresh segment and both threads. Failures are fatal like other setup.
+void messageLogOpen(MessageLog* pLog, const char* directory);
+
+// Drain the tap, commit, trim the segment to what it holds and stop the threads
+void messageLogClose(MessageLog* pLog);
+
+// Addresses for Message::peer, copied
+void messageLogSetPeers(MessageLog* pLog, const struct sockaddr_in* pAddresses, int count);
+
+// Copy messages for the writer, the caller keeps its references. Never blocks.
+void messageLogTap(MessageLog* pLog, Message** ppMessages, int count, bool sent);
+
+// Walks records in order across segments, each one checked before it is handed out
+typedef struct LogReader {
+    char                directory[PATH_MAX];
+    uint64_t*           pSegments;      // First sequence of each, ascending
+    int                 segmentCount;
+    int                 current;
+    const uint8_t*      pBase;
+    size_t              size;
+    size_t              offset;
+    uint64_t            expected;       // Sequence the next record must carry
+} LogReader;
+
+// False when the directory holds no log
+bool logReaderOpen(LogReader* pReader, const char* directory);
+void logReaderClose(LogReader* pReader);
+
+// Position on the first record at or after sequence/timestamp through the segment names
+// and their index, false when there is none
+bool logReaderSeekSequence(LogReader* pReader, uint64_t sequence);
+bool logReaderSeekTime(LogReader* pReader, uint64_t timestamp);
+
+// The record and its payload right behind it, valid until the next call. NULL at the end.
+const LogRecord* logReaderNext(LogReader* pReader);
+
+#endif
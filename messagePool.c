@@ -0,0 +1,305 @@
+#define _GNU_SOURCE // For pthread_condattr_setclock
+#include "messagePool.h"
+#include "lineReader.h"
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+// Hand out a slot holding one reference
+static Message* prepareSlot(Message* pMessage) {
+    if (pMessage != NULL) {
+        pMessage->pNext = NULL;
+        pMessage->length = 0;
+        pMessage->peer = -1;
+        pMessage->messageId = 0;
+        pMessage->fragment = 0;
+        pMessage->partial = false;
+        pMessage->bundle = false;
+        pMessage->outgoing = false;
+        pMessage->pContinuation = NULL;
+        pMessage->pData = pMessage->data;
+        pMessage->pChunk = NULL;
+        atomic_store_explicit(&pMessage->references, 1, memory_order_relaxed);
+    }
+    return pMessage;
+}
+
+// Thread a slot and the fragments chained behind it onto pFirst, returns how many
+static size_t collectSlot(Message* pMessage, Message** ppFirst, Message** ppLast) {
+    size_t freed = 0;
+    while (pMessage != NULL) {
+        Message* pContinuation = pMessage->pContinuation;
+        if (pMessage->pChunk != NULL) {
+            lineChunkRelease(pMessage->pChunk);
+            pMessage->pChunk = NULL;
+        }
+        pMessage->pNext = *ppFirst;
+        *ppFirst = pMessage;
+        if (*ppLast == NULL) {
+            *ppLast = pMessage;
+        }
+        freed++;
+        pMessage = pContinuation;
+    }
+    return freed;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void messagePoolInitialize(MessagePool* pPool, size_t capacity) {
+    assert(pPool != NULL);
+    assert(capacity > 0);
+
+    // One allocation for the lifetime of the process
+    pPool->pSlab = malloc(capacity * sizeof(Message));
+    if (pPool->pSlab == NULL) {
+        perror("Message pool allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Thread every slot onto the free list
+    pPool->pFreeList = NULL;
+    for (size_t i = capacity; i > 0; i--) {
+        pPool->pSlab[i - 1].pPool = pPool;
+        pPool->pSlab[i - 1].pNext = pPool->pFreeList;
+        pPool->pFreeList = &pPool->pSlab[i - 1];
+    }
+
+    pPool->capacity = capacity;
+    pPool->available = capacity;
+    pPool->waiters = 0;
+    pPool->closed = false;
+    pthread_mutex_init(&pPool->mutex, NULL);
+
+    // Timed waits count on the monotonic clock, a wall clock step can't stretch them
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&pPool->slotReleased, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+void messagePoolDestroy(MessagePool* pPool) {
+    assert(pPool != NULL);
+
+    // Slots still sitting in queues go down with the slab
+    free(pPool->pSlab);
+    pPool->pSlab = NULL;
+    pPool->pFreeList = NULL;
+    pthread_mutex_destroy(&pPool->mutex);
+    pthread_cond_destroy(&pPool->slotReleased);
+}
+
+Message* messagePoolAcquire(MessagePool* pPool) {
+    Message* pMessage = NULL;
+
+    pthread_mutex_lock(&pPool->mutex);
+
+    // Exhausted, wait for a consumer to hand a slot back
+    while (pPool->pFreeList == NULL && !pPool->closed) {
+        pPool->waiters++;
+        pthread_cond_wait(&pPool->slotReleased, &pPool->mutex);
+        pPool->waiters--;
+    }
+
+    if (!pPool->closed) {
+        pMessage = pPool->pFreeList;
+        pPool->pFreeList = pMessage->pNext;
+        pPool->available--;
+    }
+
+    pthread_mutex_unlock(&pPool->mutex);
+    return prepareSlot(pMessage);
+}
+
+Message* messagePoolAcquireTimed(MessagePool* pPool, int milliseconds) {
+    Message* pMessage = NULL;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += milliseconds / 1000;
+    deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&pPool->mutex);
+
+    int status = 0;
+    while (pPool->pFreeList == NULL && !pPool->closed && status != ETIMEDOUT) {
+        pPool->waiters++;
+        status = pthread_cond_timedwait(&pPool->slotReleased, &pPool->mutex, &deadline);
+        pPool->waiters--;
+    }
+
+    if (pPool->pFreeList != NULL && !pPool->closed) {
+        pMessage = pPool->pFreeList;
+        pPool->pFreeList = pMessage->pNext;
+        pPool->available--;
+    }
+
+    pthread_mutex_unlock(&pPool->mutex);
+    return prepareSlot(pMessage);
+}
+
+Message* messagePoolTryAcquire(MessagePool* pPool) {
+    Message* pMessage = NULL;
+
+    pthread_mutex_lock(&pPool->mutex);
+
+    if (pPool->pFreeList != NULL && !pPool->closed) {
+        pMessage = pPool->pFreeList;
+        pPool->pFreeList = pMessage->pNext;
+        pPool->available--;
+    }
+
+    pthread_mutex_unlock(&pPool->mutex);
+    return prepareSlot(pMessage);
+}
+
+void messagePoolRelease(MessagePool* pPool, Message* pMessage) {
+    assert(pMessage >= pPool->pSlab && pMessage < pPool->pSlab + pPool->capacity);
+
+    // Someone else still holds it
+    if (atomic_fetch_sub_explicit(&pMessage->references, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    // A reassembled message takes its continuation slots with it
+    Message* pFirst = NULL;
+    Message* pLast = NULL;
+    size_t freed = collectSlot(pMessage, &pFirst, &pLast);
+
+    pthread_mutex_lock(&pPool->mutex);
+
+    pLast->pNext = pPool->pFreeList;
+    pPool->pFreeList = pFirst;
+    pPool->available += freed;
+
+    if (pPool->waiters > 0) {
+        if (freed == 1) {
+            pthread_cond_signal(&pPool->slotReleased);
+        } else {
+            pthread_cond_broadcast(&pPool->slotReleased);
+        }
+    }
+
+    pthread_mutex_unlock(&pPool->mutex);
+}
+
+// Pool lock held
+static int takeBatch(MessagePool* pPool, Message** ppMessages, int max) {
+    int acquired = 0;
+    while (!pPool->closed && acquired < max && pPool->pFreeList != NULL) {
+        Message* pMessage = pPool->pFreeList;
+        pPool->pFreeList = pMessage->pNext;
+        pPool->available--;
+        ppMessages[acquired++] = prepareSlot(pMessage);
+    }
+    return acquired;
+}
+
+int messagePoolAcquireBatch(MessagePool* pPool, Message** ppMessages, int max) {
+    pthread_mutex_lock(&pPool->mutex);
+
+    while (pPool->pFreeList == NULL && !pPool->closed) {
+        pPool->waiters++;
+        pthread_cond_wait(&pPool->slotReleased, &pPool->mutex);
+        pPool->waiters--;
+    }
+
+    int acquired = takeBatch(pPool, ppMessages, max);
+
+    pthread_mutex_unlock(&pPool->mutex);
+    return acquired;
+}
+
+int messagePoolAcquireBatchTimed(MessagePool* pPool, Message** ppMessages, int max, int milliseconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += milliseconds / 1000;
+    deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&pPool->mutex);
+
+    int status = milliseconds > 0 ? 0 : ETIMEDOUT;
+    while (pPool->pFreeList == NULL && !pPool->closed && status != ETIMEDOUT) {
+        pPool->waiters++;
+        status = pthread_cond_timedwait(&pPool->slotReleased, &pPool->mutex, &deadline);
+        pPool->waiters--;
+    }
+
+    int acquired = pPool->closed ? -1 : takeBatch(pPool, ppMessages, max);
+
+    pthread_mutex_unlock(&pPool->mutex);
+    return acquired;
+}
+
+void messagePoolReleaseBatch(MessagePool* pPool, Message** ppMessages, int count) {
+    if (count <= 0) {
+        return;
+    }
+
+    // Chain up the slots whose last reference is going away, outside the lock
+    Message* pFirst = NULL;
+    Message* pLast = NULL;
+    size_t freed = 0;
+    for (int i = 0; i < count; i++) {
+        assert(ppMessages[i] >= pPool->pSlab && ppMessages[i] < pPool->pSlab + pPool->capacity);
+        if (atomic_fetch_sub_explicit(&ppMessages[i]->references, 1, memory_order_acq_rel) != 1) {
+            continue;
+        }
+
+        freed += collectSlot(ppMessages[i], &pFirst, &pLast);
+    }
+
+    if (freed == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&pPool->mutex);
+
+    pLast->pNext = pPool->pFreeList;
+    pPool->pFreeList = pFirst;
+    pPool->available += freed;
+
+    if (pPool->waiters > 0) {
+        pthread_cond_broadcast(&pPool->slotReleased);
+    }
+
+    pthread_mutex_unlock(&pPool->mutex);
+}
+
+void messagePoolClose(MessagePool* pPool) {
+    pthread_mutex_lock(&pPool->mutex);
+    pPool->closed = true;
+    pthread_cond_broadcast(&pPool->slotReleased);
+    pthread_mutex_unlock(&pPool->mutex);
+}
+
+size_t messagePoolAvailable(MessagePool* pPool) {
+    pthread_mutex_lock(&pPool->mutex);
+    size_t available = pPool->available;
+    pthread_mutex_unlock(&pPool->mutex);
+    return available;
+}
+
+void messageRetain(Message* pMessage) {
+    atomic_fetch_add_explicit(&pMessage->references, 1, memory_order_relaxed);
+}
+
+void messageRelease(Message* pMessage) {
+    messagePoolRelease(pMessage->pPool, pMessage);
+}
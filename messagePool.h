@@ -0,0 +1,87 @@
+#ifndef MESSAGE_POOL_H_
+#define MESSAGE_POOL_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_CHAR_COUNT 1024
+
+// Slots per direction
+#ifndef MESSAGE_POOL_CAPACITY
+#define MESSAGE_POOL_CAPACITY 256
+#endif
+
+struct MessagePool;
+struct LineChunk;
+
+// Fixed-size message slot, the length travels with the bytes so nobody needs strlen.
+// Messages longer than one slot travel as several, one per fragment.
+typedef struct Message {
+    struct Message*     pNext;          // Free list link, only valid while in the pool
+    struct MessagePool* pPool;          // Owner, for messageRelease
+    atomic_int          references;     // Slot goes back to the pool when this hits 0
+    int                 peer;           // Index into UDP::peers, -1 when unknown
+    uint32_t            messageId;      // Framed mode, shared by the fragments of one message
+    uint16_t            fragment;       // Index within its message, 0 for the first
+    bool                partial;        // More of the message follows in another slot
+    bool                bundle;         // data holds several short messages as bundle records
+    bool                outgoing;       // Typed here, set when replayed from the log
+    struct Message*     pContinuation;  // Rest of a reassembled message, released along with this slot
+    uint64_t            stamp;          // When it was queued, metrics builds only
+    size_t              length;
+    char*               pData;          // Payload, data unless the slot is a slice of stdin
+    struct LineChunk*   pChunk;         // Chunk pData points into, NULL for data
+    char                data[MAX_CHAR_COUNT];
+} Message;
+
+// Preallocated slab of message slots, producers acquire and consumers release.
+// Acquire hands out a slot holding one reference.
+typedef struct MessagePool {
+    Message*          pSlab;
+    Message*          pFreeList;
+    size_t            capacity;
+    size_t            available;
+    int               waiters;      // Only signal when someone is blocked in acquire
+    bool              closed;
+    pthread_mutex_t   mutex;
+    pthread_cond_t    slotReleased;
+} MessagePool;
+
+void messagePoolInitialize(MessagePool* pPool, size_t capacity);
+void messagePoolDestroy(MessagePool* pPool);
+
+// Blocks while the pool is exhausted (backpressure), returns NULL once closed
+Message* messagePoolAcquire(MessagePool* pPool);
+
+// Same, but gives up after milliseconds and returns NULL, for callers that have more to watch
+Message* messagePoolAcquireTimed(MessagePool* pPool, int milliseconds);
+
+// Never blocks, NULL when exhausted or closed. For single-threaded callers that are
+// themselves the ones who would free a slot.
+Message* messagePoolTryAcquire(MessagePool* pPool);
+void messagePoolRelease(MessagePool* pPool, Message* pMessage);
+
+// Batched variants take the pool lock once, AcquireBatch blocks for at least one slot
+// and returns 0 once closed
+int messagePoolAcquireBatch(MessagePool* pPool, Message** ppMessages, int max);
+
+// Waits at most milliseconds (0 doesn't wait) for at least one slot, 0 when none came
+// free and -1 once closed
+int messagePoolAcquireBatchTimed(MessagePool* pPool, Message** ppMessages, int max, int milliseconds);
+void messagePoolReleaseBatch(MessagePool* pPool, Message** ppMessages, int count);
+
+// Release anyone blocked in acquire for termination
+void messagePoolClose(MessagePool* pPool);
+
+// Free slots right now, only a hint since other threads keep acquiring and releasing
+size_t messagePoolAvailable(MessagePool* pPool);
+
+// A slot can sit in several queues at once (fan-out to many peers),
+// every holder takes a reference and the last release returns it to its pool
+void messageRetain(Message* pMessage);
+void messageRelease(Message* pMessage);
+
+#endif
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE // For clock_gettime
+#include "messageQueue.h"
+#include "metrics.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ERROR -1
+
+static int tryPopItems(MessageQueue* pQueue, void** ppItems, int max);
+static int spinForItems(MessageQueue* pQueue, void** ppItems, int max);
+
+#ifdef STALK_LIST_QUEUE
+
+//===================================================================================
+// List + Mutex Path
+//===================================================================================
+
+// Metrics builds time how long we queue for the direction's mutex
+static void lockQueue(MessageQueue* pQueue) {
+#ifdef STALK_METRICS
+    if (pthread_mutex_trylock(&pQueue->mutex) == 0) {
+        return;
+    }
+    uint64_t start = clockNanoseconds();
+    pthread_mutex_lock(&pQueue->mutex);
+    metricsCount(METRIC_LOCK_CONTENDED, 1);
+    metricsCount(METRIC_LOCK_WAIT_NS, clockNanoseconds() - start);
+#else
+    pthread_mutex_lock(&pQueue->mutex);
+#endif
+}
+
+// Called with the mutex held, a consumer that is awake drains everything anyway
+static void wakeConsumer(MessageQueue* pQueue) {
+    if (pQueue->waiters > 0) {
+        METRICS_COUNT(METRIC_QUEUE_WAKES, 1);
+        pthread_cond_signal(&pQueue->condition);
+    }
+}
+
+// Called with the mutex held, gives up at the deadline (NULL waits forever)
+static void waitForItems(MessageQueue* pQueue, const struct timespec* pDeadline) {
+    int status = 0;
+    while (List_count(pQueue->pList) == 0 && !pQueue->closed && status == 0) {
+        METRICS_COUNT(METRIC_QUEUE_PARKS, 1);
+        pQueue->waiters++;
+        if (pDeadline == NULL) {
+            pthread_cond_wait(&pQueue->condition, &pQueue->mutex);
+        } else {
+            status = pthread_cond_timedwait(&pQueue->condition, &pQueue->mutex, pDeadline);
+        }
+        pQueue->waiters--;
+    }
+}
+
+// Called with the mutex held
+static int drainItems(MessageQueue* pQueue, void** ppItems, int max) {
+    int popped = 0;
+    while (!pQueue->closed && popped < max && List_count(pQueue->pList) > 0) {
+        ppItems[popped++] = List_trim(pQueue->pList);
+    }
+    return popped;
+}
+
+void messageQueueInitialize(MessageQueue* pQueue) {
+    assert(pQueue != NULL);
+
+    pQueue->pList = List_create();
+    assert(pQueue->pList != NULL);
+
+    pQueue->closed = false;
+    pQueue->waiters = 0;
+    pQueue->spinMicroseconds = 0;
+    pthread_mutex_init(&pQueue->mutex, NULL);
+    pthread_cond_init(&pQueue->condition, NULL);
+}
+
+void messageQueueInitializeShared(MessageQueue* pQueue) {
+    messageQueueInitialize(pQueue);
+}
+
+void messageQueueDestroy(MessageQueue* pQueue, void (*pFreeFn)(void* pItem)) {
+    assert(pQueue != NULL);
+
+    if (pQueue->pList != NULL) {
+        List_free(pQueue->pList, pFreeFn);
+        pQueue->pList = NULL;
+    }
+    pthread_cond_destroy(&pQueue->condition);
+    pthread_mutex_destroy(&pQueue->mutex);
+}
+
+int messageQueuePush(MessageQueue* pQueue, void* pItem) {
+    // Entering Critical Section
+    lockQueue(pQueue);
+
+    // First message pushed will be at the end
+    int status = pQueue->closed ? ERROR : List_prepend(pQueue->pList, pItem);
+    if (status != ERROR) {
+        wakeConsumer(pQueue);
+    }
+
+    // Exiting Critical Section
+    pthread_mutex_unlock(&pQueue->mutex);
+    return status;
+}
+
+void* messageQueuePop(MessageQueue* pQueue) {
+    void* pItem = NULL;
+
+    // Entering Critical Section
+    lockQueue(pQueue);
+
+    waitForItems(pQueue, NULL);
+    if (!pQueue->closed) {
+        pItem = List_trim(pQueue->pList);
+    }
+
+    // Exiting Critical Section
+    pthread_mutex_unlock(&pQueue->mutex);
+    return pItem;
+}
+
+int messageQueuePushBatch(MessageQueue* pQueue, void** ppItems, int count) {
+    int pushed = 0;
+
+    // Entering Critical Section
+    lockQueue(pQueue);
+
+    while (!pQueue->closed && pushed < count) {
+        if (List_prepend(pQueue->pList, ppItems[pushed]) == ERROR) {
+            break;
+        }
+        pushed++;
+    }
+
+    // One wakeup for the whole batch
+    if (pushed > 0) {
+        wakeConsumer(pQueue);
+    }
+
+    // Exiting Critical Section
+    pthread_mutex_unlock(&pQueue->mutex);
+    return pushed;
+}
+
+static int tryPopItems(MessageQueue* pQueue, void** ppItems, int max) {
+    lockQueue(pQueue);
+    int popped = drainItems(pQueue, ppItems, max);
+    pthread_mutex_unlock(&pQueue->mutex);
+    return popped;
+}
+
+int messageQueuePopBatch(MessageQueue* pQueue, void** ppItems, int max) {
+    int spun = spinForItems(pQueue, ppItems, max);
+    if (spun > 0) {
+        return spun;
+    }
+
+    // Entering Critical Section
+    lockQueue(pQueue);
+
+    // Take everything pending in one go
+    waitForItems(pQueue, NULL);
+    int popped = drainItems(pQueue, ppItems, max);
+
+    // Exiting Critical Section
+    pthread_mutex_unlock(&pQueue->mutex);
+    return popped;
+}
+
+int messageQueuePopBatchTimed(MessageQueue* pQueue, void** ppItems, int max, int milliseconds) {
+    if (milliseconds < 0) {
+        return messageQueuePopBatch(pQueue, ppItems, max);
+    }
+    int spun = milliseconds > 0 ? spinForItems(pQueue, ppItems, max) : 0;
+    if (spun > 0) {
+        return spun;
+    }
+
+    // Condition variables time out against the realtime clock
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += milliseconds / 1000;
+    deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    // Entering Critical Section
+    lockQueue(pQueue);
+
+    waitForItems(pQueue, &deadline);
+    int popped = drainItems(pQueue, ppItems, max);
+
+    // Exiting Critical Section
+    pthread_mutex_unlock(&pQueue->mutex);
+    return popped;
+}
+
+int messageQueueDrain(MessageQueue* pQueue, void** ppItems, int max) {
+    lockQueue(pQueue);
+    int popped = 0;
+    while (popped < max && List_count(pQueue->pList) > 0) {
+        ppItems[popped++] = List_trim(pQueue->pList);
+    }
+    pthread_mutex_unlock(&pQueue->mutex);
+    return popped;
+}
+
+void messageQueueClose(MessageQueue* pQueue) {
+    lockQueue(pQueue);
+    pQueue->closed = true;
+    pthread_cond_broadcast(&pQueue->condition);
+    pthread_mutex_unlock(&pQueue->mutex);
+}
+
+bool messageQueueClosed(MessageQueue* pQueue) {
+    lockQueue(pQueue);
+    bool closed = pQueue->closed;
+    pthread_mutex_unlock(&pQueue->mutex);
+    return closed;
+}
+
+int messageQueueCount(MessageQueue* pQueue) {
+    lockQueue(pQueue);
+    int count = List_count(pQueue->pList);
+    pthread_mutex_unlock(&pQueue->mutex);
+    return count;
+}
+
+#else
+
+//===================================================================================
+// Lock-free Ring Path
+//===================================================================================
+
+void messageQueueInitialize(MessageQueue* pQueue) {
+    assert(pQueue != NULL);
+    pQueue->multiProducer = false;
+    pQueue->spinMicroseconds = 0;
+    ringBufferInitialize(&pQueue->ring, MESSAGE_QUEUE_CAPACITY);
+}
+
+void messageQueueInitializeShared(MessageQueue* pQueue) {
+    assert(pQueue != NULL);
+    pQueue->multiProducer = true;
+    pQueue->spinMicroseconds = 0;
+    mpmcQueueInitialize(&pQueue->shared, MESSAGE_QUEUE_CAPACITY);
+}
+
+void messageQueueDestroy(MessageQueue* pQueue, void (*pFreeFn)(void* pItem)) {
+    assert(pQueue != NULL);
+
+    // Threads are joined by now, drain whatever was left behind
+    void* pItem = NULL;
+    if (pQueue->multiProducer) {
+        while (mpmcQueueTryPopBatch(&pQueue->shared, &pItem, 1) == 1) {
+            (*pFreeFn)(pItem);
+        }
+        mpmcQueueDestroy(&pQueue->shared);
+        return;
+    }
+    while ((pItem = ringBufferTryPop(&pQueue->ring)) != NULL) {
+        (*pFreeFn)(pItem);
+    }
+    ringBufferDestroy(&pQueue->ring);
+}
+
+int messageQueuePush(MessageQueue* pQueue, void* pItem) {
+    return messageQueuePushBatch(pQueue, &pItem, 1) == 1 ? 0 : ERROR;
+}
+
+void* messageQueuePop(MessageQueue* pQueue) {
+    void* pItem = NULL;
+    messageQueuePopBatch(pQueue, &pItem, 1);
+    return pItem;
+}
+
+int messageQueuePushBatch(MessageQueue* pQueue, void** ppItems, int count) {
+    if (pQueue->multiProducer) {
+        return (int)mpmcQueuePushBatch(&pQueue->shared, ppItems, (size_t)count);
+    }
+    return (int)ringBufferPushBatch(&pQueue->ring, ppItems, (size_t)count);
+}
+
+static int tryPopItems(MessageQueue* pQueue, void** ppItems, int max) {
+    if (pQueue->multiProducer) {
+        return (int)mpmcQueueTryPopBatch(&pQueue->shared, ppItems, (size_t)max);
+    }
+    return (int)ringBufferTryPopBatch(&pQueue->ring, ppItems, (size_t)max);
+}
+
+int messageQueuePopBatch(MessageQueue* pQueue, void** ppItems, int max) {
+    int spun = spinForItems(pQueue, ppItems, max);
+    if (spun > 0) {
+        return spun;
+    }
+    if (pQueue->multiProducer) {
+        return (int)mpmcQueuePopBatch(&pQueue->shared, ppItems, (size_t)max);
+    }
+    return (int)ringBufferPopBatch(&pQueue->ring, ppItems, (size_t)max);
+}
+
+int messageQueuePopBatchTimed(MessageQueue* pQueue, void** ppItems, int max, int milliseconds) {
+    if (milliseconds < 0) {
+        return messageQueuePopBatch(pQueue, ppItems, max);
+    }
+    int spun = milliseconds > 0 ? spinForItems(pQueue, ppItems, max) : 0;
+    if (spun > 0) {
+        return spun;
+    }
+    if (pQueue->multiProducer) {
+        return (int)mpmcQueuePopBatchTimed(&pQueue->shared, ppItems, (size_t)max, milliseconds);
+    }
+    return (int)ringBufferPopBatchTimed(&pQueue->ring, ppItems, (size_t)max, milliseconds);
+}
+
+// The try pops never look at closed
+int messageQueueDrain(MessageQueue* pQueue, void** ppItems, int max) {
+    return tryPopItems(pQueue, ppItems, max);
+}
+
+void messageQueueClose(MessageQueue* pQueue) {
+    if (pQueue->multiProducer) {
+        mpmcQueueClose(&pQueue->shared);
+    } else {
+        ringBufferClose(&pQueue->ring);
+    }
+}
+
+bool messageQueueClosed(MessageQueue* pQueue) {
+    if (pQueue->multiProducer) {
+        return mpmcQueueClosed(&pQueue->shared);
+    }
+    return ringBufferClosed(&pQueue->ring);
+}
+
+int messageQueueCount(MessageQueue* pQueue) {
+    if (pQueue->multiProducer) {
+        return (int)mpmcQueueCount(&pQueue->shared);
+    }
+    return (int)ringBufferCount(&pQueue->ring);
+}
+
+#endif
+
+//===================================================================================
+// Shared
+//===================================================================================
+
+void messageQueueSetSpin(MessageQueue* pQueue, int microseconds) {
+    assert(pQueue != NULL);
+    pQueue->spinMicroseconds = microseconds > 0 ? microseconds : 0;
+}
+
+// Busy-poll mode, keep trying without parking until something shows up or the spin runs out
+static int spinForItems(MessageQueue* pQueue, void** ppItems, int max) {
+    if (pQueue->spinMicroseconds == 0) {
+        return 0;
+    }
+
+    uint64_t giveUp = clockMicroseconds() + (uint64_t)pQueue->spinMicroseconds;
+    do {
+        int popped = tryPopItems(pQueue, ppItems, max);
+        if (popped > 0) {
+            return popped;
+        }
+    } while (!messageQueueClosed(pQueue) && clockMicroseconds() < giveUp);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef MESSAGE_QUEUE_H_
+#define MESSAGE_QUEUE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// Build with QUEUE=list (-DSTALK_LIST_QUEUE) to go back to the List + mutex path
+#ifdef STALK_LIST_QUEUE
+#include "list.h"
+#else
+#include "mpmcQueue.h"
+#include "ringBuffer.h"
+#endif
+
+// Must be a power of two for the ring
+#ifndef MESSAGE_QUEUE_CAPACITY
+#define MESSAGE_QUEUE_CAPACITY 1024
+#endif
+
+// One direction of the pipeline (keyboard -> send or receive -> screen)
+typedef struct MessageQueue {
+#ifdef STALK_LIST_QUEUE
+    List*             pList;
+    pthread_mutex_t   mutex;        // This direction only, the other one never touches it
+    pthread_cond_t    condition;    // Condition variable for signaling
+    int               waiters;      // Consumers parked on condition, nobody to signal at 0
+    bool              closed;
+    int               spinMicroseconds;
+#else
+    RingBuffer        ring;         // One producer and one consumer
+    MpmcQueue         shared;       // Used instead of ring when initialized shared
+    bool              multiProducer;
+    int               spinMicroseconds;
+#endif
+} MessageQueue;
+
+void messageQueueInitialize(MessageQueue* pQueue);
+
+// For a direction fed by several threads, items each one pushes still come out in its order.
+// The List path is already safe for any number.
+void messageQueueInitializeShared(MessageQueue* pQueue);
+void messageQueueDestroy(MessageQueue* pQueue, void (*pFreeFn)(void* pItem));
+
+// Returns 0 on success, -1 on failure or once closed
+int messageQueuePush(MessageQueue* pQueue, void* pItem);
+
+// Blocks until an item is available, returns NULL once closed
+void* messageQueuePop(MessageQueue* pQueue);
+
+// Batched variants take the lock or publish the ring index once per batch
+// PushBatch returns how many were queued, PopBatch blocks for at least one and returns 0 once closed
+int messageQueuePushBatch(MessageQueue* pQueue, void** ppItems, int count);
+int messageQueuePopBatch(MessageQueue* pQueue, void** ppItems, int max);
+
+// PopBatch that gives up after milliseconds (-1 waits forever), 0 means timeout or closed
+int messageQueuePopBatchTimed(MessageQueue* pQueue, void** ppItems, int max, int milliseconds);
+
+// Pops keep retrying this long before the consumer parks, 0 (the default) parks right away.
+// Trades a core for wake-up latency.
+void messageQueueSetSpin(MessageQueue* pQueue, int microseconds);
+
+// Never blocks and still hands out what was queued before a close, for winding down
+int messageQueueDrain(MessageQueue* pQueue, void** ppItems, int max);
+
+// Wake the consumer for termination
+void messageQueueClose(MessageQueue* pQueue);
+bool messageQueueClosed(MessageQueue* pQueue);
+
+// Items waiting right now, a snapshot for metrics
+int messageQueueCount(MessageQueue* pQueue);
+
+#endif
@@ -0,0 +1,253 @@
+#define _GNU_SOURCE // For sigtimedwait
+#include "metrics.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ERROR -1
+
+#ifdef STALK_METRICS
+
+// Written by its own thread only, relaxed atomics keep the snapshot reads race free
+typedef struct MetricsShard {
+    _Alignas(64) atomic_uint_fast64_t counters[METRIC_COUNTERS];
+    atomic_uint_fast64_t  histograms[METRIC_STAGES][METRICS_BUCKETS];
+    atomic_uint_fast64_t  maximum[METRIC_STAGES];
+} MetricsShard;
+
+static MetricsShard sShards[METRICS_MAX_SHARDS];
+static atomic_int sShardCount = 0;
+static _Thread_local MetricsShard* sShard = NULL;
+
+static atomic_int sQueueDepth[METRIC_QUEUES];
+static atomic_int sQueueHighWater[METRIC_QUEUES];
+
+static pthread_t sDumpThread;
+static atomic_bool sStopping = false;
+static int sInterval = 0;
+static uint64_t sStarted = 0;
+
+static const char* sCounterNames[METRIC_COUNTERS] = {
+    "input reads", "send calls", "datagrams sent", "receive calls", "datagrams received",
+    "poll timeouts", "poll wakeups", "queue parks", "queue wakes", "lock contended", "lock wait ns",
+    "codec input bytes", "codec output bytes", "shm drops", "sanitized bytes",
+    "shed messages", "pacing stalls", "credit stalls", "reorder drops",
+    "pool drops"
+};
+static const char* sStageNames[METRIC_STAGES] = { "enqueue", "dequeue", "send", "receive", "render", "sanitize" };
+static const char* sQueueNames[METRIC_QUEUES] = { "client", "remote" };
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static MetricsShard* currentShard(void) {
+    if (sShard == NULL) {
+        int index = atomic_fetch_add(&sShardCount, 1);
+        sShard = &sShards[index < METRICS_MAX_SHARDS ? index : METRICS_MAX_SHARDS - 1];
+    }
+    return sShard;
+}
+
+// Exact below 16, then 16 sub-buckets per power of two
+static int bucketIndex(uint64_t value) {
+    if (value < METRICS_SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent >= METRICS_MAX_EXPONENT) {
+        return METRICS_BUCKETS - 1;
+    }
+
+    int sub = (int)(value >> (exponent - METRICS_SUB_BUCKET_BITS)) & (METRICS_SUB_BUCKETS - 1);
+    return (exponent - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS + sub;
+}
+
+// Lowest value that lands in the bucket
+static uint64_t bucketValue(int index) {
+    if (index < METRICS_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+
+    int exponent = index / METRICS_SUB_BUCKETS + METRICS_SUB_BUCKET_BITS - 1;
+    uint64_t sub = (uint64_t)(index % METRICS_SUB_BUCKETS);
+    return (METRICS_SUB_BUCKETS + sub) << (exponent - METRICS_SUB_BUCKET_BITS);
+}
+
+static uint64_t percentile(const uint64_t* pBuckets, uint64_t total, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * (double)total);
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += pBuckets[i];
+        if (seen > rank) {
+            return bucketValue(i);
+        }
+    }
+    return bucketValue(METRICS_BUCKETS - 1);
+}
+
+static void dumpSnapshot(FILE* pFile) {
+    int shards = atomic_load(&sShardCount);
+    if (shards > METRICS_MAX_SHARDS) {
+        shards = METRICS_MAX_SHARDS;
+    }
+
+    fprintf(pFile, "\n=== s-talk metrics, %.1f s up, %d threads ===\n",
+            (double)(clockNanoseconds() - sStarted) / 1e9, shards);
+
+    for (int counter = 0; counter < METRIC_COUNTERS; counter++) {
+        uint64_t total = 0;
+        for (int i = 0; i < shards; i++) {
+            total += atomic_load_explicit(&sShards[i].counters[counter], memory_order_relaxed);
+        }
+        fprintf(pFile, "  %-20s %" PRIu64 "\n", sCounterNames[counter], total);
+    }
+
+    for (int queue = 0; queue < METRIC_QUEUES; queue++) {
+        fprintf(pFile, "  %-20s depth %d, high water %d\n", sQueueNames[queue],
+                atomic_load(&sQueueDepth[queue]), atomic_load(&sQueueHighWater[queue]));
+    }
+
+    fprintf(pFile, "  %-10s %10s %10s %10s %10s %10s %10s\n", "stage (us)", "count", "p50", "p90", "p99", "p999", "max");
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+        uint64_t buckets[METRICS_BUCKETS] = {0};
+        uint64_t total = 0;
+        uint64_t maximum = 0;
+        for (int i = 0; i < shards; i++) {
+            for (int bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+                uint64_t count = atomic_load_explicit(&sShards[i].histograms[stage][bucket], memory_order_relaxed);
+                buckets[bucket] += count;
+                total += count;
+            }
+            uint64_t shardMaximum = atomic_load_explicit(&sShards[i].maximum[stage], memory_order_relaxed);
+            maximum = shardMaximum > maximum ? shardMaximum : maximum;
+        }
+
+        if (total == 0) {
+            fprintf(pFile, "  %-10s %10d\n", sStageNames[stage], 0);
+            continue;
+        }
+        fprintf(pFile, "  %-10s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f %10.1f\n", sStageNames[stage], total,
+                (double)percentile(buckets, total, 0.50) / 1e3, (double)percentile(buckets, total, 0.90) / 1e3,
+                (double)percentile(buckets, total, 0.99) / 1e3, (double)percentile(buckets, total, 0.999) / 1e3,
+                (double)maximum / 1e3);
+    }
+    fflush(pFile);
+}
+
+static void* dumpRoutine(void* args) {
+    (void)args;
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+
+    while (1) {
+        int result;
+        if (sInterval > 0) {
+            struct timespec timeout = { sInterval, 0 };
+            result = sigtimedwait(&signals, NULL, &timeout);
+        } else {
+            result = sigwaitinfo(&signals, NULL);
+        }
+
+        // metricsStop wakes us with SIGUSR1 and dumps the final snapshot itself
+        if (atomic_load(&sStopping)) {
+            break;
+        }
+        if (result == ERROR && errno == EINTR) {
+            continue;
+        }
+        dumpSnapshot(stderr);
+    }
+
+    return NULL;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void metricsCount(MetricCounter counter, uint64_t amount) {
+    atomic_fetch_add_explicit(&currentShard()->counters[counter], amount, memory_order_relaxed);
+}
+
+void metricsRecord(MetricStage stage, uint64_t nanoseconds) {
+    MetricsShard* pShard = currentShard();
+    atomic_fetch_add_explicit(&pShard->histograms[stage][bucketIndex(nanoseconds)], 1, memory_order_relaxed);
+    if (nanoseconds > atomic_load_explicit(&pShard->maximum[stage], memory_order_relaxed)) {
+        atomic_store_explicit(&pShard->maximum[stage], nanoseconds, memory_order_relaxed);
+    }
+}
+
+void metricsQueueDepth(MetricQueue queue, int depth) {
+    atomic_store_explicit(&sQueueDepth[queue], depth, memory_order_relaxed);
+
+    // Receive lanes share remoteQueue, a plain store could lose a higher mark
+    int highWater = atomic_load_explicit(&sQueueHighWater[queue], memory_order_relaxed);
+    while (depth > highWater
+           && !atomic_compare_exchange_weak_explicit(&sQueueHighWater[queue], &highWater, depth,
+                                                     memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+bool metricsStart(int intervalSeconds) {
+    sInterval = intervalSeconds;
+    sStarted = clockNanoseconds();
+
+    // Every thread created after this inherits the mask, only dumpRoutine takes SIGUSR1
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    int result = pthread_create(&sDumpThread, NULL, dumpRoutine, NULL);
+    if (result != 0) {
+        fprintf(stderr, "Error creating thread: %d\n", result);
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+void metricsStop(void) {
+    atomic_store(&sStopping, true);
+    pthread_kill(sDumpThread, SIGUSR1);
+    pthread_join(sDumpThread, NULL);
+    dumpSnapshot(stderr);
+}
+
+#else
+
+//===================================================================================
+// Compiled Out
+//===================================================================================
+
+void metricsCount(MetricCounter counter, uint64_t amount) {
+    (void)counter;
+    (void)amount;
+}
+
+void metricsRecord(MetricStage stage, uint64_t nanoseconds) {
+    (void)stage;
+    (void)nanoseconds;
+}
+
+void metricsQueueDepth(MetricQueue queue, int depth) {
+    (void)queue;
+    (void)depth;
+}
+
+bool metricsStart(int intervalSeconds) {
+    (void)intervalSeconds;
+    return false;
+}
+
+void metricsStop(void) {
+}
+
+#endif
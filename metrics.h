@@ -0,0 +1,90 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clock.h"
+
+// Build with METRICS=1 (-DSTALK_METRICS) to compile the instrumentation in, without it
+// the macros below expand to nothing. Every thread counts into its own shard and a
+// snapshot sums them, so the hot paths never share a cache line.
+
+typedef enum MetricCounter {
+    METRIC_INPUT_READS,         // fgets or read calls on stdin
+    METRIC_SEND_CALLS,          // sendmmsg calls
+    METRIC_DATAGRAMS_SENT,
+    METRIC_RECEIVE_CALLS,       // recvmmsg calls
+    METRIC_DATAGRAMS_RECEIVED,
+    METRIC_POLL_TIMEOUTS,       // poll, epoll_wait and timed pops that came back with nothing
+    METRIC_POLL_WAKEUPS,        // The same waits ending because something was ready
+    METRIC_QUEUE_PARKS,         // Sleeps on a queue futex or condition variable
+    METRIC_QUEUE_WAKES,         // Futex wakes for a parked queue side
+    METRIC_LOCK_CONTENDED,      // A List queue's mutex was already held
+    METRIC_LOCK_WAIT_NS,        // Time spent waiting for it
+    METRIC_CODEC_INPUT_BYTES,   // Payload bytes offered to the codec
+    METRIC_CODEC_OUTPUT_BYTES,  // What went on the wire for them, compressed or not
+    METRIC_SHM_DROPS,           // Datagrams a shared-memory ring had no room for
+    METRIC_SANITIZED_BYTES,     // Inbound bytes replaced before they reached the screen
+    METRIC_SHED_MESSAGES,       // Messages dropped for a peer whose outbound queue was at its limit
+    METRIC_PACING_STALLS,       // Sends a peer's token bucket held back
+    METRIC_CREDIT_STALLS,       // Sends held back because the receiver advertised less than the full window
+    METRIC_REORDER_DROPS,       // Out-of-order packets dropped to keep the receive reserve
+    METRIC_POOL_DROPS,          // Datagrams dropped because the receive pool had no free slot
+    METRIC_COUNTERS
+} MetricCounter;
+
+typedef enum MetricStage {
+    METRIC_STAGE_ENQUEUE,       // messageQueuePush/PushBatch call
+    METRIC_STAGE_DEQUEUE,       // Time a message sat in a queue, push to pop
+    METRIC_STAGE_SEND,          // One sendmmsg batch
+    METRIC_STAGE_RECEIVE,       // One recvmmsg call
+    METRIC_STAGE_RENDER,        // One renderMessages call
+    METRIC_STAGE_SANITIZE,      // One sanitizeMessages batch
+    METRIC_STAGES
+} MetricStage;
+
+typedef enum MetricQueue {
+    METRIC_QUEUE_CLIENT,        // keyboardRoutine -> udpSendRoutine
+    METRIC_QUEUE_REMOTE,        // udpReceiveRoutine -> screenOutputRoutine
+    METRIC_QUEUES
+} MetricQueue;
+
+// Log-linear buckets, 16 per power of two (about 6% precision) up to 2^40 ns
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MAX_EXPONENT 40
+#define METRICS_BUCKETS ((METRICS_MAX_EXPONENT - 3) * METRICS_SUB_BUCKETS)
+
+// Threads beyond this share the last shard
+#define METRICS_MAX_SHARDS 32
+
+#ifdef STALK_METRICS
+#define METRICS_COUNT(counter, amount) metricsCount(counter, (uint64_t)(amount))
+#define METRICS_NOW() clockNanoseconds()
+#define METRICS_RECORD(stage, start) metricsRecord(stage, clockNanoseconds() - (start))
+#define METRICS_QUEUE_DEPTH(queue, depth) metricsQueueDepth(queue, depth)
+#define METRICS_STAMP(pMessage) ((pMessage)->stamp = clockNanoseconds())
+#define METRICS_WAIT(result) METRICS_COUNT((result) == 0 ? METRIC_POLL_TIMEOUTS : METRIC_POLL_WAKEUPS, 1)
+#else
+#define METRICS_COUNT(counter, amount) ((void)(amount))
+#define METRICS_NOW() 0
+#define METRICS_RECORD(stage, start) ((void)(start))
+#define METRICS_QUEUE_DEPTH(queue, depth) ((void)0)
+#define METRICS_STAMP(pMessage) ((void)0)
+#define METRICS_WAIT(result) ((void)0)
+#endif
+
+void metricsCount(MetricCounter counter, uint64_t amount);
+void metricsRecord(MetricStage stage, uint64_t nanoseconds);
+void metricsQueueDepth(MetricQueue queue, int depth);
+
+// Block SIGUSR1 and start a thread that dumps a snapshot to stderr on SIGUSR1, and every
+// intervalSeconds when that is above 0. Call before any other thread exists so they all
+// inherit the mask. Returns false when built without metrics.
+bool metricsStart(int intervalSeconds);
+
+// Final dump and join
+void metricsStop(void);
+
+#endif
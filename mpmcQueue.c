@@ -0,0 +1,238 @@
+#include "mpmcQueue.h"
+#include "futex.h"
+#include "metrics.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Spins on a claimed cell before yielding to whoever claimed it before us
+#define MPMC_SPINS_BEFORE_YIELD 64
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+// The other side claimed this cell and is mid-copy, it finishes in a few instructions
+// unless it got preempted
+static void awaitSequence(MpmcCell* pCell, size_t expected) {
+    int spins = 0;
+    while (atomic_load_explicit(&pCell->sequence, memory_order_acquire) != expected) {
+        if (++spins == MPMC_SPINS_BEFORE_YIELD) {
+            spins = 0;
+            sched_yield();
+        }
+    }
+}
+
+// Same handshake as the ring's, but any number may be parked so they count themselves in
+// and wait on a word that every wake bumps
+static unsigned int announcePark(atomic_uint* pSignal, atomic_uint* pParked) {
+    atomic_fetch_add_explicit(pParked, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(pSignal, memory_order_relaxed);
+}
+
+static void leavePark(atomic_uint* pParked) {
+    atomic_fetch_sub_explicit(pParked, 1, memory_order_relaxed);
+}
+
+static void wakeParked(atomic_uint* pSignal, atomic_uint* pParked) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(pParked, memory_order_relaxed) != 0) {
+        atomic_fetch_add_explicit(pSignal, 1, memory_order_relaxed);
+        futexWake(pSignal, INT_MAX);
+        METRICS_COUNT(METRIC_QUEUE_WAKES, 1);
+    }
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void mpmcQueueInitialize(MpmcQueue* pQueue, size_t capacity) {
+    assert(pQueue != NULL);
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+    pQueue->pCells = calloc(capacity, sizeof(MpmcCell));
+    if (pQueue->pCells == NULL) {
+        perror("Queue allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&pQueue->pCells[i].sequence, i);
+    }
+
+    pQueue->mask = capacity - 1;
+    atomic_init(&pQueue->dequeuePosition, 0);
+    atomic_init(&pQueue->enqueuePosition, 0);
+    atomic_init(&pQueue->consumerSignal, 0);
+    atomic_init(&pQueue->consumersParked, 0);
+    atomic_init(&pQueue->producerSignal, 0);
+    atomic_init(&pQueue->producersParked, 0);
+    atomic_init(&pQueue->closed, false);
+}
+
+void mpmcQueueDestroy(MpmcQueue* pQueue) {
+    assert(pQueue != NULL);
+    free(pQueue->pCells);
+    pQueue->pCells = NULL;
+}
+
+size_t mpmcQueueTryPushBatch(MpmcQueue* pQueue, void** ppItems, size_t count) {
+    size_t capacity = pQueue->mask + 1;
+    size_t position = atomic_load_explicit(&pQueue->enqueuePosition, memory_order_relaxed);
+    size_t claimed = 0;
+
+    // Claim as many positions as consumers have already moved past
+    while (1) {
+        size_t used = position - atomic_load_explicit(&pQueue->dequeuePosition, memory_order_acquire);
+        if (used > capacity) {
+            // Our position went stale while consumers caught up to a newer one
+            position = atomic_load_explicit(&pQueue->enqueuePosition, memory_order_relaxed);
+            continue;
+        }
+
+        claimed = capacity - used < count ? capacity - used : count;
+        if (claimed == 0) {
+            return 0;
+        }
+        if (atomic_compare_exchange_weak_explicit(&pQueue->enqueuePosition, &position, position + claimed,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < claimed; i++) {
+        MpmcCell* pCell = &pQueue->pCells[(position + i) & pQueue->mask];
+        awaitSequence(pCell, position + i);
+        pCell->pItem = ppItems[i];
+        atomic_store_explicit(&pCell->sequence, position + i + 1, memory_order_release);
+    }
+
+    wakeParked(&pQueue->consumerSignal, &pQueue->consumersParked);
+    return claimed;
+}
+
+size_t mpmcQueueTryPopBatch(MpmcQueue* pQueue, void** ppItems, size_t max) {
+    size_t capacity = pQueue->mask + 1;
+    size_t position = atomic_load_explicit(&pQueue->dequeuePosition, memory_order_relaxed);
+    size_t claimed = 0;
+
+    // Claim as many positions as producers have already claimed
+    while (1) {
+        size_t ready = atomic_load_explicit(&pQueue->enqueuePosition, memory_order_acquire) - position;
+        if (ready > capacity) {
+            position = atomic_load_explicit(&pQueue->dequeuePosition, memory_order_relaxed);
+            continue;
+        }
+
+        claimed = ready < max ? ready : max;
+        if (claimed == 0) {
+            return 0;
+        }
+        if (atomic_compare_exchange_weak_explicit(&pQueue->dequeuePosition, &position, position + claimed,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < claimed; i++) {
+        MpmcCell* pCell = &pQueue->pCells[(position + i) & pQueue->mask];
+        awaitSequence(pCell, position + i + 1);
+        ppItems[i] = pCell->pItem;
+        atomic_store_explicit(&pCell->sequence, position + i + capacity, memory_order_release);
+    }
+
+    wakeParked(&pQueue->producerSignal, &pQueue->producersParked);
+    return claimed;
+}
+
+size_t mpmcQueuePushBatch(MpmcQueue* pQueue, void** ppItems, size_t count) {
+    size_t pushed = 0;
+
+    while (pushed < count && !atomic_load_explicit(&pQueue->closed, memory_order_acquire)) {
+        pushed += mpmcQueueTryPushBatch(pQueue, ppItems + pushed, count - pushed);
+        if (pushed == count) {
+            break;
+        }
+
+        // Full, park until a consumer frees a slot
+        unsigned int signal = announcePark(&pQueue->producerSignal, &pQueue->producersParked);
+        size_t tail = atomic_load_explicit(&pQueue->enqueuePosition, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&pQueue->dequeuePosition, memory_order_relaxed);
+        if (tail - head > pQueue->mask && !atomic_load(&pQueue->closed)) {
+            futexWait(&pQueue->producerSignal, signal, -1);
+            METRICS_COUNT(METRIC_QUEUE_PARKS, 1);
+        }
+        leavePark(&pQueue->producersParked);
+    }
+
+    return pushed;
+}
+
+size_t mpmcQueuePopBatch(MpmcQueue* pQueue, void** ppItems, size_t max) {
+    while (!atomic_load_explicit(&pQueue->closed, memory_order_acquire)) {
+        size_t popped = mpmcQueueTryPopBatch(pQueue, ppItems, max);
+        if (popped > 0) {
+            return popped;
+        }
+
+        // Empty, park until a producer publishes
+        unsigned int signal = announcePark(&pQueue->consumerSignal, &pQueue->consumersParked);
+        size_t head = atomic_load_explicit(&pQueue->dequeuePosition, memory_order_relaxed);
+        if (atomic_load_explicit(&pQueue->enqueuePosition, memory_order_relaxed) == head && !atomic_load(&pQueue->closed)) {
+            futexWait(&pQueue->consumerSignal, signal, -1);
+            METRICS_COUNT(METRIC_QUEUE_PARKS, 1);
+        }
+        leavePark(&pQueue->consumersParked);
+    }
+
+    return 0;
+}
+
+size_t mpmcQueuePopBatchTimed(MpmcQueue* pQueue, void** ppItems, size_t max, int milliseconds) {
+    if (atomic_load_explicit(&pQueue->closed, memory_order_acquire)) {
+        return 0;
+    }
+
+    size_t popped = mpmcQueueTryPopBatch(pQueue, ppItems, max);
+    if (popped > 0 || milliseconds == 0) {
+        return popped;
+    }
+
+    // Same handshake as PopBatch, but a single bounded sleep
+    unsigned int signal = announcePark(&pQueue->consumerSignal, &pQueue->consumersParked);
+    size_t head = atomic_load_explicit(&pQueue->dequeuePosition, memory_order_relaxed);
+    if (atomic_load_explicit(&pQueue->enqueuePosition, memory_order_relaxed) == head && !atomic_load(&pQueue->closed)) {
+        futexWait(&pQueue->consumerSignal, signal, milliseconds);
+        METRICS_COUNT(METRIC_QUEUE_PARKS, 1);
+    }
+    leavePark(&pQueue->consumersParked);
+
+    if (atomic_load_explicit(&pQueue->closed, memory_order_acquire)) {
+        return 0;
+    }
+    return mpmcQueueTryPopBatch(pQueue, ppItems, max);
+}
+
+void mpmcQueueClose(MpmcQueue* pQueue) {
+    atomic_store(&pQueue->closed, true);
+
+    // Unconditional wake, everyone parked on either side must observe the close
+    atomic_fetch_add(&pQueue->consumerSignal, 1);
+    futexWake(&pQueue->consumerSignal, INT_MAX);
+    atomic_fetch_add(&pQueue->producerSignal, 1);
+    futexWake(&pQueue->producerSignal, INT_MAX);
+}
+
+bool mpmcQueueClosed(MpmcQueue* pQueue) {
+    return atomic_load_explicit(&pQueue->closed, memory_order_acquire);
+}
+
+size_t mpmcQueueCount(MpmcQueue* pQueue) {
+    size_t tail = atomic_load_explicit(&pQueue->enqueuePosition, memory_order_acquire);
+    size_t head = atomic_load_explicit(&pQueue->dequeuePosition, memory_order_acquire);
+    return tail - head;
+}
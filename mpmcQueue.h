@@ -0,0 +1,60 @@
+#ifndef MPMC_QUEUE_H_
+#define MPMC_QUEUE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ringBuffer.h"
+
+// One slot, sequence says whose turn it is: equal to the position when free for the
+// producer that claims it, position + 1 once filled for the consumer that claims it
+typedef struct MpmcCell {
+    atomic_size_t  sequence;
+    void*          pItem;
+} MpmcCell;
+
+// Bounded multi-producer/multi-consumer queue of pointers (Vyukov's array queue).
+// Each side claims a run of positions with one CAS on its index, then fills or empties
+// those cells without touching the other side's line. Items one producer pushes come
+// out in the order it pushed them, producers only interleave between batches.
+// Sleepers park on a per-side futex word that is only bumped while someone is parked.
+typedef struct MpmcQueue {
+    // Consumer side
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeuePosition;
+    atomic_uint    consumerSignal;
+    atomic_uint    consumersParked;
+
+    // Producer side
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueuePosition;
+    atomic_uint    producerSignal;
+    atomic_uint    producersParked;
+
+    // Read mostly
+    _Alignas(CACHE_LINE_SIZE) MpmcCell* pCells;
+    size_t         mask;
+    atomic_bool    closed;
+} MpmcQueue;
+
+// Capacity must be a power of two
+void mpmcQueueInitialize(MpmcQueue* pQueue, size_t capacity);
+void mpmcQueueDestroy(MpmcQueue* pQueue);
+
+// Non-blocking, move as many as fit/are ready and return that count
+size_t mpmcQueueTryPushBatch(MpmcQueue* pQueue, void** ppItems, size_t count);
+size_t mpmcQueueTryPopBatch(MpmcQueue* pQueue, void** ppItems, size_t max);
+
+// PushBatch blocks until all are pushed, PopBatch until at least one is ready
+// Both return short (0 for PopBatch) once the queue is closed
+size_t mpmcQueuePushBatch(MpmcQueue* pQueue, void** ppItems, size_t count);
+size_t mpmcQueuePopBatch(MpmcQueue* pQueue, void** ppItems, size_t max);
+
+// Parks at most once for up to milliseconds, 0 on a timeout, a wake with nothing ready or once closed
+size_t mpmcQueuePopBatchTimed(MpmcQueue* pQueue, void** ppItems, size_t max, int milliseconds);
+
+// Release every parked thread on both sides, items still queued are left for the owner to drain
+void mpmcQueueClose(MpmcQueue* pQueue);
+bool mpmcQueueClosed(MpmcQueue* pQueue);
+size_t mpmcQueueCount(MpmcQueue* pQueue);
+
+#endif
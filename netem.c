@@ -0,0 +1,127 @@
+#define _GNU_SOURCE // For sendmmsg and rand_r
+#include "netem.h"
+#include "metrics.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ERROR -1
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static void sendAll(int socket, struct mmsghdr* pHeaders, int count) {
+    int sent = 0;
+    while (sent < count) {
+        int result = sendmmsg(socket, &pHeaders[sent], (unsigned int)(count - sent), 0);
+        METRICS_COUNT(METRIC_SEND_CALLS, 1);
+        if (result == ERROR) {
+            perror("Sendmmsg failed");
+            return;
+        }
+        METRICS_COUNT(METRIC_DATAGRAMS_SENT, result);
+        sent += result;
+    }
+}
+
+// Flatten a gathered datagram into buffer
+static size_t gather(const struct msghdr* pHeader, uint8_t* pBuffer, size_t capacity) {
+    size_t length = 0;
+    for (size_t i = 0; i < pHeader->msg_iovlen; i++) {
+        size_t part = pHeader->msg_iov[i].iov_len;
+        if (length + part > capacity) {
+            part = capacity - length;
+        }
+        memcpy(pBuffer + length, pHeader->msg_iov[i].iov_base, part);
+        length += part;
+    }
+    return length;
+}
+
+// Caller holds the lock
+static void sendHeld(Netem* pNetem, int socket) {
+    if (!pNetem->holding) {
+        return;
+    }
+
+    if (sendto(socket, pNetem->held, pNetem->heldLength, 0, (struct sockaddr*)&pNetem->heldAddress, sizeof(pNetem->heldAddress)) == ERROR) {
+        perror("Sendto failed");
+    }
+    pNetem->holding = false;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void netemInitialize(Netem* pNetem, int lossPercent, int reorderPercent) {
+    assert(pNetem != NULL);
+
+    pNetem->lossPercent = lossPercent;
+    pNetem->reorderPercent = reorderPercent;
+    pNetem->seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+    pNetem->holding = false;
+    pNetem->heldLength = 0;
+    pthread_mutex_init(&pNetem->lock, NULL);
+}
+
+void netemDestroy(Netem* pNetem) {
+    assert(pNetem != NULL);
+    pthread_mutex_destroy(&pNetem->lock);
+}
+
+bool netemEnabled(const Netem* pNetem) {
+    return pNetem->lossPercent > 0 || pNetem->reorderPercent > 0;
+}
+
+void netemFlush(Netem* pNetem, int socket) {
+    pthread_mutex_lock(&pNetem->lock);
+    sendHeld(pNetem, socket);
+    pthread_mutex_unlock(&pNetem->lock);
+}
+
+int netemSend(Netem* pNetem, int socket, struct mmsghdr* pHeaders, int count) {
+    struct sockaddr_in holdAddress;
+    uint8_t hold[sizeof(pNetem->held)];
+    size_t holdLength = 0;
+    bool holdNew = false;
+    int kept = 0;
+
+    pthread_mutex_lock(&pNetem->lock);
+
+    for (int i = 0; i < count; i++) {
+        int roll = rand_r(&pNetem->seed) % 100;
+        if (roll < pNetem->lossPercent) {
+            continue;
+        }
+
+        // At most one datagram is held back per batch
+        if (roll < pNetem->lossPercent + pNetem->reorderPercent && !holdNew) {
+            memcpy(&holdAddress, pHeaders[i].msg_hdr.msg_name, sizeof(holdAddress));
+            holdLength = gather(&pHeaders[i].msg_hdr, hold, sizeof(hold));
+            holdNew = true;
+            continue;
+        }
+
+        pHeaders[kept++] = pHeaders[i];
+    }
+
+    sendAll(socket, pHeaders, kept);
+
+    // The previously held datagram now arrives after everything above
+    sendHeld(pNetem, socket);
+
+    if (holdNew) {
+        memcpy(&pNetem->heldAddress, &holdAddress, sizeof(holdAddress));
+        memcpy(pNetem->held, hold, holdLength);
+        pNetem->heldLength = holdLength;
+        pNetem->holding = true;
+    }
+
+    pthread_mutex_unlock(&pNetem->lock);
+    return count;
+}
@@ -0,0 +1,38 @@
+#ifndef NETEM_H_
+#define NETEM_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "messagePool.h"
+#include "protocol.h"
+
+// Local stand-in for `tc qdisc ... netem loss/reorder` so the reliable mode can be exercised
+// on loopback without root. Sits in front of sendmmsg: a datagram is dropped with
+// lossPercent probability, or held back and sent after the next batch with reorderPercent.
+typedef struct Netem {
+    int                 lossPercent;
+    int                 reorderPercent;
+    unsigned int        seed;
+    pthread_mutex_t     lock;           // Both engines' senders and the ACK path share it
+    bool                holding;
+    struct sockaddr_in  heldAddress;
+    size_t              heldLength;
+    uint8_t             held[PACKET_HEADER_SIZE + MAX_CHAR_COUNT];
+} Netem;
+
+// Both percentages 0 leaves the send path untouched
+void netemInitialize(Netem* pNetem, int lossPercent, int reorderPercent);
+void netemDestroy(Netem* pNetem);
+bool netemEnabled(const Netem* pNetem);
+
+// Send the held-back datagram now, netem delays rather than drops
+void netemFlush(Netem* pNetem, int socket);
+
+// sendmmsg with impairments, returns how many datagrams were handed over (dropped ones count)
+int netemSend(Netem* pNetem, int socket, struct mmsghdr* pHeaders, int count);
+
+#endif
@@ -0,0 +1,112 @@
+#include "placement.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+#define ERROR -1
+
+static atomic_bool sAffinityWarned = false;
+static atomic_bool sRealtimeWarned = false;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+// Once per kind, every routine would otherwise repeat it
+static void warnOnce(atomic_bool* pWarned, const char* pWhat, int error) {
+    if (!atomic_exchange(pWarned, true)) {
+        fprintf(stderr, "%s failed, continuing without it: %s\n", pWhat, strerror(error));
+    }
+}
+
+// The nodeN entry sysfs keeps next to each CPU, -1 without NUMA
+static int nodeOfCpu(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR* pDirectory = opendir(path);
+    if (pDirectory == NULL) {
+        return ERROR;
+    }
+
+    int node = ERROR;
+    struct dirent* pEntry;
+    while (node == ERROR && (pEntry = readdir(pDirectory)) != NULL) {
+        if (sscanf(pEntry->d_name, "node%d", &node) != 1) {
+            node = ERROR;
+        }
+    }
+
+    closedir(pDirectory);
+    return node;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void placementEnter(int cpu, int fifoPriority, PlacementSaved* pSaved) {
+    pSaved->pinned = false;
+    pSaved->realtime = false;
+    pthread_t self = pthread_self();
+
+    if (cpu >= 0 && pthread_getaffinity_np(self, sizeof(cpu_set_t), &pSaved->cpus) == 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        int status = pthread_setaffinity_np(self, sizeof(cpu_set_t), &cpus);
+        if (status == 0) {
+            pSaved->pinned = true;
+        } else {
+            warnOnce(&sAffinityWarned, "Pinning a routine", status);
+        }
+    }
+
+    if (fifoPriority > 0 && pthread_getschedparam(self, &pSaved->policy, &pSaved->parameters) == 0) {
+        struct sched_param parameters = { .sched_priority = fifoPriority };
+
+        int status = pthread_setschedparam(self, SCHED_FIFO, &parameters);
+        if (status == 0) {
+            pSaved->realtime = true;
+        } else {
+            warnOnce(&sRealtimeWarned, "SCHED_FIFO", status);
+        }
+    }
+}
+
+void placementLeave(const PlacementSaved* pSaved) {
+    pthread_t self = pthread_self();
+    if (pSaved->realtime) {
+        pthread_setschedparam(self, pSaved->policy, &pSaved->parameters);
+    }
+    if (pSaved->pinned) {
+        pthread_setaffinity_np(self, sizeof(cpu_set_t), &pSaved->cpus);
+    }
+}
+
+void placementBindMemory(void* pAddress, size_t length, int cpu) {
+    int node = cpu >= 0 ? nodeOfCpu(cpu) : ERROR;
+    if (node < 0 || node >= (int)(sizeof(unsigned long) * 8) || length == 0) {
+        return;
+    }
+
+    // mbind works on whole pages
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)pAddress & ~(page - 1);
+    uintptr_t end = ((uintptr_t)pAddress + length + page - 1) & ~(page - 1);
+
+    // Preferred rather than bound, a full node still hands out memory elsewhere
+    unsigned long nodes = 1ul << node;
+    if (syscall(SYS_mbind, (void*)start, end - start, MPOL_PREFERRED, &nodes, sizeof(nodes) * 8, MPOL_MF_MOVE) == ERROR
+        && errno != ENOSYS) {
+        perror("mbind failed");
+    }
+}
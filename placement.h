@@ -0,0 +1,30 @@
+#ifndef PLACEMENT_H_
+#define PLACEMENT_H_
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // For cpu_set_t
+#endif
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Routines run as tasks on scheduler workers, so whatever a routine changes about its
+// thread is put back before the worker takes other tasks
+typedef struct PlacementSaved {
+    bool                pinned;
+    cpu_set_t           cpus;
+    bool                realtime;
+    int                 policy;
+    struct sched_param  parameters;
+} PlacementSaved;
+
+// Pin the calling thread to cpu (-1 leaves it) and switch it to SCHED_FIFO at
+// fifoPriority (0 leaves it). What the kernel refuses is reported once and skipped.
+void placementEnter(int cpu, int fifoPriority, PlacementSaved* pSaved);
+void placementLeave(const PlacementSaved* pSaved);
+
+// Prefer cpu's NUMA node for the pages under [pAddress, pAddress + length) and move the
+// ones already touched. Nothing happens for cpu -1 or when the kernel has no NUMA.
+void placementBindMemory(void* pAddress, size_t length, int cpu);
+
+#endif
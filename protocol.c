@@ -0,0 +1,93 @@
+#include "protocol.h"
+#include <arpa/inet.h>
+#include <assert.h>
+#include <string.h>
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static void putUint32(uint8_t* pBuffer, uint32_t value) {
+    value = htonl(value);
+    memcpy(pBuffer, &value, sizeof(value));
+}
+
+static void putUint16(uint8_t* pBuffer, uint16_t value) {
+    value = htons(value);
+    memcpy(pBuffer, &value, sizeof(value));
+}
+
+static uint16_t getUint16(const uint8_t* pBuffer) {
+    uint16_t value;
+    memcpy(&value, pBuffer, sizeof(value));
+    return ntohs(value);
+}
+
+static uint32_t getUint32(const uint8_t* pBuffer) {
+    uint32_t value;
+    memcpy(&value, pBuffer, sizeof(value));
+    return ntohl(value);
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void packetHeaderEncode(const PacketHeader* pHeader, uint8_t* pBuffer) {
+    assert(pHeader != NULL);
+    assert(pBuffer != NULL);
+
+    pBuffer[0] = PACKET_MAGIC;
+    pBuffer[1] = pHeader->flags;
+    putUint16(pBuffer + 2, pHeader->fragment);
+    putUint32(pBuffer + 4, pHeader->sequence);
+    putUint32(pBuffer + 8, pHeader->ack);
+    putUint32(pBuffer + 12, (uint32_t)(pHeader->sackBits >> 32));
+    putUint32(pBuffer + 16, (uint32_t)pHeader->sackBits);
+    putUint32(pBuffer + 20, pHeader->messageId);
+    putUint16(pBuffer + 24, pHeader->window);
+}
+
+bool packetHeaderDecode(PacketHeader* pHeader, const uint8_t* pBuffer, size_t length) {
+    assert(pHeader != NULL);
+
+    if (length < PACKET_HEADER_SIZE || pBuffer[0] != PACKET_MAGIC) {
+        return false;
+    }
+
+    pHeader->flags = pBuffer[1];
+    pHeader->fragment = getUint16(pBuffer + 2);
+    pHeader->sequence = getUint32(pBuffer + 4);
+    pHeader->ack = getUint32(pBuffer + 8);
+    pHeader->sackBits = ((uint64_t)getUint32(pBuffer + 12) << 32) | getUint32(pBuffer + 16);
+    pHeader->messageId = getUint32(pBuffer + 20);
+    pHeader->window = getUint16(pBuffer + 24);
+    return true;
+}
+
+bool bundleAppend(char* pBuffer, size_t* pUsed, size_t capacity, const char* pRecord, size_t length) {
+    if (length > UINT16_MAX || capacity - *pUsed < BUNDLE_RECORD_HEADER + length) {
+        return false;
+    }
+
+    putUint16((uint8_t*)pBuffer + *pUsed, (uint16_t)length);
+    memcpy(pBuffer + *pUsed + BUNDLE_RECORD_HEADER, pRecord, length);
+    *pUsed += BUNDLE_RECORD_HEADER + length;
+    return true;
+}
+
+bool bundleNext(const char* pBuffer, size_t length, size_t* pOffset, const char** ppRecord, size_t* pRecordLength) {
+    if (length - *pOffset < BUNDLE_RECORD_HEADER) {
+        return false;
+    }
+
+    size_t recordLength = getUint16((const uint8_t*)pBuffer + *pOffset);
+    if (length - *pOffset - BUNDLE_RECORD_HEADER < recordLength) {
+        return false;
+    }
+
+    *ppRecord = pBuffer + *pOffset + BUNDLE_RECORD_HEADER;
+    *pRecordLength = recordLength;
+    *pOffset += BUNDLE_RECORD_HEADER + recordLength;
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire header carried in front of every datagram when a framed mode is on.
+// Raw mode (the default) sends the bare text so it stays compatible with older builds.
+//
+//  0      1      2             4             8             12                          20            24       26
+//  +------+------+-------------+-------------+-------------+---------------------------+-------------+--------+
+//  |magic |flags |  fragment   |  sequence   |     ack     |         sack bits         | message id  | window |
+//  +------+------+-------------+-------------+-------------+---------------------------+-------------+--------+
+//
+// All fields are in network byte order.
+#define PACKET_MAGIC 0xA7
+#define PACKET_HEADER_SIZE 26
+
+#define PACKET_FLAG_DATA 0x01       // Payload follows, sequence is valid
+#define PACKET_FLAG_ACK  0x02       // ack and sack bits are valid
+#define PACKET_FLAG_MORE 0x04       // Not the last fragment of its message
+#define PACKET_FLAG_COMPRESSED 0x08 // Payload is a codec id byte and that codec's output
+#define PACKET_FLAG_BUNDLE 0x10     // Payload is several whole messages, see bundleAppend
+
+typedef struct PacketHeader {
+    uint8_t   flags;
+    uint16_t  fragment;             // Index of this fragment within its message
+    uint32_t  sequence;
+    uint32_t  ack;                  // Next sequence expected, everything before it has arrived
+    uint64_t  sackBits;             // Bit i set when ack + 1 + i has arrived out of order
+    uint32_t  messageId;            // Shared by all fragments of one message
+    uint16_t  window;               // With an ack, packets past it the sender has room for (its credit)
+} PacketHeader;
+
+void packetHeaderEncode(const PacketHeader* pHeader, uint8_t* pBuffer);
+
+// Returns false when the bytes are not one of our headers
+bool packetHeaderDecode(PacketHeader* pHeader, const uint8_t* pBuffer, size_t length);
+
+// Bundles pack small messages into one datagram as records, a 16-bit length (network
+// order) followed by the bytes. Returns false when the record doesn't fit capacity.
+#define BUNDLE_RECORD_HEADER 2
+bool bundleAppend(char* pBuffer, size_t* pUsed, size_t capacity, const char* pRecord, size_t length);
+
+// Step through a bundle from *pOffset (start at 0), false at the end or on a malformed record
+bool bundleNext(const char* pBuffer, size_t length, size_t* pOffset, const char** ppRecord, size_t* pRecordLength);
+
+// Wrap-around safe sequence ordering
+static inline bool sequenceBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+#endif
@@ -0,0 +1,376 @@
+#include "reactor.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "clock.h"
+#include "render.h"
+
+#define ERROR -1
+#define MAX_EVENTS 4
+
+//===================================================================================
+// Internal Structs/Enums
+//===================================================================================
+typedef struct Reactor {
+    ThreadPool*  pThreadPool;
+    UDP*         pUdp;
+    int          epollDescriptor;
+    bool         stdinOpen;
+    bool         stdinAlwaysReady;   // Regular files can't be epolled, they are always readable
+    bool         terminal;           // Someone is typing, echo prompts
+    bool         stalled;            // Out of client slots or a peer is backlogged, stdin is paused until that clears
+    bool         running;
+    bool         closing;            // '!' went out, only waiting on the peers' last ACKs
+    uint64_t     giveUp;             // When closing stops waiting, in microseconds
+    bool         signalled;          // Closing on SIGINT/SIGTERM, giveUp is the drain deadline and stays put
+    size_t       queued;             // Still waiting for the peers when giveUp last moved
+    LineReader   reader;             // Stdin split into lines in place
+} Reactor;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static bool acceptingInput(Reactor* pReactor) {
+    return pReactor->running && !pReactor->closing;
+}
+
+static void watchDescriptor(Reactor* pReactor, int descriptor) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = descriptor;
+
+    if (epoll_ctl(pReactor->epollDescriptor, EPOLL_CTL_ADD, descriptor, &event) == ERROR) {
+        if (descriptor == STDIN_FILENO && errno == EPERM) {
+            pReactor->stdinAlwaysReady = true;
+            return;
+        }
+        perror("epoll_ctl failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Queue a line (or one fragment of a long one) that is already sliced into pMessage
+static void addLine(Reactor* pReactor, Message** ppBatch, int* pCount, Message* message) {
+    ppBatch[(*pCount)++] = message;
+
+    // Echo the prompt only for someone typing
+    if (!message->partial && pReactor->terminal) {
+        printf("Me: ");
+    }
+
+    // Terminate connection, after the peers have acknowledged everything in reliable mode
+    if (isTerminationMessage(message)) {
+        printf("Connection Ended\n");
+        pReactor->closing = true;
+        pReactor->giveUp = clockMicroseconds() + RELIABLE_LINGER_MS * 1000u;
+    }
+}
+
+static void flushBatch(Reactor* pReactor, Message** ppBatch, int* pCount) {
+    if (*pCount == 0) {
+        return;
+    }
+
+    udpSendBatch(pReactor->pUdp, ppBatch, *pCount);
+    messagePoolReleaseBatch(&pReactor->pThreadPool->clientPool, ppBatch, *pCount);
+    *pCount = 0;
+}
+
+// Stop or resume reading stdin, level-triggered epoll would spin on input we leave unread
+static void setStalled(Reactor* pReactor, bool stalled) {
+    if (pReactor->stalled == stalled) {
+        return;
+    }
+
+    pReactor->stalled = stalled;
+    if (pReactor->stdinOpen && !pReactor->stdinAlwaysReady) {
+        if (stalled) {
+            epoll_ctl(pReactor->epollDescriptor, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+        } else {
+            watchDescriptor(pReactor, STDIN_FILENO);
+        }
+    }
+}
+
+static void closeInput(Reactor* pReactor) {
+    pReactor->stdinOpen = false;
+    if (!pReactor->stdinAlwaysReady && !pReactor->stalled) {
+        epoll_ctl(pReactor->epollDescriptor, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+    }
+}
+
+//===================================================================================
+// Event Handlers
+//===================================================================================
+
+// Turn buffered input into messages, as far as the client pool allows
+static void processInput(Reactor* pReactor) {
+    MessagePool* pPool = &pReactor->pThreadPool->clientPool;
+    Message* batch[UDP_BATCH_SIZE];
+    int count = 0;
+    bool drained = true;
+
+    // Every complete line becomes a slice of the read buffer, nothing is copied
+    while (acceptingInput(pReactor) && pReactor->stdinOpen) {
+        // A peer is too far behind, the rest waits for ACKs or pacing to drain its queue
+        Message* message = udpBacklogged(pReactor->pUdp) ? NULL : messagePoolTryAcquire(pPool);
+        if (message == NULL) {
+            drained = false;
+            break;
+        }
+
+        if (!lineReaderNext(&pReactor->reader, message)) {
+            messagePoolRelease(pPool, message);
+            break;
+        }
+
+        addLine(pReactor, batch, &count, message);
+        if (count == UDP_BATCH_SIZE) {
+            flushBatch(pReactor, batch, &count);
+        }
+    }
+
+    // End of input or '!', stop watching stdin
+    if (drained && pReactor->stdinOpen && (pReactor->reader.ended || pReactor->closing)) {
+        closeInput(pReactor);
+    }
+
+    flushBatch(pReactor, batch, &count);
+    fflush(stdout);
+
+    // Every slot or a peer's whole queue is waiting on ACKs or pacing, they will free them
+    setStalled(pReactor, !drained);
+}
+
+static void handleInput(Reactor* pReactor) {
+    METRICS_COUNT(METRIC_INPUT_READS, 1);
+    if (lineReaderFill(&pReactor->reader, STDIN_FILENO) == ERROR) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("Read failed");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    processInput(pReactor);
+}
+
+// SIGINT/SIGTERM sends what was already read and then '!' like a typed one, with drainMs
+// for the peers to acknowledge it. A second one stops right away.
+static void handleSignal(Reactor* pReactor) {
+    ThreadPool* pThreadPool = pReactor->pThreadPool;
+    struct signalfd_siginfo info;
+    if (read(pThreadPool->signalDescriptor, &info, sizeof(info)) != (ssize_t)sizeof(info)) {
+        return;
+    }
+
+    if (pReactor->closing) {
+        pReactor->running = false;
+        return;
+    }
+
+    processInput(pReactor);
+    Message* message = pReactor->closing ? NULL : messagePoolTryAcquire(&pThreadPool->clientPool);
+    if (message == NULL) {
+        // Every slot is still out, or the input itself just ended the session
+        pReactor->running = pReactor->closing;
+        return;
+    }
+
+    memcpy(message->data, "!\n", 2);
+    message->length = 2;
+    udpSendBatch(pReactor->pUdp, &message, 1);
+    messagePoolRelease(&pThreadPool->clientPool, message);
+
+    printf("\nConnection Ended\n");
+    fflush(stdout);
+    pReactor->closing = true;
+    pReactor->giveUp = clockMicroseconds() + (uint64_t)pThreadPool->drainMs * 1000u;
+    pReactor->signalled = true;
+    if (pReactor->stdinOpen) {
+        closeInput(pReactor);
+    }
+}
+
+// Busy-poll mode looks without sleeping for busyPollUs before a wait that may block
+static int waitForEvents(Reactor* pReactor, struct epoll_event* pEvents, int timeout) {
+    int busyPollUs = pReactor->pUdp->busyPollUs;
+    if (timeout != 0 && busyPollUs > 0) {
+        uint64_t giveUp = clockMicroseconds() + (uint64_t)busyPollUs;
+        do {
+            int ready = epoll_wait(pReactor->epollDescriptor, pEvents, MAX_EVENTS, 0);
+            if (ready != 0) {
+                return ready;
+            }
+        } while (clockMicroseconds() < giveUp);
+    }
+    return epoll_wait(pReactor->epollDescriptor, pEvents, MAX_EVENTS, timeout);
+}
+
+static void handleDatagrams(Reactor* pReactor) {
+    MessagePool* pPool = &pReactor->pThreadPool->remotePool;
+    Message* messages[UDP_BATCH_SIZE];
+    PacketHeader headers[UDP_BATCH_SIZE];
+    Message* delivered[UDP_DELIVER_CAPACITY];
+
+    // Drain the transport, the event is level triggered so leftovers come back anyway
+    while (pReactor->running) {
+        // Nobody else hands slots back, a full pool can only drop what is waiting
+        int acquired = messagePoolAcquireBatchTimed(pPool, messages, UDP_BATCH_SIZE, 0);
+        if (acquired == ERROR) {
+            pReactor->running = false;
+            break;
+        } else if (acquired == 0) {
+            if (udpDropBatch(pReactor->pUdp, 0) == 0) {
+                break;
+            }
+            continue;
+        }
+
+        int received = udpReceiveBatch(pReactor->pUdp, 0, messages, headers, acquired);
+        messagePoolReleaseBatch(pPool, &messages[received], acquired - received);
+
+        int deliver = udpAcceptBatch(pReactor->pUdp, 0, messages, headers, received, delivered);
+        if (deliver > 0) {
+            renderMessages(pReactor->pUdp, delivered, deliver);
+        }
+        messagePoolReleaseBatch(pPool, delivered, deliver);
+
+        // Every peer has ended its connection
+        if (received > 0 && atomic_load(&pReactor->pUdp->activePeers) == 0) {
+            pReactor->running = false;
+        }
+
+        if (received < acquired) {
+            break;
+        }
+    }
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void reactorRun(ThreadPool* pThreadPool, UDP* pUdp) {
+    assert(pThreadPool != NULL);
+    assert(pUdp != NULL);
+
+    // One per run
+    Reactor* pReactor = malloc(sizeof(Reactor));
+    if (pReactor == NULL) {
+        perror("Reactor allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pReactor->pThreadPool = pThreadPool;
+    pReactor->pUdp = pUdp;
+    pReactor->stdinOpen = true;
+    pReactor->stdinAlwaysReady = false;
+    pReactor->terminal = isatty(STDIN_FILENO);
+    pReactor->stalled = false;
+    pReactor->running = true;
+    pReactor->closing = false;
+    pReactor->giveUp = 0;
+    pReactor->signalled = false;
+    pReactor->queued = 0;
+    lineReaderInitialize(&pReactor->reader, pUdp->framed);
+
+    pReactor->epollDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    if (pReactor->epollDescriptor == ERROR) {
+        perror("epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Set stdin to non-blocking mode, except on a terminal where it shares its open
+    // file with stdout and long prints would fail with EAGAIN
+    if (!pReactor->terminal) {
+        int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+        fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    watchDescriptor(pReactor, STDIN_FILENO);
+    watchDescriptor(pReactor, udpDescriptor(pUdp, 0));
+    watchDescriptor(pReactor, pThreadPool->eventDescriptor);
+    watchDescriptor(pReactor, pThreadPool->signalDescriptor);
+
+    // We have to do this first time or else you see it's blank, only someone typing needs it
+    if (pReactor->terminal) {
+        printf("\nMe: ");
+        fflush(stdout);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (pReactor->running) {
+        // Only a plain file on stdin or a pending retransmission keeps us from sleeping indefinitely
+        int timeout = udpServiceTimers(pUdp);
+        if (pReactor->stdinOpen && pReactor->stdinAlwaysReady && !pReactor->stalled) {
+            timeout = 0;
+        }
+
+        if (pReactor->closing) {
+            // Paced sends still going out keep a typed '!' lingering, a peer that stopped acknowledging doesn't
+            uint64_t now = clockMicroseconds();
+            size_t queued = udpQueued(pUdp);
+            if (queued < pReactor->queued && !pReactor->signalled) {
+                pReactor->giveUp = now + RELIABLE_LINGER_MS * 1000u;
+            }
+            pReactor->queued = queued;
+            if (udpSettled(pUdp) || now >= pReactor->giveUp) {
+                break;
+            }
+            int remaining = (int)((pReactor->giveUp - now + 999) / 1000);
+            if (timeout < 0 || timeout > remaining) {
+                timeout = remaining;
+            }
+        }
+
+        // Same-host peers may already have something waiting, then only look around
+        bool linked = timeout == 0 ? udpPending(pUdp) : !udpPark(pUdp);
+        if (linked) {
+            timeout = 0;
+        }
+
+        int ready = waitForEvents(pReactor, events, timeout);
+        if (ready == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+        METRICS_WAIT(ready);
+
+        for (int i = 0; i < ready && pReactor->running; i++) {
+            int descriptor = events[i].data.fd;
+
+            if (descriptor == pThreadPool->eventDescriptor) {
+                pReactor->running = false;
+            } else if (descriptor == udpDescriptor(pUdp, 0)) {
+                handleDatagrams(pReactor);
+                linked = false;
+            } else if (descriptor == pThreadPool->signalDescriptor) {
+                handleSignal(pReactor);
+            } else if (descriptor == STDIN_FILENO) {
+                handleInput(pReactor);
+            }
+        }
+
+        if (linked && pReactor->running) {
+            handleDatagrams(pReactor);
+        }
+
+        if (acceptingInput(pReactor) && pReactor->stdinOpen && pReactor->stalled) {
+            processInput(pReactor);
+        } else if (acceptingInput(pReactor) && pReactor->stdinOpen && pReactor->stdinAlwaysReady) {
+            handleInput(pReactor);
+        }
+    }
+
+    lineReaderDestroy(&pReactor->reader);
+    close(pReactor->epollDescriptor);
+    free(pReactor);
+}
@@ -0,0 +1,11 @@
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#include "threadPool.h"
+
+// Single-threaded engine: one epoll loop over stdin, the UDP socket and the
+// ThreadPool eventfd and signalfd. Nothing wakes on a timeout, returns once either
+// side ends the connection, a signal's drain is over or threadPoolShutdown is called.
+void reactorRun(ThreadPool* pThreadPool, UDP* pUdp);
+
+#endif
@@ -0,0 +1,167 @@
+#include "reassembly.h"
+#include <assert.h>
+#include <string.h>
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static void clearEntry(Reassembly* pReassembly, ReassemblyEntry* pEntry) {
+    for (int i = 0; i < REASSEMBLY_MAX_FRAGMENTS; i++) {
+        if (pEntry->fragments[i] != NULL) {
+            messageRelease(pEntry->fragments[i]);
+            pEntry->fragments[i] = NULL;
+        }
+    }
+    pReassembly->held -= pEntry->held;
+    pEntry->held = 0;
+    pEntry->used = false;
+}
+
+static ReassemblyEntry* findEntry(Reassembly* pReassembly, const Message* pMessage, uint64_t now) {
+    ReassemblyEntry* pOldest = NULL;
+    ReassemblyEntry* pFree = NULL;
+
+    for (int i = 0; i < REASSEMBLY_ENTRIES; i++) {
+        ReassemblyEntry* pEntry = &pReassembly->entries[i];
+        if (!pEntry->used) {
+            if (pFree == NULL) {
+                pFree = pEntry;
+            }
+            continue;
+        }
+
+        if (pEntry->peer == pMessage->peer && pEntry->messageId == pMessage->messageId) {
+            return pEntry;
+        }
+        if (pOldest == NULL || pEntry->touched < pOldest->touched) {
+            pOldest = pEntry;
+        }
+    }
+
+    // Table full, the stalest message loses
+    if (pFree == NULL) {
+        clearEntry(pReassembly, pOldest);
+        pFree = pOldest;
+    }
+
+    pFree->used = true;
+    pFree->peer = pMessage->peer;
+    pFree->messageId = pMessage->messageId;
+    pFree->base = 0;
+    pFree->lastKnown = false;
+    pFree->last = 0;
+    pFree->held = 0;
+    pFree->touched = now;
+    return pFree;
+}
+
+// The message that went longest without a fragment, other than pExcept
+static ReassemblyEntry* stalestEntry(Reassembly* pReassembly, const ReassemblyEntry* pExcept) {
+    ReassemblyEntry* pStalest = NULL;
+    for (int i = 0; i < REASSEMBLY_ENTRIES; i++) {
+        ReassemblyEntry* pEntry = &pReassembly->entries[i];
+        if (pEntry->used && pEntry != pExcept && pEntry->held > 0
+            && (pStalest == NULL || pEntry->touched < pStalest->touched)) {
+            pStalest = pEntry;
+        }
+    }
+    return pStalest;
+}
+
+// Link the first count fragments into one chain and shift the rest down
+static Message* takePrefix(Reassembly* pReassembly, ReassemblyEntry* pEntry, int count) {
+    Message* pHead = pEntry->fragments[0];
+    for (int i = 0; i < count - 1; i++) {
+        pEntry->fragments[i]->pContinuation = pEntry->fragments[i + 1];
+    }
+
+    memmove(pEntry->fragments, pEntry->fragments + count, (size_t)(REASSEMBLY_MAX_FRAGMENTS - count) * sizeof(Message*));
+    memset(pEntry->fragments + REASSEMBLY_MAX_FRAGMENTS - count, 0, (size_t)count * sizeof(Message*));
+    pEntry->base = (uint16_t)(pEntry->base + count);
+    pEntry->held -= count;
+    pReassembly->held -= count;
+    return pHead;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void reassemblyInitialize(Reassembly* pReassembly, int lanes) {
+    assert(pReassembly != NULL && lanes >= 1);
+    memset(pReassembly, 0, sizeof(Reassembly));
+    pReassembly->limit = REASSEMBLY_MAX_HELD / lanes;
+}
+
+void reassemblyDestroy(Reassembly* pReassembly) {
+    assert(pReassembly != NULL);
+
+    for (int i = 0; i < REASSEMBLY_ENTRIES; i++) {
+        if (pReassembly->entries[i].used) {
+            clearEntry(pReassembly, &pReassembly->entries[i]);
+        }
+    }
+}
+
+Message* reassemblyAdd(Reassembly* pReassembly, Message* pMessage, uint64_t now) {
+    ReassemblyEntry* pEntry = findEntry(pReassembly, pMessage, now);
+    uint16_t offset = (uint16_t)(pMessage->fragment - pEntry->base);
+
+    // Already handed on, or too far ahead to buffer
+    if (offset >= REASSEMBLY_MAX_FRAGMENTS || pEntry->fragments[offset] != NULL) {
+        messageRelease(pMessage);
+        return NULL;
+    }
+
+    // At the limit only a fragment that extends the in-order prefix comes in, it hands at
+    // least itself on. One behind a gap makes room by dropping the stalest other message,
+    // or is dropped itself when there is none.
+    while (offset != 0 && pReassembly->held >= pReassembly->limit) {
+        ReassemblyEntry* pStalest = stalestEntry(pReassembly, pEntry);
+        if (pStalest == NULL) {
+            messageRelease(pMessage);
+            if (pEntry->held == 0) {
+                pEntry->used = false;
+            }
+            return NULL;
+        }
+        clearEntry(pReassembly, pStalest);
+    }
+
+    pEntry->fragments[offset] = pMessage;
+    pEntry->held++;
+    pEntry->touched = now;
+    pReassembly->held++;
+    if (!pMessage->partial) {
+        pEntry->lastKnown = true;
+        pEntry->last = pMessage->fragment;
+    }
+
+    int contiguous = 0;
+    while (contiguous < REASSEMBLY_MAX_FRAGMENTS && pEntry->fragments[contiguous] != NULL) {
+        contiguous++;
+    }
+
+    // Complete
+    if (pEntry->lastKnown && contiguous == (uint16_t)(pEntry->last - pEntry->base) + 1) {
+        Message* pHead = takePrefix(pReassembly, pEntry, contiguous);
+        pEntry->used = false;
+        return pHead;
+    }
+
+    // A long message passes through in pieces, also when the table as a whole runs hot
+    if (contiguous == REASSEMBLY_MAX_FRAGMENTS || (contiguous > 0 && pReassembly->held > pReassembly->limit)) {
+        return takePrefix(pReassembly, pEntry, contiguous);
+    }
+    return NULL;
+}
+
+void reassemblyExpire(Reassembly* pReassembly, uint64_t now) {
+    for (int i = 0; i < REASSEMBLY_ENTRIES; i++) {
+        ReassemblyEntry* pEntry = &pReassembly->entries[i];
+        if (pEntry->used && now - pEntry->touched > REASSEMBLY_TIMEOUT_MS * 1000u) {
+            clearEntry(pReassembly, pEntry);
+        }
+    }
+}
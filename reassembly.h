@@ -0,0 +1,56 @@
+#ifndef REASSEMBLY_H_
+#define REASSEMBLY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "messagePool.h"
+
+// Messages being put back together at once, across all peers
+#define REASSEMBLY_ENTRIES 16
+
+// Fragments buffered per message (64 KB). Longer messages are handed on in pieces of this
+// size as they complete, so any length gets through with bounded memory.
+#define REASSEMBLY_MAX_FRAGMENTS 64
+
+// Fragments held across every lane's table, kept well under the receive pool they share.
+// Nothing is held past a lane's share, fragments behind a gap included.
+#define REASSEMBLY_MAX_HELD (MESSAGE_POOL_CAPACITY / 2)
+
+// An incomplete message that hasn't seen a fragment for this long is dropped
+#define REASSEMBLY_TIMEOUT_MS 2000
+
+typedef struct ReassemblyEntry {
+    bool      used;
+    int       peer;
+    uint32_t  messageId;
+    uint16_t  base;                 // Fragment index of fragments[0]
+    bool      lastKnown;            // The fragment without PACKET_FLAG_MORE has arrived
+    uint16_t  last;
+    int       held;
+    uint64_t  touched;              // Microseconds, last fragment arrival
+    Message*  fragments[REASSEMBLY_MAX_FRAGMENTS];
+} ReassemblyEntry;
+
+// Only the receiving routine (or the reactor) touches it, no lock
+typedef struct Reassembly {
+    ReassemblyEntry  entries[REASSEMBLY_ENTRIES];
+    int              held;
+    int              limit;         // This table's share of REASSEMBLY_MAX_HELD
+} Reassembly;
+
+// One table per lane, sharing REASSEMBLY_MAX_HELD between lanes of them
+void reassemblyInitialize(Reassembly* pReassembly, int lanes);
+
+// Drops whatever is still incomplete
+void reassemblyDestroy(Reassembly* pReassembly);
+
+// Take one fragment (and ownership of it). Returns the head of a chain of slots linked
+// through pContinuation once a message, or a piece of a long one, is ready in order.
+// The last slot's partial flag says whether more of the message will follow.
+Message* reassemblyAdd(Reassembly* pReassembly, Message* pMessage, uint64_t now);
+
+// Drop messages that stopped receiving fragments
+void reassemblyExpire(Reassembly* pReassembly, uint64_t now);
+
+#endif
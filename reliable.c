@@ -0,0 +1,373 @@
+#define _GNU_SOURCE // For struct mmsghdr
+#include "reliable.h"
+#include "threadPool.h"
+#include "clock.h"
+#include <assert.h>
+
+// Keep this many slots free in the receive pool, out-of-order packets beyond it are dropped
+// and retransmitted later rather than starving recvmmsg
+#define RELIABLE_POOL_RESERVE UDP_BATCH_SIZE
+
+// Lower bound on the variance term, the clock granularity of RFC 6298
+#define RELIABLE_GRANULARITY_US 1000
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static InFlight* inFlightAt(Reliable* pReliable, uint32_t sequence) {
+    return &pReliable->window[sequence % RELIABLE_WINDOW];
+}
+
+static Message** reorderAt(Reliable* pReliable, uint32_t sequence) {
+    return &pReliable->reorder[sequence % RELIABLE_WINDOW];
+}
+
+// Packets past the next expected one we have room for: what the peer already has in the
+// reorder buffer plus its share of the free receive slots, the reserve kept back
+static uint16_t receiveCredit(struct UDP* pUdp, uint64_t sackBits) {
+    if (pUdp->pReceivePool == NULL) {
+        return RELIABLE_WINDOW;
+    }
+
+    size_t available = messagePoolAvailable(pUdp->pReceivePool);
+    size_t spare = available > RELIABLE_POOL_RESERVE ? available - RELIABLE_POOL_RESERVE : 0;
+    int peers = atomic_load_explicit(&pUdp->activePeers, memory_order_relaxed);
+    size_t credit = (size_t)__builtin_popcountll(sackBits) + spare / (size_t)(peers > 1 ? peers : 1);
+    return credit < RELIABLE_WINDOW ? (uint16_t)credit : RELIABLE_WINDOW;
+}
+
+// Every outgoing packet carries the current receive state, so data doubles as an ACK
+static void attachAck(struct UDP* pUdp, Reliable* pReliable, PacketHeader* pHeader) {
+    uint64_t sackBits = 0;
+    for (uint32_t i = 0; i < RELIABLE_WINDOW - 1; i++) {
+        if (*reorderAt(pReliable, pReliable->expected + 1 + i) != NULL) {
+            sackBits |= (uint64_t)1 << i;
+        }
+    }
+
+    pHeader->flags |= PACKET_FLAG_ACK;
+    pHeader->ack = pReliable->expected;
+    pHeader->sackBits = sackBits;
+    pHeader->window = receiveCredit(pUdp, sackBits);
+    pReliable->ackPending = false;
+}
+
+// The datagram holds a reference of its own, an ACK may release the window's before it is sent
+static void fillData(struct UDP* pUdp, Reliable* pReliable, Datagram* pDatagram, struct Peer* pPeer, uint32_t sequence) {
+    pDatagram->pPeer = pPeer;
+    pDatagram->pMessage = inFlightAt(pReliable, sequence)->pMessage;
+    messageRetain(pDatagram->pMessage);
+    udpDataHeader(&pDatagram->header, pDatagram->pMessage);
+    pDatagram->header.sequence = sequence;
+    attachAck(pUdp, pReliable, &pDatagram->header);
+}
+
+// Never waits on pacing, but charges it so new data makes room for the repair
+static void retransmit(struct UDP* pUdp, Reliable* pReliable, Datagram* pDatagram, struct Peer* pPeer, uint32_t sequence, uint64_t now) {
+    InFlight* pInFlight = inFlightAt(pReliable, sequence);
+    pInFlight->transmissions++;
+    pInFlight->sentAt = now;
+    pInFlight->deadline = now + pReliable->rto;
+    tokenBucketCharge(&pPeer->pacing, udpDatagramSize(pUdp, pInFlight->pMessage));
+    fillData(pUdp, pReliable, pDatagram, pPeer, sequence);
+}
+
+// A closed window still lets one packet out, the ACK it draws carries the next credit
+static uint32_t sendLimit(const Reliable* pReliable) {
+    return pReliable->credit > 0 ? pReliable->credit : 1;
+}
+
+static void sampleRtt(Reliable* pReliable, uint64_t sample) {
+    if (!pReliable->rttValid) {
+        pReliable->smoothedRtt = sample;
+        pReliable->rttVariance = sample / 2;
+        pReliable->rttValid = true;
+    } else {
+        uint64_t difference = pReliable->smoothedRtt > sample ? pReliable->smoothedRtt - sample : sample - pReliable->smoothedRtt;
+        pReliable->rttVariance = (3 * pReliable->rttVariance + difference) / 4;
+        pReliable->smoothedRtt = (7 * pReliable->smoothedRtt + sample) / 8;
+    }
+
+    uint64_t variance = 4 * pReliable->rttVariance;
+    if (variance < RELIABLE_GRANULARITY_US) {
+        variance = RELIABLE_GRANULARITY_US;
+    }
+
+    uint64_t rto = pReliable->smoothedRtt + variance;
+    if (rto < RELIABLE_MIN_RTO_MS * 1000u) {
+        rto = RELIABLE_MIN_RTO_MS * 1000u;
+    } else if (rto > RELIABLE_MAX_RTO_MS * 1000u) {
+        rto = RELIABLE_MAX_RTO_MS * 1000u;
+    }
+    pReliable->rto = rto;
+}
+
+static bool acknowledges(const PacketHeader* pHeader, uint32_t sequence) {
+    if (sequenceBefore(sequence, pHeader->ack)) {
+        return true;
+    }
+
+    uint32_t offset = sequence - pHeader->ack;
+    return offset > 0 && offset <= 64 && ((pHeader->sackBits >> (offset - 1)) & 1) != 0;
+}
+
+// Release what the ACK covers, then resend holes that enough later packets have overtaken.
+// Returns how many retransmissions were written to pDatagrams.
+static int applyAck(struct UDP* pUdp, Reliable* pReliable, struct Peer* pPeer, const PacketHeader* pHeader, Datagram* pDatagrams, uint64_t now) {
+    uint32_t inFlight = pReliable->nextSequence - pReliable->sendBase;
+
+    // An ACK overtaken by a newer one would hand back credit the receiver no longer has
+    if (!sequenceBefore(pHeader->ack, pReliable->sendBase)) {
+        pReliable->credit = pHeader->window < RELIABLE_WINDOW ? pHeader->window : RELIABLE_WINDOW;
+    }
+
+    for (uint32_t i = 0; i < inFlight; i++) {
+        uint32_t sequence = pReliable->sendBase + i;
+        InFlight* pInFlight = inFlightAt(pReliable, sequence);
+        if (pInFlight->acked || !acknowledges(pHeader, sequence)) {
+            continue;
+        }
+
+        if (pInFlight->transmissions == 1) {
+            sampleRtt(pReliable, now - pInFlight->sentAt);
+        }
+        messageRelease(pInFlight->pMessage);
+        pInFlight->pMessage = NULL;
+        pInFlight->acked = true;
+    }
+
+    // Walk from the newest so we know how many got past each hole
+    int count = 0;
+    int overtaken = 0;
+    for (uint32_t i = inFlight; i > 0; i--) {
+        uint32_t sequence = pReliable->sendBase + i - 1;
+        InFlight* pInFlight = inFlightAt(pReliable, sequence);
+        if (pInFlight->acked) {
+            overtaken++;
+        } else if (overtaken >= RELIABLE_DUPLICATE_THRESHOLD && !pInFlight->fastRetransmitted) {
+            pInFlight->fastRetransmitted = true;
+            retransmit(pUdp, pReliable, &pDatagrams[count++], pPeer, sequence, now);
+        }
+    }
+
+    while (pReliable->sendBase != pReliable->nextSequence && inFlightAt(pReliable, pReliable->sendBase)->acked) {
+        pReliable->sendBase++;
+    }
+    return count;
+}
+
+// Sending happens once the lock is dropped: a full same-host ring waits for the peer, and
+// the ACKs that tell us it caught up need the lock on our receive routine
+static void transmit(struct UDP* pUdp, Datagram* pDatagrams, int count) {
+    if (count == 0) {
+        return;
+    }
+
+    udpTransmit(pUdp, pDatagrams, count);
+    for (int i = 0; i < count; i++) {
+        if (pDatagrams[i].pMessage != NULL) {
+            messageRelease(pDatagrams[i].pMessage);
+        }
+    }
+}
+
+// Caller holds the lock and transmits the *pCount datagrams after dropping it. New data
+// waits on the receiver's credit and the peer's pacing. Returns how many new packets went in.
+static int pumpLocked(struct UDP* pUdp, struct Peer* pPeer, Datagram* pDatagrams, int* pCount, uint64_t now) {
+    Reliable* pReliable = &pPeer->reliable;
+    int pumped = 0;
+
+    while (ringBufferCount(&pPeer->outbound) > 0) {
+        if (pReliable->nextSequence - pReliable->sendBase >= sendLimit(pReliable)) {
+            METRICS_COUNT(METRIC_CREDIT_STALLS, pReliable->credit < RELIABLE_WINDOW);
+            break;
+        }
+        if (!tokenBucketReady(&pPeer->pacing, now)) {
+            METRICS_COUNT(METRIC_PACING_STALLS, 1);
+            break;
+        }
+
+        Message* pMessage = ringBufferTryPop(&pPeer->outbound);
+        if (pMessage == NULL) {
+            break;
+        }
+        tokenBucketCharge(&pPeer->pacing, udpDatagramSize(pUdp, pMessage));
+
+        uint32_t sequence = pReliable->nextSequence++;
+        InFlight* pInFlight = inFlightAt(pReliable, sequence);
+        pInFlight->pMessage = pMessage;
+        pInFlight->sentAt = now;
+        pInFlight->deadline = now + pReliable->rto;
+        pInFlight->transmissions = 1;
+        pInFlight->acked = false;
+        pInFlight->fastRetransmitted = false;
+
+        fillData(pUdp, pReliable, &pDatagrams[(*pCount)++], pPeer, sequence);
+        pumped++;
+    }
+    return pumped;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void reliableInitialize(Reliable* pReliable) {
+    assert(pReliable != NULL);
+
+    memset(pReliable, 0, sizeof(Reliable));
+    pthread_mutex_init(&pReliable->lock, NULL);
+    pReliable->rto = RELIABLE_INITIAL_RTO_MS * 1000u;
+    pReliable->credit = RELIABLE_WINDOW;
+}
+
+void reliableDestroy(Reliable* pReliable) {
+    assert(pReliable != NULL);
+
+    for (int i = 0; i < RELIABLE_WINDOW; i++) {
+        if (pReliable->window[i].pMessage != NULL) {
+            messageRelease(pReliable->window[i].pMessage);
+            pReliable->window[i].pMessage = NULL;
+        }
+        if (pReliable->reorder[i] != NULL) {
+            messageRelease(pReliable->reorder[i]);
+            pReliable->reorder[i] = NULL;
+        }
+    }
+    pthread_mutex_destroy(&pReliable->lock);
+}
+
+int reliablePump(struct UDP* pUdp, struct Peer* pPeer) {
+    Datagram datagrams[RELIABLE_WINDOW];
+    int count = 0;
+
+    pthread_mutex_lock(&pPeer->reliable.lock);
+    int pumped = pumpLocked(pUdp, pPeer, datagrams, &count, clockMicroseconds());
+    pthread_mutex_unlock(&pPeer->reliable.lock);
+
+    transmit(pUdp, datagrams, count);
+    return pumped;
+}
+
+int reliableReceive(struct UDP* pUdp, struct Peer* pPeer, const PacketHeader* pHeader, Message* pMessage, Message** ppDeliver) {
+    Reliable* pReliable = &pPeer->reliable;
+    Datagram datagrams[2 * RELIABLE_WINDOW];
+    int count = 0;
+    int delivered = 0;
+
+    pthread_mutex_lock(&pReliable->lock);
+
+    // The ACK may open the window, send what was waiting along with any fast retransmissions
+    if (pHeader->flags & PACKET_FLAG_ACK) {
+        uint64_t now = clockMicroseconds();
+        count = applyAck(pUdp, pReliable, pPeer, pHeader, datagrams, now);
+        pumpLocked(pUdp, pPeer, datagrams, &count, now);
+    }
+
+    if (!(pHeader->flags & PACKET_FLAG_DATA)) {
+        messageRelease(pMessage);
+        pthread_mutex_unlock(&pReliable->lock);
+        transmit(pUdp, datagrams, count);
+        return 0;
+    }
+
+    // Duplicates and out-of-window packets still get re-acknowledged
+    pReliable->ackPending = true;
+    uint32_t offset = pHeader->sequence - pReliable->expected;
+    Message** ppSlot = reorderAt(pReliable, pHeader->sequence);
+
+    if (sequenceBefore(pHeader->sequence, pReliable->expected) || offset >= RELIABLE_WINDOW || *ppSlot != NULL) {
+        messageRelease(pMessage);
+    } else if (offset == 0) {
+        // In order, along with whatever it was holding up
+        ppDeliver[delivered++] = pMessage;
+        pReliable->expected++;
+
+        while ((ppSlot = reorderAt(pReliable, pReliable->expected), *ppSlot != NULL)) {
+            ppDeliver[delivered++] = *ppSlot;
+            *ppSlot = NULL;
+            pReliable->expected++;
+        }
+    } else if (messagePoolAvailable(pMessage->pPool) < RELIABLE_POOL_RESERVE) {
+        METRICS_COUNT(METRIC_REORDER_DROPS, 1);
+        messageRelease(pMessage);
+    } else {
+        *ppSlot = pMessage;
+    }
+
+    pthread_mutex_unlock(&pReliable->lock);
+    transmit(pUdp, datagrams, count);
+    return delivered;
+}
+
+void reliableFlushAck(struct UDP* pUdp, struct Peer* pPeer) {
+    Reliable* pReliable = &pPeer->reliable;
+
+    Datagram datagram;
+    int count = 0;
+
+    pthread_mutex_lock(&pReliable->lock);
+    if (pReliable->ackPending) {
+        datagram.pPeer = pPeer;
+        datagram.pMessage = NULL;
+        memset(&datagram.header, 0, sizeof(datagram.header));
+        attachAck(pUdp, pReliable, &datagram.header);
+        count = 1;
+    }
+    pthread_mutex_unlock(&pReliable->lock);
+    transmit(pUdp, &datagram, count);
+}
+
+uint64_t reliableService(struct UDP* pUdp, struct Peer* pPeer, uint64_t now) {
+    Reliable* pReliable = &pPeer->reliable;
+    Datagram datagrams[RELIABLE_WINDOW];
+    int count = 0;
+    uint64_t next = 0;
+
+    pthread_mutex_lock(&pReliable->lock);
+
+    uint32_t inFlight = pReliable->nextSequence - pReliable->sendBase;
+    for (uint32_t i = 0; i < inFlight; i++) {
+        uint32_t sequence = pReliable->sendBase + i;
+        InFlight* pInFlight = inFlightAt(pReliable, sequence);
+        if (pInFlight->acked) {
+            continue;
+        }
+
+        if (pInFlight->deadline <= now) {
+            // Back off once per expiry round, not once per packet
+            if (count == 0 && pReliable->rto < RELIABLE_MAX_RTO_MS * 1000u) {
+                pReliable->rto *= 2;
+                if (pReliable->rto > RELIABLE_MAX_RTO_MS * 1000u) {
+                    pReliable->rto = RELIABLE_MAX_RTO_MS * 1000u;
+                }
+            }
+            retransmit(pUdp, pReliable, &datagrams[count++], pPeer, sequence, now);
+        }
+
+        if (next == 0 || pInFlight->deadline < next) {
+            next = pInFlight->deadline;
+        }
+    }
+
+    // Tokens may have come in since the last send, and if not, say when they will
+    pumpLocked(pUdp, pPeer, datagrams, &count, now);
+    if (ringBufferCount(&pPeer->outbound) > 0 && pReliable->nextSequence - pReliable->sendBase < sendLimit(pReliable)) {
+        uint64_t paced = now + tokenBucketDelay(&pPeer->pacing, now);
+        if (next == 0 || paced < next) {
+            next = paced;
+        }
+    }
+
+    pthread_mutex_unlock(&pReliable->lock);
+    transmit(pUdp, datagrams, count);
+    return next;
+}
+
+bool reliableSettled(struct Peer* pPeer) {
+    pthread_mutex_lock(&pPeer->reliable.lock);
+    bool settled = pPeer->reliable.sendBase == pPeer->reliable.nextSequence && ringBufferCount(&pPeer->outbound) == 0;
+    pthread_mutex_unlock(&pPeer->reliable.lock);
+    return settled;
+}
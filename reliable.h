@@ -0,0 +1,84 @@
+#ifndef RELIABLE_H_
+#define RELIABLE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "messagePool.h"
+#include "protocol.h"
+
+// Packets in flight per peer, the receiver's reorder buffer is the same size
+// so one 64 bit SACK field always covers it
+#define RELIABLE_WINDOW 64
+
+// Retransmission timeout bounds (RFC 6298 estimator, tightened for LAN latencies)
+#define RELIABLE_INITIAL_RTO_MS 200
+#define RELIABLE_MIN_RTO_MS 10
+#define RELIABLE_MAX_RTO_MS 2000
+
+// Later packets SACKed before an unacknowledged one is resent without waiting for its timer
+#define RELIABLE_DUPLICATE_THRESHOLD 3
+
+// How long a closing side keeps retransmitting for its peers to catch up
+#define RELIABLE_LINGER_MS 2000
+
+struct UDP;
+struct Peer;
+
+// One sent, not yet acknowledged packet
+typedef struct InFlight {
+    Message*  pMessage;             // Reference held until acknowledged
+    uint64_t  sentAt;               // Microseconds, last transmission
+    uint64_t  deadline;             // Retransmit when reached
+    int       transmissions;        // RTT is only sampled from packets sent once (Karn)
+    bool      acked;
+    bool      fastRetransmitted;
+} InFlight;
+
+// Per-peer state for the reliable mode, sender and receiver halves share the lock since
+// both the sending and the receiving routine touch them
+typedef struct Reliable {
+    pthread_mutex_t  lock;
+
+    // Sender
+    uint32_t         sendBase;       // Oldest unacknowledged sequence
+    uint32_t         nextSequence;
+    InFlight         window[RELIABLE_WINDOW];
+    uint64_t         smoothedRtt;    // Microseconds
+    uint64_t         rttVariance;
+    uint64_t         rto;
+    bool             rttValid;
+    uint16_t         credit;         // Packets past sendBase the peer last said it has room for
+
+    // Receiver
+    uint32_t         expected;       // Everything before this has been delivered
+    Message*         reorder[RELIABLE_WINDOW];
+    bool             ackPending;     // Received something not yet acknowledged
+} Reliable;
+
+void reliableInitialize(Reliable* pReliable);
+
+// Drops the references still held by the window and the reorder buffer
+void reliableDestroy(Reliable* pReliable);
+
+// Move what the window, the peer's credit and its pacing allow from the outbound queue onto
+// the wire, returns how many
+int reliablePump(struct UDP* pUdp, struct Peer* pPeer);
+
+// Take one received packet (and ownership of pMessage). Acknowledgements are applied and
+// in-order data, including anything it unblocks from the reorder buffer, is appended to
+// ppDeliver. Returns how many were appended, at most RELIABLE_WINDOW.
+int reliableReceive(struct UDP* pUdp, struct Peer* pPeer, const PacketHeader* pHeader, Message* pMessage, Message** ppDeliver);
+
+// Send a bare ACK if nothing outgoing has carried one since data arrived
+void reliableFlushAck(struct UDP* pUdp, struct Peer* pPeer);
+
+// Resend what timed out and send what pacing held back, returns the next deadline in
+// microseconds or 0 when nothing is in flight or queued
+uint64_t reliableService(struct UDP* pUdp, struct Peer* pPeer, uint64_t now);
+
+// Nothing queued or waiting for an acknowledgement
+bool reliableSettled(struct Peer* pPeer);
+
+#endif
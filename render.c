@@ -0,0 +1,179 @@
+#include "render.h"
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "clock.h"
+
+#define ERROR -1
+
+static const char sClearLine[] = "\r\033[K";
+static const char sRemote[] = "Remote: ";
+static const char sPrompt[] = "Me: ";
+
+// Everything one batch puts on the screen, text only holds the formatted prefixes
+typedef struct RenderBuffer {
+    struct iovec  vectors[RENDER_VECTORS];
+    int           count;
+    char          text[RENDER_TEXT_SIZE];
+    size_t        used;
+} RenderBuffer;
+
+// Settled on the first batch, escape codes are only for terminals
+static int sTerminal = -1;
+static uint64_t sLastPrompt = 0;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static void writeVectors(struct iovec* pVectors, int count) {
+    while (count > 0) {
+        ssize_t written = writev(STDOUT_FILENO, pVectors, count);
+        if (written == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("writev failed");
+            return;
+        }
+
+        // Skip what went out, a short write can stop in the middle of a vector
+        while (count > 0 && (size_t)written >= pVectors->iov_len) {
+            written -= (ssize_t)pVectors->iov_len;
+            pVectors++;
+            count--;
+        }
+        if (count > 0) {
+            pVectors->iov_base = (char*)pVectors->iov_base + written;
+            pVectors->iov_len -= (size_t)written;
+        }
+    }
+}
+
+static void flushBuffer(RenderBuffer* pBuffer) {
+    writeVectors(pBuffer->vectors, pBuffer->count);
+    pBuffer->count = 0;
+    pBuffer->used = 0;
+}
+
+static void appendBytes(RenderBuffer* pBuffer, const void* pBytes, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (pBuffer->count == RENDER_VECTORS) {
+        flushBuffer(pBuffer);
+    }
+
+    pBuffer->vectors[pBuffer->count].iov_base = (void*)pBytes;
+    pBuffer->vectors[pBuffer->count++].iov_len = length;
+}
+
+// The "Remote:" prefix, naming the peer when there are several. Our own lines replayed
+// from the log get the prompt's.
+static void appendPrefix(RenderBuffer* pBuffer, UDP* pUdp, const Message* pMessage) {
+    if (pMessage->outgoing) {
+        appendBytes(pBuffer, sPrompt, sizeof(sPrompt) - 1);
+        return;
+    }
+    if (pUdp->peerCount == 1) {
+        appendBytes(pBuffer, sRemote, sizeof(sRemote) - 1);
+        return;
+    }
+
+    // Flush first so the vector can't be sent before its text is written
+    if (pBuffer->count == RENDER_VECTORS || RENDER_TEXT_SIZE - pBuffer->used < MAX_MACHINE_NAME + 16) {
+        flushBuffer(pBuffer);
+    }
+
+    Peer* pPeer = &pUdp->peers[pMessage->peer];
+    char* pText = pBuffer->text + pBuffer->used;
+    int length = snprintf(pText, RENDER_TEXT_SIZE - pBuffer->used, "Remote %s:%u: ", pPeer->remoteMachineName, pPeer->remotePort);
+    pBuffer->used += (size_t)length;
+    appendBytes(pBuffer, pText, (size_t)length);
+}
+
+// Every complete message gets its own line, even a truncated one
+static void appendLine(RenderBuffer* pBuffer, const char* pLine, size_t length) {
+    appendBytes(pBuffer, pLine, length);
+    if (length == 0 || pLine[length - 1] != '\n') {
+        appendBytes(pBuffer, "\n", 1);
+    }
+}
+
+// A coalesced datagram prints like the messages it was made of
+static void appendBundle(RenderBuffer* pBuffer, UDP* pUdp, const Message* pMessage) {
+    const char* pRecord;
+    size_t length;
+    size_t offset = 0;
+    while (bundleNext(pMessage->pData, pMessage->length, &offset, &pRecord, &length)) {
+        appendPrefix(pBuffer, pUdp, pMessage);
+        appendLine(pBuffer, pRecord, length);
+    }
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void renderMessages(UDP* pUdp, Message** ppMessages, int count) {
+    if (count <= 0) {
+        return;
+    }
+
+    uint64_t start = METRICS_NOW();
+    if (sTerminal < 0) {
+        sTerminal = isatty(STDOUT_FILENO);
+    }
+
+    RenderBuffer buffer;
+    buffer.count = 0;
+    buffer.used = 0;
+
+    // The keyboard side prints through stdio, get that out first
+    fflush(stdout);
+
+    // Clear the prompt line once and move the cursor to the beginning
+    if (sTerminal && ppMessages[0]->fragment == 0) {
+        appendBytes(&buffer, sClearLine, sizeof(sClearLine) - 1);
+    }
+
+    bool complete = true;
+    for (int i = 0; i < count; i++) {
+        Message* pMessage = ppMessages[i];
+
+        if (pMessage->bundle) {
+            appendBundle(&buffer, pUdp, pMessage);
+            complete = true;
+            continue;
+        }
+
+        // A piece that continues a long message picks up where the last one stopped
+        if (pMessage->fragment == 0) {
+            appendPrefix(&buffer, pUdp, pMessage);
+        }
+
+        // Reassembled messages are a chain of slots, the last one ends the line
+        Message* pLast = pMessage;
+        for (; pLast->pContinuation != NULL; pLast = pLast->pContinuation) {
+            appendBytes(&buffer, pLast->pData, pLast->length);
+        }
+
+        complete = !pLast->partial;
+        if (complete) {
+            appendLine(&buffer, pLast->pData, pLast->length);
+        } else {
+            appendBytes(&buffer, pLast->pData, pLast->length);
+        }
+    }
+
+    // Redraw the "Me:" prompt once the batch ends on a complete message, rate-limited
+    // when no one is looking at it
+    uint64_t now = clockMicroseconds();
+    if (complete && (sTerminal || now - sLastPrompt >= RENDER_PROMPT_INTERVAL_MS * 1000u)) {
+        appendBytes(&buffer, sPrompt, sizeof(sPrompt) - 1);
+        sLastPrompt = now;
+    }
+
+    flushBuffer(&buffer);
+    METRICS_RECORD(METRIC_STAGE_RENDER, start);
+}
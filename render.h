@@ -0,0 +1,18 @@
+#ifndef RENDER_H_
+#define RENDER_H_
+
+#include "threadPool.h"
+
+// Vectors and prefix bytes gathered before a writev has to go out
+#define RENDER_VECTORS 256
+#define RENDER_TEXT_SIZE 8192
+
+// Prompt redraws when stdout is not a terminal, at most one per interval
+#define RENDER_PROMPT_INTERVAL_MS 100
+
+// Print received messages with one writev, payloads are written straight from their slots.
+// The prompt is redrawn once per batch. Reassembled messages are chains of slots.
+// Only one thread may render at a time (screenOutputRoutine or the reactor).
+void renderMessages(UDP* pUdp, Message** ppMessages, int count);
+
+#endif
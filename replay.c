@@ -0,0 +1,201 @@
+#define _GNU_SOURCE // For struct mmsghdr and localtime_r
+#include "replay.h"
+#include <inttypes.h>
+#include <time.h>
+
+#include "messageLog.h"
+#include "render.h"
+
+#define ERROR -1
+
+// One end of the range
+typedef struct ReplayBound {
+    bool      set;
+    bool      time;
+    uint64_t  value;    // Sequence number or microseconds since the epoch
+} ReplayBound;
+
+// Only peerCount and the names are read by the render path, and inbound by sanitizing
+static UDP sReplayUdp;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static bool parseBound(const char* pText, size_t length, ReplayBound* pBound) {
+    char text[32];
+    pBound->set = length > 0;
+    if (length == 0) {
+        return true;
+    }
+    if (length >= sizeof(text)) {
+        return false;
+    }
+    memcpy(text, pText, length);
+    text[length] = '\0';
+
+    char* pEnd;
+    pBound->time = text[0] == '@';
+    if (pBound->time) {
+        double seconds = strtod(text + 1, &pEnd);
+        pBound->value = (uint64_t)(seconds * 1000000.0);
+        return pEnd != text + 1 && *pEnd == '\0' && seconds >= 0;
+    }
+
+    pBound->value = strtoull(text, &pEnd, 10);
+    return pEnd != text && *pEnd == '\0';
+}
+
+static bool parseRange(const char* range, ReplayBound* pFirst, ReplayBound* pLast) {
+    const char* pDash = strchr(range, '-');
+    if (pDash == NULL) {
+        // A single bound replays just that
+        return parseBound(range, strlen(range), pFirst) && parseBound(range, strlen(range), pLast) && pFirst->set;
+    }
+    return parseBound(range, (size_t)(pDash - range), pFirst) && parseBound(pDash + 1, strlen(pDash + 1), pLast);
+}
+
+static bool pastLast(const LogRecord* pRecord, const ReplayBound* pLast) {
+    if (!pLast->set) {
+        return false;
+    }
+    return pLast->time ? pRecord->timestamp > pLast->value : pRecord->sequence > pLast->value;
+}
+
+// Peers are whoever shows up in the log, the ones past MAX_PEERS share the last slot
+static int replayPeer(uint32_t address, uint16_t port) {
+    for (int i = 0; i < sReplayUdp.peerCount; i++) {
+        Peer* pPeer = &sReplayUdp.peers[i];
+        if (pPeer->remoteAddress.sin_addr.s_addr == address && pPeer->remotePort == port) {
+            return i;
+        }
+    }
+    if (sReplayUdp.peerCount == MAX_PEERS) {
+        return MAX_PEERS - 1;
+    }
+
+    Peer* pPeer = &sReplayUdp.peers[sReplayUdp.peerCount];
+    pPeer->remoteAddress.sin_addr.s_addr = address;
+    pPeer->remotePort = port;
+    inet_ntop(AF_INET, &pPeer->remoteAddress.sin_addr, pPeer->remoteMachineName, MAX_MACHINE_NAME);
+    return sReplayUdp.peerCount++;
+}
+
+// A record back into slots the way it arrived, long ones as a chain. Only whatever the
+// whole pool holds makes it in.
+static Message* loadRecord(MessagePool* pPool, const LogRecord* pRecord) {
+    Message* pMessage = messagePoolTryAcquire(pPool);
+    if (pMessage == NULL) {
+        return NULL;
+    }
+
+    pMessage->outgoing = (pRecord->flags & LOG_FLAG_SENT) != 0;
+    pMessage->peer = pMessage->outgoing ? ERROR : replayPeer(pRecord->peerAddress, pRecord->peerPort);
+    pMessage->fragment = pRecord->fragment;
+    pMessage->bundle = (pRecord->flags & LOG_FLAG_BUNDLE) != 0;
+
+    const char* pPayload = (const char*)(pRecord + 1);
+    size_t offset = 0;
+    Message* pLast = pMessage;
+    while (1) {
+        size_t length = pRecord->length - offset < MAX_CHAR_COUNT ? pRecord->length - offset : MAX_CHAR_COUNT;
+        memcpy(pLast->data, pPayload + offset, length);
+        pLast->length = length;
+        offset += length;
+
+        Message* pNext = offset < pRecord->length ? messagePoolTryAcquire(pPool) : NULL;
+        if (pNext == NULL) {
+            break;
+        }
+        pLast->pContinuation = pNext;
+        pLast = pNext;
+    }
+
+    pLast->partial = (pRecord->flags & LOG_FLAG_PARTIAL) != 0;
+    return pMessage;
+}
+
+// Cleaned like a live batch, the log holds what came off the wire
+static void replayBatch(MessagePool* pPool, Message** ppMessages, int count) {
+    sanitizeMessages(ppMessages, count, sReplayUdp.inbound);
+    renderMessages(&sReplayUdp, ppMessages, count);
+    messagePoolReleaseBatch(pPool, ppMessages, count);
+}
+
+static void formatTime(char* pText, size_t size, uint64_t timestamp) {
+    time_t seconds = (time_t)(timestamp / 1000000u);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    size_t length = strftime(pText, size, "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(pText + length, size - length, ".%06u", (unsigned int)(timestamp % 1000000u));
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+int replayLog(const char* directory, const char* range) {
+    ReplayBound first;
+    ReplayBound last;
+    if (!parseRange(range, &first, &last)) {
+        printf("Replay range must look like 100-200, 100- or @1700000000-@1700000060.\n");
+        return EXIT_FAILURE;
+    }
+
+    LogReader reader;
+    if (!logReaderOpen(&reader, directory)) {
+        printf("No message log in %s.\n", directory);
+        return EXIT_FAILURE;
+    }
+
+    bool found = true;
+    if (first.set) {
+        found = first.time ? logReaderSeekTime(&reader, first.value) : logReaderSeekSequence(&reader, first.value);
+    }
+
+    MessagePool pool;
+    messagePoolInitialize(&pool, MESSAGE_POOL_CAPACITY);
+
+    Message* batch[REPLAY_BATCH];
+    int batched = 0;
+    uint64_t replayed = 0;
+    uint64_t firstSequence = 0;
+    uint64_t lastSequence = 0;
+    uint64_t firstTime = 0;
+    uint64_t lastTime = 0;
+
+    const LogRecord* pRecord;
+    while (found && (pRecord = logReaderNext(&reader)) != NULL && !pastLast(pRecord, &last)) {
+        // Render what is waiting when the pool can't hold the whole record
+        size_t slots = pRecord->length / MAX_CHAR_COUNT + 1;
+        if (batched == REPLAY_BATCH || (batched > 0 && messagePoolAvailable(&pool) < slots)) {
+            replayBatch(&pool, batch, batched);
+            batched = 0;
+        }
+        batch[batched++] = loadRecord(&pool, pRecord);
+
+        if (replayed++ == 0) {
+            firstSequence = pRecord->sequence;
+            firstTime = pRecord->timestamp;
+        }
+        lastSequence = pRecord->sequence;
+        lastTime = pRecord->timestamp;
+    }
+
+    replayBatch(&pool, batch, batched);
+    messagePoolDestroy(&pool);
+    logReaderClose(&reader);
+
+    if (replayed == 0) {
+        fprintf(stderr, "\nNothing in %s falls in %s\n", directory, range);
+        return EXIT_SUCCESS;
+    }
+
+    char from[64];
+    char to[64];
+    formatTime(from, sizeof(from), firstTime);
+    formatTime(to, sizeof(to), lastTime);
+    fprintf(stderr, "\nReplayed %" PRIu64 " messages, %" PRIu64 "-%" PRIu64 " from %s to %s\n",
+            replayed, firstSequence, lastSequence, from, to);
+    return EXIT_SUCCESS;
+}
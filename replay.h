@@ -0,0 +1,14 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+// Messages per render batch
+#define REPLAY_BATCH 64
+
+// Print a range of a message log through the normal render path, ours with the "Me:"
+// prefix and everyone else's named by the address they came from.
+// range is "first-last", either side may be left out. Plain numbers are sequence numbers,
+// an '@' makes it seconds since the epoch (fractions allowed), like "@1700000000.5-".
+// Returns EXIT_SUCCESS or EXIT_FAILURE for main.
+int replayLog(const char* directory, const char* range);
+
+#endif
@@ -0,0 +1,224 @@
+#include "ringBuffer.h"
+#include "futex.h"
+#include "metrics.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//===================================================================================
+// Parking Helpers
+//===================================================================================
+
+// Announce we are about to sleep, the seq_cst fence pairs with the one in wakeParked
+// so either we see the other side's update or it sees our flag
+static void announcePark(atomic_uint* pParked) {
+    atomic_store_explicit(pParked, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void cancelPark(atomic_uint* pParked) {
+    atomic_store_explicit(pParked, 0, memory_order_relaxed);
+}
+
+static void wakeParked(atomic_uint* pParked) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(pParked, memory_order_relaxed) != 0) {
+        atomic_store_explicit(pParked, 0, memory_order_relaxed);
+        futexWake(pParked, 1);
+        METRICS_COUNT(METRIC_QUEUE_WAKES, 1);
+    }
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void ringBufferInitialize(RingBuffer* pRing, size_t capacity) {
+    assert(pRing != NULL);
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+    pRing->ppSlots = calloc(capacity, sizeof(void*));
+    if (pRing->ppSlots == NULL) {
+        perror("Ring allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pRing->mask = capacity - 1;
+    pRing->cachedTail = 0;
+    pRing->cachedHead = 0;
+    atomic_init(&pRing->head, 0);
+    atomic_init(&pRing->tail, 0);
+    atomic_init(&pRing->consumerParked, 0);
+    atomic_init(&pRing->producerParked, 0);
+    atomic_init(&pRing->closed, false);
+}
+
+void ringBufferDestroy(RingBuffer* pRing) {
+    assert(pRing != NULL);
+    free(pRing->ppSlots);
+    pRing->ppSlots = NULL;
+}
+
+size_t ringBufferTryPushBatch(RingBuffer* pRing, void** ppItems, size_t count) {
+    size_t tail = atomic_load_explicit(&pRing->tail, memory_order_relaxed);
+    size_t capacity = pRing->mask + 1;
+
+    // Only refresh the consumer index when our cached copy says we are out of room
+    size_t space = capacity - (tail - pRing->cachedHead);
+    if (space < count) {
+        pRing->cachedHead = atomic_load_explicit(&pRing->head, memory_order_acquire);
+        space = capacity - (tail - pRing->cachedHead);
+    }
+
+    if (count > space) {
+        count = space;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        pRing->ppSlots[(tail + i) & pRing->mask] = ppItems[i];
+    }
+
+    // One publish and at most one wake for the whole batch
+    atomic_store_explicit(&pRing->tail, tail + count, memory_order_release);
+    wakeParked(&pRing->consumerParked);
+    return count;
+}
+
+size_t ringBufferTryPopBatch(RingBuffer* pRing, void** ppItems, size_t max) {
+    size_t head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+
+    // Only refresh the producer index when our cached copy says we are short
+    size_t ready = pRing->cachedTail - head;
+    if (ready < max) {
+        pRing->cachedTail = atomic_load_explicit(&pRing->tail, memory_order_acquire);
+        ready = pRing->cachedTail - head;
+    }
+
+    if (ready > max) {
+        ready = max;
+    }
+    if (ready == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < ready; i++) {
+        ppItems[i] = pRing->ppSlots[(head + i) & pRing->mask];
+    }
+
+    atomic_store_explicit(&pRing->head, head + ready, memory_order_release);
+    wakeParked(&pRing->producerParked);
+    return ready;
+}
+
+bool ringBufferTryPush(RingBuffer* pRing, void* pItem) {
+    return ringBufferTryPushBatch(pRing, &pItem, 1) == 1;
+}
+
+void* ringBufferTryPop(RingBuffer* pRing) {
+    void* pItem = NULL;
+    ringBufferTryPopBatch(pRing, &pItem, 1);
+    return pItem;
+}
+
+size_t ringBufferPushBatch(RingBuffer* pRing, void** ppItems, size_t count) {
+    size_t pushed = 0;
+
+    while (pushed < count && !atomic_load_explicit(&pRing->closed, memory_order_acquire)) {
+        pushed += ringBufferTryPushBatch(pRing, ppItems + pushed, count - pushed);
+        if (pushed == count) {
+            break;
+        }
+
+        // Full, park until the consumer frees a slot
+        announcePark(&pRing->producerParked);
+        size_t tail = atomic_load_explicit(&pRing->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+        if (tail - head <= pRing->mask || atomic_load(&pRing->closed)) {
+            cancelPark(&pRing->producerParked);
+            continue;
+        }
+        futexWait(&pRing->producerParked, 1, -1);
+        METRICS_COUNT(METRIC_QUEUE_PARKS, 1);
+    }
+
+    return pushed;
+}
+
+size_t ringBufferPopBatch(RingBuffer* pRing, void** ppItems, size_t max) {
+    while (!atomic_load_explicit(&pRing->closed, memory_order_acquire)) {
+        size_t popped = ringBufferTryPopBatch(pRing, ppItems, max);
+        if (popped > 0) {
+            return popped;
+        }
+
+        // Empty, park until the producer publishes
+        announcePark(&pRing->consumerParked);
+        size_t head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+        if (atomic_load_explicit(&pRing->tail, memory_order_relaxed) != head || atomic_load(&pRing->closed)) {
+            cancelPark(&pRing->consumerParked);
+            continue;
+        }
+        futexWait(&pRing->consumerParked, 1, -1);
+        METRICS_COUNT(METRIC_QUEUE_PARKS, 1);
+    }
+
+    return 0;
+}
+
+size_t ringBufferPopBatchTimed(RingBuffer* pRing, void** ppItems, size_t max, int milliseconds) {
+    if (atomic_load_explicit(&pRing->closed, memory_order_acquire)) {
+        return 0;
+    }
+
+    size_t popped = ringBufferTryPopBatch(pRing, ppItems, max);
+    if (popped > 0 || milliseconds == 0) {
+        return popped;
+    }
+
+    // Same handshake as PopBatch, but a single bounded sleep
+    announcePark(&pRing->consumerParked);
+    size_t head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+    if (atomic_load_explicit(&pRing->tail, memory_order_relaxed) == head && !atomic_load(&pRing->closed)) {
+        futexWait(&pRing->consumerParked, 1, milliseconds);
+        METRICS_COUNT(METRIC_QUEUE_PARKS, 1);
+    }
+    cancelPark(&pRing->consumerParked);
+
+    if (atomic_load_explicit(&pRing->closed, memory_order_acquire)) {
+        return 0;
+    }
+    return ringBufferTryPopBatch(pRing, ppItems, max);
+}
+
+bool ringBufferPush(RingBuffer* pRing, void* pItem) {
+    return ringBufferPushBatch(pRing, &pItem, 1) == 1;
+}
+
+void* ringBufferPop(RingBuffer* pRing) {
+    void* pItem = NULL;
+    ringBufferPopBatch(pRing, &pItem, 1);
+    return pItem;
+}
+
+void ringBufferClose(RingBuffer* pRing) {
+    atomic_store(&pRing->closed, true);
+
+    // Unconditional wake, whichever side is parked must observe the close
+    atomic_store(&pRing->consumerParked, 0);
+    futexWake(&pRing->consumerParked, 1);
+    atomic_store(&pRing->producerParked, 0);
+    futexWake(&pRing->producerParked, 1);
+}
+
+bool ringBufferClosed(RingBuffer* pRing) {
+    return atomic_load_explicit(&pRing->closed, memory_order_acquire);
+}
+
+size_t ringBufferCount(RingBuffer* pRing) {
+    size_t tail = atomic_load_explicit(&pRing->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&pRing->head, memory_order_acquire);
+    return tail - head;
+}
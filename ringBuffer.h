@@ -0,0 +1,62 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Bounded single-producer/single-consumer queue of pointers.
+// Head and tail live on their own cache lines so the two sides never share a line,
+// and each side keeps a cached copy of the other's index to avoid reading it every call.
+// A side only pays for a futex syscall when the other one is actually parked.
+typedef struct RingBuffer {
+    // Consumer side
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    size_t         cachedTail;
+    atomic_uint    consumerParked;
+
+    // Producer side
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+    size_t         cachedHead;
+    atomic_uint    producerParked;
+
+    // Read mostly
+    _Alignas(CACHE_LINE_SIZE) void** ppSlots;
+    size_t         mask;
+    atomic_bool    closed;
+} RingBuffer;
+
+// Capacity must be a power of two
+void ringBufferInitialize(RingBuffer* pRing, size_t capacity);
+void ringBufferDestroy(RingBuffer* pRing);
+
+// Non-blocking, return false when full/empty
+bool ringBufferTryPush(RingBuffer* pRing, void* pItem);
+void* ringBufferTryPop(RingBuffer* pRing);
+
+// Blocking, return false/NULL once the ring is closed
+bool ringBufferPush(RingBuffer* pRing, void* pItem);
+void* ringBufferPop(RingBuffer* pRing);
+
+// Batched variants publish the whole batch with a single index store
+// TryPushBatch/TryPopBatch move as many as fit/are ready and return that count
+size_t ringBufferTryPushBatch(RingBuffer* pRing, void** ppItems, size_t count);
+size_t ringBufferTryPopBatch(RingBuffer* pRing, void** ppItems, size_t max);
+
+// PushBatch blocks until all are pushed, PopBatch until at least one is ready
+// Both return short (0 for PopBatch) once the ring is closed
+size_t ringBufferPushBatch(RingBuffer* pRing, void** ppItems, size_t count);
+size_t ringBufferPopBatch(RingBuffer* pRing, void** ppItems, size_t max);
+
+// Parks at most once for up to milliseconds, returns 0 on a timeout, a wake with nothing
+// ready or once closed. For consumers that also have timers to service.
+size_t ringBufferPopBatchTimed(RingBuffer* pRing, void** ppItems, size_t max, int milliseconds);
+
+// Release both sides, items still queued are left for the owner to drain
+void ringBufferClose(RingBuffer* pRing);
+bool ringBufferClosed(RingBuffer* pRing);
+size_t ringBufferCount(RingBuffer* pRing);
+
+#endif
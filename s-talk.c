@@ -1,4 +1,5 @@
 #include "threadPool.h"
+#include "replay.h"
 #include <ctype.h>
 
 int isNumeric(const char *str) {
@@ -10,27 +11,280 @@ int isNumeric(const char *str) {
     return 1;
 }
 
+static void printUsage(const char* program) {
+    printf("Usage: %s [-e threads|reactor] [-f peerFile] [-F] [-r] [-z] [-c milliseconds] [-s] [-t sockets|io_uring] [-k lanes] [-a cpus] [-p priority] [-b microseconds] [-d milliseconds] [-n loss,reorder] [-l kilobytes[,burst]] [-q messages] [-o block|shed] [-B receive[,send]] [-m seconds] [-L directory [-R range]] <myPort> [<remoteMachineName> <remotePortNumber>]...\n", program);
+    printf("  -n is for testing only, it drops and reorders that percentage of our own datagrams\n");
+}
+
+// "keyboard,send,receive,screen[,lane 1,...]" cores, '-' leaves a routine unpinned
+static bool parseCpus(int* pCpus, const char* list) {
+    int slot = 0;
+    const char* pField = list;
+    while (slot < MAX_ROUTINES) {
+        size_t length = strcspn(pField, ",");
+        char field[16];
+        if (length == 0 || length >= sizeof(field)) {
+            return false;
+        }
+        memcpy(field, pField, length);
+        field[length] = '\0';
+
+        if (strcmp(field, "-") == 0) {
+            pCpus[slot++] = -1;
+        } else if (isNumeric(field) && atoi(field) < CPU_SETSIZE) {
+            pCpus[slot++] = atoi(field);
+        } else {
+            return false;
+        }
+
+        if (pField[length] == '\0') {
+            return true;
+        }
+        pField += length + 1;
+    }
+    return false;
+}
+
+static int addPeer(UDP* pUdp, const char* machineName, const char* port) {
+    // Make sure ports are numerical
+    if (!isNumeric(port)) {
+        printf("Port numbers must be numeric.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (udpAddPeer(pUdp, machineName, (uint16_t)atoi(port)) != 0) {
+        printf("Too many peers, at most %d are supported.\n", MAX_PEERS);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// One "<remoteMachineName> <remotePortNumber>" per line, '#' starts a comment
+static int loadPeerFile(UDP* pUdp, const char* path) {
+    FILE* pFile = fopen(path, "r");
+    if (pFile == NULL) {
+        perror("Could not open peer file");
+        return EXIT_FAILURE;
+    }
+
+    char line[MAX_CHAR_COUNT];
+    int status = EXIT_SUCCESS;
+    while (status == EXIT_SUCCESS && fgets(line, sizeof(line), pFile) != NULL) {
+        line[strcspn(line, "#")] = '\0';
+
+        char machineName[MAX_MACHINE_NAME];
+        char port[16];
+        int fields = sscanf(line, "%255s %15s", machineName, port);
+        if (fields == 2) {
+            status = addPeer(pUdp, machineName, port);
+        } else if (fields == 1) {
+            printf("Peer file line is missing a port: %s\n", machineName);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    fclose(pFile);
+    return status;
+}
+
 int main(int argc, char const* argv[]) {
-    if (argc != 4) {
-        printf("Usage: %s <myPort> <remoteMachineName> <remotePortNumber>\n", argv[0]);
+    Engine engine = ENGINE_THREADS;
+    const char* peerFile = NULL;
+    bool framed = false;
+    bool reliable = false;
+    bool compress = false;
+    bool sharedMemory = false;
+    const Transport* pTransport = &transportSockets;
+    int lossPercent = 0;
+    int reorderPercent = 0;
+    int metricsInterval = -1;
+    int coalesceMs = -1;
+    int laneCount = 1;
+    int cpus[MAX_ROUTINES];
+    int fifoPriority = 0;
+    int busyPollUs = 0;
+    int drainMs = SHUTDOWN_DRAIN_MS;
+    const char* logDirectory = NULL;
+    const char* replayRange = NULL;
+    unsigned long paceKilobytes = 0;
+    unsigned long burstKilobytes = 0;
+    int outboundLimit = 0;
+    Overload overload = OVERLOAD_BLOCK;
+    int receiveKilobytes = 0;
+    int sendKilobytes = 0;
+
+    for (int i = 0; i < MAX_ROUTINES; i++) {
+        cpus[i] = -1;
+    }
+
+    // Optional flags come before the positional arguments
+    int option;
+    while ((option = getopt(argc, (char* const*)argv, "e:f:Frzc:st:k:a:p:b:d:n:l:q:o:B:m:L:R:")) != -1) {
+        if (option == 'e' && strcmp(optarg, "threads") == 0) {
+            engine = ENGINE_THREADS;
+        } else if (option == 'e' && strcmp(optarg, "reactor") == 0) {
+            engine = ENGINE_REACTOR;
+        } else if (option == 'f') {
+            peerFile = optarg;
+        } else if (option == 'F') {
+            framed = true;
+        } else if (option == 'r') {
+            reliable = true;
+        } else if (option == 'z') {
+            compress = true;
+        } else if (option == 's') {
+            // Peers on this host that also pass -s skip the network stack
+            sharedMemory = true;
+        } else if (option == 't' && strcmp(optarg, "sockets") == 0) {
+            pTransport = &transportSockets;
+        } else if (option == 't' && strcmp(optarg, "io_uring") == 0) {
+            pTransport = &transportUring;
+        } else if (option == 'k' && isNumeric(optarg) && atoi(optarg) >= 1 && atoi(optarg) <= UDP_MAX_LANES) {
+            // Receive sockets sharing the port, each with its own thread
+            laneCount = atoi(optarg);
+        } else if (option == 'a' && parseCpus(cpus, optarg)) {
+            // Pin each routine to a core
+        } else if (option == 'p' && isNumeric(optarg) && atoi(optarg) >= 1 && atoi(optarg) <= 99) {
+            // SCHED_FIFO for the network routines, needs CAP_SYS_NICE
+            fifoPriority = atoi(optarg);
+        } else if (option == 'b' && isNumeric(optarg)) {
+            // Spin before sleeping on a socket or queue
+            busyPollUs = atoi(optarg);
+        } else if (option == 'd' && isNumeric(optarg)) {
+            // How long SIGINT/SIGTERM waits for queued messages to go out
+            drainMs = atoi(optarg);
+        } else if (option == 'c' && isNumeric(optarg)) {
+            // Bundle short lines, waiting this long for more to share the datagram
+            coalesceMs = atoi(optarg);
+        } else if (option == 'n') {
+            // Percentages of sent datagrams to drop and to delay past the next batch
+            if (sscanf(optarg, "%d,%d", &lossPercent, &reorderPercent) != 2 || lossPercent < 0 || reorderPercent < 0
+                || lossPercent + reorderPercent > 100) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (option == 'l') {
+            // Kilobytes per second each peer is sent at most, and how many may go back to back
+            int fields = sscanf(optarg, "%lu,%lu", &paceKilobytes, &burstKilobytes);
+            if (!isdigit((unsigned char)optarg[0]) || fields < 1 || paceKilobytes == 0 || (fields == 2 && burstKilobytes == 0)
+                || paceKilobytes > TOKEN_BUCKET_MAX_BYTES / 1024 || burstKilobytes > TOKEN_BUCKET_MAX_BYTES / 1024) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (option == 'q' && isNumeric(optarg) && atoi(optarg) >= 1) {
+            // Messages a peer's queue holds before -o applies
+            outboundLimit = atoi(optarg);
+        } else if (option == 'o' && strcmp(optarg, "block") == 0) {
+            overload = OVERLOAD_BLOCK;
+        } else if (option == 'o' && strcmp(optarg, "shed") == 0) {
+            overload = OVERLOAD_SHED;
+        } else if (option == 'B') {
+            // Socket buffers in kilobytes, the receive one for every lane
+            int fields = sscanf(optarg, "%d,%d", &receiveKilobytes, &sendKilobytes);
+            if (fields < 1 || receiveKilobytes < 0 || sendKilobytes < 0 || receiveKilobytes > INT32_MAX / 1024
+                || sendKilobytes > INT32_MAX / 1024) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (option == 'L') {
+            // Record everything sent and received
+            logDirectory = optarg;
+        } else if (option == 'R') {
+            // Print part of the log instead of connecting
+            replayRange = optarg;
+        } else if (option == 'm' && isNumeric(optarg)) {
+            // Metrics snapshot period, SIGUSR1 dumps one at any time
+            metricsInterval = atoi(optarg);
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The reactor is a single thread, and a doorbell could ring a lane that isn't draining the rings
+    if (laneCount > 1 && (engine == ENGINE_REACTOR || sharedMemory)) {
+        printf("-k needs the threads engine and can't be combined with -s.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (replayRange != NULL) {
+        if (logDirectory == NULL) {
+            printf("-R replays the log -L points at.\n");
+            return EXIT_FAILURE;
+        }
+        return replayLog(logDirectory, replayRange);
+    }
+
+    // My port followed by machine/port pairs
+    int positional = argc - optind;
+    if (positional < 1 || positional % 2 == 0 || (positional == 1 && peerFile == NULL)) {
+        printUsage(argv[0]);
         return EXIT_FAILURE;
     }
+    argv += optind - 1;
 
     // Make sure ports are numerical
-    if (!isNumeric(argv[1]) || !isNumeric(argv[3])) {
+    if (!isNumeric(argv[1])) {
         printf("Port numbers must be numeric.\n");
         return EXIT_FAILURE;
     }
 
+    // Collect arguments for udp setup, every peer slot makes it too big for the stack
+    static UDP udp;
+    udp.clientPort = (uint16_t)atoi(argv[1]);
+    udp.framed = framed;
+    udp.reliable = reliable;
+    udp.pCodec = compress ? &codecDictionaryLz : NULL;
+    udp.sharedMemory = sharedMemory;
+    udp.pTransport = pTransport;
+    udp.coalesceMs = coalesceMs;
+    udp.laneCount = laneCount;
+    udp.busyPollUs = busyPollUs;
+    udp.paceRate = paceKilobytes * 1024;
+    udp.paceBurst = burstKilobytes * 1024;
+    udp.outboundLimit = outboundLimit;
+    udp.overload = overload;
+    udp.receiveBuffer = receiveKilobytes * 1024;
+    udp.sendBuffer = sendKilobytes * 1024;
+    udp.peerCount = 0;
+    netemInitialize(&udp.netem, lossPercent, reorderPercent);
+
+    for (int i = 2; i < positional + 1; i += 2) {
+        if (addPeer(&udp, argv[i], argv[i + 1]) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (peerFile != NULL && loadPeerFile(&udp, peerFile) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    if (udp.peerCount == 0) {
+        printf("No peers given.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Before the pool so every thread inherits the blocked SIGUSR1
+    bool metrics = metricsStart(metricsInterval > 0 ? metricsInterval : 0);
+    if (!metrics && metricsInterval >= 0) {
+        printf("Metrics are not compiled in, rebuild with METRICS=1.\n");
+        return EXIT_FAILURE;
+    }
+
     // Create a thread pool object and initialize the thread pool
     ThreadPool pool;
-    threadPoolInitialize(&pool);
+    threadPoolInitialize(&pool, laneCount);
+    pool.engine = engine;
+    pool.fifoPriority = fifoPriority;
+    pool.drainMs = drainMs;
+    memcpy(pool.cpus, cpus, sizeof(cpus));
 
-    // Collect arguments for udp setup
-    UDP udp;
-    udp.clientPort = (uint16_t)atoi(argv[1]);
-    udp.remotePort = (uint16_t)atoi(argv[3]);
-    udp.remoteMachineName = argv[2];
+    // Opened first so the peers' addresses reach it
+    static MessageLog log;
+    if (logDirectory != NULL) {
+        messageLogOpen(&log, logDirectory);
+        udp.pLog = &log;
+    }
 
     // Initialize UDP
     udpInitialize(&udp);
@@ -38,9 +292,22 @@ int main(int argc, char const* argv[]) {
     // Create Processes
     createThreadRoutine(&pool, &udp);
 
+    if (udp.shedCount > 0) {
+        printf("%llu messages shed, a peer could not keep up\n", (unsigned long long)udp.shedCount);
+    }
+
+    // Every routine is done tapping, the writer drains what is left
+    if (udp.pLog != NULL) {
+        messageLogClose(udp.pLog);
+    }
+
     // Destroy Objects in Reverse Order
     destroyUdp(&udp);
     destroyThreadPool(&pool);
+    netemDestroy(&udp.netem);
+    if (metrics) {
+        metricsStop();
+    }
 
     return EXIT_SUCCESS;
 }
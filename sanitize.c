@@ -0,0 +1,392 @@
+#include "sanitize.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(SANITIZE_SCALAR)
+#define SANITIZE_SSSE3
+#include <immintrin.h>
+#endif
+
+#include "clock.h"
+#include "metrics.h"
+#include "protocol.h"
+
+// What each byte pair can be wrong with, the vector path looks all three up per byte and
+// a bit that survives the AND is an error (Keiser and Lemire, "Validating UTF-8 In Less
+// Than One Instruction Per Byte")
+#define UTF8_TOO_SHORT      0x01    // Lead not followed by a continuation
+#define UTF8_TOO_LONG       0x02    // Continuation after ASCII
+#define UTF8_OVERLONG_3     0x04
+#define UTF8_TOO_LARGE      0x08    // Past U+10FFFF
+#define UTF8_SURROGATE      0x10
+#define UTF8_OVERLONG_2     0x20
+#define UTF8_TOO_LARGE_1000 0x40
+#define UTF8_OVERLONG_4     0x40
+#define UTF8_TWO_CONTS      0x80    // Continuation after continuation, fine only inside 3 and 4 byte characters
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+// Clean bytes after a bad one before the vectors are tried again
+#define SANITIZE_CALM 64
+
+// Bad bytes in one text before the rest of it is taken for binary
+#define SANITIZE_GARBAGE 32
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+// Printable ASCII, tab and newline go to the screen untouched
+static inline bool isPlain(uint8_t byte) {
+    return (byte >= 0x20 && byte < 0x7F) || byte == '\t' || byte == '\n';
+}
+
+// Table 3-7 of the Unicode standard, what may follow each lead byte. C2 80..9F would be
+// the C1 controls (0x9B is a CSI to many terminals), those go like malformed text.
+static bool openSequence(SanitizeCarry* pCarry, uint8_t lead) {
+    pCarry->low = 0x80;
+    pCarry->high = 0xBF;
+
+    if (lead == 0xC2) {
+        pCarry->pending = 1;
+        pCarry->low = 0xA0;
+    } else if (lead >= 0xC3 && lead <= 0xDF) {
+        pCarry->pending = 1;
+    } else if (lead == 0xE0) {
+        pCarry->pending = 2;
+        pCarry->low = 0xA0;
+    } else if (lead == 0xED) {
+        // Surrogates
+        pCarry->pending = 2;
+        pCarry->high = 0x9F;
+    } else if (lead >= 0xE1 && lead <= 0xEF) {
+        pCarry->pending = 2;
+    } else if (lead == 0xF0) {
+        pCarry->pending = 3;
+        pCarry->low = 0x90;
+    } else if (lead >= 0xF1 && lead <= 0xF3) {
+        pCarry->pending = 3;
+    } else if (lead == 0xF4) {
+        // Nothing past U+10FFFF
+        pCarry->pending = 3;
+        pCarry->high = 0x8F;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Bytes of the character at pText when it is well-formed, fine to print and whole within
+// available, 0 otherwise
+static size_t characterLength(const uint8_t* pText, size_t available) {
+    if (pText[0] < 0x80) {
+        return isPlain(pText[0]) ? 1 : 0;
+    }
+
+    SanitizeCarry expected;
+    if (!openSequence(&expected, pText[0]) || expected.pending >= available) {
+        return 0;
+    }
+    for (size_t i = 1; i <= expected.pending; i++) {
+        if (pText[i] < expected.low || pText[i] > expected.high) {
+            return 0;
+        }
+        expected.low = 0x80;
+        expected.high = 0xBF;
+    }
+    return (size_t)expected.pending + 1;
+}
+
+#ifdef SANITIZE_SSSE3
+// Where the character holding pText[position] starts, everything before position is known
+// to be well-formed
+static size_t characterStart(const uint8_t* pText, size_t position) {
+    for (size_t back = 1; back <= 3 && back <= position; back++) {
+        uint8_t byte = pText[position - back];
+        if ((byte & 0xC0) != 0x80) {
+            size_t width = byte >= 0xF0 ? 4 : byte >= 0xE0 ? 3 : byte >= 0xC0 ? 2 : 1;
+            return width > back ? position - back : position;
+        }
+    }
+    return position;
+}
+
+// 16 bytes a step for as long as nothing needs replacing, returns a character boundary
+// no further than the first problem. pshufb and palignr need SSSE3, checked by the caller.
+__attribute__((target("ssse3")))
+static size_t validBlocks(const uint8_t* pText, size_t length) {
+    const __m128i byte1High = _mm_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS, (char)UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const __m128i byte1Low = _mm_setr_epi8(
+        (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+        (char)(UTF8_CARRY | UTF8_OVERLONG_2),
+        (char)UTF8_CARRY,
+        (char)UTF8_CARRY,
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000));
+    const __m128i byte2High = _mm_setr_epi8(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+
+    // A lead in the last three bytes needs the next block to carry on
+    const __m128i leadsEnding = _mm_setr_epi8(
+        (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+        (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i previous = zero;
+    __m128i previousIncomplete = zero;
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i*)(pText + i));
+
+        // 0x00..0x1F but tab and newline, and DEL
+        __m128i error = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8(-1)), _mm_cmplt_epi8(input, _mm_set1_epi8(0x20)));
+        error = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(input, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(input, _mm_set1_epi8('\n'))), error);
+        error = _mm_or_si128(error, _mm_cmpeq_epi8(input, _mm_set1_epi8(0x7F)));
+
+        if (_mm_movemask_epi8(input) == 0) {
+            // ASCII, only a character the last block left open can be wrong
+            error = _mm_or_si128(error, previousIncomplete);
+        } else {
+            __m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+            __m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+            __m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+
+            __m128i special = _mm_and_si128(
+                _mm_and_si128(_mm_shuffle_epi8(byte1High, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                              _mm_shuffle_epi8(byte1Low, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(byte2High, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+            // Third and fourth bytes are the only continuations allowed after a continuation
+            __m128i thirdOrFourth = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+                                                 _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+            error = _mm_or_si128(error, _mm_xor_si128(_mm_and_si128(thirdOrFourth, _mm_set1_epi8((char)0x80)), special));
+
+            // C1 controls, C2 followed by 80..9F
+            error = _mm_or_si128(error, _mm_and_si128(_mm_cmpeq_epi8(prev1, _mm_set1_epi8((char)0xC2)),
+                                                      _mm_cmplt_epi8(input, _mm_set1_epi8((char)0xA0))));
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xFFFF) {
+            break;
+        }
+        previousIncomplete = _mm_subs_epu8(input, leadsEnding);
+        previous = input;
+    }
+
+    return characterStart(pText, i);
+}
+#endif
+
+// How many bytes from pText on are whole characters fine to print. Chat text is nearly all
+// of it, so this is where the time goes. Garbage would only find a block to be bad over and
+// over, so vectors wait until the text looks clean again.
+static size_t validRun(const uint8_t* pText, size_t length, bool vector) {
+    size_t i = 0;
+
+#ifdef SANITIZE_SSSE3
+    if (vector && length >= 16 && __builtin_cpu_supports("ssse3")) {
+        i = validBlocks(pText, length);
+    }
+#else
+    (void)vector;
+#endif
+
+    size_t width;
+    while (i < length && (width = characterLength(pText + i, length - i)) > 0) {
+        i += width;
+    }
+    return i;
+}
+
+// Binary or hostile input, everything but printable ASCII goes without looking at characters.
+// Returns how many bytes it replaced.
+static size_t keepPlain(uint8_t* pText, size_t length) {
+    size_t replaced = 0;
+    size_t i = 0;
+
+#ifdef SANITIZE_SSSE3
+    const __m128i replacement = _mm_set1_epi8(SANITIZE_REPLACEMENT);
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(pText + i));
+        __m128i plain = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7F)));
+        plain = _mm_or_si128(plain, _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))));
+
+        int kept = _mm_movemask_epi8(plain);
+        if (kept != 0xFFFF) {
+            bytes = _mm_or_si128(_mm_and_si128(plain, bytes), _mm_andnot_si128(plain, replacement));
+            _mm_storeu_si128((__m128i*)(pText + i), bytes);
+            replaced += 16 - (size_t)__builtin_popcount((unsigned int)kept);
+        }
+    }
+#endif
+
+    for (; i < length; i++) {
+        if (!isPlain(pText[i])) {
+            pText[i] = SANITIZE_REPLACEMENT;
+            replaced++;
+        }
+    }
+    return replaced;
+}
+
+// The text ends inside a character that can still turn out well-formed, the carry takes
+// it on. False leaves the carry zeroed.
+static bool openTrailing(char* pText, size_t available, SanitizeCarry* pCarry) {
+    const uint8_t* pBytes = (const uint8_t*)pText;
+    if (pBytes[0] < 0x80 || !openSequence(pCarry, pBytes[0]) || available > pCarry->pending) {
+        memset(pCarry, 0, sizeof(*pCarry));
+        return false;
+    }
+
+    pCarry->pOpened[0] = pText;
+    pCarry->opened = 1;
+    for (size_t i = 1; i < available; i++) {
+        if (pBytes[i] < pCarry->low || pBytes[i] > pCarry->high) {
+            memset(pCarry, 0, sizeof(*pCarry));
+            return false;
+        }
+        pCarry->pOpened[pCarry->opened++] = pText + i;
+        pCarry->pending--;
+        pCarry->low = 0x80;
+        pCarry->high = 0xBF;
+    }
+    return true;
+}
+
+// The open character never completed, replace what of it is still ours to change
+static size_t breakSequence(SanitizeCarry* pCarry) {
+    size_t replaced = 0;
+    for (int i = 0; i < pCarry->opened; i++) {
+        if (pCarry->pOpened[i] != NULL) {
+            *pCarry->pOpened[i] = SANITIZE_REPLACEMENT;
+            replaced++;
+        }
+    }
+    memset(pCarry, 0, sizeof(*pCarry));
+    return replaced;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+size_t sanitizeText(char* pText, size_t length, SanitizeCarry* pCarry, bool more) {
+    SanitizeCarry carry;
+    if (pCarry != NULL) {
+        carry = *pCarry;
+    } else {
+        memset(&carry, 0, sizeof(carry));
+    }
+
+    uint8_t* pBytes = (uint8_t*)pText;
+    size_t replaced = 0;
+    size_t i = 0;
+    size_t calm = 0;        // Vectors are worth it again from here
+
+    // Finish the character the last piece ended inside of
+    while (carry.pending > 0 && i < length) {
+        if (pBytes[i] < carry.low || pBytes[i] > carry.high) {
+            replaced += breakSequence(&carry);
+            break;
+        }
+        if (--carry.pending == 0) {
+            memset(&carry, 0, sizeof(carry));
+        } else {
+            carry.pOpened[carry.opened++] = pText + i;
+            carry.low = 0x80;
+            carry.high = 0xBF;
+        }
+        i++;
+    }
+
+    while (i < length) {
+        size_t valid = validRun(pBytes + i, length - i, i >= calm);
+        i += valid;
+        if (i == length || (more && openTrailing(pText + i, length - i, &carry))) {
+            break;
+        }
+
+        // Control bytes, stray continuations and anything malformed, one byte at a time so
+        // a good character right behind still gets through
+        pBytes[i++] = SANITIZE_REPLACEMENT;
+        if (++replaced == SANITIZE_GARBAGE) {
+            replaced += keepPlain(pBytes + i, length - i);
+            break;
+        }
+        if (valid < SANITIZE_CALM) {
+            calm = i + SANITIZE_CALM;
+        }
+    }
+
+    if (carry.pending > 0 && !more) {
+        replaced += breakSequence(&carry);
+    }
+    if (pCarry != NULL) {
+        *pCarry = carry;
+    }
+    return replaced;
+}
+
+size_t sanitizeMessages(Message** ppMessages, int count, SanitizeCarry* pCarries) {
+    uint64_t start = METRICS_NOW();
+    size_t replaced = 0;
+
+    for (int i = 0; i < count; i++) {
+        Message* pMessage = ppMessages[i];
+
+        // Every record is a message of its own, the record headers stay as they are
+        if (pMessage->bundle) {
+            const char* pRecord;
+            size_t length;
+            size_t offset = 0;
+            while (bundleNext(pMessage->pData, pMessage->length, &offset, &pRecord, &length)) {
+                replaced += sanitizeText((char*)pRecord, length, NULL, false);
+            }
+            continue;
+        }
+
+        // A new message, whatever the last one left open was cut off with it
+        SanitizeCarry single;
+        SanitizeCarry* pCarry = pCarries != NULL && pMessage->peer >= 0 ? &pCarries[pMessage->peer] : &single;
+        if (pMessage->fragment == 0 || pCarry == &single) {
+            memset(pCarry, 0, sizeof(*pCarry));
+        }
+
+        for (Message* pSlot = pMessage; pSlot != NULL; pSlot = pSlot->pContinuation) {
+            bool more = pSlot->pContinuation != NULL || pSlot->partial;
+            replaced += sanitizeText(pSlot->pData, pSlot->length, pCarry, more);
+        }
+
+        // This piece is handed on and may be on the screen before the next one arrives
+        for (int j = 0; j < pCarry->opened; j++) {
+            pCarry->pOpened[j] = NULL;
+        }
+    }
+
+    METRICS_COUNT(METRIC_SANITIZED_BYTES, replaced);
+    METRICS_RECORD(METRIC_STAGE_SANITIZE, start);
+    return replaced;
+}
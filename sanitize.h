@@ -0,0 +1,35 @@
+#ifndef SANITIZE_H_
+#define SANITIZE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "messagePool.h"
+
+// Stands in for every byte a peer must not put on our terminal
+#define SANITIZE_REPLACEMENT '?'
+
+// A UTF-8 sequence a piece ended in the middle of, so the next piece of the same message
+// picks it up. Zeroed means between characters.
+typedef struct SanitizeCarry {
+    uint8_t   pending;      // Continuation bytes still expected
+    uint8_t   low;          // Range the next one must fall in, narrower after E0, ED, F0 and F4
+    uint8_t   high;
+    uint8_t   opened;       // Bytes of it seen so far
+    char*     pOpened[3];   // Where they are, NULL once they may already be on the screen
+} SanitizeCarry;
+
+// Replace, in place and keeping the length, NUL and other control bytes (tab and newline
+// stay), C1 controls and whatever isn't well-formed UTF-8. Clean text is checked 16 bytes
+// a step on x86 CPUs with SSSE3, a byte at a time elsewhere. pCarry may be NULL when text
+// is a whole message, otherwise more says whether the message continues in a later call.
+// Returns how many bytes it replaced.
+size_t sanitizeText(char* pText, size_t length, SanitizeCarry* pCarry, bool more);
+
+// The inbound stage, run over a delivered batch before anyone renders it. Reassembled chains
+// are treated as one text and bundles record by record. pCarries, one per peer, holds
+// what a long message's piece left open for its next one, NULL drops that.
+size_t sanitizeMessages(Message** ppMessages, int count, SanitizeCarry* pCarries);
+
+#endif
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE // For clock_gettime
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "sanitize.h"
+
+// Inbound sanitizing micro-benchmark, built once with the vector path and once with only
+// the scalar one (see make sanitizebench). One thread, so the rate is what one core gets
+// through.
+
+#define DEFAULT_MEGABYTES 256
+#define BATCH_SIZE 32               // UDP_BATCH_SIZE, one receive batch
+#define DEFAULT_SIZE 1024
+
+static const char* sWords[] = { "hey", "are", "you", "there", "yes", "see", "the", "message", "coming", "through", "ok" };
+static const char* sAccented[] = { "café", "über", "naïve", "señor", "déjà", "vu", "el", "niño", "straße", "crème" };
+static const char* sCjk[] = { "你好", "消息", "收到", "了吗", "没问题", "こんにちは", "메시지" };
+
+static uint32_t sSeed = 12345;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static uint32_t nextRandom(void) {
+    sSeed = sSeed * 1103515245u + 12345u;
+    return sSeed >> 8;
+}
+
+// Words separated by spaces up to size bytes, a newline last. Never cuts a character.
+static size_t fillWords(char* pText, size_t size, const char** ppWords, int wordCount) {
+    size_t used = 0;
+    while (1) {
+        const char* pWord = ppWords[nextRandom() % (uint32_t)wordCount];
+        size_t length = strlen(pWord);
+        if (used + length + 2 > size) {
+            break;
+        }
+        memcpy(pText + used, pWord, length);
+        used += length;
+        pText[used++] = ' ';
+    }
+    while (used < size - 1) {
+        pText[used++] = '.';
+    }
+    pText[used++] = '\n';
+    return used;
+}
+
+// What a hostile or broken peer might send, every byte value equally likely
+static size_t fillRandom(char* pText, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        pText[i] = (char)(nextRandom() & 0xFF);
+    }
+    return size;
+}
+
+static void benchWorkload(const char* label, const char* workload, size_t size, int megabytes) {
+    Message* pMessages[BATCH_SIZE];
+    char* pPristine[BATCH_SIZE];
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        pMessages[i] = calloc(1, sizeof(Message));
+        pPristine[i] = malloc(size);
+        if (pMessages[i] == NULL || pPristine[i] == NULL) {
+            perror("Allocation failed");
+            exit(EXIT_FAILURE);
+        }
+
+        size_t length;
+        if (strcmp(workload, "ascii") == 0) {
+            length = fillWords(pPristine[i], size, sWords, sizeof(sWords) / sizeof(sWords[0]));
+        } else if (strcmp(workload, "accented") == 0) {
+            length = fillWords(pPristine[i], size, sAccented, sizeof(sAccented) / sizeof(sAccented[0]));
+        } else if (strcmp(workload, "cjk") == 0) {
+            length = fillWords(pPristine[i], size, sCjk, sizeof(sCjk) / sizeof(sCjk[0]));
+        } else {
+            length = fillRandom(pPristine[i], size);
+        }
+
+        pMessages[i]->pData = pMessages[i]->data;
+        pMessages[i]->length = length;
+    }
+
+    // Sanitizing works in place, so every batch starts again from the original bytes
+    long batches = (long)megabytes * 1024 * 1024 / (long)(size * BATCH_SIZE) + 1;
+    uint64_t elapsed = 0;
+    size_t replaced = 0;
+    for (long round = 0; round < batches; round++) {
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            memcpy(pMessages[i]->data, pPristine[i], pMessages[i]->length);
+        }
+
+        uint64_t start = clockNanoseconds();
+        replaced += sanitizeMessages(pMessages, BATCH_SIZE, NULL);
+        elapsed += clockNanoseconds() - start;
+    }
+
+    double bytes = (double)batches * BATCH_SIZE * (double)size;
+    printf("  %-8s %-9s %5zu bytes %9.1f MB/s per core %8.1f ns/message %6.2f%% replaced\n", label, workload, size,
+           bytes / ((double)elapsed / 1e9) / 1e6, (double)elapsed / ((double)batches * BATCH_SIZE), 100.0 * (double)replaced / bytes);
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        free(pMessages[i]);
+        free(pPristine[i]);
+    }
+}
+
+static void printUsage(const char* program) {
+    fprintf(stderr, "Usage: %s [-m megabytes] [-s size] [-l label]\n", program);
+}
+
+//===================================================================================
+// Main
+//===================================================================================
+
+int main(int argc, char* argv[]) {
+    const char* label = "sanitize";
+    int megabytes = DEFAULT_MEGABYTES;
+    size_t size = DEFAULT_SIZE;
+
+    int option;
+    while ((option = getopt(argc, argv, "m:s:l:h")) != -1) {
+        if (option == 'm') {
+            megabytes = atoi(optarg);
+        } else if (option == 's') {
+            size = (size_t)atoi(optarg);
+        } else if (option == 'l') {
+            label = optarg;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (megabytes <= 0 || size < 16 || size > MAX_CHAR_COUNT) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    benchWorkload(label, "ascii", size, megabytes);
+    benchWorkload(label, "accented", size, megabytes);
+    benchWorkload(label, "cjk", size, megabytes);
+    benchWorkload(label, "random", size, megabytes);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE // For syscall and rand_r
+#include "scheduler.h"
+#include "futex.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Worker running on the current thread, NULL outside the pool
+static _Thread_local Worker* sCurrentWorker = NULL;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static void notifyWorkers(Scheduler* pScheduler, int count) {
+    atomic_fetch_add(&pScheduler->epoch, 1);
+    if (atomic_load(&pScheduler->sleepers) > 0) {
+        futexWake(&pScheduler->epoch, count);
+    }
+}
+
+static Future* takeInjected(Scheduler* pScheduler) {
+    // Cheap check before touching the lock
+    if (atomic_load_explicit(&pScheduler->injected, memory_order_acquire) == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pScheduler->injectMutex);
+
+    Future* pFuture = pScheduler->pInjectHead;
+    if (pFuture != NULL) {
+        pScheduler->pInjectHead = pFuture->pNext;
+        if (pScheduler->pInjectHead == NULL) {
+            pScheduler->pInjectTail = NULL;
+        }
+        atomic_fetch_sub(&pScheduler->injected, 1);
+    }
+
+    pthread_mutex_unlock(&pScheduler->injectMutex);
+    return pFuture;
+}
+
+static Future* stealTask(Worker* pWorker) {
+    Scheduler* pScheduler = pWorker->pScheduler;
+
+    // Start from a random victim so thieves spread out
+    int start = rand_r(&pWorker->seed) % pScheduler->workerCount;
+    for (int i = 0; i < pScheduler->workerCount; i++) {
+        Worker* pVictim = &pScheduler->pWorkers[(start + i) % pScheduler->workerCount];
+        if (pVictim == pWorker) {
+            continue;
+        }
+
+        void* pItem = NULL;
+        do {
+            pItem = workDequeSteal(&pVictim->deque);
+        } while (pItem == WORK_DEQUE_ABORT);
+
+        if (pItem != NULL) {
+            return (Future*)pItem;
+        }
+    }
+
+    return NULL;
+}
+
+// Waiting workers pass helping as false, what comes in from outside the pool may be a
+// routine that runs for the whole session and is left to an idle worker
+static Future* findTask(Worker* pWorker, bool helping) {
+    Future* pFuture = (Future*)workDequeTake(&pWorker->deque);
+    if (pFuture == NULL && !helping) {
+        pFuture = takeInjected(pWorker->pScheduler);
+    }
+    if (pFuture == NULL) {
+        pFuture = stealTask(pWorker);
+    }
+    return pFuture;
+}
+
+static void releaseFuture(Future* pFuture) {
+    if (atomic_fetch_sub_explicit(&pFuture->references, 1, memory_order_acq_rel) == 1) {
+        free(pFuture);
+    }
+}
+
+static void runTask(Future* pFuture) {
+    pFuture->pResult = pFuture->function(pFuture->pArgument);
+    atomic_store_explicit(&pFuture->done, 1, memory_order_release);
+
+    // The waiter can see done before the wake, its reference alone must not free the word
+    futexWake(&pFuture->done, 1);
+    releaseFuture(pFuture);
+}
+
+static void* workerRoutine(void* args) {
+    Worker* pWorker = (Worker*)args;
+    Scheduler* pScheduler = pWorker->pScheduler;
+    sCurrentWorker = pWorker;
+
+    while (1) {
+        Future* pFuture = findTask(pWorker, false);
+        if (pFuture != NULL) {
+            runTask(pFuture);
+            continue;
+        }
+
+        // Read the epoch before the last look so a submit in between can't be missed
+        unsigned int epoch = atomic_load(&pScheduler->epoch);
+        if (atomic_load(&pScheduler->stopping)) {
+            break;
+        }
+
+        pFuture = findTask(pWorker, false);
+        if (pFuture != NULL) {
+            runTask(pFuture);
+            continue;
+        }
+
+        atomic_fetch_add(&pScheduler->sleepers, 1);
+        futexWait(&pScheduler->epoch, epoch, -1);
+        atomic_fetch_sub(&pScheduler->sleepers, 1);
+    }
+
+    return NULL;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void schedulerInitialize(Scheduler* pScheduler, int workerCount) {
+    assert(pScheduler != NULL);
+    assert(workerCount > 0);
+
+    pScheduler->pWorkers = calloc((size_t)workerCount, sizeof(Worker));
+    if (pScheduler->pWorkers == NULL) {
+        perror("Worker allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pScheduler->workerCount = workerCount;
+    atomic_init(&pScheduler->stopping, false);
+    atomic_init(&pScheduler->epoch, 0);
+    atomic_init(&pScheduler->sleepers, 0);
+    atomic_init(&pScheduler->injected, 0);
+    pScheduler->pInjectHead = NULL;
+    pScheduler->pInjectTail = NULL;
+    pthread_mutex_init(&pScheduler->injectMutex, NULL);
+
+    // Deques must all exist before any worker starts stealing
+    for (int i = 0; i < workerCount; i++) {
+        Worker* pWorker = &pScheduler->pWorkers[i];
+        workDequeInitialize(&pWorker->deque, WORKER_DEQUE_CAPACITY);
+        pWorker->pScheduler = pScheduler;
+        pWorker->seed = (unsigned int)i * 2654435761u + 1;
+        pWorker->index = i;
+    }
+
+    for (int i = 0; i < workerCount; i++) {
+        int result = pthread_create(&pScheduler->pWorkers[i].thread, NULL, workerRoutine, &pScheduler->pWorkers[i]);
+        if (result != 0) {
+            fprintf(stderr, "Error creating thread: %d\n", result);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void schedulerDestroy(Scheduler* pScheduler) {
+    assert(pScheduler != NULL);
+
+    // Workers finish what is queued, then see the flag
+    atomic_store(&pScheduler->stopping, true);
+    notifyWorkers(pScheduler, pScheduler->workerCount);
+
+    for (int i = 0; i < pScheduler->workerCount; i++) {
+        if (pthread_join(pScheduler->pWorkers[i].thread, NULL) != 0) {
+            fprintf(stderr, "Error joining thread\n");
+            exit(EXIT_FAILURE);
+        }
+        workDequeDestroy(&pScheduler->pWorkers[i].deque);
+    }
+
+    pthread_mutex_destroy(&pScheduler->injectMutex);
+    free(pScheduler->pWorkers);
+    pScheduler->pWorkers = NULL;
+}
+
+Future* schedulerSubmit(Scheduler* pScheduler, TaskFunction function, void* pArgument) {
+    assert(pScheduler != NULL);
+    assert(function != NULL);
+
+    Future* pFuture = malloc(sizeof(Future));
+    if (pFuture == NULL) {
+        perror("Future allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pFuture->function = function;
+    pFuture->pArgument = pArgument;
+    pFuture->pResult = NULL;
+    pFuture->pNext = NULL;
+    atomic_init(&pFuture->done, 0);
+    atomic_init(&pFuture->references, 2);
+
+    Worker* pWorker = sCurrentWorker;
+    if (pWorker != NULL && pWorker->pScheduler == pScheduler) {
+        // Our own deque, idle siblings will steal it if we stay busy
+        workDequePush(&pWorker->deque, pFuture);
+    } else {
+        pthread_mutex_lock(&pScheduler->injectMutex);
+        if (pScheduler->pInjectTail == NULL) {
+            pScheduler->pInjectHead = pFuture;
+        } else {
+            pScheduler->pInjectTail->pNext = pFuture;
+        }
+        pScheduler->pInjectTail = pFuture;
+        atomic_fetch_add(&pScheduler->injected, 1);
+        pthread_mutex_unlock(&pScheduler->injectMutex);
+    }
+
+    notifyWorkers(pScheduler, 1);
+    return pFuture;
+}
+
+void* futureWait(Future* pFuture) {
+    assert(pFuture != NULL);
+
+    Worker* pWorker = sCurrentWorker;
+    while (atomic_load_explicit(&pFuture->done, memory_order_acquire) == 0) {
+        if (pWorker == NULL) {
+            futexWait(&pFuture->done, 0, -1);
+            continue;
+        }
+
+        // A worker keeps running tasks while it waits, otherwise nested waits could
+        // park every worker. The short park only covers a task appearing mid-scan.
+        Future* pTask = findTask(pWorker, true);
+        if (pTask != NULL) {
+            runTask(pTask);
+        } else {
+            futexWait(&pFuture->done, 0, 1);
+        }
+    }
+
+    void* pResult = pFuture->pResult;
+    releaseFuture(pFuture);
+    return pResult;
+}
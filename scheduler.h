@@ -0,0 +1,60 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "workDeque.h"
+
+// Initial slots per worker deque, grows on demand
+#define WORKER_DEQUE_CAPACITY 256
+
+typedef void* (*TaskFunction)(void* pArgument);
+
+// A submitted task and the handle used to wait for its result
+typedef struct Future {
+    TaskFunction     function;
+    void*            pArgument;
+    void*            pResult;
+    atomic_uint      done;          // Futex word, 1 once pResult is valid
+    atomic_int       references;    // Worker and waiter, whoever lets go last frees it
+    struct Future*   pNext;         // Injection queue link
+} Future;
+
+typedef struct Worker {
+    WorkDeque              deque;
+    pthread_t              thread;
+    struct Scheduler*      pScheduler;
+    unsigned int           seed;     // Victim selection
+    int                    index;
+} Worker;
+
+// N workers with their own deques, idle workers steal from each other before parking.
+// Submissions from outside the pool go through a shared injection queue.
+typedef struct Scheduler {
+    Worker*           pWorkers;
+    int               workerCount;
+    atomic_bool       stopping;
+
+    // Eventcount for parked workers, submit only makes a syscall when someone sleeps
+    _Alignas(CACHE_LINE_SIZE) atomic_uint epoch;
+    atomic_int        sleepers;
+
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t injectMutex;
+    Future*           pInjectHead;
+    Future*           pInjectTail;
+    atomic_int        injected;
+} Scheduler;
+
+void schedulerInitialize(Scheduler* pScheduler, int workerCount);
+void schedulerDestroy(Scheduler* pScheduler);
+
+// Run function(pArgument) on some worker, tasks submitted from a worker go on its own deque
+Future* schedulerSubmit(Scheduler* pScheduler, TaskFunction function, void* pArgument);
+
+// Block until the task has run, returns its result and lets go of the future.
+// Called from a worker it runs its own and stolen tasks in the meantime, never injected ones.
+void* futureWait(Future* pFuture);
+
+#endif
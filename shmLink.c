@@ -0,0 +1,210 @@
+#define _GNU_SOURCE // For getifaddrs
+#include "shmLink.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "clock.h"
+
+#define ERROR -1
+
+#define SHM_RING_MASK (SHM_RING_SLOTS - 1)
+
+// Between looks at a full ring's head
+#define SHM_ROOM_POLL_US 20
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+// A side whose process is gone left its pid behind, it no longer counts as attached
+static void clearStaleOwner(ShmSegment* pSegment, int side) {
+    int owner = atomic_load(&pSegment->owners[side]);
+    if (owner != 0 && kill(owner, 0) == ERROR && errno == ESRCH) {
+        atomic_compare_exchange_strong(&pSegment->owners[side], &owner, 0);
+    }
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+bool shmAddressIsLocal(struct in_addr address) {
+    if ((ntohl(address.s_addr) >> 24) == 127) {
+        return true;
+    }
+
+    struct ifaddrs* pInterfaces = NULL;
+    if (getifaddrs(&pInterfaces) == ERROR) {
+        return false;
+    }
+
+    bool local = false;
+    for (struct ifaddrs* pInterface = pInterfaces; pInterface != NULL && !local; pInterface = pInterface->ifa_next) {
+        if (pInterface->ifa_addr != NULL && pInterface->ifa_addr->sa_family == AF_INET) {
+            local = ((struct sockaddr_in*)pInterface->ifa_addr)->sin_addr.s_addr == address.s_addr;
+        }
+    }
+
+    freeifaddrs(pInterfaces);
+    return local;
+}
+
+void shmLinkOpen(ShmLink* pLink, uint16_t localPort, uint16_t remotePort) {
+    assert(pLink != NULL);
+    assert(localPort != remotePort);
+
+    uint16_t low = localPort < remotePort ? localPort : remotePort;
+    uint16_t high = localPort < remotePort ? remotePort : localPort;
+    snprintf(pLink->name, sizeof(pLink->name), "/s-talk-%u-%u", low, high);
+
+    // Both sides may race here, truncating to the same size twice is harmless
+    int descriptor = shm_open(pLink->name, O_RDWR | O_CREAT, 0600);
+    if (descriptor == ERROR) {
+        perror("shm_open failed");
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(descriptor, sizeof(ShmSegment)) == ERROR) {
+        perror("ftruncate failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pLink->pSegment = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (pLink->pSegment == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pLink->side = localPort == low ? 0 : 1;
+    pLink->pInbound = &pLink->pSegment->rings[pLink->side];
+    pLink->pOutbound = &pLink->pSegment->rings[1 - pLink->side];
+    clearStaleOwner(pLink->pSegment, 1 - pLink->side);
+
+    // Nobody writes to our ring before we attach, drop what an earlier run left in it
+    uint64_t tail = atomic_load_explicit(&pLink->pInbound->tail, memory_order_acquire);
+    atomic_store_explicit(&pLink->pInbound->head, tail, memory_order_release);
+    atomic_store_explicit(&pLink->pInbound->parked, 0, memory_order_relaxed);
+    pLink->cachedTail = tail;
+
+    pLink->written = atomic_load_explicit(&pLink->pOutbound->tail, memory_order_relaxed);
+    pLink->cachedHead = atomic_load_explicit(&pLink->pOutbound->head, memory_order_acquire);
+
+    atomic_store(&pLink->pSegment->owners[pLink->side], (int)getpid());
+}
+
+void shmLinkClose(ShmLink* pLink) {
+    assert(pLink != NULL);
+    if (pLink->pSegment == NULL) {
+        return;
+    }
+
+    // The last one out removes the name, a mapping still held stays valid
+    atomic_store(&pLink->pSegment->owners[pLink->side], 0);
+    if (atomic_load(&pLink->pSegment->owners[1 - pLink->side]) == 0) {
+        shm_unlink(pLink->name);
+    }
+
+    munmap(pLink->pSegment, sizeof(ShmSegment));
+    pLink->pSegment = NULL;
+}
+
+bool shmLinkConnected(const ShmLink* pLink) {
+    return pLink->pSegment != NULL && atomic_load_explicit(&pLink->pSegment->owners[1 - pLink->side], memory_order_acquire) != 0;
+}
+
+bool shmLinkWrite(ShmLink* pLink, const struct iovec* pVectors, int count) {
+    ShmRing* pRing = pLink->pOutbound;
+
+    // Only refresh the consumer index when our cached copy says we are out of room
+    if (pLink->written - pLink->cachedHead == SHM_RING_SLOTS) {
+        pLink->cachedHead = atomic_load_explicit(&pRing->head, memory_order_acquire);
+        if (pLink->written - pLink->cachedHead == SHM_RING_SLOTS) {
+            return false;
+        }
+    }
+
+    ShmSlot* pSlot = &pRing->slots[pLink->written & SHM_RING_MASK];
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        assert(length + pVectors[i].iov_len <= sizeof(pSlot->bytes));
+        memcpy(pSlot->bytes + length, pVectors[i].iov_base, pVectors[i].iov_len);
+        length += pVectors[i].iov_len;
+    }
+    pSlot->length = (uint32_t)length;
+    pLink->written++;
+    return true;
+}
+
+bool shmLinkPublish(ShmLink* pLink) {
+    ShmRing* pRing = pLink->pOutbound;
+    atomic_store_explicit(&pRing->tail, pLink->written, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pRing->parked, memory_order_relaxed) == 0) {
+        return false;
+    }
+    return atomic_exchange_explicit(&pRing->parked, 0, memory_order_relaxed) != 0;
+}
+
+bool shmLinkWaitForRoom(ShmLink* pLink, int milliseconds) {
+    uint64_t giveUp = clockMicroseconds() + (uint64_t)milliseconds * 1000u;
+    struct timespec pause = { 0, SHM_ROOM_POLL_US * 1000L };
+
+    while (shmLinkConnected(pLink)) {
+        pLink->cachedHead = atomic_load_explicit(&pLink->pOutbound->head, memory_order_acquire);
+        if (pLink->written - pLink->cachedHead < SHM_RING_SLOTS) {
+            return true;
+        }
+        if (clockMicroseconds() >= giveUp) {
+            break;
+        }
+        nanosleep(&pause, NULL);
+    }
+    return false;
+}
+
+ssize_t shmLinkRead(ShmLink* pLink, uint8_t* pHeader, char* pData, size_t capacity) {
+    ShmRing* pRing = pLink->pInbound;
+    uint64_t head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+
+    if (head == pLink->cachedTail) {
+        pLink->cachedTail = atomic_load_explicit(&pRing->tail, memory_order_acquire);
+        if (head == pLink->cachedTail) {
+            return ERROR;
+        }
+    }
+
+    // Split the way recvmmsg scatters a framed datagram, anything past capacity is cut off
+    const ShmSlot* pSlot = &pRing->slots[head & SHM_RING_MASK];
+    size_t length = pSlot->length < sizeof(pSlot->bytes) ? pSlot->length : sizeof(pSlot->bytes);
+    size_t header = length < PACKET_HEADER_SIZE ? length : PACKET_HEADER_SIZE;
+    size_t payload = length - header < capacity ? length - header : capacity;
+    memcpy(pHeader, pSlot->bytes, header);
+    memcpy(pData, pSlot->bytes + header, payload);
+
+    atomic_store_explicit(&pRing->head, head + 1, memory_order_release);
+    return (ssize_t)(header + payload);
+}
+
+bool shmLinkPending(ShmLink* pLink) {
+    uint64_t head = atomic_load_explicit(&pLink->pInbound->head, memory_order_relaxed);
+    return head != atomic_load_explicit(&pLink->pInbound->tail, memory_order_acquire);
+}
+
+void shmLinkPark(ShmLink* pLink) {
+    atomic_store_explicit(&pLink->pInbound->parked, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void shmLinkUnpark(ShmLink* pLink) {
+    atomic_store_explicit(&pLink->pInbound->parked, 0, memory_order_relaxed);
+}
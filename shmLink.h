@@ -0,0 +1,97 @@
+#ifndef SHM_LINK_H_
+#define SHM_LINK_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "messagePool.h"
+#include "protocol.h"
+#include "ringBuffer.h"
+
+// Datagrams per direction, a power of two
+#define SHM_RING_SLOTS 1024
+
+// How long a receiver keeps checking the rings before it goes to sleep on the socket,
+// raise it to trade CPU for wake-up latency
+#ifndef SHM_SPIN_US
+#define SHM_SPIN_US 0
+#endif
+
+// How long a sender waits for room in a full ring before dropping the datagram
+#define SHM_FULL_WAIT_MS 100
+
+// One datagram, header included, exactly as it would have gone over the wire
+typedef struct ShmSlot {
+    uint32_t  length;
+    uint8_t   bytes[PACKET_HEADER_SIZE + MAX_CHAR_COUNT];
+} ShmSlot;
+
+// Single-producer/single-consumer ring of slots, lives in the shared mapping.
+// A consumer about to sleep sets parked, the producer that finds it set sends a
+// zero-length datagram so the consumer's poll on the socket returns.
+typedef struct ShmRing {
+    // Consumer side
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head;
+    atomic_uint    parked;
+
+    // Producer side
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail;
+
+    _Alignas(CACHE_LINE_SIZE) ShmSlot slots[SHM_RING_SLOTS];
+} ShmRing;
+
+// Both directions between two ports, named after the pair so either side can create it.
+// Side 0 is the lower port, rings[i] is what side i receives.
+typedef struct ShmSegment {
+    atomic_int  owners[2];          // Pid of each attached side, 0 when gone
+    ShmRing     rings[2];
+} ShmSegment;
+
+// One process's view of a segment, the cached indices stay private
+typedef struct ShmLink {
+    ShmSegment*  pSegment;          // NULL when the peer is not on this host
+    ShmRing*     pInbound;
+    ShmRing*     pOutbound;
+    int          side;
+    uint64_t     cachedHead;        // Producer's copy of pOutbound->head
+    uint64_t     cachedTail;        // Consumer's copy of pInbound->tail
+    uint64_t     written;           // Producer's tail, published by shmLinkPublish
+    char         name[32];
+} ShmLink;
+
+// True for loopback and the addresses of this host's interfaces
+bool shmAddressIsLocal(struct in_addr address);
+
+// Map the segment for this port pair, creating it when we are first, and attach our side.
+// Whatever a previous run left queued for us is discarded.
+void shmLinkOpen(ShmLink* pLink, uint16_t localPort, uint16_t remotePort);
+void shmLinkClose(ShmLink* pLink);
+
+// The other side is attached, until then datagrams for it take the socket
+bool shmLinkConnected(const ShmLink* pLink);
+
+// Producer, one thread at a time per link. Write copies one datagram into the next slot,
+// false when the ring is full and it was dropped, like a full socket buffer would.
+// Publish makes everything written visible, true when the consumer needs a doorbell.
+bool shmLinkWrite(ShmLink* pLink, const struct iovec* pVectors, int count);
+bool shmLinkPublish(ShmLink* pLink);
+
+// Sleep in short steps until the consumer frees a slot, false after milliseconds or once it detached
+bool shmLinkWaitForRoom(ShmLink* pLink, int milliseconds);
+
+// Consumer. Read copies the next datagram out, the first PACKET_HEADER_SIZE bytes into
+// pHeader and the rest into pData, returning its full length or -1 when the ring is empty.
+ssize_t shmLinkRead(ShmLink* pLink, uint8_t* pHeader, char* pData, size_t capacity);
+bool shmLinkPending(ShmLink* pLink);
+
+// Park before sleeping on the socket, the seq_cst fence pairs with the one in shmLinkPublish
+// so either we see the datagram or the producer sees the flag. Unpark once awake.
+void shmLinkPark(ShmLink* pLink);
+void shmLinkUnpark(ShmLink* pLink);
+
+#endif
@@ -0,0 +1,1192 @@
+#define _GNU_SOURCE // For memmem, pipe2, ppoll and pthread_timedjoin_np
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "messagePool.h"
+
+// Soak test: one s-talk under test talking to M simulated peers, each of them another
+// s-talk fed seeded traffic by this driver. Every datagram goes through a UDP proxy in
+// this process that drops, duplicates, delays and reorders them. Runs for as long as
+// asked, samples every endpoint each interval and fails once one of them regresses
+// against how it looked after the first interval.
+
+#define ERROR -1
+
+#define DEFAULT_PEERS 4
+#define MAX_PEERS 32
+#define DEFAULT_SECONDS 60
+#define DEFAULT_INTERVAL 10
+#define DEFAULT_RATE 200            // Messages per second from each sender
+#define DEFAULT_LARGE_SIZE 8192
+#define DEFAULT_PORT 7200
+#define DEFAULT_PROFILES "steady,bursty,large"
+#define MIN_SIZE 40                 // Room for "<source> <sequence> <timestamp> " and the newline
+#define MAX_SIZE 65536
+#define SMALL_SIZE 160              // Steady and bursty lines are at most this long
+#define BURST_MAX 64                // Lines back to back in one burst
+#define LARGE_RATE_DIVISOR 8        // Large messages go this much less often
+#define CATCH_UP_LIMIT_US 1000000u  // A sender further behind than this skips ahead
+
+#define PROXY_HELD_CAPACITY 8192    // Datagrams delayed at once, more go out right away
+#define PROXY_BUFFER_SIZE (4 * 1024 * 1024)
+#define PROXY_IDLE_US 100000u
+#define REORDER_HOLD_US 5000u       // Most a reordered datagram falls behind the ones after it
+
+#define READ_BUFFER_SIZE (2 * MAX_SIZE)
+#define STARTUP_TIMEOUT_US 5000000u
+#define IDLE_TIMEOUT_US 1000000u    // Stop waiting for stragglers once nothing arrived for this long
+#define EXIT_TIMEOUT_US 5000000u
+#define SAMPLE_SLICE_US 100000u     // How soon a Ctrl-C is noticed
+
+// Regressions, each measured against the end of the first interval
+#define RSS_GROWTH_LIMIT_KB 16384
+#define FD_GROWTH_LIMIT 0
+#define LATENCY_DRIFT_FACTOR 4
+#define LATENCY_DRIFT_FLOOR_US 20000u
+#define DELIVERY_DRIFT_POINTS 5.0
+#define QUEUE_DRIFT_FLOOR 64        // A high water mark below this is never a regression
+
+#define LATENCY_BUCKETS 256         // Four per power of two
+
+typedef enum Profile { PROFILE_STEADY, PROFILE_BURSTY, PROFILE_LARGE } Profile;
+
+// What s-talk prints once its socket is bound
+static const char sListening[] = "Client listening on port";
+
+static const char* sProfileNames[] = { "steady", "bursty", "large" };
+
+static const char* sWords[] = {
+    "hey", "there", "what", "do", "you", "think", "about", "the", "meeting", "tomorrow", "sounds",
+    "good", "to", "me", "I'll", "send", "it", "over", "later", "tonight", "thanks", "a", "lot",
+    "no", "problem", "see", "you", "soon", "did", "anyone", "check", "build", "yet", "lol", "ok"
+};
+#define WORD_COUNT (int)(sizeof(sWords) / sizeof(sWords[0]))
+
+// Everything one source's messages did at one receiver
+typedef struct Stream {
+    uint8_t*    pSeen;              // Bit per sequence number, grows with the sender
+    size_t      capacity;           // In sequence numbers
+    uint64_t    received;
+    uint64_t    duplicates;
+    uint64_t    reordered;
+    int64_t     highest;
+    uint64_t    intervalReceived;
+    uint64_t    latencies[LATENCY_BUCKETS];     // This interval's
+} Stream;
+
+struct Soak;
+
+// An s-talk process, its pipes and the threads that feed and read them. Source 0 is the
+// endpoint under test, source i + 1 is peer i.
+typedef struct Endpoint {
+    struct Soak*    pSoak;
+    int             source;
+    pid_t           pid;
+    int             input;              // Write end of its stdin
+    int             output;             // Read end of its stdout
+    int             errors;             // Read end of its stderr
+    Profile         profile;
+    uint64_t        random;
+    int             fanout;             // Receivers of each line it sends
+    atomic_uint_fast64_t sent;
+    atomic_bool     ready;              // It printed its first prompt
+    bool            exited;
+    pthread_t       writerThread;
+    pthread_t       readerThread;
+    pthread_t       errorThread;
+
+    pthread_mutex_t lock;               // Guards everything below, the reader against sampling
+    Stream          streams[MAX_PEERS + 1];     // By source
+    bool            queuesSeen;         // A metrics snapshot arrived
+    int             queueHighWater[2];  // Client and remote, from the last snapshot
+} Endpoint;
+
+// One direction of one peer's traffic through the proxy
+typedef struct Link {
+    int                 in;             // Socket it arrives on
+    int                 out;            // Socket it leaves from, what the receiver knows the sender as
+    struct sockaddr_in  to;
+    uint64_t            random;
+} Link;
+
+typedef struct Held {
+    uint64_t    release;                // Microseconds
+    uint64_t    order;                  // Keeps equal release times in arrival order
+    Link*       pLink;
+    size_t      length;
+    uint8_t*    pData;
+} Held;
+
+typedef struct Proxy {
+    int             lossPercent;
+    int             duplicatePercent;
+    int             reorderPercent;
+    int             delayUs;            // Datagrams take between half and one and a half of this
+    int             linkCount;
+    Link            links[2 * MAX_PEERS];
+    struct pollfd   descriptors[2 * MAX_PEERS];     // descriptors[i] is links[i].in
+    Held            held[PROXY_HELD_CAPACITY];      // Min-heap on release time
+    int             heldCount;
+    uint64_t        order;
+    atomic_bool     stopping;
+    atomic_uint_fast64_t forwarded;
+    atomic_uint_fast64_t dropped;
+    atomic_uint_fast64_t duplicated;
+    atomic_uint_fast64_t reordered;
+    atomic_uint_fast64_t overflowed;
+} Proxy;
+
+typedef struct Soak {
+    int             peerCount;
+    int             endpointCount;
+    Endpoint        endpoints[MAX_PEERS + 1];
+    int             rate;
+    int             largeSize;
+    atomic_bool     stopping;
+} Soak;
+
+// What one interval looked like across every endpoint
+typedef struct Sample {
+    uint64_t    expected;               // Lines sent times their receivers
+    uint64_t    received;
+    double      delivered;              // Percent
+    uint64_t    p50;
+    uint64_t    p99;
+    long        rss[MAX_PEERS + 1];
+    int         fds[MAX_PEERS + 1];
+    int         highWater[2];
+    bool        queuesSeen;
+} Sample;
+
+static atomic_bool sInterrupted;
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static void printUsage(const char* program) {
+    printf("Usage: %s [-b s-talk] [-M peers] [-d seconds] [-i seconds] [-S seed] [-r rate] [-s size] [-P profiles] [-x loss,duplicate,reorder[,delay]] [-p port] [-g kilobytes] [-j factor] [-D percent] [-Q] [-l label] [-- s-talk flags]\n", program);
+    printf("  peers get the comma-separated profiles (steady, bursty, large) in turn, the endpoint under test sends steady\n");
+    printf("  rate is messages per second from each sender, large ones go %d times less often\n", LARGE_RATE_DIVISOR);
+    printf("  size is the largest large message, anything past %d bytes needs -F or -r in the flags\n", MAX_CHAR_COUNT - 1);
+    printf("  -x impairs every datagram in percent, delay is in milliseconds\n");
+    printf("  -g and -j are the RSS growth in kilobytes and the p99 latency factor that fail the run\n");
+    printf("  -D fails the run when less than percent of the messages were delivered in the end\n");
+    printf("  -Q tracks queue high water marks, needs an s-talk built with METRICS=1\n");
+    printf("  -s in the s-talk flags skips the network and with it the proxy\n");
+}
+
+static void handleInterrupt(int signal) {
+    (void)signal;
+    atomic_store(&sInterrupted, true);
+}
+
+// splitmix64, so seeds next to each other still start far apart
+static uint64_t seedRandom(uint64_t seed, uint64_t stream) {
+    uint64_t value = seed + stream * 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    value ^= value >> 31;
+    return value != 0 ? value : 1;
+}
+
+// xorshift64*, each sender and each proxy link keeps its own so runs repeat
+static uint64_t nextRandom(uint64_t* pState) {
+    uint64_t value = *pState;
+    value ^= value >> 12;
+    value ^= value << 25;
+    value ^= value >> 27;
+    *pState = value;
+    return value * 0x2545F4914F6CDD1Dull;
+}
+
+static bool rollPercent(uint64_t* pState, int percent) {
+    return percent > 0 && (int)(nextRandom(pState) % 100) < percent;
+}
+
+static void sleepUntil(uint64_t microseconds) {
+    struct timespec deadline;
+    deadline.tv_sec = (time_t)(microseconds / 1000000u);
+    deadline.tv_nsec = (long)(microseconds % 1000000u) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+static bool writeAll(int descriptor, const char* pData, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(descriptor, pData, length);
+        if (written == ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pData += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static int latencyBucket(uint64_t microseconds) {
+    if (microseconds < 4) {
+        return (int)microseconds;
+    }
+    int top = 63 - __builtin_clzll(microseconds);
+    return (top - 1) * 4 + (int)((microseconds >> (top - 2)) & 3);
+}
+
+// The largest latency that lands in bucket
+static uint64_t bucketLimit(int bucket) {
+    if (bucket < 4) {
+        return (uint64_t)bucket;
+    }
+    int top = bucket / 4 + 1;
+    uint64_t step = 1ull << (top - 2);
+    return (uint64_t)(4 + bucket % 4) * step + step - 1;
+}
+
+static uint64_t bucketPercentile(const uint64_t* pBuckets, uint64_t total, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * (double)total + 0.999999);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += pBuckets[bucket];
+        if (seen >= rank && seen > 0) {
+            return bucketLimit(bucket);
+        }
+    }
+    return 0;
+}
+
+// Resident set in kilobytes, -1 once the process is gone
+static long residentKilobytes(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    FILE* pFile = fopen(path, "r");
+    if (pFile == NULL) {
+        return ERROR;
+    }
+
+    long size;
+    long resident;
+    int fields = fscanf(pFile, "%ld %ld", &size, &resident);
+    fclose(pFile);
+    return fields == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : ERROR;
+}
+
+static int openDescriptors(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR* pDirectory = opendir(path);
+    if (pDirectory == NULL) {
+        return ERROR;
+    }
+
+    int count = 0;
+    struct dirent* pEntry;
+    while ((pEntry = readdir(pDirectory)) != NULL) {
+        if (pEntry->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(pDirectory);
+    return count;
+}
+
+// Run binary with ppArguments (binary first, NULL last) on pipes owned by pEndpoint
+static void spawnEndpoint(Endpoint* pEndpoint, const char* binary, char** ppArguments) {
+    int input[2];
+    int output[2];
+    int errors[2];
+    if (pipe2(input, O_CLOEXEC) == ERROR || pipe2(output, O_CLOEXEC) == ERROR || pipe2(errors, O_CLOEXEC) == ERROR) {
+        perror("pipe failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == ERROR) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0) {
+        // Its own process group keeps a Ctrl-C meant for the soak away from it
+        setpgid(0, 0);
+        signal(SIGPIPE, SIG_DFL);
+        dup2(input[0], STDIN_FILENO);
+        dup2(output[1], STDOUT_FILENO);
+        dup2(errors[1], STDERR_FILENO);
+        execv(binary, ppArguments);
+        perror("exec failed");
+        _exit(EXIT_FAILURE);
+    }
+
+    close(input[0]);
+    close(output[1]);
+    close(errors[1]);
+    pEndpoint->pid = pid;
+    pEndpoint->input = input[1];
+    pEndpoint->output = output[0];
+    pEndpoint->errors = errors[0];
+}
+
+static int bindLoopback(int port) {
+    int descriptor = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (descriptor == ERROR) {
+        perror("socket failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Bursts from every peer meet here, a capped buffer only means the proxy drops a few more
+    int size = PROXY_BUFFER_SIZE;
+    setsockopt(descriptor, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(descriptor, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    if (bind(descriptor, (struct sockaddr*)&address, sizeof(address)) == ERROR) {
+        fprintf(stderr, "Proxy could not bind port %d: %s\n", port, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return descriptor;
+}
+
+// "loss,duplicate,reorder[,delay]"
+static bool parseFaults(Proxy* pProxy, const char* text) {
+    int delayMs = 0;
+    int fields = sscanf(text, "%d,%d,%d,%d", &pProxy->lossPercent, &pProxy->duplicatePercent, &pProxy->reorderPercent, &delayMs);
+    pProxy->delayUs = delayMs * 1000;
+    return fields >= 3 && pProxy->lossPercent >= 0 && pProxy->lossPercent <= 100 && pProxy->duplicatePercent >= 0
+           && pProxy->duplicatePercent <= 100 && pProxy->reorderPercent >= 0 && pProxy->reorderPercent <= 100
+           && delayMs >= 0 && delayMs <= 10000;
+}
+
+// Peers take the listed profiles in turn
+static bool parseProfiles(Soak* pSoak, const char* list) {
+    const char* pField = list;
+    int count = 0;
+    Profile profiles[MAX_PEERS];
+    while (count < MAX_PEERS) {
+        size_t length = strcspn(pField, ",");
+        int match = ERROR;
+        for (int i = 0; i < (int)(sizeof(sProfileNames) / sizeof(sProfileNames[0])); i++) {
+            if (strlen(sProfileNames[i]) == length && strncmp(pField, sProfileNames[i], length) == 0) {
+                match = i;
+            }
+        }
+        if (match == ERROR) {
+            return false;
+        }
+        profiles[count++] = (Profile)match;
+
+        if (pField[length] == '\0') {
+            break;
+        }
+        pField += length + 1;
+    }
+
+    for (int i = 0; i < pSoak->peerCount; i++) {
+        pSoak->endpoints[i + 1].profile = profiles[i % count];
+    }
+    return true;
+}
+
+//===================================================================================
+// Proxy
+//===================================================================================
+
+static bool heldBefore(const Held* pLeft, const Held* pRight) {
+    return pLeft->release < pRight->release || (pLeft->release == pRight->release && pLeft->order < pRight->order);
+}
+
+static void heldPush(Proxy* pProxy, Held held) {
+    int index = pProxy->heldCount++;
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!heldBefore(&held, &pProxy->held[parent])) {
+            break;
+        }
+        pProxy->held[index] = pProxy->held[parent];
+        index = parent;
+    }
+    pProxy->held[index] = held;
+}
+
+static Held heldPop(Proxy* pProxy) {
+    Held first = pProxy->held[0];
+    Held last = pProxy->held[--pProxy->heldCount];
+    int index = 0;
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= pProxy->heldCount) {
+            break;
+        }
+        if (child + 1 < pProxy->heldCount && heldBefore(&pProxy->held[child + 1], &pProxy->held[child])) {
+            child++;
+        }
+        if (!heldBefore(&pProxy->held[child], &last)) {
+            break;
+        }
+        pProxy->held[index] = pProxy->held[child];
+        index = child;
+    }
+    if (pProxy->heldCount > 0) {
+        pProxy->held[index] = last;
+    }
+    return first;
+}
+
+static void forward(Proxy* pProxy, Link* pLink, const uint8_t* pData, size_t length) {
+    // A full socket buffer on the way out is loss like any other
+    sendto(pLink->out, pData, length, 0, (const struct sockaddr*)&pLink->to, sizeof(pLink->to));
+    atomic_fetch_add_explicit(&pProxy->forwarded, 1, memory_order_relaxed);
+}
+
+// One datagram that came in on pLink, dropped, sent now or held until its release time
+static void admit(Proxy* pProxy, Link* pLink, const uint8_t* pData, size_t length, uint64_t now) {
+    if (rollPercent(&pLink->random, pProxy->lossPercent)) {
+        atomic_fetch_add_explicit(&pProxy->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    int copies = 1;
+    if (rollPercent(&pLink->random, pProxy->duplicatePercent)) {
+        atomic_fetch_add_explicit(&pProxy->duplicated, 1, memory_order_relaxed);
+        copies = 2;
+    }
+
+    for (int copy = 0; copy < copies; copy++) {
+        uint64_t delay = 0;
+        if (pProxy->delayUs > 0) {
+            delay = (uint64_t)pProxy->delayUs / 2 + nextRandom(&pLink->random) % (uint64_t)pProxy->delayUs;
+        }
+        if (rollPercent(&pLink->random, pProxy->reorderPercent)) {
+            atomic_fetch_add_explicit(&pProxy->reordered, 1, memory_order_relaxed);
+            delay += 1 + nextRandom(&pLink->random) % REORDER_HOLD_US;
+        }
+
+        uint8_t* pCopy = delay > 0 && pProxy->heldCount < PROXY_HELD_CAPACITY ? malloc(length) : NULL;
+        if (pCopy == NULL) {
+            if (delay > 0) {
+                atomic_fetch_add_explicit(&pProxy->overflowed, 1, memory_order_relaxed);
+            }
+            forward(pProxy, pLink, pData, length);
+            continue;
+        }
+
+        memcpy(pCopy, pData, length);
+        Held held = { now + delay, pProxy->order++, pLink, length, pCopy };
+        heldPush(pProxy, held);
+    }
+}
+
+static void* proxyRoutine(void* args) {
+    Proxy* pProxy = (Proxy*)args;
+    uint8_t* pBuffer = malloc(MAX_SIZE);
+    if (pBuffer == NULL) {
+        perror("Proxy buffer allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!atomic_load(&pProxy->stopping)) {
+        uint64_t now = clockMicroseconds();
+        while (pProxy->heldCount > 0 && pProxy->held[0].release <= now) {
+            Held held = heldPop(pProxy);
+            forward(pProxy, held.pLink, held.pData, held.length);
+            free(held.pData);
+        }
+
+        uint64_t wait = pProxy->heldCount > 0 ? pProxy->held[0].release - now : PROXY_IDLE_US;
+        struct timespec timeout = { (time_t)(wait / 1000000u), (long)(wait % 1000000u) * 1000 };
+        if (ppoll(pProxy->descriptors, (nfds_t)pProxy->linkCount, &timeout, NULL) <= 0) {
+            continue;
+        }
+
+        now = clockMicroseconds();
+        for (int i = 0; i < pProxy->linkCount; i++) {
+            if ((pProxy->descriptors[i].revents & POLLIN) == 0) {
+                continue;
+            }
+            ssize_t length;
+            while ((length = recv(pProxy->links[i].in, pBuffer, MAX_SIZE, 0)) >= 0) {
+                admit(pProxy, &pProxy->links[i], pBuffer, (size_t)length, now);
+            }
+        }
+    }
+
+    while (pProxy->heldCount > 0) {
+        free(heldPop(pProxy).pData);
+    }
+    free(pBuffer);
+    return NULL;
+}
+
+// The endpoint under test knows peer i as proxyPort + i, peer i knows it as proxyPort +
+// peers + i. Whatever arrives on one leaves from the other, so both see the address they
+// expect.
+static void proxyInitialize(Proxy* pProxy, int peerCount, int port, int proxyPort, uint64_t seed) {
+    for (int i = 0; i < peerCount; i++) {
+        int towardTest = bindLoopback(proxyPort + i);
+        int towardPeer = bindLoopback(proxyPort + peerCount + i);
+
+        Link* pOut = &pProxy->links[2 * i];
+        Link* pBack = &pProxy->links[2 * i + 1];
+        pOut->in = towardTest;
+        pOut->out = towardPeer;
+        pBack->in = towardPeer;
+        pBack->out = towardTest;
+
+        int ports[2] = { port + 1 + i, port };
+        for (int j = 0; j < 2; j++) {
+            Link* pLink = &pProxy->links[2 * i + j];
+            memset(&pLink->to, 0, sizeof(pLink->to));
+            pLink->to.sin_family = AF_INET;
+            pLink->to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            pLink->to.sin_port = htons((uint16_t)ports[j]);
+            pLink->random = seedRandom(seed, 1000u + (uint64_t)(2 * i + j));
+            pProxy->descriptors[2 * i + j].fd = pLink->in;
+            pProxy->descriptors[2 * i + j].events = POLLIN;
+        }
+    }
+    pProxy->linkCount = 2 * peerCount;
+}
+
+//===================================================================================
+// Routines
+//===================================================================================
+
+// Seeded traffic into one endpoint's stdin until the soak stops
+static void* writerRoutine(void* args) {
+    Endpoint* pEndpoint = (Endpoint*)args;
+    Soak* pSoak = pEndpoint->pSoak;
+    char* pLine = malloc(MAX_SIZE + 1);
+    if (pLine == NULL) {
+        perror("Line allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t gap = 1000000u / (uint64_t)pSoak->rate;
+    uint64_t next = clockMicroseconds();
+    while (!atomic_load(&pSoak->stopping)) {
+        int lines = 1;
+        uint64_t wait = gap;
+        if (pEndpoint->profile == PROFILE_BURSTY) {
+            // A random burst, then as long a pause as keeps the average at the rate
+            lines = 1 + (int)(nextRandom(&pEndpoint->random) % BURST_MAX);
+            wait = (uint64_t)lines * gap * (50 + nextRandom(&pEndpoint->random) % 101) / 100;
+        } else if (pEndpoint->profile == PROFILE_LARGE) {
+            wait = gap * LARGE_RATE_DIVISOR;
+        }
+
+        for (int i = 0; i < lines; i++) {
+            int size = MIN_SIZE + (int)(nextRandom(&pEndpoint->random) % (SMALL_SIZE - MIN_SIZE + 1));
+            if (pEndpoint->profile == PROFILE_LARGE) {
+                int smallest = pSoak->largeSize / 2 > MIN_SIZE ? pSoak->largeSize / 2 : MIN_SIZE;
+                size = smallest + (int)(nextRandom(&pEndpoint->random) % (uint64_t)(pSoak->largeSize - smallest + 1));
+            }
+
+            // Counted before it is written, the receiver ignores sequence numbers past sent
+            uint64_t sequence = atomic_fetch_add(&pEndpoint->sent, 1);
+            int used = snprintf(pLine, (size_t)size, "%d %" PRIu64 " %" PRIu64 " ", pEndpoint->source, sequence, clockMicroseconds());
+            int word = (int)(nextRandom(&pEndpoint->random) % WORD_COUNT);
+            while (used < size - 1) {
+                for (const char* pWord = sWords[word]; *pWord != '\0' && used < size - 1; pWord++) {
+                    pLine[used++] = *pWord;
+                }
+                if (used < size - 1) {
+                    pLine[used++] = ' ';
+                }
+                word = (word * 7 + 3) % WORD_COUNT;
+            }
+            pLine[used++] = '\n';
+
+            if (!writeAll(pEndpoint->input, pLine, (size_t)used)) {
+                free(pLine);
+                return NULL;
+            }
+        }
+
+        // Behind by more than a moment means the endpoint pushed back, don't make up for it in one go
+        next += wait;
+        uint64_t now = clockMicroseconds();
+        if (next + CATCH_UP_LIMIT_US < now) {
+            next = now;
+        }
+        sleepUntil(next);
+    }
+
+    free(pLine);
+    return NULL;
+}
+
+// One line of screen output, anything that isn't a soak message is ignored
+static void recordLine(Endpoint* pEndpoint, const char* pLine, size_t length, uint64_t now) {
+    const char* pRemote = memmem(pLine, length, "Remote", 6);
+    if (pRemote == NULL) {
+        return;
+    }
+    const char* pText = memmem(pRemote, length - (size_t)(pRemote - pLine), ": ", 2);
+    if (pText == NULL) {
+        return;
+    }
+
+    int source;
+    uint64_t sequence;
+    uint64_t sent;
+    if (sscanf(pText + 2, "%d %" SCNu64 " %" SCNu64, &source, &sequence, &sent) != 3 || source < 0
+        || source >= pEndpoint->pSoak->endpointCount || source == pEndpoint->source
+        || sequence >= atomic_load(&pEndpoint->pSoak->endpoints[source].sent) || sent > now) {
+        return;
+    }
+
+    pthread_mutex_lock(&pEndpoint->lock);
+    Stream* pStream = &pEndpoint->streams[source];
+    if (sequence >= pStream->capacity) {
+        size_t capacity = pStream->capacity > 0 ? pStream->capacity : 65536;
+        while (capacity <= sequence) {
+            capacity *= 2;
+        }
+        uint8_t* pSeen = realloc(pStream->pSeen, capacity / 8);
+        if (pSeen == NULL) {
+            perror("Stream allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        memset(pSeen + pStream->capacity / 8, 0, (capacity - pStream->capacity) / 8);
+        pStream->pSeen = pSeen;
+        pStream->capacity = capacity;
+    }
+
+    uint8_t bit = (uint8_t)(1u << (sequence % 8));
+    if (pStream->pSeen[sequence / 8] & bit) {
+        pStream->duplicates++;
+    } else {
+        pStream->pSeen[sequence / 8] |= bit;
+        if ((int64_t)sequence < pStream->highest) {
+            pStream->reordered++;
+        } else {
+            pStream->highest = (int64_t)sequence;
+        }
+        pStream->received++;
+        pStream->intervalReceived++;
+        pStream->latencies[latencyBucket(now - sent)]++;
+    }
+    pthread_mutex_unlock(&pEndpoint->lock);
+}
+
+// Drain an endpoint's stdout until it exits
+static void* readerRoutine(void* args) {
+    Endpoint* pEndpoint = (Endpoint*)args;
+    char* pBuffer = malloc(READ_BUFFER_SIZE);
+    if (pBuffer == NULL) {
+        perror("Read buffer allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t pending = 0;
+
+    while (1) {
+        ssize_t result = read(pEndpoint->output, pBuffer + pending, READ_BUFFER_SIZE - pending);
+        if (result == ERROR && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        pending += (size_t)result;
+        uint64_t now = clockMicroseconds();
+
+        // Bound and listening, printed on piped stdin too where there is no prompt
+        if (!atomic_load(&pEndpoint->ready) && memmem(pBuffer, pending, sListening, sizeof(sListening) - 1) != NULL) {
+            atomic_store(&pEndpoint->ready, true);
+        }
+
+        size_t start = 0;
+        char* pNewline;
+        while ((pNewline = memchr(pBuffer + start, '\n', pending - start)) != NULL) {
+            size_t end = (size_t)(pNewline - pBuffer) + 1;
+            recordLine(pEndpoint, pBuffer + start, end - start, now);
+            start = end;
+        }
+
+        if (start == 0 && pending == READ_BUFFER_SIZE) {
+            start = pending;
+        }
+        pending -= start;
+        memmove(pBuffer, pBuffer + start, pending);
+    }
+
+    free(pBuffer);
+    return NULL;
+}
+
+// An endpoint's stderr. Metrics builds dump a snapshot there at exit, and with -Q every
+// interval from the endpoint under test, whose queue lines are kept. The rest of a snapshot
+// is dropped and anything else passed on.
+static void* errorRoutine(void* args) {
+    Endpoint* pEndpoint = (Endpoint*)args;
+    FILE* pFile = fdopen(pEndpoint->errors, "r");
+    if (pFile == NULL) {
+        perror("fdopen failed");
+        exit(EXIT_FAILURE);
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), pFile) != NULL) {
+        char name[32];
+        int highWater;
+        if (sscanf(line, " %31s depth %*d, high water %d", name, &highWater) == 2) {
+            int queue = strcmp(name, "client") == 0 ? 0 : strcmp(name, "remote") == 0 ? 1 : ERROR;
+            if (queue != ERROR && pEndpoint->source == 0) {
+                pthread_mutex_lock(&pEndpoint->lock);
+                pEndpoint->queuesSeen = true;
+                pEndpoint->queueHighWater[queue] = highWater;
+                pthread_mutex_unlock(&pEndpoint->lock);
+            }
+        } else if (line[0] != ' ' && line[0] != '=' && line[0] != '\n') {
+            fputs(line, stderr);
+        }
+    }
+
+    fclose(pFile);
+    return NULL;
+}
+
+//===================================================================================
+// Sampling
+//===================================================================================
+
+// Take and reset this interval's counts, previous holds the send counts last time
+static void takeSample(Soak* pSoak, Sample* pSample, uint64_t* pPrevious) {
+    memset(pSample, 0, sizeof(*pSample));
+    uint64_t latencies[LATENCY_BUCKETS] = {0};
+
+    for (int i = 0; i < pSoak->endpointCount; i++) {
+        Endpoint* pEndpoint = &pSoak->endpoints[i];
+        uint64_t sent = atomic_load(&pEndpoint->sent);
+        pSample->expected += (sent - pPrevious[i]) * (uint64_t)pEndpoint->fanout;
+        pPrevious[i] = sent;
+
+        pthread_mutex_lock(&pEndpoint->lock);
+        for (int source = 0; source < pSoak->endpointCount; source++) {
+            Stream* pStream = &pEndpoint->streams[source];
+            pSample->received += pStream->intervalReceived;
+            pStream->intervalReceived = 0;
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+                latencies[bucket] += pStream->latencies[bucket];
+            }
+            memset(pStream->latencies, 0, sizeof(pStream->latencies));
+        }
+        if (pEndpoint->queuesSeen) {
+            pSample->queuesSeen = true;
+            pSample->highWater[0] = pEndpoint->queueHighWater[0];
+            pSample->highWater[1] = pEndpoint->queueHighWater[1];
+        }
+        pthread_mutex_unlock(&pEndpoint->lock);
+
+        pSample->rss[i] = residentKilobytes(pEndpoint->pid);
+        pSample->fds[i] = openDescriptors(pEndpoint->pid);
+    }
+
+    pSample->delivered = pSample->expected > 0 ? 100.0 * (double)pSample->received / (double)pSample->expected : 100.0;
+    pSample->p50 = bucketPercentile(latencies, pSample->received, 0.50);
+    pSample->p99 = bucketPercentile(latencies, pSample->received, 0.99);
+}
+
+static void printSample(const Soak* pSoak, const Sample* pSample, double seconds) {
+    long peerRss = 0;
+    int peerFds = 0;
+    for (int i = 1; i < pSoak->endpointCount; i++) {
+        peerRss = pSample->rss[i] > peerRss ? pSample->rss[i] : peerRss;
+        peerFds = pSample->fds[i] > peerFds ? pSample->fds[i] : peerFds;
+    }
+
+    printf("  %7.0f s  expected %8" PRIu64 ", delivered %6.2f%%, latency us p50 %6" PRIu64 " p99 %7" PRIu64
+           ", rss KB %ld (peers %ld), fds %d (peers %d)",
+           seconds, pSample->expected, pSample->delivered, pSample->p50, pSample->p99,
+           pSample->rss[0], peerRss, pSample->fds[0], peerFds);
+    if (pSample->queuesSeen) {
+        printf(", high water client %d remote %d", pSample->highWater[0], pSample->highWater[1]);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+// Why pSample is a regression against pBaseline, NULL when it isn't
+static const char* findRegression(const Soak* pSoak, const Sample* pBaseline, const Sample* pSample,
+                                  long rssLimit, int latencyFactor, char* pReason, size_t size) {
+    for (int i = 0; i < pSoak->endpointCount; i++) {
+        const char* name = i == 0 ? "endpoint under test" : "peer";
+        if (pSoak->endpoints[i].exited || pSample->rss[i] == ERROR) {
+            snprintf(pReason, size, "%s %d exited", name, (int)pSoak->endpoints[i].pid);
+            return pReason;
+        }
+        if (pSample->rss[i] - pBaseline->rss[i] > rssLimit) {
+            snprintf(pReason, size, "%s %d grew from %ld to %ld KB resident", name, (int)pSoak->endpoints[i].pid,
+                     pBaseline->rss[i], pSample->rss[i]);
+            return pReason;
+        }
+        if (pSample->fds[i] - pBaseline->fds[i] > FD_GROWTH_LIMIT) {
+            snprintf(pReason, size, "%s %d went from %d to %d open descriptors", name, (int)pSoak->endpoints[i].pid,
+                     pBaseline->fds[i], pSample->fds[i]);
+            return pReason;
+        }
+    }
+
+    if (pSample->p99 > pBaseline->p99 * (uint64_t)latencyFactor && pSample->p99 - pBaseline->p99 > LATENCY_DRIFT_FLOOR_US) {
+        snprintf(pReason, size, "p99 latency drifted from %" PRIu64 " to %" PRIu64 " us", pBaseline->p99, pSample->p99);
+        return pReason;
+    }
+    if (pSample->delivered < pBaseline->delivered - DELIVERY_DRIFT_POINTS) {
+        snprintf(pReason, size, "delivery fell from %.2f%% to %.2f%%", pBaseline->delivered, pSample->delivered);
+        return pReason;
+    }
+
+    // High water marks only rise, so this catches a queue that keeps filling further
+    for (int queue = 0; queue < 2 && pSample->queuesSeen && pBaseline->queuesSeen; queue++) {
+        if (pSample->highWater[queue] > QUEUE_DRIFT_FLOOR && pSample->highWater[queue] > 2 * pBaseline->highWater[queue]) {
+            snprintf(pReason, size, "%s queue high water rose from %d to %d", queue == 0 ? "client" : "remote",
+                     pBaseline->highWater[queue], pSample->highWater[queue]);
+            return pReason;
+        }
+    }
+    return NULL;
+}
+
+static void noteExits(Soak* pSoak) {
+    for (int i = 0; i < pSoak->endpointCount; i++) {
+        if (!pSoak->endpoints[i].exited && waitpid(pSoak->endpoints[i].pid, NULL, WNOHANG) == pSoak->endpoints[i].pid) {
+            pSoak->endpoints[i].exited = true;
+        }
+    }
+}
+
+static uint64_t totalExpected(const Soak* pSoak) {
+    uint64_t expected = 0;
+    for (int i = 0; i < pSoak->endpointCount; i++) {
+        expected += atomic_load(&pSoak->endpoints[i].sent) * (uint64_t)pSoak->endpoints[i].fanout;
+    }
+    return expected;
+}
+
+// Unique, duplicate and reordered lines over the whole run
+static void totalReceived(Soak* pSoak, uint64_t* pReceived, uint64_t* pDuplicates, uint64_t* pReordered) {
+    *pReceived = 0;
+    *pDuplicates = 0;
+    *pReordered = 0;
+    for (int i = 0; i < pSoak->endpointCount; i++) {
+        Endpoint* pEndpoint = &pSoak->endpoints[i];
+        pthread_mutex_lock(&pEndpoint->lock);
+        for (int source = 0; source < pSoak->endpointCount; source++) {
+            *pReceived += pEndpoint->streams[source].received;
+            *pDuplicates += pEndpoint->streams[source].duplicates;
+            *pReordered += pEndpoint->streams[source].reordered;
+        }
+        pthread_mutex_unlock(&pEndpoint->lock);
+    }
+}
+
+//===================================================================================
+// Main
+//===================================================================================
+
+int main(int argc, char* argv[]) {
+    static Soak soak;
+    static Proxy proxy;
+    const char* binary = "bin/s-talk";
+    const char* label = NULL;
+    const char* profiles = DEFAULT_PROFILES;
+    int seconds = DEFAULT_SECONDS;
+    int interval = DEFAULT_INTERVAL;
+    int port = DEFAULT_PORT;
+    uint64_t seed = 1;
+    long rssLimit = RSS_GROWTH_LIMIT_KB;
+    int latencyFactor = LATENCY_DRIFT_FACTOR;
+    double minimumDelivered = 0;
+    bool queues = false;
+    soak.peerCount = DEFAULT_PEERS;
+    soak.rate = DEFAULT_RATE;
+    soak.largeSize = DEFAULT_LARGE_SIZE;
+
+    int option;
+    while ((option = getopt(argc, argv, "b:M:d:i:S:r:s:P:x:p:g:j:D:Ql:h")) != -1) {
+        if (option == 'b') {
+            binary = optarg;
+        } else if (option == 'M') {
+            soak.peerCount = atoi(optarg);
+        } else if (option == 'd') {
+            seconds = atoi(optarg);
+        } else if (option == 'i') {
+            interval = atoi(optarg);
+        } else if (option == 'S') {
+            seed = strtoull(optarg, NULL, 10);
+        } else if (option == 'r') {
+            soak.rate = atoi(optarg);
+        } else if (option == 's') {
+            soak.largeSize = atoi(optarg);
+        } else if (option == 'P') {
+            profiles = optarg;
+        } else if (option == 'x' && parseFaults(&proxy, optarg)) {
+            // Checked as it is parsed
+        } else if (option == 'p') {
+            port = atoi(optarg);
+        } else if (option == 'g') {
+            rssLimit = atol(optarg);
+        } else if (option == 'j') {
+            latencyFactor = atoi(optarg);
+        } else if (option == 'D') {
+            minimumDelivered = atof(optarg);
+        } else if (option == 'Q') {
+            queues = true;
+        } else if (option == 'l') {
+            label = optarg;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    soak.endpointCount = soak.peerCount + 1;
+    if (soak.peerCount < 1 || soak.peerCount > MAX_PEERS || seconds <= 0 || interval <= 0 || soak.rate <= 0
+        || soak.rate > 1000000 || soak.largeSize < MIN_SIZE || soak.largeSize > MAX_SIZE || port <= 0
+        || port + 1 + 3 * soak.peerCount > 65535 || rssLimit < 0 || latencyFactor < 1 || !parseProfiles(&soak, profiles)) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Everything after "--" goes to every endpoint
+    char** ppFlags = argv + optind;
+    int flagCount = argc - optind;
+
+    // A dead endpoint shows up as a failed write, Ctrl-C ends the soak early with a report
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleInterrupt;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int proxyPort = port + 1 + soak.peerCount;
+    proxyInitialize(&proxy, soak.peerCount, port, proxyPort, seed);
+    pthread_t proxyThread;
+    if (pthread_create(&proxyThread, NULL, proxyRoutine, &proxy) != 0) {
+        fprintf(stderr, "Error creating thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%s\n", label != NULL ? label : binary);
+    printf("  seed %" PRIu64 ", %d peers at %d messages/s (", seed, soak.peerCount, soak.rate);
+    for (int i = 0; i < soak.peerCount; i++) {
+        printf("%s%s", i > 0 ? "," : "", sProfileNames[soak.endpoints[i + 1].profile]);
+    }
+    printf("), proxy loss %d%%, duplicate %d%%, reorder %d%%, delay %d ms\n", proxy.lossPercent,
+           proxy.duplicatePercent, proxy.reorderPercent, proxy.delayUs / 1000);
+    fflush(stdout);
+
+    // Arguments are the flags, -m for the snapshots and then "<myPort> [127.0.0.1 <port>]..."
+    char** ppArguments = calloc((size_t)flagCount + 2 * (size_t)soak.peerCount + 6, sizeof(char*));
+    char* pText = calloc((size_t)soak.peerCount + 2, 32);
+    if (ppArguments == NULL || pText == NULL) {
+        perror("Argument allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < soak.endpointCount; i++) {
+        Endpoint* pEndpoint = &soak.endpoints[i];
+        pEndpoint->pSoak = &soak;
+        pEndpoint->source = i;
+        pEndpoint->fanout = i == 0 ? soak.peerCount : 1;
+        pEndpoint->random = seedRandom(seed, (uint64_t)i);
+        atomic_init(&pEndpoint->sent, 0);
+        atomic_init(&pEndpoint->ready, false);
+        pthread_mutex_init(&pEndpoint->lock, NULL);
+        for (int source = 0; source < soak.endpointCount; source++) {
+            pEndpoint->streams[source].highest = ERROR;
+        }
+
+        int count = 0;
+        ppArguments[count++] = (char*)binary;
+        for (int j = 0; j < flagCount; j++) {
+            ppArguments[count++] = ppFlags[j];
+        }
+        if (i == 0 && queues) {
+            snprintf(pText, 32, "%d", interval);
+            ppArguments[count++] = "-m";
+            ppArguments[count++] = pText;
+        }
+        snprintf(pText + 32, 32, "%d", port + i);
+        ppArguments[count++] = pText + 32;
+        if (i == 0) {
+            for (int j = 0; j < soak.peerCount; j++) {
+                snprintf(pText + 32 * (j + 2), 32, "%d", proxyPort + j);
+                ppArguments[count++] = "127.0.0.1";
+                ppArguments[count++] = pText + 32 * (j + 2);
+            }
+        } else {
+            snprintf(pText + 64, 32, "%d", proxyPort + soak.peerCount + i - 1);
+            ppArguments[count++] = "127.0.0.1";
+            ppArguments[count++] = pText + 64;
+        }
+        ppArguments[count] = NULL;
+
+        spawnEndpoint(pEndpoint, binary, ppArguments);
+        if (pthread_create(&pEndpoint->readerThread, NULL, readerRoutine, pEndpoint) != 0
+            || pthread_create(&pEndpoint->errorThread, NULL, errorRoutine, pEndpoint) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Each one is listening before the next sends to it
+        uint64_t startupDeadline = clockMicroseconds() + STARTUP_TIMEOUT_US;
+        while (!atomic_load(&pEndpoint->ready) && clockMicroseconds() < startupDeadline) {
+            usleep(1000);
+        }
+        if (!atomic_load(&pEndpoint->ready)) {
+            fprintf(stderr, "Endpoint %d did not start\n", (int)pEndpoint->pid);
+        }
+    }
+    free(ppArguments);
+    free(pText);
+
+    for (int i = 0; i < soak.endpointCount; i++) {
+        if (pthread_create(&soak.endpoints[i].writerThread, NULL, writerRoutine, &soak.endpoints[i]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Sample every interval, the first one is the baseline the rest are held to
+    uint64_t start = clockMicroseconds();
+    uint64_t end = start + (uint64_t)seconds * 1000000u;
+    uint64_t previous[MAX_PEERS + 1] = {0};
+    Sample baseline;
+    Sample sample;
+    char reason[256];
+    const char* pRegression = NULL;
+    int samples = 0;
+    uint64_t next = start;
+    while (pRegression == NULL && !atomic_load(&sInterrupted) && next < end) {
+        next = next + (uint64_t)interval * 1000000u < end ? next + (uint64_t)interval * 1000000u : end;
+        while (!atomic_load(&sInterrupted) && clockMicroseconds() < next) {
+            uint64_t now = clockMicroseconds();
+            sleepUntil(next - now > SAMPLE_SLICE_US ? now + SAMPLE_SLICE_US : next);
+        }
+
+        noteExits(&soak);
+        takeSample(&soak, &sample, previous);
+        printSample(&soak, &sample, (double)(clockMicroseconds() - start) / 1e6);
+        if (samples++ == 0) {
+            baseline = sample;
+        }
+        pRegression = findRegression(&soak, &baseline, &sample, rssLimit, latencyFactor, reason, sizeof(reason));
+    }
+
+    // Stop the traffic and give the stragglers time to arrive, the proxy still running
+    atomic_store(&soak.stopping, true);
+    uint64_t stopped = clockMicroseconds();
+    for (int i = 0; i < soak.endpointCount; i++) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += EXIT_TIMEOUT_US / 1000000u;
+        if (pthread_timedjoin_np(soak.endpoints[i].writerThread, NULL, &deadline) != 0) {
+            // Wedged on a full pipe, killing it gets the write back
+            kill(soak.endpoints[i].pid, SIGKILL);
+            pthread_join(soak.endpoints[i].writerThread, NULL);
+        }
+    }
+
+    uint64_t expected = totalExpected(&soak);
+    uint64_t received;
+    uint64_t duplicates;
+    uint64_t reordered;
+    uint64_t lastProgress = clockMicroseconds();
+    uint64_t lastReceived = 0;
+    totalReceived(&soak, &received, &duplicates, &reordered);
+    while (received < expected && clockMicroseconds() - lastProgress < IDLE_TIMEOUT_US) {
+        usleep(10000);
+        totalReceived(&soak, &received, &duplicates, &reordered);
+        if (received != lastReceived) {
+            lastReceived = received;
+            lastProgress = clockMicroseconds();
+        }
+    }
+
+    // Every endpoint is told, a '!' the proxy drops mustn't leave a peer behind
+    for (int i = 0; i < soak.endpointCount; i++) {
+        writeAll(soak.endpoints[i].input, "!\n", 2);
+    }
+    bool clean = true;
+    uint64_t exitDeadline = clockMicroseconds() + EXIT_TIMEOUT_US;
+    for (int i = 0; i < soak.endpointCount; i++) {
+        Endpoint* pEndpoint = &soak.endpoints[i];
+        while (!pEndpoint->exited && waitpid(pEndpoint->pid, NULL, WNOHANG) == 0) {
+            if (clockMicroseconds() > exitDeadline) {
+                fprintf(stderr, "Endpoint %d did not exit, killing it\n", (int)pEndpoint->pid);
+                kill(pEndpoint->pid, SIGKILL);
+                waitpid(pEndpoint->pid, NULL, 0);
+                clean = false;
+                break;
+            }
+            usleep(1000);
+        }
+        pEndpoint->exited = true;
+        pthread_join(pEndpoint->readerThread, NULL);
+        pthread_join(pEndpoint->errorThread, NULL);
+        close(pEndpoint->input);
+        close(pEndpoint->output);
+    }
+
+    atomic_store(&proxy.stopping, true);
+    pthread_join(proxyThread, NULL);
+    for (int i = 0; i < proxy.linkCount; i += 2) {
+        close(proxy.links[i].in);
+        close(proxy.links[i].out);
+    }
+
+    double delivered = expected > 0 ? 100.0 * (double)received / (double)expected : 100.0;
+    printf("  ran %.0f s, expected %" PRIu64 ", delivered %" PRIu64 " (%.2f%%), %" PRIu64 " duplicates, %" PRIu64 " reordered, ended in %.1f s\n",
+           (double)(stopped - start) / 1e6, expected, received, delivered, duplicates, reordered,
+           (double)(clockMicroseconds() - stopped) / 1e6);
+    printf("  proxy forwarded %" PRIu64 ", dropped %" PRIu64 ", duplicated %" PRIu64 ", reordered %" PRIu64 ", sent early %" PRIu64 "\n",
+           (uint64_t)atomic_load(&proxy.forwarded), (uint64_t)atomic_load(&proxy.dropped),
+           (uint64_t)atomic_load(&proxy.duplicated), (uint64_t)atomic_load(&proxy.reordered),
+           (uint64_t)atomic_load(&proxy.overflowed));
+
+    if (pRegression == NULL && delivered < minimumDelivered) {
+        snprintf(reason, sizeof(reason), "delivered %.2f%%, less than %.2f%%", delivered, minimumDelivered);
+        pRegression = reason;
+    }
+    if (pRegression == NULL && !clean) {
+        pRegression = "an endpoint had to be killed";
+    }
+
+    for (int i = 0; i < soak.endpointCount; i++) {
+        for (int source = 0; source < soak.endpointCount; source++) {
+            free(soak.endpoints[i].streams[source].pSeen);
+        }
+        pthread_mutex_destroy(&soak.endpoints[i].lock);
+    }
+
+    if (pRegression != NULL) {
+        printf("  FAIL: %s\n", pRegression);
+        return EXIT_FAILURE;
+    }
+    printf("  PASS%s\n", atomic_load(&sInterrupted) ? ", stopped early" : "");
+    return EXIT_SUCCESS;
+}
@@ -2,13 +2,30 @@
 #include <assert.h>
 #include <netdb.h>
 #include <poll.h>
-#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+
+#include "clock.h"
+#include "reactor.h"
+#include "render.h"
 
 // Define a timeout value in seconds and microseconds
 #define ERROR -1
 
-static bool sClientTermination = false;
-static bool sRemoteTermination = false;
+// Input waiting on the client pool looks at the signalfd this often, a slow peer can hold
+// every slot for as long as it stays slow
+#define INPUT_SIGNAL_POLL_MS 20
+
+// Why a routine's wait ended
+typedef enum Wake {
+    WAKE_READY,         // The descriptor has input
+    WAKE_TIMEOUT,
+    WAKE_SIGNAL,        // SIGINT or SIGTERM, already taken off the signalfd
+    WAKE_ENDED          // The session is over
+} Wake;
 
 //===================================================================================
 // Prototypes
@@ -17,8 +34,11 @@ static void* keyboardRoutine(void* args);
 static void* udpSendRoutine(void* args);
 static void* udpReceiveRoutine(void* args);
 static void* screenOutputRoutine(void* args);
+static void* reactorRoutine(void* args);
+static void* placedRoutine(void* args);
 
-static int timeoutUntilAvailable(int descriptor, int milliseconds);
+static Wake waitForWake(ThreadPool* pThreadPool, int descriptor, bool signals, int milliseconds);
+static void endSession(ThreadPool* pThreadPool, Termination reason);
 
 //===================================================================================
 // Internal Structs/Enums
@@ -26,9 +46,13 @@ static int timeoutUntilAvailable(int descriptor, int milliseconds);
 typedef struct ThreadArg {
     ThreadPool*  pThreadPool;
     UDP*         pUdp;
+    int          lane;          // Which of pUdp's sockets a udpReceiveRoutine drains
+    int          slot;          // Index into ThreadPool::cpus
+    bool         realtime;      // On the network path, gets ThreadPool::fifoPriority
+    TaskFunction routine;       // What placedRoutine runs once the worker is set up
 } ThreadArg;
 
-// Easy thread/mutex tracking
+// Easy routine/future tracking
 typedef enum PoolType {
     POOL_TYPE_KEYBOARD_ROUTINE,
     POOL_TYPE_UDP_SEND_ROUTINE,
@@ -40,41 +64,144 @@ typedef enum PoolType {
 // Functions
 //===================================================================================
 
-void udpInitialize(UDP* pUdp) {
+int udpAddPeer(UDP* pUdp, const char* remoteMachineName, uint16_t remotePort) {
     assert(pUdp != NULL);
+    assert(remoteMachineName != NULL);
+
+    if (pUdp->peerCount == MAX_PEERS) {
+        return ERROR;
+    }
+
+    Peer* pPeer = &pUdp->peers[pUdp->peerCount++];
+    snprintf(pPeer->remoteMachineName, MAX_MACHINE_NAME, "%s", remoteMachineName);
+    pPeer->remotePort = remotePort;
+    return 0;
+}
 
-    pUdp->socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (pUdp->socket == ERROR) {
-        perror("Socket creation failed");
+// Every lane or none, a backend that fails on one is closed on the ones it got
+static bool openTransports(UDP* pUdp) {
+    for (int i = 0; i < pUdp->laneCount; i++) {
+        pUdp->lanes[i].pTransportState = pUdp->pTransport->open(pUdp->lanes[i].socket);
+        if (pUdp->lanes[i].pTransportState == NULL) {
+            while (i-- > 0) {
+                pUdp->pTransport->close(pUdp->lanes[i].pTransportState);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Linux doubles what it grants for its own bookkeeping and quietly caps it at the sysctl
+static void setSocketBuffer(int socket, int option, int bytes, bool report) {
+    const char* pName = option == SO_RCVBUF ? "SO_RCVBUF" : "SO_SNDBUF";
+    if (setsockopt(socket, SOL_SOCKET, option, &bytes, sizeof(bytes)) == ERROR) {
+        perror(pName);
         exit(EXIT_FAILURE);
     }
 
+    int granted = 0;
+    socklen_t length = sizeof(granted);
+    if (report && getsockopt(socket, SOL_SOCKET, option, &granted, &length) == 0 && granted / 2 < bytes) {
+        fprintf(stderr, "%s capped at %d bytes, raise net.core.%s for more\n", pName, granted / 2,
+                option == SO_RCVBUF ? "rmem_max" : "wmem_max");
+    }
+}
+
+void udpInitialize(UDP* pUdp) {
+    assert(pUdp != NULL);
+    assert(pUdp->peerCount > 0);
+
+    if (pUdp->laneCount < 1) {
+        pUdp->laneCount = 1;
+    }
+    assert(pUdp->laneCount <= UDP_MAX_LANES);
+    memset(pUdp->inbound, 0, sizeof(pUdp->inbound));
+
+    for (int i = 0; i < pUdp->laneCount; i++) {
+        pUdp->lanes[i].socket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (pUdp->lanes[i].socket == ERROR) {
+            perror("Socket creation failed");
+            exit(EXIT_FAILURE);
+        }
+
+        // Every lane binds the same port, the kernel spreads sources across them
+        int one = 1;
+        if (pUdp->laneCount > 1 && setsockopt(pUdp->lanes[i].socket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == ERROR) {
+            perror("SO_REUSEPORT failed");
+            exit(EXIT_FAILURE);
+        }
+        reassemblyInitialize(&pUdp->lanes[i].reassembly, pUdp->laneCount);
+
+        // Room for bursts the receive routine can't keep up with, lane 0 also does the sending
+        if (pUdp->receiveBuffer > 0) {
+            setSocketBuffer(pUdp->lanes[i].socket, SO_RCVBUF, pUdp->receiveBuffer, i == 0);
+        }
+        if (pUdp->sendBuffer > 0 && i == 0) {
+            setSocketBuffer(pUdp->lanes[i].socket, SO_SNDBUF, pUdp->sendBuffer, true);
+        }
+
+        // Lets the kernel spin on the device queue when we read an empty socket, only with NAPI drivers
+        if (pUdp->busyPollUs > 0
+            && setsockopt(pUdp->lanes[i].socket, SOL_SOCKET, SO_BUSY_POLL, &pUdp->busyPollUs, sizeof(pUdp->busyPollUs)) == ERROR
+            && i == 0) {
+            perror("SO_BUSY_POLL failed, spinning in user space only");
+        }
+    }
+
     struct addrinfo hints;
     struct addrinfo* info;
 
+    // Queued messages hold client slots, a limit past the ring's capacity could never bind
+    if (pUdp->outboundLimit <= 0) {
+        pUdp->outboundLimit = UDP_OUTBOUND_LIMIT;
+    } else if (pUdp->outboundLimit > MESSAGE_QUEUE_CAPACITY) {
+        pUdp->outboundLimit = MESSAGE_QUEUE_CAPACITY;
+    }
+    if (pUdp->paceRate > 0 && pUdp->paceBurst == 0) {
+        pUdp->paceBurst = pUdp->paceRate * UDP_PACING_BURST_MS / 1000;
+    }
+    pUdp->shedCount = 0;
+
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = AF_INET;      // IPv4
     hints.ai_socktype = SOCK_DGRAM; // UDP socket
     hints.ai_flags = 0;
     hints.ai_protocol = 0;
 
-    int status = getaddrinfo(pUdp->remoteMachineName, NULL, &hints, &info);
-    if (status != 0) {
-        fprintf(stderr, "getaddrinfo failed for host '%s': %s\n", pUdp->remoteMachineName, gai_strerror(status));
-        exit(EXIT_FAILURE);
-    }
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        Peer* pPeer = &pUdp->peers[i];
 
-    // Retrieve the first address from info
-    struct sockaddr_in* remote_addr = (struct sockaddr_in*)info->ai_addr;
+        int status = getaddrinfo(pPeer->remoteMachineName, NULL, &hints, &info);
+        if (status != 0) {
+            fprintf(stderr, "getaddrinfo failed for host '%s': %s\n", pPeer->remoteMachineName, gai_strerror(status));
+            exit(EXIT_FAILURE);
+        }
 
-    // Setup remote address
-    memset(&pUdp->remoteAddress, 0, sizeof(struct sockaddr_in));
-    pUdp->remoteAddress.sin_family = AF_INET;
-    pUdp->remoteAddress.sin_port = htons(pUdp->remotePort);
-    pUdp->remoteAddress.sin_addr = remote_addr->sin_addr;
+        // Retrieve the first address from info
+        struct sockaddr_in* remote_addr = (struct sockaddr_in*)info->ai_addr;
 
-    // Free the address info structure
-    freeaddrinfo(info);
+        // Setup remote address
+        memset(&pPeer->remoteAddress, 0, sizeof(struct sockaddr_in));
+        pPeer->remoteAddress.sin_family = AF_INET;
+        pPeer->remoteAddress.sin_port = htons(pPeer->remotePort);
+        pPeer->remoteAddress.sin_addr = remote_addr->sin_addr;
+
+        // Free the address info structure
+        freeaddrinfo(info);
+
+        atomic_init(&pPeer->active, true);
+        ringBufferInitialize(&pPeer->outbound, MESSAGE_QUEUE_CAPACITY);
+        reliableInitialize(&pPeer->reliable);
+        tokenBucketInitialize(&pPeer->pacing, pUdp->paceRate, pUdp->paceBurst, clockMicroseconds());
+        pPeer->shedding = false;
+    }
+    pUdp->framed = pUdp->framed || pUdp->reliable || pUdp->pCodec != NULL || pUdp->coalesceMs >= 0 || pUdp->sharedMemory;
+    pUdp->nextMessageId = 0;
+    if (pUdp->coalesceMs >= 0) {
+        messagePoolInitialize(&pUdp->bundlePool, MESSAGE_POOL_CAPACITY);
+    }
+    atomic_init(&pUdp->activePeers, pUdp->peerCount);
 
     // Setup client address
     memset(&pUdp->clientAddress, 0, sizeof(struct sockaddr_in));
@@ -82,114 +209,1201 @@ void udpInitialize(UDP* pUdp) {
     pUdp->clientAddress.sin_port = htons(pUdp->clientPort);
     pUdp->clientAddress.sin_addr.s_addr = INADDR_ANY;
 
-    // Bind socket to address and port
-    status = bind(pUdp->socket, (struct sockaddr*)&pUdp->clientAddress, sizeof(pUdp->clientAddress));
-    if (status == ERROR) {
-        perror("Bind failed");
-        exit(EXIT_FAILURE);
+    // Bind sockets to address and port
+    for (int i = 0; i < pUdp->laneCount; i++) {
+        int status = bind(pUdp->lanes[i].socket, (struct sockaddr*)&pUdp->clientAddress, sizeof(pUdp->clientAddress));
+        if (status == ERROR) {
+            perror("Bind failed");
+            exit(EXIT_FAILURE);
+        }
     }
 
-    printf("Client listening on port %d...\n", pUdp->clientPort);
+    // Backends that this kernel can't run fall back to plain sockets
+    if (pUdp->pTransport == NULL) {
+        pUdp->pTransport = &transportSockets;
+    }
+    if (!openTransports(pUdp)) {
+        fprintf(stderr, "The %s transport is not available, using sockets\n", pUdp->pTransport->pName);
+        pUdp->pTransport = &transportSockets;
+        openTransports(pUdp);
+    }
 
-    pUdp->pClientList = List_create();
-    assert(pUdp->pClientList != NULL);
-    
-    pUdp->pRemoteList = List_create();
-    assert(pUdp->pRemoteList != NULL);
-}
+    // Only once the port is ours, it names the segment. Remote hosts keep using the socket.
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        Peer* pPeer = &pUdp->peers[i];
+        pPeer->shm.pSegment = NULL;
+        if (pUdp->sharedMemory && pPeer->remotePort != pUdp->clientPort && shmAddressIsLocal(pPeer->remoteAddress.sin_addr)) {
+            shmLinkOpen(&pPeer->shm, pUdp->clientPort, pPeer->remotePort);
+        }
+    }
 
-static void freeItem(void* pItem) {
-    if (pItem != NULL) {
-        free(pItem);
+    // The log names received messages by address, Message::peer only means something here
+    if (pUdp->pLog != NULL) {
+        struct sockaddr_in addresses[MAX_PEERS];
+        for (int i = 0; i < pUdp->peerCount; i++) {
+            addresses[i] = pUdp->peers[i].remoteAddress;
+        }
+        messageLogSetPeers(pUdp->pLog, addresses, pUdp->peerCount);
     }
+
+    // Flushed, harnesses reading us through a pipe take it as the sign we're up
+    printf("Client listening on port %d...\n", pUdp->clientPort);
+    fflush(stdout);
+}
+
+// Queued messages are slab slots, the pools reclaim them wholesale
+static void discardItem(void* pItem) {
+    (void)pItem;
 }
 
 void destroyUdp(UDP* pUdp) {
     assert(pUdp != NULL);
 
-    if (pUdp->pClientList != NULL) {
-        List_free(pUdp->pClientList, &freeItem);
+    // Messages still waiting for a peer only need their reference dropped
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        reliableDestroy(&pUdp->peers[i].reliable);
+
+        Message* pMessage = NULL;
+        while ((pMessage = ringBufferTryPop(&pUdp->peers[i].outbound)) != NULL) {
+            messageRelease(pMessage);
+        }
+        ringBufferDestroy(&pUdp->peers[i].outbound);
+        shmLinkClose(&pUdp->peers[i].shm);
     }
 
-    if (pUdp->pRemoteList != NULL) {
-        List_free(pUdp->pRemoteList, &freeItem);
+    if (pUdp->coalesceMs >= 0) {
+        messagePoolDestroy(&pUdp->bundlePool);
     }
 
-    // Close the socket
-    close(pUdp->socket);
+    // Close the sockets
+    netemFlush(&pUdp->netem, pUdp->lanes[0].socket);
+    for (int i = 0; i < pUdp->laneCount; i++) {
+        reassemblyDestroy(&pUdp->lanes[i].reassembly);
+        pUdp->pTransport->close(pUdp->lanes[i].pTransportState);
+        close(pUdp->lanes[i].socket);
+    }
 }
 
-void threadPoolInitialize(ThreadPool* pThreadPool) {
+void threadPoolInitialize(ThreadPool* pThreadPool, int receiveThreads) {
     assert(pThreadPool != NULL);
-    pthread_mutex_init(&pThreadPool->listMutex, NULL);
-    pthread_cond_init(&pThreadPool->clientListCondition, NULL);
-    pthread_cond_init(&pThreadPool->remoteListCondition, NULL);
+    assert(receiveThreads >= 1 && receiveThreads <= UDP_MAX_LANES);
+    pThreadPool->engine = ENGINE_THREADS;
+    pThreadPool->receiveThreads = receiveThreads;
+    pThreadPool->fifoPriority = 0;
+    pThreadPool->drainMs = SHUTDOWN_DRAIN_MS;
+    atomic_init(&pThreadPool->termination, TERMINATION_NONE);
+    for (int i = 0; i < MAX_ROUTINES; i++) {
+        pThreadPool->cpus[i] = ERROR;
+    }
+
+    // Before the workers exist so they inherit the mask, the signals only come out of the signalfd
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pThreadPool->signalDescriptor = signalfd(ERROR, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (pThreadPool->signalDescriptor == ERROR) {
+        perror("Signalfd creation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every routine blocks its worker for the whole connection, one worker per core is left
+    // beside them for the codec slices the routines split their batches into
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    pThreadPool->cores = cores > 0 ? (int)cores : 1;
+    schedulerInitialize(&pThreadPool->scheduler, MAX_THREADS + receiveThreads - 1 + pThreadPool->cores);
+
+    // Readable for good once the session ends, every blocking wait includes it
+    pThreadPool->eventDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pThreadPool->eventDescriptor == ERROR) {
+        perror("Eventfd creation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    messagePoolInitialize(&pThreadPool->clientPool, MESSAGE_POOL_CAPACITY);
+    messagePoolInitialize(&pThreadPool->remotePool, MESSAGE_POOL_CAPACITY);
+
+    // Each direction gets its own ring, or List and mutex
+    messageQueueInitialize(&pThreadPool->clientQueue);
+    if (receiveThreads > 1) {
+        messageQueueInitializeShared(&pThreadPool->remoteQueue);
+    } else {
+        messageQueueInitialize(&pThreadPool->remoteQueue);
+    }
 }
 
 void destroyThreadPool(ThreadPool* pThreadPool) {
     assert(pThreadPool != NULL);
-    pthread_mutex_destroy(&pThreadPool->listMutex);
-    pthread_cond_destroy(&pThreadPool->clientListCondition);
-    pthread_cond_destroy(&pThreadPool->remoteListCondition);
+    schedulerDestroy(&pThreadPool->scheduler);
+    messageQueueDestroy(&pThreadPool->clientQueue, &discardItem);
+    messageQueueDestroy(&pThreadPool->remoteQueue, &discardItem);
+    messagePoolDestroy(&pThreadPool->clientPool);
+    messagePoolDestroy(&pThreadPool->remotePool);
+    lineChunkCacheDrain();
+    close(pThreadPool->eventDescriptor);
+    close(pThreadPool->signalDescriptor);
+}
+
+void threadPoolShutdown(ThreadPool* pThreadPool) {
+    assert(pThreadPool != NULL);
+    endSession(pThreadPool, TERMINATION_SHUTDOWN);
 }
 
 void createThreadRoutine(ThreadPool* pThreadPool, UDP* pUdp) {
     assert(pThreadPool != NULL);
     assert(pUdp != NULL);
-    
-    int result = 0;
-    
-    ThreadArg threadArg;
-    threadArg.pThreadPool = pThreadPool;
-    threadArg.pUdp = pUdp;
-
-    result = pthread_create(&pThreadPool->threadPool[POOL_TYPE_UDP_SEND_ROUTINE], NULL, udpSendRoutine, &threadArg);
-    if (result != 0) {
-        fprintf(stderr, "Error creating thread: %d\n", result);
-        exit(EXIT_FAILURE);
+
+    assert(pUdp->laneCount == pThreadPool->receiveThreads);
+    assert(pThreadPool->engine == ENGINE_THREADS || pUdp->laneCount == 1);
+
+    Future* routines[MAX_ROUTINES];
+    int routineCount = 0;
+
+    // Each routine gets its own copy, one may not have read its argument before the next is set up
+    ThreadArg args[MAX_ROUTINES];
+    for (int i = 0; i < MAX_ROUTINES; i++) {
+        args[i].pThreadPool = pThreadPool;
+        args[i].pUdp = pUdp;
+        args[i].lane = 0;
+        args[i].slot = i;
+        args[i].realtime = false;
     }
 
-    result = pthread_create(&pThreadPool->threadPool[POOL_TYPE_UDP_RECEIVE_ROUTINE], NULL, udpReceiveRoutine, &threadArg);
-    if (result != 0) {
-        fprintf(stderr, "Error creating thread: %d\n", result);
-        exit(EXIT_FAILURE);
+    // The credit each peer is given comes out of the pool our receive routines fill
+    pUdp->pReceivePool = &pThreadPool->remotePool;
+
+    // A single core only pays for the hand-off, its slices stay with the routine
+    pUdp->pScheduler = pThreadPool->cores > 1 ? &pThreadPool->scheduler : NULL;
+
+    // Consumers spin on their queue before parking in busy-poll mode
+    messageQueueSetSpin(&pThreadPool->clientQueue, pUdp->busyPollUs);
+    messageQueueSetSpin(&pThreadPool->remoteQueue, pUdp->busyPollUs);
+
+    if (pThreadPool->engine == ENGINE_REACTOR) {
+        // Single epoll task drives everything, placed like the receive routine
+        args[POOL_TYPE_UDP_RECEIVE_ROUTINE].routine = reactorRoutine;
+        args[POOL_TYPE_UDP_RECEIVE_ROUTINE].realtime = true;
+        routines[routineCount++] = threadPoolSubmit(pThreadPool, placedRoutine, &args[POOL_TYPE_UDP_RECEIVE_ROUTINE]);
+    } else {
+        // Long-running routine tasks, each holds one worker until the connection ends
+        args[POOL_TYPE_KEYBOARD_ROUTINE].routine = keyboardRoutine;
+        args[POOL_TYPE_UDP_SEND_ROUTINE].routine = udpSendRoutine;
+        args[POOL_TYPE_UDP_SEND_ROUTINE].realtime = true;
+        args[POOL_TYPE_UDP_RECEIVE_ROUTINE].routine = udpReceiveRoutine;
+        args[POOL_TYPE_UDP_RECEIVE_ROUTINE].realtime = true;
+        args[POOL_TYPE_SCREEN_OUTPUT_ROUTINE].routine = screenOutputRoutine;
+
+        // One more udpReceiveRoutine per extra lane, all pushing into remoteQueue
+        for (int i = 1; i < pUdp->laneCount; i++) {
+            ThreadArg* pArg = &args[MAX_THREADS + i - 1];
+            pArg->lane = i;
+            pArg->routine = udpReceiveRoutine;
+            pArg->realtime = true;
+        }
+
+        routineCount = MAX_THREADS + pUdp->laneCount - 1;
+        for (int i = 0; i < routineCount; i++) {
+            routines[i] = threadPoolSubmit(pThreadPool, placedRoutine, &args[i]);
+        }
     }
 
-    result = pthread_create(&pThreadPool->threadPool[POOL_TYPE_KEYBOARD_ROUTINE], NULL, keyboardRoutine, &threadArg);
-    if (result != 0) {
-        fprintf(stderr, "Error creating thread: %d\n", result);
-        exit(EXIT_FAILURE);
+    // Wait for the routines to finish
+    for (int i = 0; i < routineCount; i++) {
+        futureWait(routines[i]);
     }
 
-    result = pthread_create(&pThreadPool->threadPool[POOL_TYPE_SCREEN_OUTPUT_ROUTINE], NULL, screenOutputRoutine, &threadArg);
-    if (result != 0) {
-        fprintf(stderr, "Error creating thread: %d\n", result);
-        exit(EXIT_FAILURE);
+    printf("\nThreads Joined\n");
+}
+
+Future* threadPoolSubmit(ThreadPool* pThreadPool, TaskFunction function, void* pArgument) {
+    assert(pThreadPool != NULL);
+    return schedulerSubmit(&pThreadPool->scheduler, function, pArgument);
+}
+
+//===================================================================================
+// Shared By The Engines
+//===================================================================================
+
+// Hand one batch of datagrams to the transport
+static void sendHeaders(UDP* pUdp, struct mmsghdr* pHeaders, int count) {
+    uint64_t start = METRICS_NOW();
+    if (netemEnabled(&pUdp->netem)) {
+        netemSend(&pUdp->netem, pUdp->lanes[0].socket, pHeaders, count);
+        METRICS_RECORD(METRIC_STAGE_SEND, start);
+        return;
     }
 
-    // Join the four threads
-    for (int i = 0; i < MAX_THREADS; i++) {
-        if (pthread_join(pThreadPool->threadPool[i], NULL) != 0) {
-            fprintf(stderr, "Error joining thread\n");
-            exit(EXIT_FAILURE);
+    int sent = pUdp->pTransport->send(pUdp->lanes[0].pTransportState, pHeaders, count);
+    METRICS_COUNT(METRIC_DATAGRAMS_SENT, sent);
+    METRICS_RECORD(METRIC_STAGE_SEND, start);
+}
+
+// Make what went into the ring visible, a parked receiver gets an empty datagram to wake its poll
+static void publishLink(UDP* pUdp, Peer* pPeer) {
+    if (shmLinkPublish(&pPeer->shm)
+        && sendto(pUdp->lanes[0].socket, NULL, 0, 0, (struct sockaddr*)&pPeer->remoteAddress, sizeof(pPeer->remoteAddress)) == ERROR) {
+        perror("Doorbell failed");
+    }
+}
+
+// A full ring means the receiver is behind, unlike a socket buffer it can push back for a while
+static void writeLink(UDP* pUdp, Peer* pPeer, const struct iovec* pVectors, int count) {
+    if (shmLinkWrite(&pPeer->shm, pVectors, count)) {
+        return;
+    }
+
+    publishLink(pUdp, pPeer);
+    if (!shmLinkWaitForRoom(&pPeer->shm, SHM_FULL_WAIT_MS) || !shmLinkWrite(&pPeer->shm, pVectors, count)) {
+        METRICS_COUNT(METRIC_SHM_DROPS, 1);
+    }
+}
+
+// A range of one batch's codec work, for the caller or a worker
+typedef struct CodecSlice {
+    UDP*            pUdp;
+    int             from;
+    int             to;
+    uint8_t*        pScratch;       // Decoding only, the caller's lane buffer, workers bring their own
+    Datagram*       pDatagrams;     // Compressing, into compressed and packed
+    uint8_t         (*pCompressed)[MAX_CHAR_COUNT];
+    size_t*         pPacked;
+    Message**       ppMessages;     // Decoding, the ones pHeaders flags as compressed
+    PacketHeader*   pHeaders;
+} CodecSlice;
+
+// Runs task over count items. When more than a slice of them needs the codec and there are
+// workers, all slices but the first are submitted (to our own deque when we are one, idle
+// workers steal them) and the first is done here while they run.
+static void runSlices(UDP* pUdp, TaskFunction task, const CodecSlice* pTemplate, int count, int work) {
+    CodecSlice slices[(UDP_BATCH_SIZE + UDP_SLICE_SIZE - 1) / UDP_SLICE_SIZE];
+    Future* futures[(UDP_BATCH_SIZE + UDP_SLICE_SIZE - 1) / UDP_SLICE_SIZE];
+    assert(count <= UDP_BATCH_SIZE);
+
+    int sliceCount = pUdp->pScheduler != NULL && work > UDP_SLICE_SIZE ? (count + UDP_SLICE_SIZE - 1) / UDP_SLICE_SIZE : 1;
+    for (int i = 0; i < sliceCount; i++) {
+        slices[i] = *pTemplate;
+        slices[i].from = sliceCount == 1 ? 0 : i * UDP_SLICE_SIZE;
+        slices[i].to = sliceCount == 1 || (i + 1) * UDP_SLICE_SIZE > count ? count : (i + 1) * UDP_SLICE_SIZE;
+        slices[i].pScratch = i == 0 ? pTemplate->pScratch : NULL;
+    }
+
+    for (int i = 1; i < sliceCount; i++) {
+        futures[i] = schedulerSubmit(pUdp->pScheduler, task, &slices[i]);
+    }
+    task(&slices[0]);
+    for (int i = 1; i < sliceCount; i++) {
+        futureWait(futures[i]);
+    }
+}
+
+// Compress the payload behind the codec's id when that makes it smaller, returns its size
+// or 0 to send it as is
+static size_t compressPayload(UDP* pUdp, const Message* pMessage, uint8_t* pBuffer) {
+    if (pUdp->pCodec == NULL || pMessage == NULL) {
+        return 0;
+    }
+
+    size_t size = pUdp->pCodec->compress(pMessage->pData, pMessage->length, pBuffer + 1, MAX_CHAR_COUNT - 1);
+    if (size > 0 && size + 1 < pMessage->length) {
+        pBuffer[0] = pUdp->pCodec->id;
+        size++;
+    } else {
+        size = 0;
+    }
+    METRICS_COUNT(METRIC_CODEC_INPUT_BYTES, pMessage->length);
+    METRICS_COUNT(METRIC_CODEC_OUTPUT_BYTES, size > 0 ? size : pMessage->length);
+    return size;
+}
+
+static void* compressSlice(void* pArgument) {
+    CodecSlice* pSlice = pArgument;
+    for (int i = pSlice->from; i < pSlice->to; i++) {
+        pSlice->pPacked[i] = compressPayload(pSlice->pUdp, pSlice->pDatagrams[i].pMessage, pSlice->pCompressed[i]);
+    }
+    return NULL;
+}
+
+void udpTransmit(UDP* pUdp, Datagram* pDatagrams, int count) {
+    struct mmsghdr headers[UDP_BATCH_SIZE];
+    struct iovec vectors[UDP_BATCH_SIZE][2];
+    uint8_t encoded[UDP_BATCH_SIZE][PACKET_HEADER_SIZE];
+    uint8_t compressed[UDP_BATCH_SIZE][MAX_CHAR_COUNT];
+    size_t packed[UDP_BATCH_SIZE] = { 0 };
+    bool linked[MAX_PEERS] = { false };
+    bool anyLinked = false;
+    int batched = 0;
+
+    for (int i = 0; i < count; i++) {
+        Datagram* pDatagram = &pDatagrams[i];
+        int window = i % UDP_BATCH_SIZE;
+        int parts = 0;
+
+        // A window's payloads are compressed up front, retransmissions again since the slot
+        // itself always holds the text. What went into the last window's batch is sent first.
+        if (window == 0 && pUdp->pCodec != NULL) {
+            if (batched > 0) {
+                sendHeaders(pUdp, headers, batched);
+                batched = 0;
+            }
+            int size = count - i < UDP_BATCH_SIZE ? count - i : UDP_BATCH_SIZE;
+            CodecSlice slice = { .pUdp = pUdp, .pDatagrams = &pDatagrams[i], .pCompressed = compressed, .pPacked = packed };
+            runSlices(pUdp, compressSlice, &slice, size, size);
+        }
+
+        // Header and payload are gathered, the slot is never copied
+        if (pUdp->framed) {
+            PacketHeader header = pDatagram->header;
+            header.flags |= packed[window] > 0 ? PACKET_FLAG_COMPRESSED : 0;
+            packetHeaderEncode(&header, encoded[batched]);
+            vectors[batched][parts].iov_base = encoded[batched];
+            vectors[batched][parts++].iov_len = PACKET_HEADER_SIZE;
+        }
+        if (packed[window] > 0) {
+            vectors[batched][parts].iov_base = compressed[window];
+            vectors[batched][parts++].iov_len = packed[window];
+        } else if (pDatagram->pMessage != NULL) {
+            vectors[batched][parts].iov_base = pDatagram->pMessage->pData;
+            vectors[batched][parts++].iov_len = pDatagram->pMessage->length;
+        }
+
+        // Same host, the datagram goes straight into the peer's ring
+        if (shmLinkConnected(&pDatagram->pPeer->shm)) {
+            writeLink(pUdp, pDatagram->pPeer, vectors[batched], parts);
+            METRICS_COUNT(METRIC_DATAGRAMS_SENT, 1);
+            linked[pDatagram->pPeer - pUdp->peers] = true;
+            anyLinked = true;
+            continue;
+        }
+
+        memset(&headers[batched], 0, sizeof(headers[batched]));
+        headers[batched].msg_hdr.msg_name = &pDatagram->pPeer->remoteAddress;
+        headers[batched].msg_hdr.msg_namelen = sizeof(pDatagram->pPeer->remoteAddress);
+        headers[batched].msg_hdr.msg_iov = vectors[batched];
+        headers[batched].msg_hdr.msg_iovlen = (size_t)parts;
+        batched++;
+
+        if (batched == UDP_BATCH_SIZE) {
+            sendHeaders(pUdp, headers, batched);
+            batched = 0;
         }
     }
 
-    printf("\nThreads Joined\n");
+    if (batched > 0) {
+        sendHeaders(pUdp, headers, batched);
+    }
+    for (int i = 0; anyLinked && i < pUdp->peerCount; i++) {
+        if (linked[i]) {
+            publishLink(pUdp, &pUdp->peers[i]);
+        }
+    }
+}
+
+void udpDataHeader(PacketHeader* pHeader, const Message* pMessage) {
+    memset(pHeader, 0, sizeof(PacketHeader));
+    pHeader->flags = PACKET_FLAG_DATA | (pMessage->partial ? PACKET_FLAG_MORE : 0) | (pMessage->bundle ? PACKET_FLAG_BUNDLE : 0);
+    pHeader->fragment = pMessage->fragment;
+    pHeader->messageId = pMessage->messageId;
+}
+
+size_t udpDatagramSize(const UDP* pUdp, const Message* pMessage) {
+    return (pUdp->framed ? PACKET_HEADER_SIZE : 0) + pMessage->length;
+}
+
+// Every peer's queue goes into the same batch, each datagram carries its own destination.
+// What a peer's pacing holds back stays queued for udpServiceTimers.
+static int flushOutbound(UDP* pUdp, uint64_t now) {
+    Datagram batch[UDP_BATCH_SIZE];
+    int count = 0;
+    int sent = 0;
+
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        Peer* pPeer = &pUdp->peers[i];
+        Message* pMessage = NULL;
+
+        while (tokenBucketReady(&pPeer->pacing, now) && (pMessage = ringBufferTryPop(&pPeer->outbound)) != NULL) {
+            tokenBucketCharge(&pPeer->pacing, udpDatagramSize(pUdp, pMessage));
+            batch[count].pPeer = pPeer;
+            batch[count].pMessage = pMessage;
+            udpDataHeader(&batch[count].header, pMessage);
+            count++;
+
+            if (count == UDP_BATCH_SIZE) {
+                udpTransmit(pUdp, batch, count);
+                for (int j = 0; j < count; j++) {
+                    messageRelease(batch[j].pMessage);
+                }
+                sent += count;
+                count = 0;
+            }
+        }
+    }
+
+    udpTransmit(pUdp, batch, count);
+    for (int j = 0; j < count; j++) {
+        messageRelease(batch[j].pMessage);
+    }
+    return sent + count;
+}
+
+// Whole, short messages can share a datagram, '!' always goes on its own
+static bool bundleable(const Message* pMessage) {
+    return !pMessage->partial && pMessage->fragment == 0 && !pMessage->bundle
+           && pMessage->length + BUNDLE_RECORD_HEADER <= MAX_CHAR_COUNT / 2 && !isTerminationMessage(pMessage);
+}
+
+// Replace runs of short messages with bundles written into fresh slots, returns the new count.
+// ppBundled holds one reference of its own on every bundle.
+static int coalesceMessages(UDP* pUdp, Message** ppMessages, int count, Message** ppOut, bool* pBundled) {
+    int out = 0;
+
+    for (int i = 0; i < count;) {
+        int run = i;
+        size_t bytes = 0;
+        while (run < count && bundleable(ppMessages[run]) && bytes + BUNDLE_RECORD_HEADER + ppMessages[run]->length <= MAX_CHAR_COUNT) {
+            bytes += BUNDLE_RECORD_HEADER + ppMessages[run]->length;
+            run++;
+        }
+
+        // Nothing to gain from a bundle of one. The input pool is usually full of queued
+        // lines, so bundles have their own, while that is dry they go out one by one.
+        Message* pBundle = run - i > 1 ? messagePoolTryAcquire(&pUdp->bundlePool) : NULL;
+        if (pBundle == NULL) {
+            pBundled[out] = false;
+            ppOut[out++] = ppMessages[i++];
+            continue;
+        }
+
+        pBundle->bundle = true;
+        pBundle->peer = ppMessages[i]->peer;
+        for (; i < run; i++) {
+            bundleAppend(pBundle->data, &pBundle->length, MAX_CHAR_COUNT, ppMessages[i]->pData, ppMessages[i]->length);
+        }
+        pBundled[out] = true;
+        ppOut[out++] = pBundle;
+    }
+    return out;
+}
+
+// Under OVERLOAD_SHED a message for a peer whose queue is at the limit is dropped, along
+// with the rest of its fragments so the peer never waits on half a line. '!' always goes.
+static bool shedMessage(UDP* pUdp, Peer* pPeer, const Message* pMessage) {
+    if (pPeer->shedding && pMessage->messageId == pPeer->shedId) {
+        pPeer->shedding = pMessage->partial;
+    } else if (pUdp->overload != OVERLOAD_SHED || (int)ringBufferCount(&pPeer->outbound) < pUdp->outboundLimit
+               || isTerminationMessage(pMessage)) {
+        pPeer->shedding = false;
+        return false;
+    } else {
+        pPeer->shedId = pMessage->messageId;
+        pPeer->shedding = pMessage->partial;
+    }
+
+    pUdp->shedCount++;
+    METRICS_COUNT(METRIC_SHED_MESSAGES, 1);
+    return true;
+}
+
+int udpSendBatch(UDP* pUdp, Message** ppMessages, int count) {
+    Message* coalesced[UDP_BATCH_SIZE];
+    bool bundled[UDP_BATCH_SIZE];
+    bool coalescing = pUdp->coalesceMs >= 0 && count > 1;
+
+    // As typed, before any of it is bundled
+    if (pUdp->pLog != NULL) {
+        messageLogTap(pUdp->pLog, ppMessages, count, true);
+    }
+
+    if (coalescing) {
+        assert(count <= UDP_BATCH_SIZE);
+        count = coalesceMessages(pUdp, ppMessages, count, coalesced, bundled);
+        ppMessages = coalesced;
+    }
+
+    // Fragments of one message share its id, the producer numbered them
+    for (int i = 0; i < count; i++) {
+        ppMessages[i]->messageId = pUdp->nextMessageId;
+        if (!ppMessages[i]->partial) {
+            pUdp->nextMessageId++;
+        }
+    }
+
+    // Fan out, each active peer's queue holds its own reference
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        Peer* pPeer = &pUdp->peers[i];
+        if (!atomic_load_explicit(&pPeer->active, memory_order_relaxed)) {
+            continue;
+        }
+
+        for (int j = 0; j < count; j++) {
+            if (shedMessage(pUdp, pPeer, ppMessages[j])) {
+                continue;
+            }
+            messageRetain(ppMessages[j]);
+
+            // Can only fill up if the pool outgrows the queue
+            if (!ringBufferTryPush(&pPeer->outbound, ppMessages[j])) {
+                messageRelease(ppMessages[j]);
+            }
+        }
+    }
+
+    // The peers' queues keep the bundles alive from here
+    for (int i = 0; coalescing && i < count; i++) {
+        if (bundled[i]) {
+            messageRelease(ppMessages[i]);
+        }
+    }
+
+    if (!pUdp->reliable) {
+        return flushOutbound(pUdp, clockMicroseconds());
+    }
+
+    // Whatever doesn't fit a peer's window or pacing waits in its queue until ACKs or tokens free it
+    int sent = 0;
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        if (atomic_load_explicit(&pUdp->peers[i].active, memory_order_relaxed)) {
+            sent += reliablePump(pUdp, &pUdp->peers[i]);
+        }
+    }
+    return sent;
+}
+
+static int findPeer(UDP* pUdp, const struct sockaddr_in* pAddress) {
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        const struct sockaddr_in* pRemote = &pUdp->peers[i].remoteAddress;
+        if (pRemote->sin_addr.s_addr == pAddress->sin_addr.s_addr && pRemote->sin_port == pAddress->sin_port) {
+            return i;
+        }
+    }
+    return ERROR;
+}
+
+// The id in front picks the codec, one we don't have drops the payload
+static bool decompressPayload(uint8_t* pScratch, Message* pMessage) {
+    const Codec* pCodec = pMessage->length > 0 ? codecFind((uint8_t)pMessage->data[0]) : NULL;
+    if (pCodec == NULL) {
+        return false;
+    }
+
+    size_t packed = pMessage->length - 1;
+    memcpy(pScratch, pMessage->data + 1, packed);
+    ssize_t length = pCodec->decompress(pScratch, packed, pMessage->data, MAX_CHAR_COUNT);
+    if (length < 0) {
+        return false;
+    }
+    pMessage->length = (size_t)length;
+    return true;
+}
+
+// Decoded whether or not we compress ourselves, a payload that won't decode is dropped
+static void* decodeSlice(void* pArgument) {
+    CodecSlice* pSlice = pArgument;
+    uint8_t scratch[MAX_CHAR_COUNT];
+    uint8_t* pScratch = pSlice->pScratch != NULL ? pSlice->pScratch : scratch;
+
+    for (int i = pSlice->from; i < pSlice->to; i++) {
+        if ((pSlice->pHeaders[i].flags & PACKET_FLAG_COMPRESSED) && !decompressPayload(pScratch, pSlice->ppMessages[i])) {
+            pSlice->ppMessages[i]->peer = ERROR;
+            pSlice->ppMessages[i]->length = 0;
+        }
+    }
+    return NULL;
+}
+
+// Drain the same-host peers' rings into the first slots, returns how many were filled
+static int receiveLinks(UDP* pUdp, Message** ppMessages, uint8_t (*pEncoded)[PACKET_HEADER_SIZE], size_t* pLengths, int count) {
+    int received = 0;
+
+    for (int i = 0; i < pUdp->peerCount && received < count; i++) {
+        ShmLink* pLink = &pUdp->peers[i].shm;
+        if (pLink->pSegment == NULL) {
+            continue;
+        }
+
+        // Awake now, senders can skip the doorbell
+        shmLinkUnpark(pLink);
+        ssize_t length;
+        while (received < count && (length = shmLinkRead(pLink, pEncoded[received], ppMessages[received]->data, MAX_CHAR_COUNT)) != ERROR) {
+            ppMessages[received]->peer = i;
+            pLengths[received++] = (size_t)length;
+        }
+    }
+    return received;
+}
+
+int udpReceiveBatch(UDP* pUdp, int lane, Message** ppMessages, PacketHeader* pHeaders, int count) {
+    struct mmsghdr headers[UDP_BATCH_SIZE];
+    struct iovec vectors[UDP_BATCH_SIZE][2];
+    struct sockaddr_in addresses[UDP_BATCH_SIZE];
+    uint8_t encoded[UDP_BATCH_SIZE][PACKET_HEADER_SIZE];
+    size_t lengths[UDP_BATCH_SIZE];
+    assert(count <= UDP_BATCH_SIZE);
+
+    uint64_t start = METRICS_NOW();
+    int linked = pUdp->sharedMemory && lane == 0 ? receiveLinks(pUdp, ppMessages, encoded, lengths, count) : 0;
+
+    // The socket fills whatever slots the rings left
+    for (int i = linked; i < count; i++) {
+        int parts = 0;
+
+        // Scatter the header into its own buffer so the payload lands at the start of the slot
+        if (pUdp->framed) {
+            vectors[i][parts].iov_base = encoded[i];
+            vectors[i][parts++].iov_len = PACKET_HEADER_SIZE;
+        }
+        vectors[i][parts].iov_base = ppMessages[i]->data;
+        vectors[i][parts++].iov_len = MAX_CHAR_COUNT;
+
+        memset(&headers[i], 0, sizeof(headers[i]));
+        headers[i].msg_hdr.msg_name = &addresses[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+        headers[i].msg_hdr.msg_iov = vectors[i];
+        headers[i].msg_hdr.msg_iovlen = (size_t)parts;
+    }
+
+    int received = 0;
+    if (linked < count) {
+        received = pUdp->pTransport->receive(pUdp->lanes[lane].pTransportState, &headers[linked], count - linked);
+    }
+    METRICS_RECORD(METRIC_STAGE_RECEIVE, start);
+
+    // Demultiplex by source address
+    for (int i = linked; i < linked + received; i++) {
+        lengths[i] = headers[i].msg_len;
+        ppMessages[i]->peer = findPeer(pUdp, &addresses[i]);
+    }
+    received += linked;
+
+    METRICS_COUNT(METRIC_DATAGRAMS_RECEIVED, received);
+
+    // Headers first, they are cheap and say how much payload there is to decode
+    int compressed = 0;
+    for (int i = 0; i < received; i++) {
+        size_t length = lengths[i];
+
+        if (!pUdp->framed) {
+            pHeaders[i].flags = PACKET_FLAG_DATA;
+            ppMessages[i]->length = length;
+            continue;
+        }
+
+        // Anything without our header is treated like an unknown sender, doorbells included
+        if (!packetHeaderDecode(&pHeaders[i], encoded[i], length)) {
+            pHeaders[i].flags = 0;
+            ppMessages[i]->peer = ERROR;
+            ppMessages[i]->length = 0;
+            continue;
+        }
+        ppMessages[i]->length = length - PACKET_HEADER_SIZE;
+        ppMessages[i]->messageId = pHeaders[i].messageId;
+        ppMessages[i]->fragment = pHeaders[i].fragment;
+        ppMessages[i]->partial = (pHeaders[i].flags & PACKET_FLAG_MORE) != 0;
+        ppMessages[i]->bundle = (pHeaders[i].flags & PACKET_FLAG_BUNDLE) != 0;
+        compressed += (pHeaders[i].flags & PACKET_FLAG_COMPRESSED) != 0;
+    }
+
+    if (compressed > 0) {
+        CodecSlice slice = { .pUdp = pUdp, .pScratch = pUdp->lanes[lane].packed, .ppMessages = ppMessages, .pHeaders = pHeaders };
+        runSlices(pUdp, decodeSlice, &slice, received, compressed);
+    }
+    return received;
+}
+
+int udpDescriptor(UDP* pUdp, int lane) {
+    return pUdp->pTransport->descriptor(pUdp->lanes[lane].pTransportState);
+}
+
+bool udpPending(UDP* pUdp) {
+    for (int i = 0; pUdp->sharedMemory && i < pUdp->peerCount; i++) {
+        if (pUdp->peers[i].shm.pSegment != NULL && shmLinkPending(&pUdp->peers[i].shm)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool udpPark(UDP* pUdp) {
+    if (!pUdp->sharedMemory) {
+        return true;
+    }
+
+    // A sender that is mid-burst usually has the next one in well before the spin runs out
+    uint64_t giveUp = clockMicroseconds() + (pUdp->busyPollUs > SHM_SPIN_US ? (uint64_t)pUdp->busyPollUs : SHM_SPIN_US);
+    do {
+        if (udpPending(pUdp)) {
+            return false;
+        }
+    } while (clockMicroseconds() < giveUp);
+
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        if (pUdp->peers[i].shm.pSegment != NULL) {
+            shmLinkPark(&pUdp->peers[i].shm);
+        }
+    }
+
+    // Check again after parking, a datagram published in between would get no doorbell
+    return !udpPending(pUdp);
+}
+
+int udpDropBatch(UDP* pUdp, int lane) {
+    struct mmsghdr headers[UDP_BATCH_SIZE];
+    struct sockaddr_in addresses[UDP_BATCH_SIZE];
+    Lane* pLane = &pUdp->lanes[lane];
+
+    // Every datagram lands in the lane's scratch buffer, none of them is looked at
+    struct iovec vector = { .iov_base = pLane->packed, .iov_len = sizeof(pLane->packed) };
+    for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+        memset(&headers[i], 0, sizeof(headers[i]));
+        headers[i].msg_hdr.msg_name = &addresses[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+        headers[i].msg_hdr.msg_iov = &vector;
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int dropped = pUdp->pTransport->receive(pLane->pTransportState, headers, UDP_BATCH_SIZE);
+    METRICS_COUNT(METRIC_POOL_DROPS, dropped);
+
+    if (pUdp->framed) {
+        reassemblyExpire(&pLane->reassembly, clockMicroseconds());
+    }
+    return dropped;
+}
+
+int udpAcceptBatch(UDP* pUdp, int lane, Message** ppMessages, const PacketHeader* pHeaders, int received, Message** ppDeliver) {
+    int delivered = 0;
+
+    for (int i = 0; i < received; i++) {
+        Message* pMessage = ppMessages[i];
+
+        // Not one of ours
+        if (pMessage->peer == ERROR) {
+            messageRelease(pMessage);
+            continue;
+        }
+
+        // The reliable layer hands back data in sequence order, possibly several at once
+        if (pUdp->reliable) {
+            delivered += reliableReceive(pUdp, &pUdp->peers[pMessage->peer], &pHeaders[i], pMessage, &ppDeliver[delivered]);
+        } else {
+            ppDeliver[delivered++] = pMessage;
+        }
+    }
+
+    uint64_t now = clockMicroseconds();
+    int accepted = 0;
+    for (int i = 0; i < delivered; i++) {
+        Message* pMessage = ppDeliver[i];
+
+        // Terminate connection with this peer
+        if (isTerminationMessage(pMessage)) {
+            Peer* pPeer = &pUdp->peers[pMessage->peer];
+            if (atomic_exchange(&pPeer->active, false)) {
+                atomic_fetch_sub(&pUdp->activePeers, 1);
+                if (pUdp->peerCount == 1) {
+                    printf("Remote Connection Ended\n");
+                } else {
+                    printf("\r\033[KRemote %s:%u Connection Ended\n", pPeer->remoteMachineName, pPeer->remotePort);
+                }
+            }
+            messageRelease(pMessage);
+            continue;
+        }
+
+        // Fragments wait for the rest of their message, at most one piece comes out per fragment
+        if (pMessage->fragment != 0 || pMessage->partial) {
+            pMessage = reassemblyAdd(&pUdp->lanes[lane].reassembly, pMessage, now);
+            if (pMessage == NULL) {
+                continue;
+            }
+        }
+
+        // Stable, keeps each peer's messages in order
+        ppDeliver[accepted++] = pMessage;
+    }
+
+    if (pUdp->framed) {
+        reassemblyExpire(&pUdp->lanes[lane].reassembly, now);
+    }
+
+    if (pUdp->pLog != NULL) {
+        messageLogTap(pUdp->pLog, ppDeliver, accepted, false);
+    }
+
+    // After the tap, the log keeps what actually arrived
+    sanitizeMessages(ppDeliver, accepted, pUdp->inbound);
+
+    // One ACK per peer per batch unless outgoing data already carried it
+    if (pUdp->reliable) {
+        for (int i = 0; i < pUdp->peerCount; i++) {
+            reliableFlushAck(pUdp, &pUdp->peers[i]);
+        }
+    }
+    return accepted;
+}
+
+int udpServiceTimers(UDP* pUdp) {
+    uint64_t now = clockMicroseconds();
+    uint64_t next = 0;
+    if (!pUdp->reliable && pUdp->paceRate > 0) {
+        flushOutbound(pUdp, now);
+    }
+
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        Peer* pPeer = &pUdp->peers[i];
+
+        // A peer that left won't acknowledge anything anymore
+        if (!atomic_load_explicit(&pPeer->active, memory_order_relaxed)) {
+            continue;
+        }
+
+        uint64_t deadline = 0;
+        if (pUdp->reliable) {
+            deadline = reliableService(pUdp, pPeer, now);
+        } else if (ringBufferCount(&pPeer->outbound) > 0) {
+            deadline = now + tokenBucketDelay(&pPeer->pacing, now);
+        }
+        if (deadline != 0 && (next == 0 || deadline < next)) {
+            next = deadline;
+        }
+    }
+
+    if (next == 0) {
+        return ERROR;
+    }
+    return next <= now ? 0 : (int)((next - now + 999) / 1000);
+}
+
+bool udpSettled(UDP* pUdp) {
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        Peer* pPeer = &pUdp->peers[i];
+        if (!atomic_load_explicit(&pPeer->active, memory_order_relaxed)) {
+            continue;
+        }
+        if (pUdp->reliable ? !reliableSettled(pPeer) : ringBufferCount(&pPeer->outbound) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t udpQueued(UDP* pUdp) {
+    size_t queued = 0;
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        if (atomic_load_explicit(&pUdp->peers[i].active, memory_order_relaxed)) {
+            queued += ringBufferCount(&pUdp->peers[i].outbound);
+        }
+    }
+    return queued;
+}
+
+bool udpBacklogged(UDP* pUdp) {
+    if (pUdp->overload != OVERLOAD_BLOCK) {
+        return false;
+    }
+
+    for (int i = 0; i < pUdp->peerCount; i++) {
+        Peer* pPeer = &pUdp->peers[i];
+        if (atomic_load_explicit(&pPeer->active, memory_order_relaxed)
+            && (int)ringBufferCount(&pPeer->outbound) >= pUdp->outboundLimit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isTerminationMessage(const Message* pMessage) {
+    return pMessage->fragment == 0 && !pMessage->bundle && pMessage->length > 0 && pMessage->pData[0] == '!';
 }
 
 //===================================================================================
 // Routines Helpers
 //===================================================================================
 
-static int timeoutUntilAvailable(int descriptor, int milliseconds) {
-    
-    struct pollfd polltime;
-    polltime.fd = descriptor;
-    polltime.events = POLLIN;   // Check for input readiness
+static bool sessionOver(ThreadPool* pThreadPool) {
+    return atomic_load_explicit(&pThreadPool->termination, memory_order_acquire) != TERMINATION_NONE;
+}
 
-    // Wait for events on the file descriptors
-    return poll(&polltime, 1, milliseconds);
+// Whoever ends the session first names the reason, then everyone blocked on a queue, a pool
+// or a descriptor is let go
+static void endSession(ThreadPool* pThreadPool, Termination reason) {
+    int expected = TERMINATION_NONE;
+    atomic_compare_exchange_strong(&pThreadPool->termination, &expected, (int)reason);
+
+    messageQueueClose(&pThreadPool->clientQueue);
+    messageQueueClose(&pThreadPool->remoteQueue);
+    messagePoolClose(&pThreadPool->clientPool);
+    messagePoolClose(&pThreadPool->remotePool);
+
+    // Nobody reads it, so it stays readable for every later wait too
+    uint64_t one = 1;
+    if (write(pThreadPool->eventDescriptor, &one, sizeof(one)) == ERROR) {
+        perror("Eventfd write failed");
+    }
+}
+
+// Sleep until descriptor (-1 for none) is readable, the session ends or, for the input
+// routine, a signal comes in. The end is a descriptor, nothing has to time out to see it.
+static Wake waitForWake(ThreadPool* pThreadPool, int descriptor, bool signals, int milliseconds) {
+    struct pollfd descriptors[3];
+    int count = 0;
+    descriptors[count++] = (struct pollfd){ .fd = pThreadPool->eventDescriptor, .events = POLLIN };
+    if (signals) {
+        descriptors[count++] = (struct pollfd){ .fd = pThreadPool->signalDescriptor, .events = POLLIN };
+    }
+    if (descriptor != ERROR) {
+        descriptors[count++] = (struct pollfd){ .fd = descriptor, .events = POLLIN };
+    }
+
+    int result = poll(descriptors, (nfds_t)count, milliseconds);
+    if (milliseconds != 0) {
+        METRICS_WAIT(result);
+    }
+    if (result == ERROR) {
+        if (errno == EINTR) {
+            return WAKE_TIMEOUT;
+        }
+        perror("poll failed");
+        exit(EXIT_FAILURE);
+    }
+
+    if (descriptors[0].revents != 0) {
+        return WAKE_ENDED;
+    }
+    if (signals && descriptors[1].revents != 0) {
+        struct signalfd_siginfo info;
+        return read(pThreadPool->signalDescriptor, &info, sizeof(info)) == (ssize_t)sizeof(info) ? WAKE_SIGNAL : WAKE_TIMEOUT;
+    }
+    return result > 0 ? WAKE_READY : WAKE_TIMEOUT;
+}
+
+// Busy-poll mode keeps looking at the lane for busyPollUs before it sleeps
+static Wake waitForDatagram(ThreadPool* pThreadPool, UDP* pUdp, int lane) {
+    int descriptor = udpDescriptor(pUdp, lane);
+
+    if (pUdp->busyPollUs > 0) {
+        uint64_t giveUp = clockMicroseconds() + (uint64_t)pUdp->busyPollUs;
+        do {
+            Wake wake = waitForWake(pThreadPool, descriptor, false, 0);
+            if (wake != WAKE_TIMEOUT) {
+                return wake;
+            }
+        } while (clockMicroseconds() < giveUp);
+    }
+    return waitForWake(pThreadPool, descriptor, false, ERROR);
+}
+
+// Blocks while udpSendRoutine still holds every slot (backpressure). NULL when the session
+// ends or SIGINT/SIGTERM comes in first, *pWake says which.
+static Message* acquireInput(ThreadPool* pThreadPool, Wake* pWake) {
+    while (1) {
+        Message* pMessage = messagePoolAcquireTimed(&pThreadPool->clientPool, INPUT_SIGNAL_POLL_MS);
+        if (pMessage != NULL) {
+            return pMessage;
+        }
+
+        Wake wake = sessionOver(pThreadPool) ? WAKE_ENDED : waitForWake(pThreadPool, ERROR, true, 0);
+        if (wake == WAKE_ENDED || wake == WAKE_SIGNAL) {
+            *pWake = wake;
+            return NULL;
+        }
+    }
+}
+
+// A signal ends the session like a typed '!', queued behind whatever input is already waiting
+static bool queueTermination(ThreadPool* pThreadPool) {
+    Message* pMessage = messagePoolTryAcquire(&pThreadPool->clientPool);
+    if (pMessage == NULL) {
+        return false;
+    }
+
+    memcpy(pMessage->data, "!\n", 2);
+    pMessage->length = 2;
+    if (messageQueuePush(&pThreadPool->clientQueue, pMessage) == ERROR) {
+        messagePoolRelease(&pThreadPool->clientPool, pMessage);
+        return false;
+    }
+
+    printf("\nConnection Ended\n");
+    fflush(stdout);
+    return true;
+}
+
+// Input is over but the session may not be, the input routine stays to take the signals.
+// The first SIGINT/SIGTERM sends '!' and gives it drainMs to get out. One after a typed '!',
+// a second one or the deadline stops everything at once.
+static void awaitSessionEnd(ThreadPool* pThreadPool, Wake wake, bool closing) {
+    uint64_t deadline = 0;
+    bool queued = closing;
+
+    while (wake != WAKE_ENDED) {
+        uint64_t now = clockMicroseconds();
+        if (wake == WAKE_SIGNAL && !closing && deadline == 0) {
+            deadline = now + (uint64_t)pThreadPool->drainMs * 1000u;
+        } else if (wake == WAKE_SIGNAL || (deadline != 0 && now >= deadline)) {
+            endSession(pThreadPool, TERMINATION_SHUTDOWN);
+            return;
+        }
+
+        // Every slot may be queued ahead of it, then look again shortly
+        if (deadline != 0 && !queued) {
+            queued = queueTermination(pThreadPool);
+        }
+
+        int timeout = ERROR;
+        if (deadline != 0) {
+            timeout = deadline > now ? (int)((deadline - now + 999) / 1000) : 0;
+            if (!queued && timeout > 1) {
+                timeout = 1;
+            }
+        }
+        wake = waitForWake(pThreadPool, ERROR, true, timeout);
+    }
+}
+
+// How long a popped batch sat in its queue
+static void recordDequeued(Message** ppMessages, int count) {
+#ifdef STALK_METRICS
+    uint64_t now = clockNanoseconds();
+    for (int i = 0; i < count; i++) {
+        metricsRecord(METRIC_STAGE_DEQUEUE, now - ppMessages[i]->stamp);
+    }
+#else
+    (void)ppMessages;
+    (void)count;
+#endif
+}
+
+// Keep popping until a datagram's worth is waiting, milliseconds pass or something
+// that can't be bundled shows up. Returns how many were added after count.
+static int gatherBundle(MessageQueue* pQueue, Message** ppMessages, int count, int milliseconds) {
+    uint64_t deadline = clockMicroseconds() + (uint64_t)milliseconds * 1000u;
+    size_t bytes = 0;
+    int total = count;
+
+    for (int i = 0; i < total; i++) {
+        if (!bundleable(ppMessages[i])) {
+            return 0;
+        }
+        bytes += BUNDLE_RECORD_HEADER + ppMessages[i]->length;
+    }
+
+    while (total < UDP_BATCH_SIZE && bytes < MAX_CHAR_COUNT) {
+        uint64_t now = clockMicroseconds();
+        if (now >= deadline) {
+            break;
+        }
+
+        int popped = messageQueuePopBatchTimed(pQueue, (void**)&ppMessages[total], UDP_BATCH_SIZE - total,
+                                               (int)((deadline - now + 999) / 1000));
+        recordDequeued(&ppMessages[total], popped);
+        if (popped == 0) {
+            break;
+        }
+
+        bool more = true;
+        for (int i = total; i < total + popped; i++) {
+            more = more && bundleable(ppMessages[i]);
+            bytes += BUNDLE_RECORD_HEADER + ppMessages[i]->length;
+        }
+        total += popped;
+        if (!more) {
+            break;
+        }
+    }
+    return total - count;
+}
+
+// Hand a batch of input to the udpSendRoutine thread in one push
+static void pushInput(ThreadPool* pThreadPool, Message** ppBatch, int* pCount) {
+    if (*pCount == 0) {
+        return;
+    }
+
+    for (int i = 0; i < *pCount; i++) {
+        METRICS_STAMP(ppBatch[i]);
+    }
+    uint64_t start = METRICS_NOW();
+    int pushed = messageQueuePushBatch(&pThreadPool->clientQueue, (void**)ppBatch, *pCount);
+    METRICS_RECORD(METRIC_STAGE_ENQUEUE, start);
+    METRICS_QUEUE_DEPTH(METRIC_QUEUE_CLIENT, messageQueueCount(&pThreadPool->clientQueue));
+
+    if (pushed < *pCount) {
+        perror("queue push error");
+        messagePoolReleaseBatch(&pThreadPool->clientPool, &ppBatch[pushed], *pCount - pushed);
+    }
+    *pCount = 0;
+}
+
+// Pipes and files: large reads, every line goes out as a slice of the read buffer and
+// nobody is there to see a prompt
+static void streamInput(ThreadArg* pArg) {
+    ThreadPool* pThreadPool = pArg->pThreadPool;
+    Message* batch[UDP_BATCH_SIZE];
+    int count = 0;
+    Message* message = NULL;
+    bool terminate = false;
+    Wake wake = WAKE_READY;
+
+    LineReader reader;
+    lineReaderInitialize(&reader, pArg->pUdp->framed);
+
+    while (!terminate && !sessionOver(pThreadPool)) {
+        // Blocks while udpSendRoutine still holds every slot (backpressure), after handing
+        // over what is already split
+        if (message == NULL) {
+            message = messagePoolTryAcquire(&pThreadPool->clientPool);
+        }
+        if (message == NULL) {
+            pushInput(pThreadPool, batch, &count);
+            message = acquireInput(pThreadPool, &wake);
+            if (message == NULL) {
+                break;
+            }
+        }
+
+        if (lineReaderNext(&reader, message)) {
+            terminate = isTerminationMessage(message);
+            batch[count++] = message;
+            message = NULL;
+            if (count == UDP_BATCH_SIZE) {
+                pushInput(pThreadPool, batch, &count);
+            }
+            continue;
+        }
+
+        // Every complete line is out, wait for more
+        pushInput(pThreadPool, batch, &count);
+        if (reader.ended) {
+            break;
+        }
+
+        wake = waitForWake(pThreadPool, STDIN_FILENO, true, ERROR);
+        if (wake == WAKE_TIMEOUT) {
+            continue;
+        } else if (wake != WAKE_READY) {
+            break;
+        }
+
+        METRICS_COUNT(METRIC_INPUT_READS, 1);
+        if (lineReaderFill(&reader, STDIN_FILENO) == ERROR && errno != EAGAIN && errno != EINTR) {
+            perror("Read failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pushInput(pThreadPool, batch, &count);
+    if (message != NULL) {
+        messagePoolRelease(&pThreadPool->clientPool, message);
+    }
+    lineReaderDestroy(&reader);
+
+    // Terminate connection, udpSendRoutine winds the rest down once '!' is out
+    if (terminate) {
+        printf("Connection Ended\n");
+        fflush(stdout);
+    }
+    awaitSessionEnd(pThreadPool, sessionOver(pThreadPool) ? WAKE_ENDED : wake, terminate);
 }
 
 //===================================================================================
@@ -198,212 +1412,269 @@ static int timeoutUntilAvailable(int descriptor, int milliseconds) {
 
 static void* keyboardRoutine(void* args) {
     ThreadArg arg = *(ThreadArg*)args;
-    char clientBuffer[MAX_CHAR_COUNT];
-
-    // Set stdin to non-blocking mode
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    ThreadPool* pThreadPool = arg.pThreadPool;
+    Message* message = NULL;
+    uint16_t fragment = 0;          // Next fragment index of the line being read
+    bool waitForInput = true;       // Not while stdio still holds the rest of a long line
+    bool terminate = false;
+    Wake wake = WAKE_READY;
+
+    // Scripts feeding us through a pipe or a file take the bulk path, and get no prompt
+    if (!isatty(STDIN_FILENO)) {
+        streamInput(&arg);
+        return NULL;
+    }
 
     // We have to do this first time or else you see it's blank
     printf("\nMe: ");
     fflush(stdout); // Flush the output buffer to ensure prompt output
 
-    while (1) {
-        // Check for termination condition
-        if (sClientTermination || sRemoteTermination) {
+    while (!terminate) {
+        wake = waitForInput ? waitForWake(pThreadPool, STDIN_FILENO, true, ERROR) : WAKE_READY;
+        if (wake == WAKE_TIMEOUT) {
+            continue;
+        } else if (wake != WAKE_READY) {
             break;
         }
+        waitForInput = true;
 
-        int ret = timeoutUntilAvailable(STDIN_FILENO + 1, 100);
-        if (ret == ERROR) {
-            perror("poll failed");
-            exit(EXIT_FAILURE);
-
-        } else if (ret == 0) {
-            // Timeout occurred, skip
-            continue;
+        // Blocks while udpSendRoutine still holds every slot (backpressure)
+        message = acquireInput(pThreadPool, &wake);
+        if (message == NULL) {
+            break;
         }
 
-        // Input is available, read it
-        printf("Me: ");
-        fflush(stdout);
-        fgets(clientBuffer, MAX_CHAR_COUNT, stdin);
+        // Input is available, read it straight into the slot
+        METRICS_COUNT(METRIC_INPUT_READS, 1);
+        if (fgets(message->data, MAX_CHAR_COUNT, stdin) == NULL) {
+            messagePoolRelease(&pThreadPool->clientPool, message);
 
-        // Check if input was too long, consume remaining characters from stdin
-        if (strchr(clientBuffer, '\n') == NULL) {
-            while (getchar() != '\n');
+            // Input ended, keep receiving until the session is over
+            if (feof(stdin)) {
+                break;
+            }
+            clearerr(stdin);
+            continue;
         }
+        message->length = strlen(message->data);
 
-        // Entering Critical Section
-        pthread_mutex_lock(&arg.pThreadPool->listMutex);
-
-        // First message sent will be at the end
-        int status = List_prepend(arg.pUdp->pClientList, strdup(clientBuffer)); // Make a copy of the input buffer
-        if (status == EXIT_FAILURE) {
-            perror("list_prepend error");
+        // A pasted or piped line can start with a NUL, there is nothing of it to send
+        if (message->length == 0) {
+            messagePoolRelease(&pThreadPool->clientPool, message);
+            continue;
         }
+        message->partial = message->data[message->length - 1] != '\n';
 
-        // Signal the udpSendRoutine thread that a new message is available
-        pthread_cond_signal(&arg.pThreadPool->clientListCondition);
+        // Check if input was too long, framed links send the rest as further fragments
+        if (message->partial && !arg.pUdp->framed) {
+            int character;
+            while ((character = getchar()) != '\n' && character != EOF);
+            message->partial = false;
+        }
+        if (fragment == 0) {
+            printf("Me: ");
+            fflush(stdout);
+        }
+        message->fragment = fragment;
+        fragment = message->partial ? fragment + 1 : 0;
+        waitForInput = !message->partial;
+
+        terminate = isTerminationMessage(message);
+
+        // Hand the slot to the udpSendRoutine thread
+        METRICS_STAMP(message);
+        uint64_t start = METRICS_NOW();
+        int status = messageQueuePush(&arg.pThreadPool->clientQueue, message);
+        METRICS_RECORD(METRIC_STAGE_ENQUEUE, start);
+        METRICS_QUEUE_DEPTH(METRIC_QUEUE_CLIENT, messageQueueCount(&arg.pThreadPool->clientQueue));
+        if (status == ERROR) {
+            perror("queue push error");
+            messagePoolRelease(&arg.pThreadPool->clientPool, message);
+        }
 
-        // Terminate connection
-        if (strncmp(clientBuffer, "!", 1) == 0) {
+        // Terminate connection, udpSendRoutine winds the rest down once '!' is out
+        if (terminate) {
             printf("Connection Ended\n");
-            pthread_cond_signal(&arg.pThreadPool->remoteListCondition);
-            sClientTermination = true;
         }
-
-        // Exiting Critical Section
-        pthread_mutex_unlock(&arg.pThreadPool->listMutex);
     }
 
-    pthread_exit(NULL);
+    awaitSessionEnd(pThreadPool, wake, terminate);
+    return NULL;
 }
 
 
 static void* udpSendRoutine(void* args) {
     ThreadArg arg = *(ThreadArg*)args;
-    char* message = NULL;
-
-    while (1) {
-        pthread_mutex_lock(&arg.pThreadPool->listMutex);
-        // Entering Critical Section
-
-        // Check if the list is empty
-        while (List_count(arg.pUdp->pClientList) == 0) {
-            // Wait for a signal from the keyboardRoutine thread indicating a new message
-            pthread_cond_wait(&arg.pThreadPool->clientListCondition, &arg.pThreadPool->listMutex);
-            if (sClientTermination || sRemoteTermination) {
+    Message* messages[UDP_BATCH_SIZE];
+    bool terminate = false;
+
+    while (!terminate) {
+        // Wait for the keyboardRoutine thread, waking up early when a retransmission or paced send is due
+        int timeout = udpServiceTimers(arg.pUdp);
+
+        // A peer is too far behind, input stays queued and the keyboard ends up waiting on
+        // the client pool. ACKs drain the queue on the receive routine, so look again shortly.
+        if (udpBacklogged(arg.pUdp)) {
+            int milliseconds = (timeout < 0 || timeout > UDP_BACKLOG_POLL_MS) ? UDP_BACKLOG_POLL_MS : timeout;
+            if (waitForWake(arg.pThreadPool, ERROR, false, milliseconds) == WAKE_ENDED) {
                 break;
             }
+            continue;
         }
 
-        // Remote Terminated, nothing to send
-        if (sRemoteTermination) {
-            pthread_mutex_unlock(&arg.pThreadPool->listMutex);
-            break;
+        int count = messageQueuePopBatchTimed(&arg.pThreadPool->clientQueue, (void**)messages, UDP_BATCH_SIZE, timeout);
+        METRICS_WAIT(count);
+        recordDequeued(messages, count);
+
+        if (count == 0) {
+            // Remote Terminated, nothing to send
+            if (messageQueueClosed(&arg.pThreadPool->clientQueue)) {
+                break;
+            }
+            continue;
         }
 
-        // Get a message from the list
-        message = (char*)List_trim(arg.pUdp->pClientList);
+        // Nagle-style, give short lines a moment to fill a bundle
+        if (arg.pUdp->coalesceMs > 0) {
+            count += gatherBundle(&arg.pThreadPool->clientQueue, messages, count, arg.pUdp->coalesceMs);
+        }
 
-        // Exiting Critical Section
-        pthread_mutex_unlock(&arg.pThreadPool->listMutex);
+        // Stop after a termination message
+        int batched = 0;
+        while (batched < count && !terminate) {
+            terminate = isTerminationMessage(messages[batched]);
+            batched++;
+        }
 
-        // Send the message over the network
-        sendto(arg.pUdp->socket, message, strlen(message), 0, (struct sockaddr*)&arg.pUdp->remoteAddress, sizeof(arg.pUdp->remoteAddress));
-        free(message);
+        // Send the batch over the network
+        udpSendBatch(arg.pUdp, messages, batched);
+        messagePoolReleaseBatch(&arg.pThreadPool->clientPool, messages, count);
+    }
 
-        // Send Termination to remote and end client
-        if (sClientTermination) {
-            break;
+    if (terminate) {
+        // Keep retransmitting while udpReceiveRoutine collects the last ACKs. Paced sends still
+        // going out keep it lingering, a peer that stopped acknowledging doesn't.
+        uint64_t giveUp = clockMicroseconds() + RELIABLE_LINGER_MS * 1000u;
+        size_t queued = udpQueued(arg.pUdp);
+        while (!udpSettled(arg.pUdp) && !sessionOver(arg.pThreadPool) && clockMicroseconds() < giveUp) {
+            if (udpQueued(arg.pUdp) < queued) {
+                queued = udpQueued(arg.pUdp);
+                giveUp = clockMicroseconds() + RELIABLE_LINGER_MS * 1000u;
+            }
+            int timeout = udpServiceTimers(arg.pUdp);
+            waitForWake(arg.pThreadPool, ERROR, false, (timeout < 0 || timeout > RELIABLE_MIN_RTO_MS) ? RELIABLE_MIN_RTO_MS : timeout);
         }
+        endSession(arg.pThreadPool, TERMINATION_LOCAL);
     }
 
-    pthread_exit(NULL);
+    return NULL;
 }
 
 static void* udpReceiveRoutine(void* args) {
     ThreadArg arg = *(ThreadArg*)args;
-    char recieveBuffer[MAX_CHAR_COUNT];
-
-    while (1) {
-        if (sClientTermination || sRemoteTermination) {
+    Message* messages[UDP_BATCH_SIZE];
+    PacketHeader headers[UDP_BATCH_SIZE];
+    Message* delivered[UDP_DELIVER_CAPACITY];
+
+    while (!sessionOver(arg.pThreadPool)) {
+        // Same-host peers may already have something waiting, no point sleeping then
+        bool idle = arg.lane != 0 || udpPark(arg.pUdp);
+        Wake wake = idle ? waitForDatagram(arg.pThreadPool, arg.pUdp, arg.lane) : WAKE_READY;
+        if (wake == WAKE_ENDED) {
             break;
+        } else if (wake == WAKE_TIMEOUT) {
+            continue;
         }
 
-        int ret = timeoutUntilAvailable(arg.pUdp->socket, 1000);
-        if (ret == ERROR) {
-            perror("poll failed");
-            exit(EXIT_FAILURE);
-
-        } else if (ret == 0) {
-            // Timeout occurred, skip
+        // Waits while screenOutputRoutine still holds every slot, the socket buffer absorbs the
+        // rest. A pool that stays empty must not wedge us, we drop and look at the session again.
+        int acquired = messagePoolAcquireBatchTimed(&arg.pThreadPool->remotePool, messages, UDP_BATCH_SIZE,
+                                                    UDP_POOL_WAIT_MS);
+        if (acquired == ERROR) {
+            break;
+        } else if (acquired == 0) {
+            udpDropBatch(arg.pUdp, arg.lane);
             continue;
         }
 
-        memset(recieveBuffer, 0, MAX_CHAR_COUNT);
-        socklen_t addressLength = sizeof(arg.pUdp->remoteAddress);
-        
-        ssize_t result = recvfrom(arg.pUdp->socket, recieveBuffer, MAX_CHAR_COUNT, 0, (struct sockaddr*)&arg.pUdp->remoteAddress, &addressLength);
+        // Drain whatever has arrived, up to one datagram per slot
+        int received = udpReceiveBatch(arg.pUdp, arg.lane, messages, headers, acquired);
+        messagePoolReleaseBatch(&arg.pThreadPool->remotePool, &messages[received], acquired - received);
+        int deliver = udpAcceptBatch(arg.pUdp, arg.lane, messages, headers, received, delivered);
 
-        if (result == ERROR) {
-            perror("Recvfrom failed");
-            exit(EXIT_FAILURE);
+        // Hand the batch to the screenOutputRoutine thread in one push. Other lanes push too,
+        // but a peer only ever arrives on this one so its messages keep their order.
+        for (int i = 0; i < deliver; i++) {
+            METRICS_STAMP(delivered[i]);
         }
-
-        pthread_mutex_lock(&arg.pThreadPool->listMutex);
-        // Entering Critical Section
-
-        int status = List_prepend(arg.pUdp->pRemoteList, strdup(recieveBuffer));
-        if (status == ERROR) {
-            perror("list_prepend error");
+        uint64_t start = METRICS_NOW();
+        int pushed = messageQueuePushBatch(&arg.pThreadPool->remoteQueue, (void**)delivered, deliver);
+        METRICS_RECORD(METRIC_STAGE_ENQUEUE, start);
+        METRICS_QUEUE_DEPTH(METRIC_QUEUE_REMOTE, messageQueueCount(&arg.pThreadPool->remoteQueue));
+        if (pushed < deliver) {
+            perror("queue push error");
         }
+        messagePoolReleaseBatch(&arg.pThreadPool->remotePool, &delivered[pushed], deliver - pushed);
 
-        // Signal the screenOutputRoutine thread that a new message is available
-        pthread_cond_signal(&arg.pThreadPool->remoteListCondition);
-
-        // Terminate connection
-        if (strncmp(recieveBuffer, "!", 1) == 0) {
-            printf("Remote Connection Ended\n");
-
-            // Release wait threads
-            pthread_cond_signal(&arg.pThreadPool->clientListCondition);
-            sRemoteTermination = true;
-            pthread_cond_signal(&arg.pThreadPool->remoteListCondition);
+        // Every peer has ended its connection
+        if (received > 0 && atomic_load(&arg.pUdp->activePeers) == 0) {
+            endSession(arg.pThreadPool, TERMINATION_REMOTE);
         }
-
-        // Exiting Critical Section
-        pthread_mutex_unlock(&arg.pThreadPool->listMutex);
     }
 
-    pthread_exit(NULL);
+    return NULL;
 }
 
 static void* screenOutputRoutine(void* args) {
     ThreadArg arg = *(ThreadArg*)args;
-    char* message = NULL;
+    Message* messages[UDP_DELIVER_CAPACITY];
 
     while (1) {
-        pthread_mutex_lock(&arg.pThreadPool->listMutex);
-        // Entering Critical Section
-        
-        // Check if the list is empty
-        while (List_count(arg.pUdp->pRemoteList) == 0) {
-            // Wait for a signal from the keyboardRoutine thread indicating a new message
-            pthread_cond_wait(&arg.pThreadPool->remoteListCondition, &arg.pThreadPool->listMutex);
-            if (sClientTermination || sRemoteTermination) {
+        // Wait for the udpReceiveRoutine thread, then take everything it has handed over
+        int count = messageQueuePopBatch(&arg.pThreadPool->remoteQueue, (void**)messages, UDP_DELIVER_CAPACITY);
+
+        // Either side ended the connection, what arrived before that still gets shown
+        if (count == 0) {
+            count = messageQueueDrain(&arg.pThreadPool->remoteQueue, (void**)messages, UDP_DELIVER_CAPACITY);
+            if (count == 0) {
                 break;
             }
         }
+        recordDequeued(messages, count);
 
-        // Terminate here because there is nothing in the buffer
-        if (sClientTermination) {
-            pthread_mutex_unlock(&arg.pThreadPool->listMutex);
-            break;
-        }
+        renderMessages(arg.pUdp, messages, count);
+        messagePoolReleaseBatch(&arg.pThreadPool->remotePool, messages, count);
+    }
 
-        // Get a message from the list
-        message = (char*)List_trim(arg.pUdp->pRemoteList);
+    return NULL;
+}
 
-        // Exiting Critical Section
-        pthread_mutex_unlock(&arg.pThreadPool->listMutex);
-        
-        if (sRemoteTermination) {
-            break;
-        } else {
-            // Clear the current line and move the cursor to the beginning
-            printf("\r\033[K");
+// Runs the routine on its core and priority, the worker gets its old settings back afterwards
+static void* placedRoutine(void* args) {
+    ThreadArg* pArg = (ThreadArg*)args;
+    ThreadPool* pThreadPool = pArg->pThreadPool;
+    int cpu = pThreadPool->cpus[pArg->slot];
 
-            // Print the received message with the "Remote:" prefix
-            printf("Remote: %s", message);
-            free(message);
+    PlacementSaved saved;
+    placementEnter(cpu, pArg->realtime ? pThreadPool->fifoPriority : 0, &saved);
 
-            // Print the "Me:" prompt again on the same line
-            printf("Me: ");
-            fflush(stdout);
-        }
+    // The slots a routine writes into move to its node, the receive lanes share lane 0's
+    MessagePool* pClient = &pThreadPool->clientPool;
+    MessagePool* pRemote = &pThreadPool->remotePool;
+    if (pArg->slot == POOL_TYPE_KEYBOARD_ROUTINE || pThreadPool->engine == ENGINE_REACTOR) {
+        placementBindMemory(pClient->pSlab, pClient->capacity * sizeof(Message), cpu);
+    }
+    if (pArg->slot == POOL_TYPE_UDP_RECEIVE_ROUTINE) {
+        placementBindMemory(pRemote->pSlab, pRemote->capacity * sizeof(Message), cpu);
     }
 
-    pthread_exit(NULL);
-}
\ No newline at end of file
+    void* pResult = pArg->routine(pArg);
+    placementLeave(&saved);
+    return pResult;
+}
+
+static void* reactorRoutine(void* args) {
+    ThreadArg arg = *(ThreadArg*)args;
+    reactorRun(arg.pThreadPool, arg.pUdp);
+    return NULL;
+}
@@ -4,6 +4,7 @@
 #define _GNU_SOURCE // For pthread_barrier
 #include <pthread.h>
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,36 +12,242 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 
-#include "list.h"
+#include "codec.h"
+#include "lineReader.h"
+#include "messageLog.h"
+#include "messagePool.h"
+#include "messageQueue.h"
+#include "metrics.h"
+#include "netem.h"
+#include "placement.h"
+#include "protocol.h"
+#include "reassembly.h"
+#include "reliable.h"
+#include "ringBuffer.h"
+#include "sanitize.h"
+#include "scheduler.h"
+#include "shmLink.h"
+#include "tokenBucket.h"
+#include "transport.h"
 
+// Long-running routines per connection
 #define MAX_THREADS 4
-#define MAX_CHAR_COUNT 1024
+
+// One bound socket, or one set of lanes, serves all of them
+#define MAX_PEERS 64
+#define MAX_MACHINE_NAME 256
+
+// Datagrams moved per recvmmsg/sendmmsg call
+#ifndef UDP_BATCH_SIZE
+#define UDP_BATCH_SIZE 64
+#endif
+
+// Sockets sharing the port through SO_REUSEPORT, each drained by its own udpReceiveRoutine.
+// More than the remote pool has batches for only adds threads waiting on slots.
+#define UDP_MAX_LANES 8
+
+// Routines that can be placed, the four above and a receive routine per extra lane
+#define MAX_ROUTINES (MAX_THREADS + UDP_MAX_LANES - 1)
+
+// Room for everything one accept can hand over, every message comes out of the receive pool
+#define UDP_DELIVER_CAPACITY MESSAGE_POOL_CAPACITY
+
+// Messages a peer's outbound queue holds, waiting on its window or pacing, before the
+// overload policy applies. The default only binds once the client pool is bigger.
+#define UDP_OUTBOUND_LIMIT MESSAGE_POOL_CAPACITY
+
+// Default pacing burst, this long at the paced rate
+#define UDP_PACING_BURST_MS 20
+
+// How often a sender held back by a full outbound queue looks again
+#define UDP_BACKLOG_POLL_MS 1
+
+// Datagrams one codec task compresses or decodes. A batch is spread over the workers only
+// when it holds more than one slice of codec work, less costs more to hand off than to do.
+#define UDP_SLICE_SIZE 16
+
+// How long a receive routine waits for the screen to hand back a slot before it drops
+// what is waiting on its socket instead
+#define UDP_POOL_WAIT_MS 500
+
+// How the routines are scheduled, picked at startup
+typedef enum Engine {
+    ENGINE_THREADS,     // One thread per routine
+    ENGINE_REACTOR      // One epoll thread over stdin, the socket and an eventfd
+} Engine;
+
+// What happens to input for a peer whose outbound queue is at its limit
+typedef enum Overload {
+    OVERLOAD_BLOCK,     // Stop taking input until the queue drains, typing waits on the client pool
+    OVERLOAD_SHED       // Drop it for that peer and count it, input never waits on the network
+} Overload;
+
+// Why the session ended, the first one to end it names the reason
+typedef enum Termination {
+    TERMINATION_NONE,
+    TERMINATION_LOCAL,      // Our '!' went out, acknowledged or given up on
+    TERMINATION_REMOTE,     // Every peer sent '!'
+    TERMINATION_SHUTDOWN    // threadPoolShutdown, a signal that can't wait or the drain deadline
+} Termination;
+
+// Default time SIGINT/SIGTERM gives queued messages and the peers' ACKs
+#define SHUTDOWN_DRAIN_MS RELIABLE_LINGER_MS
 
 typedef struct ThreadPool {
-    pthread_t         threadPool[MAX_THREADS];   // Four threads per routine
-    pthread_mutex_t   listMutex;                 // Only one shared resource (Nodes)
-    pthread_cond_t    clientListCondition;       // Condition variable for signaling
-    pthread_cond_t    remoteListCondition;       // Condition variable for signaling
+    Scheduler         scheduler;                 // Work-stealing workers, the routines and codec slices run as tasks
+    int               cores;                     // Online when initialized, one worker each beside the routines
+    Engine            engine;                    // ENGINE_THREADS unless changed before createThreadRoutine
+    int               eventDescriptor;           // Eventfd written once the session ends and never read, every wait polls it
+    int               signalDescriptor;          // Signalfd for SIGINT and SIGTERM, blocked in every thread
+    atomic_int        termination;               // Termination, set once
+    int               drainMs;                   // What SIGINT/SIGTERM gives queued messages to go out before everything stops
+    MessageQueue      clientQueue;               // keyboardRoutine -> udpSendRoutine
+    MessageQueue      remoteQueue;               // udpReceiveRoutine(s) -> screenOutputRoutine, shared when there are several
+    int               receiveThreads;            // One udpReceiveRoutine per UDP lane
+    int               cpus[MAX_ROUTINES];        // Core per routine (keyboard, send, receive, screen, extra lanes), -1 unpinned
+    int               fifoPriority;              // SCHED_FIFO for the send and receive routines or the reactor, 0 off
+    MessagePool       clientPool;                // Slots for outgoing messages
+    MessagePool       remotePool;                // Slots for incoming messages
 } ThreadPool;
 
-typedef struct UDP {
+typedef struct Peer {
     struct sockaddr_in  remoteAddress;
-    struct sockaddr_in  clientAddress;
-    List*               pRemoteList;
-    List*               pClientList;
     uint16_t            remotePort;
-    uint16_t            clientPort;
+    atomic_bool         active;             // Cleared once this peer ends its connection
+    char                remoteMachineName[MAX_MACHINE_NAME];
+    RingBuffer          outbound;           // Waiting to go out, pushed by the sending thread
+    Reliable            reliable;           // Window and reorder state, only used in reliable mode
+    ShmLink             shm;                // Rings to a peer on this host, only opened with UDP::sharedMemory
+    TokenBucket         pacing;             // Charged by whoever sends to it, under the reliable lock in reliable mode
+    uint32_t            shedId;             // Message whose remaining fragments are being shed
+    bool                shedding;
+} Peer;
+
+// One socket bound to the client port and what receiving on it needs. The kernel hashes
+// each source address to the same socket every time, so a peer only ever arrives on one lane
+// and its fragments and ordering never span two.
+typedef struct Lane {
     int                 socket;
-    const char*         remoteMachineName;
+    void*               pTransportState;
+    Reassembly          reassembly;         // Fragments waiting for the rest of their message
+    uint8_t             packed[MAX_CHAR_COUNT];     // A compressed payload while it is decoded back into its slot
+} Lane;
+
+typedef struct UDP {
+    struct sockaddr_in  clientAddress;
+    uint16_t            clientPort;
+    bool                reliable;           // Sequenced, acknowledged and retransmitted delivery
+    bool                framed;             // Datagrams carry a PacketHeader, messages of any length (implied by reliable, pCodec, coalesceMs and sharedMemory)
+    const Codec*        pCodec;             // Compresses outgoing payloads when set, incoming ones are decoded by the codec they name
+    int                 coalesceMs;         // Bundle short messages into shared datagrams, waiting up to this long for more (-1 off)
+    bool                sharedMemory;       // Peers on this host that do the same get their datagrams through shmLink rings
+    MessagePool         bundlePool;         // Slots the bundles are written into, only set up when coalescing
+    const Transport*    pTransport;         // Datagram I/O on the socket, transportSockets when left NULL
+    int                 busyPollUs;         // Spin this long before sleeping on a socket or queue and SO_BUSY_POLL the sockets, 0 off
+    Netem               netem;              // Optional loss/reorder injection on send, straight on the socket
+    MessageLog*         pLog;               // Everything sent and delivered is tapped into it when set
+    uint64_t            paceRate;           // Bytes per second each peer gets at most, 0 unpaced
+    uint64_t            paceBurst;          // Bytes a peer may get back to back, 0 for UDP_PACING_BURST_MS at paceRate
+    int                 outboundLimit;      // 0 for UDP_OUTBOUND_LIMIT, at most MESSAGE_QUEUE_CAPACITY
+    Overload            overload;
+    int                 receiveBuffer;      // SO_RCVBUF of every lane in bytes, 0 keeps the kernel default
+    int                 sendBuffer;         // SO_SNDBUF of the sending socket
+    MessagePool*        pReceivePool;       // Received datagrams land here, the credit peers are given is its free share
+    Scheduler*          pScheduler;         // Idle workers take slices of large codec batches, NULL does them inline
+    uint64_t            shedCount;          // Messages shed, sending side only
+    uint32_t            nextMessageId;      // Stamped on outgoing messages, sending side only
+    int                 peerCount;
+    atomic_int          activePeers;
+    Peer                peers[MAX_PEERS];
+    SanitizeCarry       inbound[MAX_PEERS];  // What each peer's last piece of a long message left open, only its lane touches it
+    int                 laneCount;          // Receive sockets, more than one needs the threads engine and no sharedMemory
+    Lane                lanes[UDP_MAX_LANES]; // lanes[0] also does all the sending
 } UDP;
 
-// Setup Udp and destroy it
+// One outgoing datagram, the payload stays owned by the caller
+typedef struct Datagram {
+    Peer*               pPeer;
+    Message*            pMessage;           // NULL for a header-only packet (bare ACK)
+    PacketHeader        header;             // Only goes on the wire when framed
+} Datagram;
+
+// Setup Udp and destroy it, peers are added in between the two
 void udpInitialize(UDP* pUdp);
 void destroyUdp(UDP* pUdp);
 
-// Setup thread pool and destroy it
-void threadPoolInitialize(ThreadPool* pThreadPool);
+// Add a peer before udpInitialize, returns -1 once MAX_PEERS is reached
+// reliable, framed, pCodec, coalesceMs, sharedMemory, pTransport, busyPollUs, laneCount, netem, pLog,
+// the pacing, the outbound limit, the overload policy and the socket buffers are also set up before udpInitialize
+int udpAddPeer(UDP* pUdp, const char* remoteMachineName, uint16_t remotePort);
+
+// Setup thread pool and destroy it, receiveThreads is the UDP's laneCount.
+// engine, cpus, fifoPriority and drainMs can be changed between this and createThreadRoutine.
+// Blocks SIGINT and SIGTERM for the whole process, the input routine or the reactor takes them.
+void threadPoolInitialize(ThreadPool* pThreadPool, int receiveThreads);
 void destroyThreadPool(ThreadPool* pThreadPool);
 void createThreadRoutine(ThreadPool* pThreadPool, UDP* pUdp);
 
+// Stop a running createThreadRoutine at once, safe from any thread
+void threadPoolShutdown(ThreadPool* pThreadPool);
+
+// Schedule work on the pool, wait with futureWait. The routines hold one worker each for
+// the session, the per-core workers beside them run the codec slices the routines submit.
+Future* threadPoolSubmit(ThreadPool* pThreadPool, TaskFunction function, void* pArgument);
+
+// Batched datagram I/O shared by the engines, receive never blocks
+// Send fans every message out to all active peers in as few transport sends as possible,
+// bundling runs of short ones when coalescing. The caller keeps its references either way.
+// Receive reads one lane, tags each message with the peer it came from and fills pHeaders.
+// Lane 0 also drains the shared-memory rings.
+int udpSendBatch(UDP* pUdp, Message** ppMessages, int count);
+int udpReceiveBatch(UDP* pUdp, int lane, Message** ppMessages, PacketHeader* pHeaders, int count);
+
+// What to poll for a lane's incoming datagrams, its socket or whatever the transport delivers through
+int udpDescriptor(UDP* pUdp, int lane);
+
+// Same-host peers have datagrams waiting in their rings, never blocks
+bool udpPending(UDP* pUdp);
+
+// Call before sleeping on the socket. Spins briefly (busyPollUs when longer) on the shared-memory rings, then parks
+// them so the next datagram rings the socket. False when something is already waiting.
+bool udpPark(UDP* pUdp);
+
+// Put datagrams on the wire, with their header when framed and compressed when there is a codec.
+// Ones for a connected shared-memory peer are copied into its ring instead.
+void udpTransmit(UDP* pUdp, Datagram* pDatagrams, int count);
+
+// Header for a data datagram carrying pMessage, fragment fields included
+void udpDataHeader(PacketHeader* pHeader, const Message* pMessage);
+
+// Takes ownership of the messages a lane received and writes the ones worth showing to ppDeliver
+// (UDP_DELIVER_CAPACITY), in order per peer, returning how many. Datagrams from unknown
+// senders and termination messages are released, peers that sent '!' are marked inactive.
+// What is delivered has been sanitized for the terminal. Lanes may accept concurrently, each
+// only reassembles and sanitizes its own peers.
+int udpAcceptBatch(UDP* pUdp, int lane, Message** ppMessages, const PacketHeader* pHeaders, int received, Message** ppDeliver);
+
+// The receive pool has no slot to read into. Drops what is waiting on a lane's socket (the
+// rings hold their own) and expires stale reassembly, returns how many datagrams went.
+int udpDropBatch(UDP* pUdp, int lane);
+
+// Resend whatever timed out and send what pacing held back, returns milliseconds until
+// the next retransmission or paced send is due or -1 when nothing is waiting for one
+int udpServiceTimers(UDP* pUdp);
+
+// True once every active peer has acknowledged everything sent to it, or only had it sent when unreliable
+bool udpSettled(UDP* pUdp);
+
+// Messages waiting in the active peers' outbound queues, lingering goes on while this shrinks
+size_t udpQueued(UDP* pUdp);
+
+// Under OVERLOAD_BLOCK, some active peer's outbound queue is at its limit and no more
+// input should be taken until it drains
+bool udpBacklogged(UDP* pUdp);
+
+// Bytes a datagram carrying pMessage puts on the wire, what pacing charges for it
+size_t udpDatagramSize(const UDP* pUdp, const Message* pMessage);
+
+// A line starting with '!' ends the connection, only its first fragment is checked
+bool isTerminationMessage(const Message* pMessage);
+
 #endif
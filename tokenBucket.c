@@ -0,0 +1,62 @@
+#include "tokenBucket.h"
+#include <assert.h>
+
+#define MICROSECONDS 1000000
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static void refill(TokenBucket* pBucket, uint64_t now) {
+    if (now <= pBucket->updated) {
+        return;
+    }
+
+    // Anything past a full bucket would be clamped anyway, and this keeps the product in range
+    uint64_t elapsed = now - pBucket->updated;
+    uint64_t full = (uint64_t)(pBucket->burst - pBucket->balance) / pBucket->rate + 1;
+    if (elapsed > full) {
+        elapsed = full;
+    }
+
+    pBucket->balance += (int64_t)(elapsed * pBucket->rate);
+    if (pBucket->balance > pBucket->burst) {
+        pBucket->balance = pBucket->burst;
+    }
+    pBucket->updated = now;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void tokenBucketInitialize(TokenBucket* pBucket, uint64_t rate, uint64_t burst, uint64_t now) {
+    assert(pBucket != NULL && rate <= TOKEN_BUCKET_MAX_BYTES && burst <= TOKEN_BUCKET_MAX_BYTES);
+
+    pBucket->rate = rate;
+    pBucket->burst = (int64_t)(burst * MICROSECONDS);
+    pBucket->balance = pBucket->burst;
+    pBucket->updated = now;
+}
+
+bool tokenBucketReady(TokenBucket* pBucket, uint64_t now) {
+    if (pBucket->rate == 0) {
+        return true;
+    }
+
+    refill(pBucket, now);
+    return pBucket->balance > 0;
+}
+
+void tokenBucketCharge(TokenBucket* pBucket, size_t bytes) {
+    if (pBucket->rate != 0) {
+        pBucket->balance -= (int64_t)bytes * MICROSECONDS;
+    }
+}
+
+uint64_t tokenBucketDelay(TokenBucket* pBucket, uint64_t now) {
+    if (tokenBucketReady(pBucket, now)) {
+        return 0;
+    }
+    return (uint64_t)(-pBucket->balance) / pBucket->rate + 1;
+}
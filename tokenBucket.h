@@ -0,0 +1,32 @@
+#ifndef TOKEN_BUCKET_H_
+#define TOKEN_BUCKET_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest rate or burst in bytes, the balance scales them by a million in an int64_t
+#define TOKEN_BUCKET_MAX_BYTES (INT64_MAX / 1000000)
+
+// Send pacing for one peer. Tokens are bytes and refill at rate up to burst. A datagram
+// may go whenever the balance is positive and is charged in full, so one larger than the
+// burst still goes out and retransmissions, which never wait, can leave it in debt.
+typedef struct TokenBucket {
+    uint64_t  rate;         // Bytes per second, 0 never holds anything back
+    int64_t   burst;        // Most that can go out back to back, scaled like balance
+    int64_t   balance;      // Bytes times 1000000 so slow rates don't lose the fractions
+    uint64_t  updated;      // Microseconds, last refill
+} TokenBucket;
+
+void tokenBucketInitialize(TokenBucket* pBucket, uint64_t rate, uint64_t burst, uint64_t now);
+
+// Something may go out now
+bool tokenBucketReady(TokenBucket* pBucket, uint64_t now);
+
+// Take bytes for a datagram that is going out, ready or not
+void tokenBucketCharge(TokenBucket* pBucket, size_t bytes);
+
+// Microseconds until tokenBucketReady, 0 when it already is
+uint64_t tokenBucketDelay(TokenBucket* pBucket, uint64_t now);
+
+#endif
@@ -0,0 +1,68 @@
+#define _GNU_SOURCE // For sendmmsg and recvmmsg
+#include "transport.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "metrics.h"
+
+#define ERROR -1
+
+//===================================================================================
+// Sockets
+//===================================================================================
+
+typedef struct Sockets {
+    int socket;
+} Sockets;
+
+static void* socketsOpen(int socket) {
+    Sockets* pSockets = malloc(sizeof(Sockets));
+    if (pSockets == NULL) {
+        perror("Transport allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    pSockets->socket = socket;
+    return pSockets;
+}
+
+static void socketsClose(void* pState) {
+    free(pState);
+}
+
+static int socketsDescriptor(void* pState) {
+    return ((Sockets*)pState)->socket;
+}
+
+static int socketsSend(void* pState, struct mmsghdr* pHeaders, int count) {
+    int socket = socketsDescriptor(pState);
+
+    // sendmmsg may stop short, keep going until the batch is out
+    int sent = 0;
+    while (sent < count) {
+        int result = sendmmsg(socket, &pHeaders[sent], (unsigned int)(count - sent), 0);
+        METRICS_COUNT(METRIC_SEND_CALLS, 1);
+        if (result == ERROR) {
+            perror("Sendmmsg failed");
+            break;
+        }
+        sent += result;
+    }
+    return sent;
+}
+
+static int socketsReceive(void* pState, struct mmsghdr* pHeaders, int count) {
+    int received = recvmmsg(socketsDescriptor(pState), pHeaders, (unsigned int)count, MSG_DONTWAIT, NULL);
+    METRICS_COUNT(METRIC_RECEIVE_CALLS, 1);
+    if (received == ERROR) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        perror("Recvmmsg failed");
+        exit(EXIT_FAILURE);
+    }
+    return received;
+}
+
+const Transport transportSockets = { "sockets", socketsOpen, socketsClose, socketsSend, socketsReceive, socketsDescriptor };
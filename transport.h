@@ -0,0 +1,34 @@
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+// Batched datagram I/O under the UDP layer, over a socket that is already bound.
+// Framing, reliability and peers stay above it, a backend only moves mmsghdr batches.
+typedef struct Transport {
+    const char* pName;
+
+    // Returns the backend's state, or NULL when this kernel can't run it
+    void* (*open)(int socket);
+    void (*close)(void* pState);
+
+    // Sends the whole batch, returns how many went out
+    int (*send)(void* pState, struct mmsghdr* pHeaders, int count);
+
+    // Never blocks, fills msg_len, msg_namelen and the scattered payload of up to count
+    // headers and returns how many, 0 when nothing is waiting
+    int (*receive)(void* pState, struct mmsghdr* pHeaders, int count);
+
+    // Readable when receive has something, what the engines poll and epoll
+    int (*descriptor)(void* pState);
+} Transport;
+
+// sendmmsg and recvmmsg on the socket itself
+extern const Transport transportSockets;
+
+// io_uring: one multishot recvmsg into a registered ring of provided buffers, sends
+// submitted a batch per io_uring_enter. Kernel 6.0 or newer.
+extern const Transport transportUring;
+
+#endif
@@ -0,0 +1,360 @@
+#define _GNU_SOURCE // For syscall
+#include "transport.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "metrics.h"
+
+#define ERROR -1
+
+// Submission slots per ring, a send batch larger than this goes in several submissions
+#define URING_ENTRIES 64
+
+// Provided buffers the kernel picks from for each datagram, a power of two
+#define URING_BUFFERS 256
+#define URING_BUFFER_SIZE 2048
+#define URING_GROUP 0
+
+// A provided buffer starts with where the datagram came from, the payload follows
+#define URING_NAME_SIZE sizeof(struct sockaddr_in)
+#define URING_PAYLOAD_OFFSET (sizeof(struct io_uring_recvmsg_out) + URING_NAME_SIZE)
+
+// The mmap'd submission and completion queues of one io_uring instance
+typedef struct Ring {
+    int                    descriptor;
+    void*                  pMap;
+    size_t                 mapSize;
+    struct io_uring_sqe*   pSqes;
+    size_t                 sqesSize;
+    atomic_uint*           pSqHead;
+    atomic_uint*           pSqTail;
+    unsigned*              pSqArray;
+    unsigned               sqMask;
+    unsigned               sqEntries;
+    atomic_uint*           pCqHead;
+    atomic_uint*           pCqTail;
+    struct io_uring_cqe*   pCqes;
+    unsigned               cqMask;
+} Ring;
+
+// Sends and receives get a ring each, the routines that use them never share a completion queue
+typedef struct Uring {
+    int                        socket;
+    Ring                       send;
+    pthread_mutex_t            sendLock;       // The sending routine and the ACK path both send
+    Ring                       receive;
+    struct io_uring_buf_ring*  pBufferRing;
+    uint8_t*                   pBuffers;
+    uint16_t                   bufferTail;
+    struct msghdr              receiveTemplate;
+    bool                       armed;          // The multishot recvmsg is still posting completions
+} Uring;
+
+//===================================================================================
+// Ring Helpers
+//===================================================================================
+
+// GETEVENTS also runs pending task work and flushes overflowed completions
+static int enter(Ring* pRing, unsigned submit, unsigned complete, unsigned flags) {
+    int result;
+    do {
+        result = (int)syscall(SYS_io_uring_enter, pRing->descriptor, submit, complete, flags, NULL, 0);
+    } while (result == ERROR && errno == EINTR);
+    return result;
+}
+
+static bool ringSetup(Ring* pRing, unsigned entries, unsigned completions) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(pRing, 0, sizeof(Ring));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = completions;
+
+    pRing->descriptor = (int)syscall(SYS_io_uring_setup, entries, &params);
+    if (pRing->descriptor == ERROR) {
+        return false;
+    }
+
+    // One mapping for both queues, every kernel that has multishot receive does this
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(pRing->descriptor);
+        return false;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    pRing->mapSize = sqSize > cqSize ? sqSize : cqSize;
+    pRing->pMap = mmap(NULL, pRing->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       pRing->descriptor, IORING_OFF_SQ_RING);
+    pRing->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    pRing->pSqes = mmap(NULL, pRing->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        pRing->descriptor, IORING_OFF_SQES);
+    if (pRing->pMap == MAP_FAILED || pRing->pSqes == MAP_FAILED) {
+        perror("io_uring mmap failed");
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t* pMap = pRing->pMap;
+    pRing->pSqHead = (atomic_uint*)(pMap + params.sq_off.head);
+    pRing->pSqTail = (atomic_uint*)(pMap + params.sq_off.tail);
+    pRing->pSqArray = (unsigned*)(pMap + params.sq_off.array);
+    pRing->sqMask = *(unsigned*)(pMap + params.sq_off.ring_mask);
+    pRing->sqEntries = params.sq_entries;
+    pRing->pCqHead = (atomic_uint*)(pMap + params.cq_off.head);
+    pRing->pCqTail = (atomic_uint*)(pMap + params.cq_off.tail);
+    pRing->pCqes = (struct io_uring_cqe*)(pMap + params.cq_off.cqes);
+    pRing->cqMask = *(unsigned*)(pMap + params.cq_off.ring_mask);
+    return true;
+}
+
+static void ringTeardown(Ring* pRing) {
+    munmap(pRing->pSqes, pRing->sqesSize);
+    munmap(pRing->pMap, pRing->mapSize);
+    close(pRing->descriptor);
+}
+
+// Next free submission entry, zeroed. The kernel consumes everything we submit before
+// enter returns, so there is always room for URING_ENTRIES of them.
+static struct io_uring_sqe* nextSqe(Ring* pRing, unsigned* pTail) {
+    unsigned index = *pTail & pRing->sqMask;
+    struct io_uring_sqe* pSqe = &pRing->pSqes[index];
+    memset(pSqe, 0, sizeof(*pSqe));
+    pRing->pSqArray[index] = index;
+    (*pTail)++;
+    return pSqe;
+}
+
+static void publishSqes(Ring* pRing, unsigned tail) {
+    atomic_store_explicit(pRing->pSqTail, tail, memory_order_release);
+}
+
+//===================================================================================
+// Receive Helpers
+//===================================================================================
+
+static void provideBuffer(Uring* pUring, uint16_t id) {
+    struct io_uring_buf* pBuffer = &pUring->pBufferRing->bufs[pUring->bufferTail & (URING_BUFFERS - 1)];
+    pBuffer->addr = (uint64_t)(uintptr_t)(pUring->pBuffers + (size_t)id * URING_BUFFER_SIZE);
+    pBuffer->len = URING_BUFFER_SIZE;
+    pBuffer->bid = id;
+    pUring->bufferTail++;
+}
+
+// The kernel only sees returned buffers once the tail moves
+static void publishBuffers(Uring* pUring) {
+    atomic_store_explicit((_Atomic uint16_t*)&pUring->pBufferRing->tail, pUring->bufferTail, memory_order_release);
+}
+
+// One recvmsg that keeps posting a completion per datagram until it runs out of buffers
+static void armReceive(Uring* pUring) {
+    unsigned tail = atomic_load_explicit(pUring->receive.pSqTail, memory_order_relaxed);
+    struct io_uring_sqe* pSqe = nextSqe(&pUring->receive, &tail);
+    pSqe->opcode = IORING_OP_RECVMSG;
+    pSqe->fd = pUring->socket;
+    pSqe->addr = (uint64_t)(uintptr_t)&pUring->receiveTemplate;
+    pSqe->ioprio = IORING_RECV_MULTISHOT;
+    pSqe->flags = IOSQE_BUFFER_SELECT;
+    pSqe->buf_group = URING_GROUP;
+    publishSqes(&pUring->receive, tail);
+
+    if (enter(&pUring->receive, 1, 0, 0) == ERROR) {
+        perror("io_uring_enter failed");
+        exit(EXIT_FAILURE);
+    }
+    pUring->armed = true;
+}
+
+// Copy a provided buffer out the way recvmmsg would have scattered the datagram
+static void scatterDatagram(const uint8_t* pBuffer, struct mmsghdr* pHeader) {
+    const struct io_uring_recvmsg_out* pOut = (const struct io_uring_recvmsg_out*)pBuffer;
+    struct msghdr* pMessage = &pHeader->msg_hdr;
+
+    size_t nameLength = pOut->namelen < pMessage->msg_namelen ? pOut->namelen : pMessage->msg_namelen;
+    memcpy(pMessage->msg_name, pBuffer + sizeof(*pOut), nameLength);
+    pMessage->msg_namelen = (socklen_t)nameLength;
+
+    size_t available = URING_BUFFER_SIZE - URING_PAYLOAD_OFFSET;
+    size_t remaining = pOut->payloadlen < available ? pOut->payloadlen : available;
+    const uint8_t* pPayload = pBuffer + URING_PAYLOAD_OFFSET;
+    size_t copied = 0;
+    for (size_t i = 0; i < pMessage->msg_iovlen && remaining > 0; i++) {
+        size_t part = pMessage->msg_iov[i].iov_len < remaining ? pMessage->msg_iov[i].iov_len : remaining;
+        memcpy(pMessage->msg_iov[i].iov_base, pPayload + copied, part);
+        copied += part;
+        remaining -= part;
+    }
+    pHeader->msg_len = (unsigned int)copied;
+}
+
+//===================================================================================
+// io_uring
+//===================================================================================
+
+static void uringClose(void* pState) {
+    Uring* pUring = pState;
+
+    // Closing the ring cancels the receive, the buffers can go after that
+    ringTeardown(&pUring->receive);
+    ringTeardown(&pUring->send);
+    munmap(pUring->pBufferRing, URING_BUFFERS * sizeof(struct io_uring_buf));
+    free(pUring->pBuffers);
+    pthread_mutex_destroy(&pUring->sendLock);
+    free(pUring);
+}
+
+static void* uringOpen(int socket) {
+    Uring* pUring = calloc(1, sizeof(Uring));
+    if (pUring == NULL) {
+        perror("Transport allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    pUring->socket = socket;
+
+    // Every provided buffer can be sitting in a completion at once, plus the one that ends the receive
+    if (!ringSetup(&pUring->send, URING_ENTRIES, URING_ENTRIES)) {
+        free(pUring);
+        return NULL;
+    }
+    if (!ringSetup(&pUring->receive, URING_ENTRIES, 2 * URING_BUFFERS)) {
+        ringTeardown(&pUring->send);
+        free(pUring);
+        return NULL;
+    }
+    pthread_mutex_init(&pUring->sendLock, NULL);
+
+    // The buffer ring has to be page aligned, an anonymous mapping is
+    pUring->pBufferRing = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    pUring->pBuffers = malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    if (pUring->pBufferRing == MAP_FAILED || pUring->pBuffers == NULL) {
+        perror("Transport allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (uint64_t)(uintptr_t)pUring->pBufferRing;
+    registration.ring_entries = URING_BUFFERS;
+    registration.bgid = URING_GROUP;
+    if (syscall(SYS_io_uring_register, pUring->receive.descriptor, IORING_REGISTER_PBUF_RING, &registration, 1) == ERROR) {
+        uringClose(pUring);
+        return NULL;
+    }
+    for (uint16_t i = 0; i < URING_BUFFERS; i++) {
+        provideBuffer(pUring, i);
+    }
+    publishBuffers(pUring);
+
+    // Only the sizes matter, each datagram's address and payload land in its buffer
+    pUring->receiveTemplate.msg_namelen = URING_NAME_SIZE;
+    return pUring;
+}
+
+// Completions run as task work on the thread that submitted the receive, so it is armed by
+// the one that asks what to wait on rather than whoever opened the transport
+static int uringDescriptor(void* pState) {
+    Uring* pUring = pState;
+    if (!pUring->armed) {
+        armReceive(pUring);
+    }
+    return pUring->receive.descriptor;
+}
+
+static int uringSend(void* pState, struct mmsghdr* pHeaders, int count) {
+    Uring* pUring = pState;
+    Ring* pRing = &pUring->send;
+    int sent = 0;
+
+    pthread_mutex_lock(&pUring->sendLock);
+    for (int first = 0; first < count; first += URING_ENTRIES) {
+        unsigned batch = (unsigned)(count - first < URING_ENTRIES ? count - first : URING_ENTRIES);
+
+        // The headers point into the caller's stack, so wait for the whole batch before returning
+        unsigned tail = atomic_load_explicit(pRing->pSqTail, memory_order_relaxed);
+        for (unsigned i = 0; i < batch; i++) {
+            struct io_uring_sqe* pSqe = nextSqe(pRing, &tail);
+            pSqe->opcode = IORING_OP_SENDMSG;
+            pSqe->fd = pUring->socket;
+            pSqe->addr = (uint64_t)(uintptr_t)&pHeaders[first + i].msg_hdr;
+            pSqe->user_data = (uint64_t)(first + i);
+        }
+        publishSqes(pRing, tail);
+
+        if (enter(pRing, batch, batch, IORING_ENTER_GETEVENTS) == ERROR) {
+            perror("io_uring_enter failed");
+            break;
+        }
+        METRICS_COUNT(METRIC_SEND_CALLS, 1);
+
+        unsigned head = atomic_load_explicit(pRing->pCqHead, memory_order_relaxed);
+        for (unsigned i = 0; i < batch; i++, head++) {
+            const struct io_uring_cqe* pCqe = &pRing->pCqes[head & pRing->cqMask];
+            if (pCqe->res < 0) {
+                errno = -pCqe->res;
+                perror("io_uring sendmsg failed");
+                continue;
+            }
+            pHeaders[pCqe->user_data].msg_len = (unsigned int)pCqe->res;
+            sent++;
+        }
+        atomic_store_explicit(pRing->pCqHead, head, memory_order_release);
+    }
+    pthread_mutex_unlock(&pUring->sendLock);
+    return sent;
+}
+
+static int uringReceive(void* pState, struct mmsghdr* pHeaders, int count) {
+    Uring* pUring = pState;
+    Ring* pRing = &pUring->receive;
+
+    // Completions are posted as task work, an empty queue may only mean it hasn't run yet
+    unsigned head = atomic_load_explicit(pRing->pCqHead, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(pRing->pCqTail, memory_order_acquire);
+    if (head == tail) {
+        enter(pRing, 0, 0, IORING_ENTER_GETEVENTS);
+        METRICS_COUNT(METRIC_RECEIVE_CALLS, 1);
+        tail = atomic_load_explicit(pRing->pCqTail, memory_order_acquire);
+    }
+
+    int received = 0;
+    for (; head != tail && received < count; head++) {
+        const struct io_uring_cqe* pCqe = &pRing->pCqes[head & pRing->cqMask];
+
+        // Out of buffers ends the multishot, it is rearmed below once they are back
+        if (!(pCqe->flags & IORING_CQE_F_MORE)) {
+            pUring->armed = false;
+        }
+        if (!(pCqe->flags & IORING_CQE_F_BUFFER)) {
+            if (pCqe->res < 0 && pCqe->res != -ENOBUFS) {
+                errno = -pCqe->res;
+                perror("io_uring recvmsg failed");
+            }
+            continue;
+        }
+
+        uint16_t id = (uint16_t)(pCqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (pCqe->res >= 0) {
+            scatterDatagram(pUring->pBuffers + (size_t)id * URING_BUFFER_SIZE, &pHeaders[received++]);
+        }
+        provideBuffer(pUring, id);
+    }
+    atomic_store_explicit(pRing->pCqHead, head, memory_order_release);
+    publishBuffers(pUring);
+
+    if (!pUring->armed) {
+        armReceive(pUring);
+    }
+    return received;
+}
+
+const Transport transportUring = { "io_uring", uringOpen, uringClose, uringSend, uringReceive, uringDescriptor };
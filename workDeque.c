@@ -0,0 +1,121 @@
+#include "workDeque.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//===================================================================================
+// Helpers
+//===================================================================================
+
+static WorkArray* createArray(int64_t size) {
+    WorkArray* pArray = malloc(sizeof(WorkArray) + (size_t)size * sizeof(_Atomic(void*)));
+    if (pArray == NULL) {
+        perror("Work deque allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pArray->pRetired = NULL;
+    pArray->size = size;
+    return pArray;
+}
+
+// Copy the live range into an array twice the size, the old one stays reachable for thieves
+static WorkArray* growArray(WorkArray* pOld, int64_t top, int64_t bottom) {
+    WorkArray* pArray = createArray(pOld->size * 2);
+    for (int64_t i = top; i < bottom; i++) {
+        void* pItem = atomic_load_explicit(&pOld->items[i % pOld->size], memory_order_relaxed);
+        atomic_store_explicit(&pArray->items[i % pArray->size], pItem, memory_order_relaxed);
+    }
+
+    pArray->pRetired = pOld;
+    return pArray;
+}
+
+//===================================================================================
+// Functions
+//===================================================================================
+
+void workDequeInitialize(WorkDeque* pDeque, int64_t capacity) {
+    assert(pDeque != NULL);
+    assert(capacity > 0);
+
+    atomic_init(&pDeque->top, 0);
+    atomic_init(&pDeque->bottom, 0);
+    atomic_init(&pDeque->pArray, createArray(capacity));
+}
+
+void workDequeDestroy(WorkDeque* pDeque) {
+    assert(pDeque != NULL);
+
+    WorkArray* pArray = atomic_load(&pDeque->pArray);
+    while (pArray != NULL) {
+        WorkArray* pRetired = pArray->pRetired;
+        free(pArray);
+        pArray = pRetired;
+    }
+    atomic_store(&pDeque->pArray, NULL);
+}
+
+void workDequePush(WorkDeque* pDeque, void* pItem) {
+    int64_t bottom = atomic_load_explicit(&pDeque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&pDeque->top, memory_order_acquire);
+    WorkArray* pArray = atomic_load_explicit(&pDeque->pArray, memory_order_relaxed);
+
+    if (bottom - top > pArray->size - 1) {
+        pArray = growArray(pArray, top, bottom);
+        atomic_store_explicit(&pDeque->pArray, pArray, memory_order_release);
+    }
+
+    // Release publishes the item to thieves that acquire bottom
+    atomic_store_explicit(&pArray->items[bottom % pArray->size], pItem, memory_order_relaxed);
+    atomic_store_explicit(&pDeque->bottom, bottom + 1, memory_order_release);
+}
+
+void* workDequeTake(WorkDeque* pDeque) {
+    int64_t bottom = atomic_load_explicit(&pDeque->bottom, memory_order_relaxed) - 1;
+    WorkArray* pArray = atomic_load_explicit(&pDeque->pArray, memory_order_relaxed);
+    atomic_store_explicit(&pDeque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&pDeque->top, memory_order_relaxed);
+
+    // Already empty, undo the reservation
+    if (top > bottom) {
+        atomic_store_explicit(&pDeque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    void* pItem = atomic_load_explicit(&pArray->items[bottom % pArray->size], memory_order_relaxed);
+    if (top == bottom) {
+        // Last item, race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&pDeque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            pItem = NULL;
+        }
+        atomic_store_explicit(&pDeque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return pItem;
+}
+
+void* workDequeSteal(WorkDeque* pDeque) {
+    int64_t top = atomic_load_explicit(&pDeque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&pDeque->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    WorkArray* pArray = atomic_load_explicit(&pDeque->pArray, memory_order_acquire);
+    void* pItem = atomic_load_explicit(&pArray->items[top % pArray->size], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&pDeque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return WORK_DEQUE_ABORT;
+    }
+
+    return pItem;
+}
+
+bool workDequeEmpty(WorkDeque* pDeque) {
+    int64_t top = atomic_load_explicit(&pDeque->top, memory_order_acquire);
+    int64_t bottom = atomic_load_explicit(&pDeque->bottom, memory_order_acquire);
+    return top >= bottom;
+}
@@ -0,0 +1,41 @@
+#ifndef WORK_DEQUE_H_
+#define WORK_DEQUE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ringBuffer.h"
+
+// Chase-Lev work-stealing deque (Le et al. C11 formulation).
+// The owning worker pushes and takes at the bottom, any other thread steals from the top.
+// The array doubles when full, retired arrays are kept until destroy since a thief
+// may still be reading one.
+typedef struct WorkArray {
+    struct WorkArray*  pRetired;     // Older, smaller arrays
+    int64_t            size;
+    _Atomic(void*)     items[];
+} WorkArray;
+
+typedef struct WorkDeque {
+    _Alignas(CACHE_LINE_SIZE) atomic_int_fast64_t top;
+    _Alignas(CACHE_LINE_SIZE) atomic_int_fast64_t bottom;
+    _Atomic(WorkArray*)  pArray;
+} WorkDeque;
+
+// Result of a steal that lost a race, worth retrying
+#define WORK_DEQUE_ABORT ((void*)1)
+
+void workDequeInitialize(WorkDeque* pDeque, int64_t capacity);
+void workDequeDestroy(WorkDeque* pDeque);
+
+// Owner only
+void workDequePush(WorkDeque* pDeque, void* pItem);
+void* workDequeTake(WorkDeque* pDeque);
+
+// Any thread, NULL when empty or WORK_DEQUE_ABORT when another thread won the item
+void* workDequeSteal(WorkDeque* pDeque);
+
+bool workDequeEmpty(WorkDeque* pDeque);
+
+#endif